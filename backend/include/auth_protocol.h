@@ -3,7 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
 #include <cstdint>
+#include "pq_suite.h"
 
 // Global SRTP key (46 bytes: 32-byte key + 14-byte salt)
 extern std::vector<uint8_t> SRTP_KEY;
@@ -19,13 +21,160 @@ extern std::vector<uint8_t> SRTP_KEY;
 #define MSG_HMAC_VERIFY_SUCCESS 0x08
 #define MSG_HMAC_VERIFY_FAILURE 0x09
 
-// Server-side authenticated key exchange
+// 1-RTT mode: the client's first flight carries the parameter suite, username,
+// KEM public key and its ML-DSA signature; the server answers with ciphertext +
+// key-confirmation
+#define MSG_HELLO_1RTT 0x0A
+#define MSG_ENCRYPTED_SECRET_CONFIRMED 0x0B
+
+// Session resumption: the client presents a ticket from an earlier exchange and
+// both sides derive fresh keys symmetrically, skipping ML-KEM and ML-DSA
+#define MSG_RESUME 0x0C
+#define MSG_RESUME_ACCEPT 0x0D
+#define MSG_RESUME_REJECT 0x0E
+#define MSG_SESSION_TICKET 0x0F
+
+// How often a waiting server checks whether it was cancelled
+#define KEY_EXCHANGE_CANCEL_POLL_MS 200
+
+// Sealed record of the in-call control channel that follows the exchange on
+// the same connection
+#define MSG_CONTROL 0x10
+
+// Frame header is 1-byte type + 4-byte length; larger payloads are rejected
+#define HANDSHAKE_HEADER_SIZE 5
+#define MAX_HANDSHAKE_MESSAGE_SIZE 65536
+
+// Handshake modes offered by the client. The server accepts both; a 1-RTT
+// HELLO from a user with no stored Dilithium key falls back to the
+// multi-step enrollment flow.
+enum HandshakeMode {
+    HANDSHAKE_MODE_1RTT,
+    HANDSHAKE_MODE_LEGACY
+};
+
+// Dilithium (ML-DSA) identity keys of a client
+struct DilithiumKeys {
+    std::vector<uint8_t> public_key;
+    std::vector<uint8_t> secret_key;
+};
+
+// Ephemeral KEM keypair with an identity signature over its public key
+struct SignedKyberKey {
+    std::vector<uint8_t> public_key;
+    std::vector<uint8_t> secret_key;
+    std::vector<uint8_t> signature;
+};
+
+struct HandshakeMessage {
+    uint8_t type;
+    std::vector<uint8_t> data;
+};
+
+// The exchange's TCP connection, kept open after the handshake for the
+// control channel
+struct ControlConnection {
+    int fd = -1;
+    // Keys derived from the Kyber shared secret (CONTROL_SECRET_SIZE bytes)
+    std::vector<uint8_t> secret;
+    // Bytes that arrived after the final handshake message
+    std::vector<uint8_t> unread;
+    // Handshake bytes not yet written when the exchange completed
+    std::vector<uint8_t> unsent;
+};
+
+// Server side of the exchange as a per-connection state machine, independent
+// of how messages are transported. Each received message is fed to
+// on_message(), which may run ML-DSA verification and ML-KEM encapsulation
+// and appends the replies to be sent.
+class ServerHandshake {
+public:
+    ServerHandshake();
+    ~ServerHandshake();
+
+    // Returns false if the handshake failed and the connection must be dropped
+    bool on_message(uint8_t msg_type, const std::vector<uint8_t>& data,
+                    std::vector<HandshakeMessage>& out);
+
+    bool is_complete() const { return state == STATE_COMPLETE; }
+    const std::string& username() const { return client_username; }
+    const std::vector<uint8_t>& srtp_key() const { return session_srtp_key; }
+    const std::vector<uint8_t>& control_secret() const { return session_control_secret; }
+
+private:
+    enum State {
+        STATE_AWAIT_HELLO,
+        STATE_AWAIT_DILITHIUM_KEY,
+        STATE_AWAIT_SIGNED_KYBER,
+        STATE_AWAIT_CLIENT_HMAC,
+        STATE_AWAIT_VERIFY_SUCCESS,
+        STATE_AWAIT_1RTT_CLIENT_TAG,
+        STATE_AWAIT_RESUME_CLIENT_TAG,
+        STATE_COMPLETE,
+        STATE_FAILED
+    };
+
+    bool handle_hello(uint8_t msg_type, const std::vector<uint8_t>& data,
+                      std::vector<HandshakeMessage>& out);
+    bool handle_resume(const std::vector<uint8_t>& data, std::vector<HandshakeMessage>& out);
+    bool start_multi_step(std::vector<HandshakeMessage>& out);
+    bool handle_dilithium_key(const std::vector<uint8_t>& data, std::vector<HandshakeMessage>& out);
+    bool handle_signed_kyber(const std::vector<uint8_t>& data, std::vector<HandshakeMessage>& out);
+    bool handle_client_hmac(const std::vector<uint8_t>& data, std::vector<HandshakeMessage>& out);
+    bool finish();
+
+    State state;
+    bool resume_allowed;
+    std::string client_username;
+    std::vector<uint8_t> client_dilithium_pubkey;
+    bool dilithium_key_received;
+    const PqSuiteInfo *suite;
+    // Computed as soon as the shared secret exists, so no transcript is kept
+    std::vector<uint8_t> expected_client_tag;
+    uint8_t shared_secret[32];
+    std::vector<uint8_t> session_srtp_key;
+    std::vector<uint8_t> session_control_secret;
+};
+
+// Server-side authenticated key exchange: accepts connections until one
+// client completes the exchange, then sets SRTP_KEY. With control, the
+// client's connection is handed over instead of closed. Setting cancelled,
+// from another thread, gives up the wait within KEY_EXCHANGE_CANCEL_POLL_MS.
 bool server_perform_authenticated_key_exchange(int key_exchange_port, 
-                                               std::string& client_username);
+                                               std::string& client_username,
+                                               ControlConnection* control = nullptr,
+                                               const std::atomic<bool>* cancelled = nullptr);
 
-// Client-side authenticated key exchange
+// Client-side authenticated key exchange. With control, the connection is
+// handed over instead of closed.
 bool client_perform_authenticated_key_exchange(const char* server_ip, 
                                                int key_exchange_port, 
-                                               const std::string& username);
+                                               const std::string& username,
+                                               HandshakeMode mode = HANDSHAKE_MODE_1RTT,
+                                               const PqSuiteInfo& suite = default_pq_suite(),
+                                               ControlConnection* control = nullptr);
+
+// Longest client_perform_key_exchange_with_keys waits on one connect, send or
+// receive, so a silent server cannot hang its caller (e.g. the rekey thread)
+#define CLIENT_EXCHANGE_TIMEOUT_SECONDS 10
+
+// Client-side exchange with caller-supplied identity keys. Does not touch the
+// key file, the session ticket cache or SRTP_KEY, so many can run in parallel.
+bool client_perform_key_exchange_with_keys(const char* server_ip, int key_exchange_port,
+                                           const std::string& username,
+                                           const DilithiumKeys& dilithium_keys,
+                                           HandshakeMode mode, std::vector<uint8_t>& srtp_key,
+                                           const PqSuiteInfo& suite = default_pq_suite());
+
+// Generate a fresh in-memory Dilithium identity for the suite's ML-DSA level
+bool generate_dilithium_keys(DilithiumKeys& keys, const PqSuiteInfo& suite = default_pq_suite());
+
+// Load the client's Dilithium identity from disk, creating it on first use.
+// Each ML-DSA level has its own key file.
+bool load_or_generate_dilithium_keys(DilithiumKeys& keys, const PqSuiteInfo& suite = default_pq_suite());
+
+// Generate an ephemeral KEM keypair and sign its public key with identity
+bool generate_signed_kyber_key(const DilithiumKeys& identity, SignedKyberKey& key,
+                               const PqSuiteInfo& suite = default_pq_suite());
 
 #endif // AUTH_PROTOCOL_H
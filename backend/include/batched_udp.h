@@ -0,0 +1,108 @@
+#ifndef BATCHED_UDP_H
+#define BATCHED_UDP_H
+
+#include <gst/gst.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Datagrams moved per recvmmsg() / sendmmsg() call
+#define UDP_BATCH_SIZE 32
+
+// Largest RTP/RTCP datagram received without GRO
+#define UDP_MAX_DATAGRAM 2048
+
+// With GRO one read can return up to 64 KB of same-size datagrams glued
+// together, so fewer, larger slots
+#define UDP_GRO_BATCH_SIZE 8
+#define UDP_GRO_MAX_READ 65536
+
+// With GSO the kernel splits one send into datagrams of the first one's
+// size; runs of equal-size packets (the last may be shorter) go out as one
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_BYTES 65000
+
+struct UdpIoStats {
+    uint64_t packets;
+    uint64_t syscalls;
+    uint64_t dropped;
+};
+
+// UDP socket bound to port on all addresses (0 for any port), with the
+// receive buffer set when buffer_size > 0. Returns -1 on failure.
+int open_udp_socket(int port, int buffer_size);
+
+// sendmmsg() until all count messages are out or a call fails. Returns the
+// number of messages sent; syscalls, when given, counts the calls made.
+int send_all(int fd, struct mmsghdr *messages, int count, uint64_t *syscalls = NULL);
+
+// Replaces udpsrc: a thread reads the socket with recvmmsg() (and GRO when
+// asked) and pushes what each call returns into an appsrc as one
+// GstBufferList. The appsrc is set up here: live, timestamped on arrival,
+// with caps.
+class BatchedUdpReceiver {
+public:
+    // Takes ownership of fd
+    BatchedUdpReceiver(int fd, GstElement *appsrc, const std::string& caps, bool gro);
+    ~BatchedUdpReceiver();
+
+    bool start();
+    void stop();
+
+    UdpIoStats stats() const;
+
+private:
+    void run();
+    bool refill(int slot);
+    int split(GstBufferList *list, GstBuffer *buffer, int length, int segment_size);
+
+    int fd;
+    GstElement *appsrc;
+    bool gro;
+    int batch_size;
+    int slot_size;
+
+    GstBuffer *slots[UDP_BATCH_SIZE];
+    GstMapInfo maps[UDP_BATCH_SIZE];
+
+    std::thread receive_thread;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> packet_count;
+    std::atomic<uint64_t> syscall_count;
+    std::atomic<uint64_t> drop_count;
+};
+
+// Replaces udpsink: an appsink takes buffer lists from upstream (srtpenc
+// passes on the lists rtpbin and the payloaders produce) and each list goes
+// out with sendmmsg(), in runs of equal-size packets with GSO when asked.
+// Sends from the streaming thread; no thread of its own.
+class BatchedUdpSender {
+public:
+    // Takes ownership of fd unless owns_fd is false (a socket shared with a
+    // BatchedUdpReceiver)
+    BatchedUdpSender(int fd, bool owns_fd, const std::string& host, int port, bool gso);
+    ~BatchedUdpSender();
+
+    // Configure appsink and send what arrives on it
+    bool attach(GstElement *appsink);
+
+    UdpIoStats stats() const;
+
+private:
+    static GstFlowReturn on_new_sample(GstElement *appsink, gpointer user_data);
+    void send_buffers(GstBuffer **buffers, guint count);
+
+    int fd;
+    bool owns_fd;
+    bool gso;
+    struct sockaddr_in peer;
+
+    std::atomic<uint64_t> packet_count;
+    std::atomic<uint64_t> syscall_count;
+    std::atomic<uint64_t> drop_count;
+};
+
+#endif // BATCHED_UDP_H
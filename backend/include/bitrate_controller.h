@@ -0,0 +1,107 @@
+#ifndef BITRATE_CONTROLLER_H
+#define BITRATE_CONTROLLER_H
+
+#include <gst/gst.h>
+#include <deque>
+#include <cstdint>
+#include "media_pipeline.h"
+
+// How often the send session is checked for a new receiver report
+#define RATE_POLL_INTERVAL_MS 250
+
+// Queueing delay, above the lowest RTT of the last RATE_MIN_RTT_REPORTS
+// reports, that counts as congestion
+#define RATE_QUEUE_DELAY_MS 50
+#define RATE_MIN_RTT_REPORTS 30
+
+// Loss above RATE_HIGH_LOSS cuts the rate to the share that arrived; below
+// RATE_LOW_LOSS, with no queue building, the rate grows
+#define RATE_HIGH_LOSS 0.10
+#define RATE_LOW_LOSS 0.02
+#define RATE_INCREASE 1.08
+#define RATE_DELAY_DECREASE 0.85
+
+// Smallest change worth reconfiguring the encoders for
+#define RATE_MIN_CHANGE 0.02
+
+// Audio gives way only once video is at its minimum
+#define MIN_AUDIO_BITRATE 16000
+
+// Video FEC packets per 100 media packets: FEC_PROTECTION_FACTOR times the
+// loss, within FEC_MIN_PERCENTAGE .. FEC_MAX_PERCENTAGE. The loss it follows
+// rises with each report at once and decays by FEC_LOSS_DECAY per report,
+// so protection outlasts a burst.
+#define FEC_PROTECTION_FACTOR 3
+#define FEC_MIN_PERCENTAGE 5
+#define FEC_MAX_PERCENTAGE 50
+#define FEC_LOSS_DECAY 0.9
+
+// One report block on our video stream, from the peer's receiver report
+struct ReceiverReport {
+    double fraction_lost;   // 0..1, since the previous report
+    double jitter_ms;
+    double rtt_ms;          // 0 when the peer has not seen a sender report yet
+};
+
+// Sender-side congestion control from RTCP receiver reports. Each report moves
+// one target for video + audio: cut on heavy loss or on RTT rising above its
+// recent minimum (a queue building at the bottleneck), held for one report
+// after a cut so the queue can drain, and grown by a fixed factor otherwise.
+// Loss- and delay-based like GCC, at RTCP's granularity of one report per
+// rtcp-interval. Runs on a GMainLoop; encoder bitrates change in place.
+// Once FEC is enabled, redundancy follows the reported loss and comes out of
+// the video share of the target.
+class BitrateController {
+public:
+    BitrateController(MediaPipeline& media, const MediaProfile& profile);
+    ~BitrateController();
+
+    // Poll the video send session from the main loop of context (NULL for the
+    // default context)
+    void start(GMainContext *context = NULL);
+    void stop();
+
+    // Move the target by one report and apply it
+    void on_report(const ReceiverReport& report);
+
+    // Start sending FEC, when the peer has said it recovers it. Needs fec in
+    // the profile; on the same loop as the controller.
+    void enable_fec();
+
+    int video_bitrate() const { return video_kbps; }     // kbit/s
+    int audio_bitrate() const { return audio_bps; }      // bit/s
+    int fec_percentage() const { return fec_percent; }   // 0 when off
+    uint64_t reports() const { return report_count; }
+    const ReceiverReport& last_report() const { return last; }
+
+private:
+    static gboolean on_poll(gpointer user_data);
+    bool read_report(ReceiverReport& report);
+    void apply(bool force);
+
+    MediaPipeline& media;
+    int min_video_kbps;
+    int max_video_kbps;
+    int max_audio_bps;
+
+    double target_kbps;     // Video + audio
+    int video_kbps;
+    int audio_bps;
+    int hold;
+    std::deque<double> rtts;
+
+    bool fec_allowed;
+    bool fec_enabled;
+    int fec_percent;
+    double fec_loss;
+
+    // Identifies the last report read, so each is used once
+    guint last_highest_seq;
+    guint last_round_trip;
+    uint64_t report_count;
+    ReceiverReport last;
+
+    GSource *poll_source;
+};
+
+#endif // BITRATE_CONTROLLER_H
@@ -0,0 +1,62 @@
+#ifndef CALL_SESSION_H
+#define CALL_SESSION_H
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <string>
+#include <atomic>
+#include "pq_suite.h"
+#include "srtp_rekey.h"
+#include "media_pipeline.h"
+
+// Everything one 1:1 call needs besides the media options
+struct CallConfig {
+    MediaRole role = MEDIA_ROLE_CLIENT;
+    // Client: the server to call; server: the client whose media is expected
+    std::string peer_ip;
+    // Client only: who we log in as
+    std::string username;
+    // Client only: parameter suite; NULL for the default
+    const PqSuiteInfo *suite = nullptr;
+    // Client only: interval of the in-call key exchanges; 0 keeps the first key
+    int rekey_seconds = REKEY_INTERVAL_SECONDS;
+    MediaProfile profile;
+    // Ctrl+C hangs up; for the command line tools, not for a host application
+    bool stop_on_interrupt = false;
+};
+
+// One call, from the key exchange to the hang-up, as the client and server
+// tools run it, for a host application to run in its own process: run() on a
+// thread of the host's, stop() from any other. The call's main loop runs on
+// a GMainContext of its own, so it does not need the host's main loop. With
+// sink "app", decoded video goes to the video callback instead of a window;
+// statistics go to stats_socket as from the tools. gst_init() must have been
+// called.
+class CallSession {
+public:
+    explicit CallSession(const CallConfig& config);
+    ~CallSession();
+    CallSession(const CallSession&) = delete;
+    CallSession& operator=(const CallSession&) = delete;
+
+    // Before run(); called on GStreamer's streaming threads
+    void set_video_callback(VideoFrameCallback callback) { video_callback = callback; }
+
+    // Runs the call to its end: 0 after a hang-up from either side or stop(),
+    // -1 when the call could not be set up
+    int run();
+    // Hangs up, or abandons the setup; thread-safe, and may come before run()
+    void stop();
+
+private:
+    static gboolean on_stop(gpointer data);
+
+    CallConfig config;
+    const char *tag;
+    VideoFrameCallback video_callback;
+    GMainContext *context;
+    GMainLoop *loop;
+    std::atomic<bool> cancelled;
+};
+
+#endif // CALL_SESSION_H
@@ -0,0 +1,160 @@
+#ifndef CALL_STATS_H
+#define CALL_STATS_H
+
+#include <gst/gst.h>
+#include <gst/codecparsers/gsth264parser.h>
+#include <gst/codecparsers/gstvp8parser.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include "media_pipeline.h"
+#include "handshake_trace.h"
+
+// Rates (bitrate, loss, frame rates, QP, CPU shares) are taken over this
+// window and refreshed once per window; counters are current in every snapshot
+#define STATS_RATE_WINDOW_MS 1000
+
+// Subscribers on the socket at once; later ones are closed at once
+#define STATS_MAX_CLIENTS 8
+
+enum CallState {
+    CALL_STATE_WAITING,      // Server: waiting for the client's key exchange
+    CALL_STATE_CONNECTING,   // Client: key exchange with the server running
+    CALL_STATE_CONNECTED,    // Keys agreed, media flowing
+    CALL_STATE_ENDED,
+    CALL_STATE_FAILED        // Key exchange or pipeline failed
+};
+
+const char* call_state_name(CallState state);
+
+// Live call statistics for a frontend, from a thread of their own. Every
+// stats_interval ms, while anyone is connected to stats_socket (a Unix
+// stream socket), a snapshot goes to each subscriber as one line of JSON:
+// call state, handshake timings, per-SSRC bitrate, loss, jitter and RTT of
+// what we send (from the peer's receiver reports) and receive, frames
+// rendered and dropped per received stream, encoder frame rate and QP, and
+// the CPU share of every thread of the process (GStreamer names its
+// streaming threads after their pads). The snapshot is read from rtpbin's
+// and the sinks' own statistics, which take their locks for a moment; the
+// media threads only bump counters, plus one slice header parsed per encoded
+// frame for the QP. A subscriber that does not keep up misses snapshots
+// rather than holding the publisher up. Without stats_socket nothing runs.
+class CallStatsPublisher {
+public:
+    // Must exist before the pipeline plays
+    CallStatsPublisher(MediaPipeline& media, const MediaProfile& profile, MediaRole role);
+    ~CallStatsPublisher();
+
+    bool enabled() const { return !socket_path.empty(); }
+
+    // Listen on the socket and publish from a thread; false when the socket
+    // cannot be bound
+    bool start();
+    // Send a last snapshot, stop for good and take the probes out; before
+    // the pipeline is freed
+    void stop();
+
+    void set_state(CallState state);
+    // Startup timings of the call; trace is the exchange's per-phase
+    // breakdown, or NULL
+    void set_handshake(long long pipeline_ms, long long exchange_ms, const HandshakeTrace *trace);
+
+private:
+    struct Client {
+        int fd;
+        std::string out;      // Unsent part of the last snapshot
+    };
+
+    // A received stream, from rtpbin's pad to the sink that renders it
+    struct Playback {
+        guint32 ssrc;
+        bool video;
+        GstElement *sink;         // As linked; may be a bin
+        GstElement *base_sink;    // The one with statistics, once found
+    };
+
+    // Counters of one stream at the start of the current rate window
+    struct Previous {
+        uint64_t octets = 0;
+        uint64_t packets = 0;
+        int64_t lost = 0;
+        uint64_t frames = 0;
+        double kbps = 0;
+        double loss = 0;
+        double fps = 0;
+    };
+
+    struct ThreadCpu {
+        int tid;
+        std::string name;
+        uint64_t ticks;
+        double percent;
+    };
+
+    static GstPadProbeReturn on_encoded(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void on_pad_added(GstElement *rtpbin, GstPad *pad, gpointer user_data);
+
+    void run();
+    void accept_clients();
+    void publish(const std::string& line);
+    bool flush(Client& client);
+    std::string snapshot(bool window_ended);
+    void write_sessions(std::ostream& out, bool window_ended, double window_s);
+    void write_threads(std::ostream& out, bool window_ended, double window_s);
+    void parse_qp(GstBuffer *buffer);
+
+    MediaPipeline& media;
+    std::string socket_path;
+    int interval_ms;
+    const char *role;
+    bool h264;
+
+    int listen_fd;
+    int wake_fd;
+    std::vector<Client> clients;
+    std::thread publish_thread;
+    std::atomic<bool> running;
+    bool stopped;
+
+    // Set from the main thread
+    std::mutex state_lock;
+    CallState state;
+    long long pipeline_ms;
+    long long exchange_ms;
+    bool have_trace;
+    HandshakeTrace trace;
+
+    // Encoder output, counted on its streaming thread. QP is parsed there
+    // too, by the one thread that pushes the encoder's output.
+    GstPad *encoder_pad;
+    gulong encoder_probe;
+    std::atomic<uint64_t> frames_encoded;
+    std::atomic<uint64_t> qp_sum;
+    std::atomic<uint64_t> qp_frames;
+    GstH264NalParser *h264_parser;
+    GstVp8Parser vp8_parser;
+
+    gulong pad_added_id;
+    std::mutex playback_lock;
+    std::vector<Playback> playbacks;
+
+    // The publisher thread's own
+    uint64_t sequence;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point window_start;
+    std::map<std::pair<bool, guint32>, Previous> previous;   // (sent, ssrc)
+    uint64_t previous_encoded;
+    uint64_t previous_qp_sum;
+    uint64_t previous_qp_frames;
+    double encoder_fps;
+    double encoder_qp;
+    std::vector<ThreadCpu> threads;
+};
+
+#endif // CALL_STATS_H
@@ -0,0 +1,146 @@
+#ifndef CAPTURE_LATENCY_H
+#define CAPTURE_LATENCY_H
+
+#include <gst/gst.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "media_pipeline.h"
+
+// How often RTT and clock offsets are refreshed, and how many of those
+// periods make up one live report
+#define LATENCY_POLL_INTERVAL_MS 1000
+#define LATENCY_REPORT_POLLS 10
+
+// Sender reports per sender the clock offset is estimated from; the one
+// least delayed on the way counts
+#define LATENCY_OFFSET_REPORTS 8
+
+// Histograms in 1 ms buckets; anything longer lands in the last
+#define LATENCY_HISTOGRAM_MS 2000
+
+// Frames per stream between the depayloader and the sink, matched by PTS;
+// a frame is matched to the latest one at most LATENCY_MATCH_WINDOW_MS older
+#define LATENCY_PENDING_FRAMES 64
+#define LATENCY_MATCH_WINDOW_MS 100
+
+struct LatencyHistogram {
+    std::vector<uint32_t> buckets = std::vector<uint32_t>(LATENCY_HISTOGRAM_MS + 1);
+    uint64_t count = 0;
+
+    void add(double ms);
+    // p in 0..1; 0 when empty
+    double percentile(double p) const;
+    void clear();
+};
+
+// Capture-to-render latency of one kind of stream, ms. The parts are the
+// medians of each, so they need not add up to total_p50 exactly.
+struct LatencySummary {
+    uint64_t frames = 0;      // Stamped, with the sender's clock offset known
+    uint64_t unsynced = 0;    // Stamped, before the offset was known
+    double total_p50 = 0;
+    double total_p95 = 0;
+    double total_p99 = 0;
+    double encode_p50 = 0;    // Capture to the payloader, sender's clock
+    double network_p50 = 0;   // Payloader to our depayloader: SRTP, network, jitter buffer
+    double playout_p50 = 0;   // Depayloader to the sink: decode, convert, render
+};
+
+// Glass-to-glass latency. With capture_time in the profile, every packet
+// the payloaders send is stamped with the time its frame was captured and
+// the time it left the payloader (see CAPTURE_TIME_EXTENSION_ID). On the
+// receiving side, every stream rtpbin adds is followed from its depayloader
+// to its sink; a frame is measured when it reaches the sink, which renders
+// at once (sync=false). Sender and receiver clocks are related through the
+// peer's RTCP sender reports: the smallest (arrival - NTP time in the report)
+// of the last few, less half the RTT from the peer's receiver reports on our
+// video. That assumes symmetric paths, like NTP; behind the SFU the RTT is to
+// the SFU, so totals are approximate. Live reports every
+// LATENCY_REPORT_POLLS polls on a GMainLoop, and a summary for the call.
+class CaptureLatencyMeter {
+public:
+    // Must exist before the pipeline plays
+    CaptureLatencyMeter(MediaPipeline& media, const MediaProfile& profile);
+    ~CaptureLatencyMeter();
+
+    // Poll from the main loop of context (NULL for the default context)
+    void start(GMainContext *context = NULL);
+    // Stop for good and take the probes out; before the pipeline is freed
+    void stop();
+
+    // Since the start of the call
+    LatencySummary video_summary();
+    LatencySummary audio_summary();
+    // Starts the call summaries over, e.g. after a warm-up
+    void reset_summaries();
+    // Local clock minus each sender's, ms, once known
+    std::vector<double> clock_offsets_ms();
+    // Logs the summaries, if anything stamped arrived
+    void print_summary();
+
+private:
+    struct Pending {
+        GstClockTime pts;
+        guint32 ssrc;
+        gint64 capture_us;    // Sender's clock
+        gint64 send_us;       // Sender's clock
+        gint64 depayload_us;  // Ours
+    };
+
+    struct Chain {
+        CaptureLatencyMeter *meter;
+        bool video;
+        std::deque<Pending> pending;
+    };
+
+    struct Parts {
+        LatencyHistogram total;
+        LatencyHistogram encode;
+        LatencyHistogram network;
+        LatencyHistogram playout;
+        uint64_t unsynced = 0;
+
+        void clear();
+        LatencySummary summary() const;
+    };
+
+    struct Offset {
+        std::deque<gint64> samples_us;   // Arrival minus NTP time of each report
+        bool known = false;
+        gint64 offset_us = 0;
+    };
+
+    static GstPadProbeReturn on_payloader_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_depayloader_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_sink_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void on_pad_added(GstElement *rtpbin, GstPad *pad, gpointer user_data);
+    static void on_receiving_rtcp(GObject *session, GstBuffer *buffer, gpointer user_data);
+    static gboolean on_poll(gpointer user_data);
+
+    void add_probe(GstPad *pad, GstPadProbeCallback callback, gpointer user_data);
+    void depayloaded(Chain& chain, GstBuffer *buffer, gint64 now_us);
+    void rendered(Chain& chain, GstBuffer *buffer, gint64 now_us);
+    double read_rtt_ms();
+    void report(const char* kind, Parts& window);
+
+    MediaPipeline& media;
+    gulong pad_added_id;
+    std::vector<std::pair<GObject*, gulong>> rtcp_handlers;
+    std::vector<std::pair<GstPad*, gulong>> probes;
+    std::vector<std::unique_ptr<Chain>> chains;
+
+    // Taken by the streaming threads of every stream
+    std::mutex lock;
+    std::map<guint32, Offset> offsets;
+    Parts video_call, audio_call;
+    Parts video_window, audio_window;
+
+    int polls;
+    GSource *poll_source;
+};
+
+#endif // CAPTURE_LATENCY_H
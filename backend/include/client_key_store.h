@@ -0,0 +1,51 @@
+#ifndef CLIENT_KEY_STORE_H
+#define CLIENT_KEY_STORE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <cstdint>
+
+// Append-only binary store of enrolled clients' Dilithium public keys with an
+// in-memory hash index, replacing the client_keys.json database.
+//
+// File layout:
+//   header  "QSVCKEY1"
+//   record  [u32 CRC-32 of the rest][u16 username length][u32 key length][username][key]
+//
+// Lookups never touch the disk. An enrollment is one append + fdatasync.
+// Keys are indexed by username alone: a username is enrolled once, at one
+// ML-DSA level, and enroll() refuses it afterwards. Should a file still hold
+// several records for a name, the first one wins on load.
+// A torn record left by a crash fails its CRC and is truncated away on open.
+class ClientKeyStore {
+public:
+    explicit ClientKeyStore(const std::string& path);
+    ~ClientKeyStore();
+
+    // Map the file, index every valid record and open it for appending
+    bool open();
+
+    bool lookup(const std::string& username, std::vector<uint8_t>& public_key) const;
+    // Fails if the username already has a key, at any level
+    bool enroll(const std::string& username, const std::vector<uint8_t>& public_key);
+    size_t size() const;
+
+    // One-shot import of the legacy JSON database. Users already in the store
+    // are skipped, and the JSON file is renamed to <json_path>.migrated
+    // afterwards so it is never imported twice.
+    bool migrate_from_json(const std::string& json_path);
+
+private:
+    std::string path;
+    int fd;
+    // Serializes enrollments, so the write and fdatasync run without
+    // index_mutex and never hold up lookups
+    std::mutex append_mutex;
+    mutable std::shared_mutex index_mutex;
+    std::unordered_map<std::string, std::vector<uint8_t>> index;
+};
+
+#endif // CLIENT_KEY_STORE_H
@@ -0,0 +1,84 @@
+#ifndef CONTROL_CHANNEL_H
+#define CONTROL_CHANNEL_H
+
+#include <glib.h>
+#include "auth_protocol.h"
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Control message types, carried inside sealed MSG_CONTROL records. Features
+// that signal during the call add their own types here.
+#define CTRL_HANGUP 0x01
+// Sent once at the start of a call by a side that recovers FEC; the peer
+// starts sending it if it has FEC on too
+#define CTRL_FEC 0x02
+// Sent once at the start of a call by a side that retransmits video on NACK
+// (jitter-mode adaptive); the peer may then ask for retransmissions
+#define CTRL_RTX 0x03
+
+// Longest wait for queued messages when closing
+#define CONTROL_CLOSE_TIMEOUT_MS 500
+
+// In-call control channel on the connection left open by the key exchange.
+// Every message is one framed record, [MSG_CONTROL][length][ciphertext + tag],
+// sealed with AES-256-GCM under the sender's direction key. The nonce is the
+// record's sequence number, so nothing extra goes on the wire and a replayed,
+// dropped or reordered record fails to open. The socket is non-blocking and
+// served from a GMainLoop.
+class ControlChannel {
+public:
+    typedef std::function<void(uint8_t type, const std::vector<uint8_t>& payload)> MessageHandler;
+    typedef std::function<void()> CloseHandler;
+
+    // Takes ownership of connection.fd; is_client picks the direction keys
+    ControlChannel(ControlConnection& connection, bool is_client);
+    ~ControlChannel();
+
+    // Serve the socket from the main loop of context (NULL for the default
+    // context). Handlers run on that loop. on_close runs once, when the peer
+    // closes the connection or sends something that does not open.
+    bool attach(GMainContext *context, MessageHandler on_message, CloseHandler on_close);
+
+    // Seal and queue one message; callable from any thread. What the socket
+    // does not take at once is written from the main loop.
+    bool send(uint8_t type, const std::vector<uint8_t>& payload = std::vector<uint8_t>());
+
+    // Write what is still queued, waiting at most timeout_ms, then close
+    void close(int timeout_ms = CONTROL_CLOSE_TIMEOUT_MS);
+
+    bool is_open() const { return fd >= 0; }
+
+private:
+    static gboolean on_readable(GIOChannel *io, GIOCondition condition, gpointer user_data);
+    static gboolean on_writable(GIOChannel *io, GIOCondition condition, gpointer user_data);
+    static gboolean on_pending(gpointer user_data);
+
+    bool receive_records();
+    bool flush_locked();
+    void fail();
+
+    std::atomic<int> fd;
+    uint8_t send_key[32];
+    uint8_t recv_key[32];
+    uint64_t recv_seq;
+
+    // Receive side is only touched on the loop thread
+    std::vector<uint8_t> in;
+
+    std::mutex out_mutex;
+    std::vector<uint8_t> out;
+    uint64_t send_seq;
+
+    GMainContext *context;
+    GIOChannel *io;
+    GSource *read_source;
+    GSource *write_source;
+    GSource *pending_source;
+    MessageHandler message_handler;
+    CloseHandler close_handler;
+};
+
+#endif // CONTROL_CHANNEL_H
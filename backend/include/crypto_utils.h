@@ -2,13 +2,67 @@
 #define CRYPTO_UTILS_H
 
 #include <vector>
+#include <string>
 #include <cstdint>
+#include <cstddef>
+#include <initializer_list>
 
 // Derive 46-byte SRTP key from 32-byte Kyber shared secret using HKDF
 bool derive_srtp_key(const uint8_t* kyber_secret, uint8_t* srtp_key);
 
+// Control channel keys: client-to-server key || server-to-client key
+#define CONTROL_SECRET_SIZE 64
+
+// Derive the control channel keys from the same shared secret, independent of
+// the SRTP key
+bool derive_control_secret(const uint8_t* kyber_secret, uint8_t* control_secret);
+
+// HKDF-SHA256 with explicit salt and info (salt may be empty)
+bool hkdf_sha256(const uint8_t* ikm, size_t ikm_len,
+                 const uint8_t* salt, size_t salt_len,
+                 const std::string& info, uint8_t* out, size_t out_len);
+
 // Compute HMAC-SHA512
 std::vector<uint8_t> compute_hmac_sha512(const std::vector<uint8_t>& key, 
                                          const std::vector<uint8_t>& data);
 
+// One contiguous piece of a larger message
+struct ByteSpan {
+    const uint8_t* data;
+    size_t len;
+};
+
+// HMAC-SHA512 over the concatenation of parts, fed piece by piece so the
+// message never has to be assembled in one buffer
+std::vector<uint8_t> compute_hmac_sha512(const uint8_t* key, size_t key_len,
+                                         const ByteSpan* parts, size_t count);
+
+inline std::vector<uint8_t> compute_hmac_sha512(const uint8_t* key, size_t key_len,
+                                                std::initializer_list<ByteSpan> parts) {
+    return compute_hmac_sha512(key, key_len, parts.begin(), parts.size());
+}
+
+// Constant-time comparison of two MAC tags; an empty tag never matches
+bool tags_equal(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b);
+
+// Fill buffer from the OpenSSL CSPRNG
+bool random_bytes(uint8_t* out, size_t len);
+
+// AES-256-GCM with a random 12-byte IV; output is IV || ciphertext || 16-byte tag
+bool aes256_gcm_seal(const uint8_t* key, const std::vector<uint8_t>& plaintext,
+                     const std::vector<uint8_t>& aad, std::vector<uint8_t>& sealed);
+
+// Inverse of aes256_gcm_seal; fails if the tag does not verify
+bool aes256_gcm_open(const uint8_t* key, const std::vector<uint8_t>& sealed,
+                     const std::vector<uint8_t>& aad, std::vector<uint8_t>& plaintext);
+
+// AES-256-GCM under a caller-managed 12-byte nonce that must never repeat for
+// a key. sealed receives len + 16 bytes: ciphertext || tag.
+bool aes256_gcm_seal_with_nonce(const uint8_t* key, const uint8_t* nonce, const uint8_t* plaintext,
+                                size_t len, const uint8_t* aad, size_t aad_len, uint8_t* sealed);
+
+// Inverse of aes256_gcm_seal_with_nonce; plaintext receives sealed_len - 16 bytes
+bool aes256_gcm_open_with_nonce(const uint8_t* key, const uint8_t* nonce, const uint8_t* sealed,
+                                size_t sealed_len, const uint8_t* aad, size_t aad_len, uint8_t* plaintext);
+
 #endif // CRYPTO_UTILS_H
@@ -0,0 +1,63 @@
+#ifndef EPHEMERAL_KEY_POOL_H
+#define EPHEMERAL_KEY_POOL_H
+
+#include "auth_protocol.h"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+struct KeyPoolStats {
+    size_t depth;       // Ready keys right now
+    size_t capacity;
+    uint64_t hits;      // take() served from the pool
+    uint64_t misses;    // take() had to generate inline
+    uint64_t generated; // Keys produced by the refill thread
+};
+
+// Keeps a few ready (KEM keypair, ML-DSA signature) tuples for one suite in memory
+// and refills them on a low-priority background thread, so that the key
+// exchange itself only costs network round trips. Every key is handed out
+// exactly once.
+class EphemeralKeyPool {
+public:
+    EphemeralKeyPool(const DilithiumKeys& identity, const PqSuiteInfo& suite, size_t capacity);
+    ~EphemeralKeyPool();
+
+    void start();
+    void stop();
+
+    // Pops a precomputed key, or generates one inline if the pool is empty
+    bool take(SignedKyberKey& key);
+
+    const DilithiumKeys& identity() const { return client_identity; }
+    const PqSuiteInfo& suite() const { return key_suite; }
+    KeyPoolStats stats() const;
+
+private:
+    void refill_loop();
+
+    DilithiumKeys client_identity;
+    const PqSuiteInfo& key_suite;
+    size_t capacity;
+
+    mutable std::mutex pool_mutex;
+    std::condition_variable pool_cv;
+    std::deque<SignedKyberKey> ready;
+    bool running;
+    std::thread refill_thread;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> generated;
+};
+
+// Process-wide pool used by client_perform_authenticated_key_exchange. Loads
+// (or creates) the client's Dilithium identity once and starts refilling.
+bool start_client_key_pool(size_t capacity, const PqSuiteInfo& suite = default_pq_suite());
+EphemeralKeyPool* client_key_pool();
+void stop_client_key_pool();
+
+#endif // EPHEMERAL_KEY_POOL_H
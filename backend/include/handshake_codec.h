@@ -0,0 +1,51 @@
+#ifndef HANDSHAKE_CODEC_H
+#define HANDSHAKE_CODEC_H
+
+#include "auth_protocol.h"
+#include "crypto_utils.h"
+#include <vector>
+#include <chrono>
+#include <initializer_list>
+#include <cstdint>
+
+// Framing of key exchange messages, shared by the blocking client and the
+// HandshakeServer: [1-byte type][4-byte payload length, host order][payload]
+
+// Append one framed message to out
+void append_frame(std::vector<uint8_t>& out, uint8_t msg_type, const std::vector<uint8_t>& data);
+
+// Reads the header at the start of buf. Returns false if the header is not
+// complete yet; data_len is checked against MAX_HANDSHAKE_MESSAGE_SIZE by the
+// caller.
+bool peek_frame_header(const uint8_t* buf, size_t len, uint8_t& msg_type, uint32_t& data_len);
+
+// Disable Nagle so that a flight leaves as soon as it is written
+void enable_tcp_nodelay(int sock);
+
+// Blocking connection with a reusable receive buffer. Every message is sent
+// with a single sendmsg() (header and payload pieces gathered in place), and
+// one recv() usually returns a whole server flight. With a HandshakeTrace
+// installed, the time from each send to the reply is recorded as one flight.
+class HandshakeChannel {
+public:
+    explicit HandshakeChannel(int sock);
+
+    bool send(uint8_t msg_type, const std::vector<uint8_t>& data);
+    // Payload is the concatenation of parts, which are not copied
+    bool send(uint8_t msg_type, std::initializer_list<ByteSpan> parts);
+    // Copies the payload into data, reusing its capacity
+    bool receive(uint8_t& msg_type, std::vector<uint8_t>& data);
+    // Bytes received past the last returned message, for whoever reads the
+    // socket next
+    void take_unread(std::vector<uint8_t>& out);
+
+private:
+    int sock;
+    std::vector<uint8_t> buffer;
+    size_t start;
+    size_t end;
+    bool sent;
+    std::chrono::steady_clock::time_point last_send;
+};
+
+#endif // HANDSHAKE_CODEC_H
@@ -0,0 +1,115 @@
+#ifndef HANDSHAKE_SERVER_H
+#define HANDSHAKE_SERVER_H
+
+#include "auth_protocol.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+// Connections that have not completed the exchange within this time are dropped
+#define HANDSHAKE_TIMEOUT_SECONDS 10
+
+// Result of one successful key exchange
+struct CompletedHandshake {
+    std::string username;
+    std::string peer_ip;
+    std::vector<uint8_t> srtp_key;
+    // Only with keep_completed_connections(); the caller owns control.fd
+    ControlConnection control;
+};
+
+struct HandshakeServerStats {
+    uint64_t accepted;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t timed_out;
+};
+
+// Event-driven key exchange server. One epoll thread owns all sockets
+// (non-blocking, one ServerHandshake per connection) and only does I/O and
+// framing; every complete message is handed to a fixed worker pool where
+// ML-DSA verification and ML-KEM encapsulation run. Replies come back to the
+// epoll thread through an eventfd.
+class HandshakeServer {
+public:
+    // worker_count 0 sizes the pool to the number of cores
+    explicit HandshakeServer(int port, int worker_count = 0);
+    ~HandshakeServer();
+
+    bool start();
+    void stop();
+
+    // Hand the connection of each completed exchange over with its result
+    // instead of closing it. Call before start().
+    void keep_completed_connections(bool keep) { keep_connections = keep; }
+
+    // Blocks until a client completes the exchange. Returns false on timeout
+    // or when the server is stopped. timeout_ms < 0 waits forever.
+    bool wait_for_handshake(CompletedHandshake& result, int timeout_ms = -1);
+
+    HandshakeServerStats stats() const;
+    int workers() const { return worker_count; }
+
+private:
+    struct Connection;
+
+    struct WorkResult {
+        int fd;
+        std::vector<uint8_t> bytes;
+        bool ok;
+    };
+
+    void event_loop();
+    void worker_loop();
+    void submit(std::function<void()> job);
+
+    void accept_connections();
+    void handle_io(int fd, uint32_t events);
+    void dispatch_next(Connection& conn);
+    void process_results();
+    bool flush(Connection& conn);
+    void update_interest(Connection& conn);
+    void close_connection(int fd, bool failed);
+    void hand_over(Connection& conn, ControlConnection& control);
+    void expire_connections();
+
+    int port;
+    int worker_count;
+    bool keep_connections;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;
+    std::atomic<bool> running;
+
+    std::thread event_thread;
+    std::vector<std::thread> worker_threads;
+
+    std::mutex job_mutex;
+    std::condition_variable job_cv;
+    std::deque<std::function<void()>> jobs;
+
+    std::mutex result_mutex;
+    std::deque<WorkResult> results;
+
+    // Only touched by the epoll thread
+    std::map<int, std::unique_ptr<Connection>> connections;
+
+    std::mutex completed_mutex;
+    std::condition_variable completed_cv;
+    std::deque<CompletedHandshake> completed;
+
+    std::atomic<uint64_t> accepted_count;
+    std::atomic<uint64_t> completed_count;
+    std::atomic<uint64_t> failed_count;
+    std::atomic<uint64_t> timed_out_count;
+};
+
+#endif // HANDSHAKE_SERVER_H
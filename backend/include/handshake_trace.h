@@ -0,0 +1,66 @@
+#ifndef HANDSHAKE_TRACE_H
+#define HANDSHAKE_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+
+// Optional per-thread breakdown of where a key exchange spends its time.
+// Code on the handshake path wraps each step in a PhaseTimer; the timers only
+// read the clock while a trace is installed on the calling thread, so normal
+// runs pay one thread-local load per step.
+
+enum HandshakePhase {
+    PHASE_CONNECT,          // TCP connect to the key exchange port
+    PHASE_KEY_FILE_LOAD,    // Client identity read from (or created on) disk
+    PHASE_KEM_KEYGEN,
+    PHASE_SIGN,
+    PHASE_VERIFY,
+    PHASE_ENCAPS,
+    PHASE_DECAPS,
+    PHASE_HKDF,
+    PHASE_HMAC,
+    PHASE_KEY_STORE,        // Server lookup / enrollment of Dilithium keys
+    PHASE_TICKET,           // Session ticket seal / open
+    PHASE_COUNT
+};
+
+// Round trips a client can wait on: four for multi-step enrollment
+#define MAX_TRACED_FLIGHTS 4
+
+struct HandshakeTrace {
+    uint64_t phase_ns[PHASE_COUNT];
+    // Time from just before a send's sendmsg() until the reply was complete,
+    // in order; the write itself is included, since the peer may answer
+    // before sendmsg() returns
+    uint64_t flight_ns[MAX_TRACED_FLIGHTS];
+    int flight_count;
+};
+
+// Trace that PhaseTimers on this thread add to, or nullptr
+extern thread_local HandshakeTrace* current_handshake_trace;
+
+void reset_handshake_trace(HandshakeTrace& trace);
+const char* handshake_phase_name(int phase);
+
+class PhaseTimer {
+public:
+    explicit PhaseTimer(HandshakePhase phase) : trace(current_handshake_trace), phase(phase) {
+        if (trace) {
+            begin = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~PhaseTimer() {
+        if (trace) {
+            trace->phase_ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin).count();
+        }
+    }
+
+private:
+    HandshakeTrace *trace;
+    HandshakePhase phase;
+    std::chrono::steady_clock::time_point begin;
+};
+
+#endif // HANDSHAKE_TRACE_H
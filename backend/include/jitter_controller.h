@@ -0,0 +1,98 @@
+#ifndef JITTER_CONTROLLER_H
+#define JITTER_CONTROLLER_H
+
+#include <gst/gst.h>
+#include <vector>
+#include <mutex>
+#include "media_pipeline.h"
+
+// How often each stream's latency is reconsidered
+#define JITTER_POLL_INTERVAL_MS 500
+
+// Share of packets that may arrive after their playout time
+#define JITTER_TARGET_LATE_RATE 0.002
+
+// Latency floor: JITTER_DEVIATIONS times the stream's RFC 3550 jitter (a
+// mean deviation of the transit time), plus JITTER_MIN_LATENCY_MS
+#define JITTER_DEVIATIONS 4
+#define JITTER_MIN_LATENCY_MS 3
+
+// Margin above the floor. Grows by JITTER_MARGIN_GROWTH, and by at least
+// JITTER_MARGIN_STEP_MS, in each poll with late packets above the target;
+// shrinks by JITTER_MARGIN_DECAY per poll once JITTER_CALM_PACKETS packets
+// in a row have stayed below a quarter of it.
+#define JITTER_MARGIN_STEP_MS 5
+#define JITTER_MARGIN_GROWTH 1.5
+#define JITTER_MARGIN_DECAY 0.9
+#define JITTER_CALM_PACKETS 1000
+
+// Retransmission is asked for only when a round trip, the wait before the
+// NACK and this much slack fit in the latency
+#define JITTER_RTX_MARGIN_MS 5
+
+// Smallest latency change worth applying
+#define JITTER_MIN_CHANGE_MS 2
+
+// Adaptive playout delay for the received streams. Each new jitterbuffer is
+// picked up as rtpbin creates it. Every poll, its latency is set to the
+// smallest that keeps late arrivals under JITTER_TARGET_LATE_RATE: a floor
+// from the stream's inter-arrival jitter, plus a margin that late packets
+// push up and calm periods let down, within JITTER_MIN_LATENCY_MS ..
+// max-jitter-latency. NACKs go out only once the peer retransmits and only
+// for streams whose latency leaves time for the round trip (from our own
+// stream's receiver reports); otherwise a lost packet is given up at once.
+// Runs on a GMainLoop.
+class JitterController {
+public:
+    // Only does anything with jitter_mode "adaptive". Must exist before the
+    // pipeline receives anything.
+    JitterController(MediaPipeline& media, const MediaProfile& profile);
+    ~JitterController();
+
+    // Poll from the main loop of context (NULL for the default context)
+    void start(GMainContext *context = NULL);
+    // Stop for good and let go of the jitterbuffers; before the pipeline is
+    // freed
+    void stop();
+
+    // The peer retransmits on NACK; on the controller's loop
+    void enable_rtx();
+
+private:
+    struct Stream {
+        GstElement *jitterbuffer;
+        guint session;
+        guint ssrc;
+        int latency_ms;
+        double margin_ms;
+        bool rtx;
+        // Jitterbuffer counters at the last poll
+        guint64 pushed;
+        guint64 late;
+        // Since the margin last grew
+        guint64 calm_packets;
+        guint64 calm_late;
+    };
+
+    static void on_new_jitterbuffer(GstElement *rtpbin, GstElement *jitterbuffer, guint session, guint ssrc,
+                                    gpointer user_data);
+    static gboolean on_poll(gpointer user_data);
+    double read_jitter_ms(const Stream& stream);
+    double read_rtt_ms();
+    void update(Stream& stream, double rtt_ms);
+
+    MediaPipeline& media;
+    bool adaptive;
+    int start_latency_ms;
+    int max_latency_ms;
+    bool peer_rtx;
+    gulong handler_id;
+
+    // Added from streaming threads, tuned on the loop
+    std::mutex streams_mutex;
+    std::vector<Stream> streams;
+
+    GSource *poll_source;
+};
+
+#endif // JITTER_CONTROLLER_H
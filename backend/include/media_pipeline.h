@@ -0,0 +1,210 @@
+#ifndef MEDIA_PIPELINE_H
+#define MEDIA_PIPELINE_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+class BatchedUdpReceiver;
+class BatchedUdpSender;
+class NetworkImpairment;
+
+#define VIDEO_PAYLOAD_TYPE 96
+#define AUDIO_PAYLOAD_TYPE 97
+// ULPFEC (RFC 5109) packets, in the video stream
+#define FEC_PAYLOAD_TYPE 98
+// Retransmitted video packets (RFC 4588), in a stream of their own
+#define RTX_PAYLOAD_TYPE 99
+
+// RTP header extensions (RFC 8285, one-byte form) stamped on sent packets
+// with capture-time on: abs-capture-time, the 64-bit NTP time of capture,
+// and abs-send-time, 24 bits of NTP time in 1/2^18 s as the packet left the
+// payloader. Together, padded, they add CAPTURE_STAMP_SIZE bytes.
+#define CAPTURE_TIME_EXTENSION_ID 1
+#define SEND_TIME_EXTENSION_ID 2
+#define CAPTURE_STAMP_SIZE 20
+
+// Offsets from base_port. With the legacy transport RTP and RTCP of a
+// session are on adjacent ports, video first, then audio two ports up: client
+// to server +0..+3, server to client +10..+13, reports to the client +5/+7
+// and to the server +15/+17. The bundle transport uses only the server's +0
+// and the client's +10.
+#define CLIENT_TO_SERVER_PORT_OFFSET 0
+#define SERVER_TO_CLIENT_PORT_OFFSET 10
+#define CLIENT_FEEDBACK_PORT_OFFSET 5
+#define SERVER_FEEDBACK_PORT_OFFSET 15
+
+// Video clock rate, which tells the video stream's sources apart from audio
+// when both share one RTP session
+#define VIDEO_CLOCK_RATE 90000
+
+// Media settings shared by client and server. Defaults are the values the
+// pipeline always used; width, height and fps of 0 keep what the camera
+// delivers. Both sides must agree on video_codec and base_port.
+struct MediaProfile {
+    int width = 0;
+    int height = 0;
+    int fps = 0;
+    std::string video_codec = "h264";    // h264 or vp8
+    int video_bitrate = 500;              // kbit/s, the start rate when adaptive
+    int min_video_bitrate = 150;          // kbit/s
+    int max_video_bitrate = 2500;         // kbit/s
+    bool adaptive_bitrate = true;         // Follow the peer's receiver reports
+    // ULPFEC on video (payload type 98, sent at 0% until set_video_fec()) and
+    // in-band FEC on Opus; received streams recover from the peer's FEC
+    bool fec = false;
+    int gop = 30;                         // Frames between keyframes
+    std::string x264_preset = "superfast";
+    int audio_bitrate = 64000;            // bit/s
+    int mtu = 1400;
+    int udp_buffer_size = 212992;         // Receive socket buffer, bytes
+    int jitter_latency = 50;              // ms, the start latency when adaptive
+    // fixed: jitter_latency throughout. adaptive: AVPF sessions, video kept for
+    // retransmission (payload type 99) and jitterbuffers that start at
+    // jitter_latency for a JitterController to tune
+    std::string jitter_mode = "fixed";
+    int max_jitter_latency = 400;         // ms, when adaptive
+    // Payloaders leave CAPTURE_STAMP_SIZE bytes of the MTU for the capture and
+    // send time stamps a CaptureLatencyMeter adds
+    bool capture_time = false;
+    int rtcp_interval = 1000;             // Minimum RTCP report interval, ms
+    int base_port = 5000;
+    // legacy: a port per stream. bundle: one rtpbin session carries audio and
+    // video, RTP and RTCP, over one socket (BUNDLE and rtcp-mux, as in
+    // WebRTC); streams are told apart by payload type.
+    std::string transport = "legacy";
+    // stock: udpsrc/udpsink. batched: appsrc/appsink stages whose socket is
+    // read with recvmmsg() and written with sendmmsg(), on the same ports.
+    std::string udp_io = "stock";
+    bool udp_offload = false;             // UDP GSO/GRO with batched I/O, where the kernel has it
+    int trace_interval = 0;               // s between per-element latency dumps; 0 leaves tracing off
+    std::string trace_file;               // Also write the full histograms here, as CSV
+    std::string stats_socket;             // Unix socket live call statistics are served on; empty for none
+    int stats_interval = 100;             // ms between statistics snapshots
+    std::string source = "camera";        // camera, or test: live noise and tone
+    std::string sink = "screen";          // screen; app: video to on_video_frame, audio played; none: discard
+    // Impairment of everything sent, in userspace (see NetworkImpairment)
+    int impair_delay = 0;                 // ms
+    int impair_jitter = 0;                // ms either way around the delay
+    double impair_loss = 0;               // % of packets
+    int impair_burst = 1;                 // Mean run of lost packets; 1 for independent losses
+    double impair_reorder = 0;            // % of packets sent without the delay
+    double impair_duplicate = 0;          // % of packets sent twice
+    int impair_rate = 0;                  // kbit/s per sender; 0 for no cap
+    int impair_seed = 1;                  // Same seed, same fate for the same packets
+};
+
+// Set one setting by its option name (e.g. "video-bitrate"). Returns false
+// for unknown names or invalid values.
+bool set_media_option(MediaProfile& profile, const std::string& name, const std::string& value);
+
+// Read "name = value" lines; blank lines and lines starting with # are skipped
+bool load_media_profile(const std::string& path, MediaProfile& profile);
+
+// Checks that need several settings, made once all of them are known:
+// min_video_bitrate <= video_bitrate <= max_video_bitrate
+bool validate_media_profile(const MediaProfile& profile);
+
+// Apply and remove every --name=value argument (--profile=<file> loads a
+// file), leaving positional arguments in argv; the result is validated
+bool parse_media_args(int& argc, char** argv, MediaProfile& profile);
+
+// One line per option for usage messages
+std::string media_options_help();
+
+// A base-10 integer in [min, max] and nothing else, as option values are
+// parsed; the programs use it for their positional numbers too
+bool parse_int(const std::string& value, int min, int max, int& out);
+
+// A decoded frame of a received video stream, as sink "app" delivers it:
+// BGRx, mapped for reading in place. The buffer stays mapped, and out of its
+// pool, until the last reference goes.
+class VideoFrame {
+public:
+    // Takes the sample; not valid() when it cannot be mapped
+    VideoFrame(GstSample *sample, int stream);
+    ~VideoFrame();
+    VideoFrame(const VideoFrame&) = delete;
+    VideoFrame& operator=(const VideoFrame&) = delete;
+
+    bool valid() const { return mapped; }
+    const uint8_t* data() const { return (const uint8_t*)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0); }
+    int width() const { return GST_VIDEO_FRAME_WIDTH(&frame); }
+    int height() const { return GST_VIDEO_FRAME_HEIGHT(&frame); }
+    int stride() const { return GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0); }   // Bytes per row
+    // Received video streams in the order they appeared; only 0 in a 1:1 call
+    int stream() const { return stream_index; }
+
+private:
+    GstSample *sample;
+    GstVideoFrame frame;
+    bool mapped;
+    int stream_index;
+};
+
+typedef std::function<void(const std::shared_ptr<VideoFrame>& frame)> VideoFrameCallback;
+
+enum MediaRole {
+    MEDIA_ROLE_CLIENT,
+    MEDIA_ROLE_SERVER
+};
+
+// Elements of a built pipeline, owned by the pipeline, for tuning while it runs
+struct MediaPipeline {
+    GstElement *pipeline = nullptr;
+    GstElement *video_encoder = nullptr;
+    GstElement *audio_encoder = nullptr;
+    GstElement *video_payloader = nullptr;
+    GstElement *audio_payloader = nullptr;
+    GstElement *rtpbin_send = nullptr;
+    GstElement *rtpbin_recv = nullptr;
+    GstElement *video_depayloader = nullptr;
+    GstElement *audio_depayloader = nullptr;
+    // rtpulpfecenc after the video payloader, with fec on
+    GstElement *fec_encoder = nullptr;
+    // Names of the srtpenc / srtpdec elements, for SrtpKeyRing
+    std::vector<std::string> encoder_names;
+    std::vector<std::string> decoder_names;
+    // Profile settings for the playback chains of streams that appear later
+    std::string video_codec;
+    std::string sink;
+    int jitter_latency = 0;
+    bool fec = false;
+    bool rtx = false;
+    // Socket I/O of the batched appsrc/appsink stages; receivers run from
+    // build_media_pipeline() until the MediaPipeline is destroyed
+    std::vector<std::shared_ptr<BatchedUdpReceiver>> udp_receivers;
+    std::vector<std::shared_ptr<BatchedUdpSender>> udp_senders;
+    // Between srtpenc and the UDP sink when impairment is on; run from
+    // build_media_pipeline() until the MediaPipeline is destroyed
+    std::vector<std::shared_ptr<NetworkImpairment>> impairments;
+    // With sink "app", called with every decoded frame of every received
+    // video stream, on its streaming thread. Set after build_media_pipeline()
+    // and before the pipeline plays.
+    VideoFrameCallback on_video_frame;
+    int video_streams = 0;
+};
+
+// Two-way call pipeline: camera and microphone are encoded, packetized and
+// sent through srtpenc to peer_ip; the peer's streams are received through
+// srtpdec, jitter-buffered and played, and receiver reports go back through
+// srtpenc. See MediaProfile for what each setting changes. Elements are
+// created with the GStreamer API; on failure nothing is left allocated.
+// media must outlive the pipeline.
+bool build_media_pipeline(const MediaProfile& profile, MediaRole role, const std::string& peer_ip,
+                          MediaPipeline& media);
+
+// Change encoder bitrates while the pipeline runs
+void set_video_bitrate(MediaPipeline& media, int kbps);
+void set_audio_bitrate(MediaPipeline& media, int bps);
+
+// FEC packets per 100 video packets; 0 sends none. Needs fec in the profile.
+void set_video_fec(MediaPipeline& media, int percentage);
+// Loss Opus should protect against with in-band FEC; 0 turns it off
+void set_audio_fec(MediaPipeline& media, int loss_percentage);
+
+#endif // MEDIA_PIPELINE_H
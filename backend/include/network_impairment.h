@@ -0,0 +1,98 @@
+#ifndef NETWORK_IMPAIRMENT_H
+#define NETWORK_IMPAIRMENT_H
+
+#include <gst/gst.h>
+#include <vector>
+#include <queue>
+#include <random>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+struct MediaProfile;
+
+// Most a rate-capped sender queues before the link drops what it is given,
+// like a router's tail drop
+#define IMPAIR_RATE_QUEUE_MS 200
+
+struct ImpairmentStats {
+    uint64_t packets;       // Given to the stage
+    uint64_t lost;          // Dropped by the loss model
+    uint64_t queue_drops;   // Dropped as the rate cap's queue was full
+    uint64_t duplicated;
+    uint64_t reordered;     // Sent at once, ahead of delayed ones
+};
+
+// True when the profile asks for any impairment
+bool impairment_enabled(const MediaProfile& profile);
+
+// Network conditions applied in userspace, like netem, to one sender's
+// packets between srtpenc and its UDP sink: a fixed delay with uniform
+// jitter (kept in order, as netem does by default), random loss or
+// Gilbert-Elliott bursts of impair-burst packets on average, packets that
+// skip the delay, duplicates and a bandwidth cap with a bounded queue. An
+// appsink takes the packets on the streaming thread, which decides each
+// packet's fate; a thread of the stage's own pushes them into an appsrc
+// when due. Decisions come from a generator seeded with impair-seed and the
+// stream's port, in packet order, so two runs drop, delay and duplicate the
+// same packets; only the rate cap's queue also depends on timing.
+class NetworkImpairment {
+public:
+    NetworkImpairment(const MediaProfile& profile, GstElement *appsink, GstElement *appsrc, int port);
+    ~NetworkImpairment();
+
+    bool start();
+    // Packets still held are dropped
+    void stop();
+
+    ImpairmentStats stats() const;
+
+private:
+    struct Held {
+        gint64 due_us;
+        uint64_t order;     // Ties go out in arrival order
+        GstBuffer *buffer;
+
+        bool operator>(const Held& other) const {
+            return due_us != other.due_us ? due_us > other.due_us : order > other.order;
+        }
+    };
+
+    static GstFlowReturn on_new_sample(GstElement *appsink, gpointer user_data);
+    void impair(GstBuffer *buffer);
+    bool chance(double percent);
+    void hold(GstBuffer *buffer, gint64 due_us);
+    void run();
+
+    GstElement *appsrc;
+    int delay_ms;
+    int jitter_ms;
+    double loss_percent;
+    int burst;
+    double reorder_percent;
+    double duplicate_percent;
+    int rate_kbps;
+
+    // Streaming thread only
+    std::mt19937 generator;
+    bool in_burst;
+    gint64 link_free_us;
+    gint64 last_due_us;     // Latest release time of a packet not reordered
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::priority_queue<Held, std::vector<Held>, std::greater<Held>> held;
+    uint64_t next_order;
+    bool running;
+    std::thread release_thread;
+
+    std::atomic<uint64_t> packet_count;
+    std::atomic<uint64_t> lost_count;
+    std::atomic<uint64_t> queue_drop_count;
+    std::atomic<uint64_t> duplicate_count;
+    std::atomic<uint64_t> reorder_count;
+};
+
+#endif // NETWORK_IMPAIRMENT_H
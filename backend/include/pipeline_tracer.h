@@ -0,0 +1,101 @@
+#ifndef PIPELINE_TRACER_H
+#define PIPELINE_TRACER_H
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "media_pipeline.h"
+
+// Elements traced per pipeline; later ones are left alone
+#define TRACE_MAX_ELEMENTS 512
+
+// Log-scale buckets: one below 1 us, then TRACE_BUCKETS_PER_OCTAVE per
+// doubling up to 2^TRACE_OCTAVES us (about 17 s); longer lands in the last
+#define TRACE_BUCKETS_PER_OCTAVE 4
+#define TRACE_OCTAVES 24
+#define TRACE_BUCKETS (1 + TRACE_OCTAVES * TRACE_BUCKETS_PER_OCTAVE)
+
+// Buffers per element remembered between input and output on another thread
+#define TRACE_RESIDENCY_SLOTS 64
+
+// Rows in the logged table
+#define TRACE_TOP_ELEMENTS 20
+
+// One thread's times for one element. Only that thread writes, with plain
+// relaxed stores; the dump reads them from another thread.
+struct TraceHistogram {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint32_t> buckets[TRACE_BUCKETS];
+
+    void add(uint64_t ns);
+};
+
+// Per-element latency of a running pipeline, from pad probes on every
+// element, including those rtpbin and the SFU chains add later. When an
+// element pushes its output on the thread that brought the input, the time
+// from input to output is its processing time (x264enc, srtpenc,
+// videoconvert, decoders). When the output leaves on another thread, the
+// time the same buffer spent inside is its queue residency (queues, the
+// jitterbuffer). Elements that make new buffers on another thread are not
+// timed, nor is what sinks do with a buffer. Each streaming thread fills
+// histograms of its own, without locks; the dump adds them up. Logs the
+// elements with the most processing time every trace_interval seconds and
+// on dump(), and writes every thread's histograms to trace_file as CSV.
+// Without trace_interval nothing is hooked and nothing is spent.
+class PipelineTracer {
+public:
+    PipelineTracer(GstElement *pipeline, const MediaProfile& profile);
+    ~PipelineTracer();
+
+    bool enabled() const { return interval_s > 0; }
+
+    // Dump every trace_interval s from the main loop of context (NULL for
+    // the default context)
+    void start(GMainContext *context = NULL);
+    // Stop for good and take the probes out; before the pipeline is freed
+    void stop();
+    void dump();
+
+private:
+    struct ThreadState;
+    struct ElementTrace;
+
+    static gboolean hook_pad(GstElement *element, GstPad *pad, gpointer user_data);
+    static void on_pad_added(GstElement *element, GstPad *pad, gpointer user_data);
+    static void on_element_added(GstBin *pipeline, GstBin *bin, GstElement *element, gpointer user_data);
+    static GstPadProbeReturn on_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn on_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static gboolean on_interval(gpointer user_data);
+
+    void hook(GstElement *element);
+    ThreadState* thread_state();
+    TraceHistogram* histogram(std::atomic<TraceHistogram*>& slot);
+    void write_csv();
+
+    GstElement *pipeline;
+    int interval_s;
+    std::string csv_path;
+    uint64_t generation;
+    std::chrono::steady_clock::time_point started;
+
+    // Hooking happens on streaming threads too
+    std::mutex registry;
+    std::set<GstElement*> hooked;
+    std::vector<std::unique_ptr<ElementTrace>> elements;
+    std::vector<std::unique_ptr<ThreadState>> threads;
+    std::vector<std::pair<GstPad*, gulong>> probes;
+    std::vector<std::pair<GstElement*, gulong>> handlers;
+    bool stopped;
+
+    GSource *interval_source;
+};
+
+#endif // PIPELINE_TRACER_H
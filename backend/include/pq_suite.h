@@ -0,0 +1,192 @@
+#ifndef PQ_SUITE_H
+#define PQ_SUITE_H
+
+#include <oqs/oqs.h>
+#include "handshake_trace.h"
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Post-quantum parameter sets for the key exchange. Each set is a traits type
+// wrapping liboqs' size constants and per-algorithm entry points, so the
+// crypto calls create no OQS_KEM/OQS_SIG object. The handshake is not
+// specialized per suite: it picks a PqSuiteInfo from the runtime table below,
+// calls through its function pointers and keeps its messages in vectors sized
+// from its fields.
+//
+// liboqs can be built without any algorithm (and recent releases drop Kyber
+// altogether), so every traits type and suite exists only when its
+// OQS_ENABLE_KEM_* / OQS_ENABLE_SIG_* macro is defined.
+
+#define PQ_SHARED_SECRET_SIZE 32
+
+#define PQ_KEM_TRAITS(type, suite_code, display_name, cli_token, oqs)                        \
+    struct type {                                                                             \
+        static constexpr uint8_t code = suite_code;                                           \
+        static constexpr const char *name = display_name;                                     \
+        static constexpr const char *token = cli_token;                                       \
+        static constexpr size_t public_key_bytes = OQS_KEM_##oqs##_length_public_key;         \
+        static constexpr size_t secret_key_bytes = OQS_KEM_##oqs##_length_secret_key;         \
+        static constexpr size_t ciphertext_bytes = OQS_KEM_##oqs##_length_ciphertext;         \
+        static_assert(OQS_KEM_##oqs##_length_shared_secret == PQ_SHARED_SECRET_SIZE,          \
+                      "shared secret size");                                                  \
+        static OQS_STATUS keypair(uint8_t *pk, uint8_t *sk) {                                 \
+            return OQS_KEM_##oqs##_keypair(pk, sk);                                           \
+        }                                                                                     \
+        static OQS_STATUS encaps(uint8_t *ct, uint8_t *ss, const uint8_t *pk) {               \
+            return OQS_KEM_##oqs##_encaps(ct, ss, pk);                                        \
+        }                                                                                     \
+        static OQS_STATUS decaps(uint8_t *ss, const uint8_t *ct, const uint8_t *sk) {         \
+            return OQS_KEM_##oqs##_decaps(ss, ct, sk);                                        \
+        }                                                                                     \
+    }
+
+#define PQ_SIG_TRAITS(type, suite_code, display_name, cli_token, oqs)                        \
+    struct type {                                                                             \
+        static constexpr uint8_t code = suite_code;                                           \
+        static constexpr const char *name = display_name;                                     \
+        static constexpr const char *token = cli_token;                                       \
+        static constexpr size_t public_key_bytes = OQS_SIG_##oqs##_length_public_key;         \
+        static constexpr size_t secret_key_bytes = OQS_SIG_##oqs##_length_secret_key;         \
+        static constexpr size_t signature_bytes = OQS_SIG_##oqs##_length_signature;           \
+        static OQS_STATUS keypair(uint8_t *pk, uint8_t *sk) {                                 \
+            return OQS_SIG_##oqs##_keypair(pk, sk);                                           \
+        }                                                                                     \
+        static OQS_STATUS sign(uint8_t *sig, size_t *sig_len, const uint8_t *msg,             \
+                               size_t msg_len, const uint8_t *sk) {                           \
+            return OQS_SIG_##oqs##_sign(sig, sig_len, msg, msg_len, sk);                      \
+        }                                                                                     \
+        static OQS_STATUS verify(const uint8_t *msg, size_t msg_len, const uint8_t *sig,      \
+                                 size_t sig_len, const uint8_t *pk) {                         \
+            return OQS_SIG_##oqs##_verify(msg, msg_len, sig, sig_len, pk);                    \
+        }                                                                                     \
+    }
+
+// Kyber-768 is the original (pre-FIPS 203) KEM and stays the default so that
+// peers speaking the multi-step protocol keep working
+#ifdef OQS_ENABLE_KEM_kyber_768
+PQ_KEM_TRAITS(Kyber768, 0x0, "Kyber-768", "kyber768", kyber_768);
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_512
+PQ_KEM_TRAITS(MlKem512, 0x1, "ML-KEM-512", "mlkem512", ml_kem_512);
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_768
+PQ_KEM_TRAITS(MlKem768, 0x2, "ML-KEM-768", "mlkem768", ml_kem_768);
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_1024
+PQ_KEM_TRAITS(MlKem1024, 0x3, "ML-KEM-1024", "mlkem1024", ml_kem_1024);
+#endif
+
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+PQ_SIG_TRAITS(MlDsa44, 0x1, "ML-DSA-44", "mldsa44", ml_dsa_44);
+#endif
+#ifdef OQS_ENABLE_SIG_ml_dsa_65
+PQ_SIG_TRAITS(MlDsa65, 0x2, "ML-DSA-65", "mldsa65", ml_dsa_65);
+#endif
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+PQ_SIG_TRAITS(MlDsa87, 0x3, "ML-DSA-87", "mldsa87", ml_dsa_87);
+#endif
+
+// ML-DSA-65 is the identity of every existing client
+#ifndef OQS_ENABLE_SIG_ml_dsa_65
+#error "liboqs must be built with ML-DSA-65"
+#endif
+#if !defined(OQS_ENABLE_KEM_kyber_768) && !defined(OQS_ENABLE_KEM_ml_kem_768)
+#error "liboqs must be built with Kyber-768 or ML-KEM-768"
+#endif
+
+// Runtime view of one (KEM, signature) pair, selected by the id carried in
+// HELLO_1RTT. The function pointers are PqSuite<> instantiations; the
+// handshake sizes every buffer from the fields below.
+struct PqSuiteInfo {
+    uint8_t id;
+    const char *kem_name;
+    const char *sig_name;
+    const char *kem_token;
+    const char *sig_token;
+    size_t kem_public_key_bytes;
+    size_t kem_secret_key_bytes;
+    size_t kem_ciphertext_bytes;
+    size_t sig_public_key_bytes;
+    size_t sig_secret_key_bytes;
+    size_t sig_bytes;
+
+    bool (*generate_identity)(uint8_t *public_key, uint8_t *secret_key);
+    // Ephemeral KEM keypair plus an identity signature over its public key
+    bool (*generate_signed_key)(const uint8_t *identity_secret_key, uint8_t *kem_public_key,
+                                uint8_t *kem_secret_key, uint8_t *signature);
+    bool (*verify_signed_key)(const uint8_t *kem_public_key, const uint8_t *signature,
+                              const uint8_t *identity_public_key);
+    bool (*encapsulate)(const uint8_t *kem_public_key, uint8_t *ciphertext, uint8_t *shared_secret);
+    bool (*decapsulate)(const uint8_t *ciphertext, const uint8_t *kem_secret_key, uint8_t *shared_secret);
+};
+
+// The entry points of one (KEM, signature) pair; info() turns them into the
+// pair's PqSuiteInfo
+template <class Kem, class Sig>
+struct PqSuite {
+    static constexpr uint8_t id = (Kem::code << 4) | Sig::code;
+
+    static bool generate_identity(uint8_t *public_key, uint8_t *secret_key) {
+        return Sig::keypair(public_key, secret_key) == OQS_SUCCESS;
+    }
+
+    static bool generate_signed_key(const uint8_t *identity_secret_key, uint8_t *kem_public_key,
+                                    uint8_t *kem_secret_key, uint8_t *signature) {
+        {
+            PhaseTimer timer(PHASE_KEM_KEYGEN);
+            if (Kem::keypair(kem_public_key, kem_secret_key) != OQS_SUCCESS) {
+                return false;
+            }
+        }
+
+        PhaseTimer timer(PHASE_SIGN);
+        size_t sig_len;
+        return Sig::sign(signature, &sig_len, kem_public_key, Kem::public_key_bytes,
+                         identity_secret_key) == OQS_SUCCESS &&
+               sig_len == Sig::signature_bytes;
+    }
+
+    static bool verify_signed_key(const uint8_t *kem_public_key, const uint8_t *signature,
+                                  const uint8_t *identity_public_key) {
+        PhaseTimer timer(PHASE_VERIFY);
+        return Sig::verify(kem_public_key, Kem::public_key_bytes, signature, Sig::signature_bytes,
+                           identity_public_key) == OQS_SUCCESS;
+    }
+
+    static bool encapsulate(const uint8_t *kem_public_key, uint8_t *ciphertext, uint8_t *shared_secret) {
+        PhaseTimer timer(PHASE_ENCAPS);
+        return Kem::encaps(ciphertext, shared_secret, kem_public_key) == OQS_SUCCESS;
+    }
+
+    static bool decapsulate(const uint8_t *ciphertext, const uint8_t *kem_secret_key, uint8_t *shared_secret) {
+        PhaseTimer timer(PHASE_DECAPS);
+        return Kem::decaps(shared_secret, ciphertext, kem_secret_key) == OQS_SUCCESS;
+    }
+
+    static constexpr PqSuiteInfo info() {
+        return {id, Kem::name, Sig::name, Kem::token, Sig::token,
+                Kem::public_key_bytes, Kem::secret_key_bytes, Kem::ciphertext_bytes,
+                Sig::public_key_bytes, Sig::secret_key_bytes, Sig::signature_bytes,
+                generate_identity, generate_signed_key, verify_signed_key, encapsulate, decapsulate};
+    }
+};
+
+// Suite implied by the multi-step HELLO, and used unless one is chosen. Without
+// Kyber, ML-KEM-768 takes its place; multi-step peers that still speak
+// Kyber-768 can then no longer connect.
+#ifdef OQS_ENABLE_KEM_kyber_768
+#define PQ_SUITE_DEFAULT PqSuite<Kyber768, MlDsa65>::id
+#else
+#define PQ_SUITE_DEFAULT PqSuite<MlKem768, MlDsa65>::id
+#endif
+
+// All suites this build supports, in table order
+const PqSuiteInfo* pq_suites(size_t& count);
+const PqSuiteInfo* find_pq_suite(uint8_t id);
+// Looks up "<kem>-<sig>", e.g. "mlkem768-mldsa65"
+const PqSuiteInfo* find_pq_suite(const std::string& name);
+const PqSuiteInfo& default_pq_suite();
+std::string pq_suite_name(const PqSuiteInfo& suite);
+
+#endif // PQ_SUITE_H
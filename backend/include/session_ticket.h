@@ -0,0 +1,41 @@
+#ifndef SESSION_TICKET_H
+#define SESSION_TICKET_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Lifetime of resumption tickets issued by the server
+#define SESSION_TICKET_LIFETIME_SECONDS 3600
+
+// Resumption ticket as cached by the client
+struct ClientSessionTicket {
+    std::vector<uint8_t> ticket;             // Opaque, sealed under the server's ticket key
+    std::vector<uint8_t> resumption_secret;  // 32 bytes, never sent on the wire
+    uint64_t expiry;                         // Unix time
+};
+
+// Derive the 32-byte resumption secret of a session from its shared secret
+bool derive_resumption_secret(const uint8_t* shared_secret, uint8_t* resumption_secret);
+
+// Derive the shared secret of a resumed session from the ticket's
+// resumption secret and both parties' 32-byte nonces
+bool derive_resumed_secret(const uint8_t* resumption_secret, const uint8_t* client_nonce,
+                           const uint8_t* server_nonce, uint8_t* shared_secret);
+
+// Server-side: seal a ticket for username, or open and validate one. The
+// ticket records the id of the PQ suite its session was set up with, so a
+// resumption can be held to that suite.
+bool issue_session_ticket(const std::string& username, uint8_t suite_id, const uint8_t* resumption_secret,
+                          std::vector<uint8_t>& ticket);
+bool open_session_ticket(const std::vector<uint8_t>& ticket, std::string& username, uint8_t& suite_id,
+                         uint8_t* resumption_secret);
+
+// Client-side ticket cache, keyed by server address and username
+bool load_client_session_ticket(const std::string& server, const std::string& username,
+                                ClientSessionTicket& ticket);
+void store_client_session_ticket(const std::string& server, const std::string& username,
+                                 const ClientSessionTicket& ticket);
+void discard_client_session_ticket();
+
+#endif // SESSION_TICKET_H
@@ -0,0 +1,157 @@
+#ifndef SFU_H
+#define SFU_H
+
+#include <srtp2/srtp.h>
+#include <glib.h>
+#include "handshake_server.h"
+#include "control_channel.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <netinet/in.h>
+
+#define SFU_DEFAULT_MAX_PARTICIPANTS 16
+
+// Largest packet forwarded; anything bigger is not from our pipelines
+#define SFU_MAX_PACKET_SIZE 2048
+
+// Receive buffer of each forwarder socket, for bursts of keyframe packets
+// from several participants at once
+#define SFU_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+
+struct SfuStats {
+    uint64_t received;
+    uint64_t forwarded;
+    uint64_t auth_failures;
+    uint64_t unknown_key;
+    uint64_t send_errors;
+    // CPU time of the forwarding thread
+    uint64_t cpu_ns;
+    int participants;
+};
+
+// Media plane of a multi-party call. Participants run the normal client
+// pipeline against base_port, exactly as in a 1:1 call with a server. Every
+// SRTP/SRTCP packet is matched to its sender by MKI (each participant's keys
+// are its own), decrypted once with the sender's context and re-encrypted
+// for each other participant with theirs. Nothing is decoded: the cost per
+// packet and receiver is one AES-CTR + HMAC pass and a sendto().
+class SfuForwarder {
+public:
+    explicit SfuForwarder(int base_port);
+    ~SfuForwarder();
+
+    bool start();
+    void stop();
+
+    // Returns the participant id, or -1 when the key cannot be used
+    int add_participant(const std::string& username, const std::string& ip, const std::vector<uint8_t>& key);
+    // Key from an in-call exchange: accepted from the participant at once,
+    // sent with after REKEY_SWITCH_DELAY_MS, like ServerRekeyer
+    bool rekey_participant(int id, const std::vector<uint8_t>& key);
+    void remove_participant(int id);
+    // Id of the participant with this user name and address, or -1
+    int find_participant(const std::string& username, const std::string& ip);
+
+    SfuStats stats();
+
+private:
+    struct SfuKey {
+        std::vector<uint8_t> key;
+        uint32_t mki;
+    };
+
+    struct Participant {
+        int id;
+        std::string username;
+        std::string ip;
+        struct sockaddr_in addr;
+        // Newest last
+        std::vector<SfuKey> keys;
+        srtp_t inbound;
+        srtp_t outbound;
+        // Index into keys of the key sent with
+        unsigned int sending_index;
+        bool switch_pending;
+        std::chrono::steady_clock::time_point switch_at;
+        uint32_t last_inbound_mki;
+    };
+
+    struct Socket {
+        int fd;
+        int forward_offset;
+        bool rtcp;
+    };
+
+    bool update_sessions(Participant& participant, bool create);
+    void trim_keys(Participant& participant);
+    void destroy_sessions(Participant& participant);
+    void run();
+    void forward(const Socket& socket, uint8_t* packet, int len);
+    void switch_due_participants();
+
+    int base_port;
+    std::vector<Socket> sockets;
+    std::atomic<bool> running;
+    std::thread forward_thread;
+
+    // Held by the forwarding thread for each packet and by joins, leaves and
+    // rekeys: libsrtp sessions are not thread-safe
+    std::mutex participants_mutex;
+    std::map<int, std::unique_ptr<Participant>> participants;
+    std::map<uint32_t, Participant*> by_mki;
+    int next_id;
+    std::atomic<int> pending_switches;
+
+    std::atomic<uint64_t> received_count;
+    std::atomic<uint64_t> forwarded_count;
+    std::atomic<uint64_t> auth_failure_count;
+    std::atomic<uint64_t> unknown_key_count;
+    std::atomic<uint64_t> send_error_count;
+    std::atomic<uint64_t> cpu_ns;
+};
+
+// Multi-party server: key exchanges on one port admit participants (or rekey
+// those already in the call), each gets its own SRTP context in the forwarder
+// and keeps its exchange connection as a control channel. Control channels
+// run on the default main context; a hang-up or lost connection removes the
+// participant.
+class SfuServer {
+public:
+    SfuServer(int key_exchange_port, int base_port, int max_participants);
+    ~SfuServer();
+
+    bool start();
+    void stop();
+
+    SfuStats stats() { return forwarder.stats(); }
+
+private:
+    struct Removal {
+        SfuServer *server;
+        int id;
+    };
+
+    static gboolean on_remove(gpointer data);
+
+    void accept_loop();
+    void admit(CompletedHandshake& done);
+    void schedule_removal(int id);
+
+    int max_participants;
+    HandshakeServer handshake_server;
+    SfuForwarder forwarder;
+    std::atomic<bool> running;
+    std::thread accept_thread;
+
+    std::mutex channels_mutex;
+    std::map<int, std::unique_ptr<ControlChannel>> channels;
+};
+
+#endif // SFU_H
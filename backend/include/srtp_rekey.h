@@ -0,0 +1,152 @@
+#ifndef SRTP_REKEY_H
+#define SRTP_REKEY_H
+
+#include <gst/gst.h>
+#include "auth_protocol.h"
+#include "handshake_server.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+// Every SRTP/SRTCP packet carries a master key identifier (MKI) between the
+// payload and the auth tag, so a receiver can hold several keys and pick the
+// right one per packet: keys change mid-call without a switch-over gap.
+#define SRTP_MASTER_KEY_SIZE 46
+#define SRTP_MKI_SIZE 4
+#define SRTP_AUTH_TAG_SIZE 10
+
+// The MKI is a public label of the key: HKDF output, so it reveals nothing
+// about the key, and both sides compute the same value independently. The
+// raw bytes are kept as a word.
+bool derive_srtp_mki(const std::vector<uint8_t>& key, uint32_t& mki);
+
+// Keys the decoders keep accepting: the current one plus older ones whose
+// packets may still be in flight
+#define SRTP_KEY_RING_SIZE 3
+
+// The server starts encrypting with a new key this long after it has it
+#define REKEY_SWITCH_DELAY_MS 500
+
+// Default interval between in-call key exchanges started by the client
+#define REKEY_INTERVAL_SECONDS 600
+
+// SRTP master keys of one call. Each key's MKI is derived from the key itself,
+// so both sides agree on it without counting rekeys.
+class SrtpKeyRing {
+public:
+    SrtpKeyRing(GstElement *pipeline, const std::vector<std::string>& encoder_names,
+                const std::vector<std::string>& decoder_names);
+    ~SrtpKeyRing();
+
+    // srtpenc will not leave NULL without a key. Nothing is encrypted before
+    // PLAYING, so this random key is replaced by start() before any packet.
+    void set_placeholder_key();
+
+    // First key of the call, used at once by encoders and decoders
+    void start(const std::vector<uint8_t>& key);
+
+    // Key from an in-call exchange: decoders accept it immediately, encoders
+    // keep the current key until switch_encoders()
+    void add_key(const std::vector<uint8_t>& key);
+    void switch_encoders();
+    // Switch encoders as soon as a packet from the peer uses the newest key,
+    // which proves the peer has it
+    void switch_encoders_when_peer_does();
+
+    uint64_t rekeys() const { return rekey_count; }
+    // Times the encoders moved to a newer key after start()
+    uint64_t switches() const { return switch_count; }
+
+private:
+    struct MasterKey {
+        std::vector<uint8_t> key;
+        // Raw MKI bytes, compared as a word
+        uint32_t mki;
+    };
+
+    static GstCaps* on_request_key(GstElement *srtpdec, guint ssrc, gpointer user_data);
+    static GstPadProbeReturn on_decoder_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    void set_encoder_key(const MasterKey& key);
+    void refresh_decoders();
+    GstCaps* decoder_caps(GstElement *srtpdec, guint ssrc);
+
+    GstElement *pipeline;
+    std::vector<std::string> encoder_names;
+    std::vector<std::string> decoder_names;
+
+    std::mutex ring_mutex;
+    // Newest first. Trimming never drops the key the peer last sent with.
+    std::deque<MasterKey> keys;
+    // Rollover counters of each decoder stream, carried over when its keys
+    // are replaced. Keyed by decoder name, then SSRC.
+    std::map<std::string, std::map<guint, guint>> rollover_counters;
+    std::vector<std::pair<GstPad*, gulong>> probes;
+
+    // Read by the decoder probes on every packet, so kept outside the mutex
+    std::atomic<uint32_t> peer_mki;
+    std::atomic<uint32_t> sending_mki;
+    std::atomic<uint32_t> pending_mki;
+    std::atomic<bool> switch_pending;
+    std::atomic<uint64_t> rekey_count;
+    std::atomic<uint64_t> switch_count;
+};
+
+// Client side: runs a fresh 1-RTT exchange (new ML-KEM key, same identity)
+// every interval and hands the result to the ring
+class ClientRekeyer {
+public:
+    ClientRekeyer(SrtpKeyRing& ring, const std::string& server_ip, int port, const std::string& username,
+                  const PqSuiteInfo& suite, int interval_seconds);
+    ~ClientRekeyer();
+
+    bool start();
+    void stop();
+
+private:
+    void run();
+
+    SrtpKeyRing& ring;
+    std::string server_ip;
+    int port;
+    std::string username;
+    const PqSuiteInfo& suite;
+    int interval_seconds;
+    DilithiumKeys identity;
+
+    std::thread rekey_thread;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool stopping;
+};
+
+// Server side: keeps accepting key exchanges during the call and treats one
+// from the call's user and address as a rekey
+class ServerRekeyer {
+public:
+    ServerRekeyer(SrtpKeyRing& ring, int port, const std::string& username, const std::string& peer_ip);
+    ~ServerRekeyer();
+
+    bool start();
+    void stop();
+
+private:
+    void run();
+
+    SrtpKeyRing& ring;
+    int port;
+    std::string username;
+    std::string peer_ip;
+    std::unique_ptr<HandshakeServer> server;
+    std::thread rekey_thread;
+    std::atomic<bool> running;
+};
+
+#endif // SRTP_REKEY_H
@@ -1,559 +1,993 @@
 #include "auth_protocol.h"
 #include "crypto_utils.h"
+#include "session_ticket.h"
+#include "handshake_server.h"
+#include "client_key_store.h"
+#include "ephemeral_key_pool.h"
+#include "handshake_codec.h"
+#include "handshake_trace.h"
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <ctime>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <oqs/oqs.h>
-#include <nlohmann/json.hpp>
 
 using namespace std;
-using json = nlohmann::json;
 
 // Global SRTP key
 vector<uint8_t> SRTP_KEY;
 
 const string CLIENT_DB_FILE = "client_keys.json";
+const string CLIENT_KEY_STORE_FILE = "client_keys.db";
 const string CLIENT_KEYS_FILE = "client_dilithium_keys.bin";
 
-// Dilithium keys structure
-struct DilithiumKeys {
-    vector<uint8_t> public_key;
-    vector<uint8_t> secret_key;
-};
+// Opened once per process; imports the legacy JSON database on first use
+static ClientKeyStore* client_key_store() {
+    static ClientKeyStore* store = [] {
+        ClientKeyStore *s = new ClientKeyStore(CLIENT_KEY_STORE_FILE);
+        if (!s->open()) {
+            delete s;
+            return (ClientKeyStore*)nullptr;
+        }
+        s->migrate_from_json(CLIENT_DB_FILE);
+        return s;
+    }();
+    return store;
+}
 
 // Helper functions
-static json load_client_db() {
-    ifstream file(CLIENT_DB_FILE);
-    if (!file.is_open()) {
-        return json::object();
+// Returns false only for a username with no key at any level. A key enrolled
+// at another ML-DSA level is still returned, so callers reject the handshake
+// instead of treating the user as new and re-enrolling the name.
+static bool get_client_dilithium_key(const string& username, vector<uint8_t>& public_key) {
+    PhaseTimer timer(PHASE_KEY_STORE);
+    ClientKeyStore *store = client_key_store();
+    return store && store->lookup(username, public_key);
+}
+
+static bool key_matches_suite(const string& username, const vector<uint8_t>& public_key,
+                              const PqSuiteInfo& suite) {
+    if (public_key.size() != suite.sig_public_key_bytes) {
+        cerr << "SERVER: " << username << " is enrolled at another ML-DSA level than "
+             << suite.sig_name << ", rejecting" << endl;
+        return false;
     }
-    json db;
-    file >> db;
-    return db;
+    return true;
 }
 
-static void save_client_db(const json& db) {
-    ofstream file(CLIENT_DB_FILE);
-    file << db.dump(4);
+static bool store_client_dilithium_key(const string& username, const vector<uint8_t>& public_key) {
+    PhaseTimer timer(PHASE_KEY_STORE);
+    ClientKeyStore *store = client_key_store();
+    if (!store || !store->enroll(username, public_key)) {
+        return false;
+    }
+    cout << "SERVER: Stored Dilithium public key for user: " << username << endl;
+    return true;
 }
 
-static bool get_client_dilithium_key(const string& username, vector<uint8_t>& public_key) {
-    json db = load_client_db();
-    if (db.contains(username)) {
-        auto key_json = db[username]["dilithium_public_key"];
-        public_key = vector<uint8_t>(key_json.begin(), key_json.end());
-        return true;
+// ML-DSA-65 keeps the original file name so existing identities stay valid
+static string client_keys_file(const PqSuiteInfo& suite) {
+    if (suite.sig_public_key_bytes == MlDsa65::public_key_bytes) {
+        return CLIENT_KEYS_FILE;
     }
-    return false;
+    return string("client_") + suite.sig_token + "_keys.bin";
 }
 
-static void store_client_dilithium_key(const string& username, const vector<uint8_t>& public_key) {
-    json db = load_client_db();
-    db[username]["dilithium_public_key"] = public_key;
-    save_client_db(db);
-    cout << "SERVER: Stored Dilithium public key for user: " << username << endl;
+bool generate_dilithium_keys(DilithiumKeys& keys, const PqSuiteInfo& suite) {
+    keys.public_key.resize(suite.sig_public_key_bytes);
+    keys.secret_key.resize(suite.sig_secret_key_bytes);
+    return suite.generate_identity(keys.public_key.data(), keys.secret_key.data());
 }
 
-static bool load_or_generate_dilithium_keys(DilithiumKeys& keys) {
-    OQS_SIG *sig = OQS_SIG_new(OQS_SIG_alg_ml_dsa_65);
-    if (!sig) {
-        cerr << "Failed to initialize ML-DSA-65" << endl;
-        return false;
-    }
+bool load_or_generate_dilithium_keys(DilithiumKeys& keys, const PqSuiteInfo& suite) {
+    PhaseTimer timer(PHASE_KEY_FILE_LOAD);
+    string keys_file = client_keys_file(suite);
+    keys.public_key.resize(suite.sig_public_key_bytes);
+    keys.secret_key.resize(suite.sig_secret_key_bytes);
     
-    ifstream file(CLIENT_KEYS_FILE, ios::binary);
+    ifstream file(keys_file, ios::binary);
     if (file.is_open()) {
-        keys.public_key.resize(sig->length_public_key);
-        keys.secret_key.resize(sig->length_secret_key);
-        
-        file.read((char*)keys.public_key.data(), sig->length_public_key);
-        file.read((char*)keys.secret_key.data(), sig->length_secret_key);
+        file.read((char*)keys.public_key.data(), keys.public_key.size());
+        file.read((char*)keys.secret_key.data(), keys.secret_key.size());
         file.close();
         
-        cout << "CLIENT: Loaded existing Dilithium keys" << endl;
+        cout << "CLIENT: Loaded existing " << suite.sig_name << " keys" << endl;
     } else {
-        keys.public_key.resize(sig->length_public_key);
-        keys.secret_key.resize(sig->length_secret_key);
-        
-        if (OQS_SIG_keypair(sig, keys.public_key.data(), keys.secret_key.data()) != OQS_SUCCESS) {
+        if (!suite.generate_identity(keys.public_key.data(), keys.secret_key.data())) {
             cerr << "CLIENT: Failed to generate Dilithium keys" << endl;
-            OQS_SIG_free(sig);
             return false;
         }
         
-        ofstream outfile(CLIENT_KEYS_FILE, ios::binary);
-        outfile.write((char*)keys.public_key.data(), sig->length_public_key);
-        outfile.write((char*)keys.secret_key.data(), sig->length_secret_key);
+        ofstream outfile(keys_file, ios::binary);
+        outfile.write((char*)keys.public_key.data(), keys.public_key.size());
+        outfile.write((char*)keys.secret_key.data(), keys.secret_key.size());
         outfile.close();
         
-        cout << "CLIENT: Generated and saved new Dilithium keys" << endl;
+        cout << "CLIENT: Generated and saved new " << suite.sig_name << " keys" << endl;
     }
     
-    OQS_SIG_free(sig);
     return true;
 }
 
-static bool send_message(int sock, uint8_t msg_type, const vector<uint8_t>& data) {
-    uint32_t data_len = data.size();
+#define MAX_TRANSCRIPT_PARTS 6
+
+// Direction labels for the 1-RTT key-confirmation tags, so that the server's
+// tag can never be reflected back as the client's
+static const string SERVER_FINISHED_LABEL = "QSVC 1-RTT server finished";
+static const string CLIENT_FINISHED_LABEL = "QSVC 1-RTT client finished";
+static const string RESUME_SERVER_FINISHED_LABEL = "QSVC resume server finished";
+static const string RESUME_CLIENT_FINISHED_LABEL = "QSVC resume client finished";
+// The multi-step server tag MACs the client's tag under its own label; echoing
+// the client's tag back would prove nothing about the server
+static const string MULTI_STEP_SERVER_FINISHED_LABEL = "QSVC multi-step server finished";
+
+static ByteSpan span(const vector<uint8_t>& data) {
+    return {data.data(), data.size()};
+}
+
+static ByteSpan span(const string& data) {
+    return {(const uint8_t*)data.data(), data.size()};
+}
+
+// HMAC-SHA512(shared secret, label || transcript). The transcript is passed
+// as the pieces it already lives in, so it is never copied together.
+static vector<uint8_t> compute_finished_tag(const uint8_t* shared_secret, const string& label,
+                                            initializer_list<ByteSpan> transcript) {
+    ByteSpan parts[MAX_TRANSCRIPT_PARTS + 1] = {span(label)};
+    size_t count = 1;
+    for (const ByteSpan& part : transcript) {
+        if (count > MAX_TRANSCRIPT_PARTS) return {};
+        parts[count++] = part;
+    }
+    return compute_hmac_sha512(shared_secret, 32, parts, count);
+}
+
+static bool verify_signed_kyber_key(const PqSuiteInfo& suite, const uint8_t* kyber_pubkey,
+                                    const uint8_t* signature, const vector<uint8_t>& dilithium_pubkey) {
+    if (dilithium_pubkey.size() != suite.sig_public_key_bytes ||
+        !suite.verify_signed_key(kyber_pubkey, signature, dilithium_pubkey.data())) {
+        cerr << "SERVER: Signature verification FAILED! Possible MITM attack!" << endl;
+        return false;
+    }
+    
+    cout << "SERVER: Signature verification SUCCESS!" << endl;
+    return true;
+}
+
+// HELLO_1RTT payload: [u8 suite id][u16 username length, network order][username]
+// [KEM pk][signature]. The suite byte is part of the transcript, so both
+// finished tags also confirm which parameter set was used.
+#define HELLO_1RTT_PREFIX_SIZE 3
+
+static void build_hello_1rtt_prefix(const PqSuiteInfo& suite, const string& username, uint8_t* prefix) {
+    prefix[0] = suite.id;
+    uint16_t name_len = htons((uint16_t)username.size());
+    memcpy(prefix + 1, &name_len, sizeof(name_len));
+}
+
+// Points kyber_pubkey and signature into payload rather than copying them
+static bool parse_hello_1rtt(const vector<uint8_t>& payload, const PqSuiteInfo*& suite, string& username,
+                             const uint8_t*& kyber_pubkey, const uint8_t*& signature) {
+    uint16_t name_len;
+    if (payload.size() < 1 + sizeof(name_len)) return false;
     
-    if (send(sock, &msg_type, 1, 0) != 1) return false;
-    if (send(sock, &data_len, sizeof(data_len), 0) != sizeof(data_len)) return false;
-    if (data_len > 0) {
-        if (send(sock, data.data(), data_len, 0) != (ssize_t)data_len) return false;
+    suite = find_pq_suite(payload[0]);
+    if (!suite) {
+        cerr << "SERVER: Unsupported parameter suite 0x" << hex << (int)payload[0] << dec << endl;
+        return false;
     }
     
+    memcpy(&name_len, payload.data() + 1, sizeof(name_len));
+    name_len = ntohs(name_len);
+    
+    size_t offset = 1 + sizeof(name_len);
+    if (name_len == 0 ||
+        payload.size() != offset + name_len + suite->kem_public_key_bytes + suite->sig_bytes) return false;
+    
+    username.assign(payload.begin() + offset, payload.begin() + offset + name_len);
+    offset += name_len;
+    kyber_pubkey = payload.data() + offset;
+    signature = kyber_pubkey + suite->kem_public_key_bytes;
     return true;
 }
 
-static bool recv_message(int sock, uint8_t& msg_type, vector<uint8_t>& data) {
-    if (recv(sock, &msg_type, 1, MSG_WAITALL) != 1) return false;
+// SESSION_TICKET payload: [u32 lifetime in seconds, network order][ticket].
+// An empty payload tells the client that no ticket could be issued.
+static HandshakeMessage make_session_ticket_message(const string& username, const PqSuiteInfo& suite,
+                                                    const uint8_t* shared_secret) {
+    HandshakeMessage msg = {MSG_SESSION_TICKET, {}};
+    uint8_t resumption_secret[32];
+    vector<uint8_t> ticket;
+    
+    if (derive_resumption_secret(shared_secret, resumption_secret) &&
+        issue_session_ticket(username, suite.id, resumption_secret, ticket)) {
+        uint32_t lifetime = htonl(SESSION_TICKET_LIFETIME_SECONDS);
+        msg.data.insert(msg.data.end(), (uint8_t*)&lifetime, (uint8_t*)&lifetime + sizeof(lifetime));
+        msg.data.insert(msg.data.end(), ticket.begin(), ticket.end());
+    } else {
+        cerr << "SERVER: Could not issue session ticket" << endl;
+    }
+    memset(resumption_secret, 0, sizeof(resumption_secret));
+    return msg;
+}
+
+static void save_session_ticket(const string& server, const string& username,
+                                const vector<uint8_t>& ticket_msg, const uint8_t* shared_secret) {
+    uint32_t lifetime;
+    if (ticket_msg.size() <= sizeof(lifetime)) {
+        return;
+    }
+    memcpy(&lifetime, ticket_msg.data(), sizeof(lifetime));
     
-    uint32_t data_len;
-    if (recv(sock, &data_len, sizeof(data_len), MSG_WAITALL) != sizeof(data_len)) return false;
+    ClientSessionTicket ticket;
+    ticket.ticket.assign(ticket_msg.begin() + sizeof(lifetime), ticket_msg.end());
+    ticket.resumption_secret.resize(32);
+    ticket.expiry = (uint64_t)time(nullptr) + ntohl(lifetime);
     
-    if (data_len > 0) {
-        data.resize(data_len);
-        if (recv(sock, data.data(), data_len, MSG_WAITALL) != (ssize_t)data_len) return false;
+    if (derive_resumption_secret(shared_secret, ticket.resumption_secret.data())) {
+        store_client_session_ticket(server, username, ticket);
+        cout << "CLIENT: Stored session ticket (valid " << ntohl(lifetime) << "s)" << endl;
+    }
+}
+
+ServerHandshake::ServerHandshake()
+    : state(STATE_AWAIT_HELLO), resume_allowed(true), dilithium_key_received(false),
+      suite(&default_pq_suite()) {
+    memset(shared_secret, 0, sizeof(shared_secret));
+}
+
+ServerHandshake::~ServerHandshake() {
+    memset(shared_secret, 0, sizeof(shared_secret));
+}
+
+bool ServerHandshake::on_message(uint8_t msg_type, const vector<uint8_t>& data,
+                                 vector<HandshakeMessage>& out) {
+    bool ok = false;
+    
+    switch (state) {
+        case STATE_AWAIT_HELLO:
+            ok = handle_hello(msg_type, data, out);
+            break;
+        
+        case STATE_AWAIT_DILITHIUM_KEY:
+            if (msg_type != MSG_DILITHIUM_PUBLIC_KEY) {
+                cerr << "SERVER: Failed to receive Dilithium public key" << endl;
+                break;
+            }
+            ok = handle_dilithium_key(data, out);
+            break;
+        
+        case STATE_AWAIT_SIGNED_KYBER:
+            if (msg_type != MSG_KYBER_PUBLIC_KEY_SIGNED) {
+                cerr << "SERVER: Failed to receive signed Kyber public key" << endl;
+                break;
+            }
+            ok = handle_signed_kyber(data, out);
+            break;
+        
+        case STATE_AWAIT_CLIENT_HMAC:
+            if (msg_type != MSG_HMAC_TAG) {
+                cerr << "SERVER: Failed to receive client HMAC" << endl;
+                break;
+            }
+            ok = handle_client_hmac(data, out);
+            break;
+        
+        case STATE_AWAIT_VERIFY_SUCCESS:
+            if (msg_type != MSG_HMAC_VERIFY_SUCCESS) {
+                cerr << "SERVER: Client rejected our HMAC" << endl;
+                break;
+            }
+            cout << "SERVER: Mutual HMAC verification complete!" << endl;
+            ok = finish();
+            break;
+        
+        case STATE_AWAIT_1RTT_CLIENT_TAG:
+        case STATE_AWAIT_RESUME_CLIENT_TAG: {
+            // The client's tag proves it holds the session secret, which rules
+            // out a replayed HELLO_1RTT or RESUME
+            if (msg_type != MSG_HMAC_TAG) {
+                cerr << "SERVER: Failed to receive client HMAC" << endl;
+                break;
+            }
+            if (!tags_equal(data, expected_client_tag)) {
+                cerr << "SERVER: HMAC verification FAILED!" << endl;
+                break;
+            }
+            cout << "SERVER: Client HMAC verification SUCCESS!" << endl;
+            ok = finish();
+            break;
+        }
+        
+        case STATE_COMPLETE:
+        case STATE_FAILED:
+            break;
     }
     
-    return true;
+    if (!ok) {
+        state = STATE_FAILED;
+    }
+    return ok;
 }
 
-// Server-side key exchange implementation
-bool server_perform_authenticated_key_exchange(int key_exchange_port, string& client_username) {
-    cout << "\n=== SERVER: Starting Authenticated Key Exchange ===\n" << endl;
+// 1. HELLO (multi-step), HELLO_1RTT, or RESUME; a rejected ticket is followed
+// by a normal HELLO on the same connection
+bool ServerHandshake::handle_hello(uint8_t msg_type, const vector<uint8_t>& data,
+                                   vector<HandshakeMessage>& out) {
+    if (msg_type == MSG_RESUME && resume_allowed) {
+        return handle_resume(data, out);
+    }
     
-    OQS_KEM *kem = OQS_KEM_new(OQS_KEM_alg_kyber_768);
-    if (!kem) {
-        cerr << "Failed to initialize Kyber-768" << endl;
-        return false;
+    if (msg_type == MSG_HELLO) {
+        // The multi-step HELLO predates suite negotiation
+        client_username.assign(data.begin(), data.end());
+        cout << "SERVER: Received HELLO from: " << client_username << endl;
+        suite = &default_pq_suite();
+        return start_multi_step(out);
     }
     
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(key_exchange_port);
+    if (msg_type != MSG_HELLO_1RTT) {
+        cerr << "SERVER: Invalid HELLO message" << endl;
+        return false;
+    }
     
-    int reuse = 1;
-    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    const uint8_t *kyber_pubkey, *signature;
+    if (!parse_hello_1rtt(data, suite, client_username, kyber_pubkey, signature)) {
+        cerr << "SERVER: Malformed 1-RTT HELLO" << endl;
+        return false;
+    }
+    cout << "SERVER: Received 1-RTT HELLO from: " << client_username
+         << " (" << suite->kem_name << " + " << suite->sig_name << ")" << endl;
     
-    if (bind(server_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        cerr << "SERVER: Bind failed" << endl;
-        close(server_sock);
-        OQS_KEM_free(kem);
+    if (!get_client_dilithium_key(client_username, client_dilithium_pubkey)) {
+        // First-time enrollment: fall back to the multi-step flow, whose
+        // transcript starts with the bare username
+        cout << "SERVER: Unknown user, falling back to multi-step enrollment" << endl;
+        return start_multi_step(out);
+    }
+    if (!key_matches_suite(client_username, client_dilithium_pubkey, *suite)) {
         return false;
     }
     
-    listen(server_sock, 1);
-    cout << "SERVER: Listening on port " << key_exchange_port << "..." << endl;
+    cout << "SERVER: Found existing Dilithium key for " << client_username << endl;
+    
+    // Verify the signed Kyber key from the first flight, then answer with
+    // ciphertext + server finished tag + session ticket in one flight
+    if (!verify_signed_kyber_key(*suite, kyber_pubkey, signature, client_dilithium_pubkey)) {
+        return false;
+    }
     
-    int client_sock = accept(server_sock, nullptr, nullptr);
-    if (client_sock < 0) {
-        cerr << "SERVER: Accept failed" << endl;
-        close(server_sock);
-        OQS_KEM_free(kem);
+    HandshakeMessage flight = {MSG_ENCRYPTED_SECRET_CONFIRMED, vector<uint8_t>(suite->kem_ciphertext_bytes)};
+    if (!suite->encapsulate(kyber_pubkey, flight.data.data(), shared_secret)) {
+        cerr << "SERVER: Encapsulation failed" << endl;
         return false;
     }
     
-    cout << "SERVER: Client connected!" << endl;
+    // Transcript: HELLO_1RTT || ciphertext
+    vector<uint8_t> server_tag = compute_finished_tag(shared_secret, SERVER_FINISHED_LABEL,
+                                                      {span(data), span(flight.data)});
+    expected_client_tag = compute_finished_tag(shared_secret, CLIENT_FINISHED_LABEL,
+                                               {span(data), span(flight.data)});
     
-    vector<uint8_t> all_messages;
-    uint8_t msg_type;
-    vector<uint8_t> msg_data;
+    flight.data.insert(flight.data.end(), server_tag.begin(), server_tag.end());
+    out.push_back(flight);
+    out.push_back(make_session_ticket_message(client_username, *suite, shared_secret));
     
-    // 1. Receive HELLO
-    if (!recv_message(client_sock, msg_type, msg_data) || msg_type != MSG_HELLO) {
-        cerr << "SERVER: Invalid HELLO message" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    state = STATE_AWAIT_1RTT_CLIENT_TAG;
+    return true;
+}
+
+// RESUME payload: [u8 suite id][u16 ticket length, network order][ticket]
+// [32-byte client nonce]. The suite is the one the client would otherwise
+// negotiate; a ticket from a session under any other suite is rejected, so a
+// resumption can never weaken the parameters of the session it continues.
+bool ServerHandshake::handle_resume(const vector<uint8_t>& data, vector<HandshakeMessage>& out) {
+    uint16_t ticket_len;
+    if (data.size() < 1 + sizeof(ticket_len)) {
+        cerr << "SERVER: Malformed RESUME message" << endl;
+        return false;
+    }
+    memcpy(&ticket_len, data.data() + 1, sizeof(ticket_len));
+    ticket_len = ntohs(ticket_len);
+    if (data.size() != 1 + sizeof(ticket_len) + ticket_len + 32) {
+        cerr << "SERVER: Malformed RESUME message" << endl;
+        return false;
+    }
+    
+    const uint8_t *ticket_start = data.data() + 1 + sizeof(ticket_len);
+    vector<uint8_t> ticket(ticket_start, ticket_start + ticket_len);
+    const uint8_t *client_nonce = ticket_start + ticket_len;
+    
+    uint8_t resumption_secret[32];
+    uint8_t ticket_suite;
+    bool opened = open_session_ticket(ticket, client_username, ticket_suite, resumption_secret);
+    if (opened && ticket_suite != data[0]) {
+        cerr << "SERVER: Session ticket rejected (issued under another suite)" << endl;
+        opened = false;
+    }
+    const PqSuiteInfo *resumed_suite = opened ? find_pq_suite(ticket_suite) : nullptr;
+    if (!resumed_suite) {
+        memset(resumption_secret, 0, sizeof(resumption_secret));
+        resume_allowed = false;
+        out.push_back({MSG_RESUME_REJECT, {}});
+        return true;
+    }
+    suite = resumed_suite;
+    cout << "SERVER: Resuming session for: " << client_username << endl;
+    
+    uint8_t server_nonce[32];
+    bool derived = random_bytes(server_nonce, sizeof(server_nonce)) &&
+                   derive_resumed_secret(resumption_secret, client_nonce, server_nonce, shared_secret);
+    memset(resumption_secret, 0, sizeof(resumption_secret));
+    if (!derived) {
+        cerr << "SERVER: Resumed key derivation failed" << endl;
         return false;
     }
     
-    string username(msg_data.begin(), msg_data.end());
-    client_username = username;
-    cout << "SERVER: Received HELLO from: " << username << endl;
-    all_messages.insert(all_messages.end(), msg_data.begin(), msg_data.end());
+    // Transcript: RESUME || server nonce
+    ByteSpan nonce = {server_nonce, sizeof(server_nonce)};
+    vector<uint8_t> server_tag = compute_finished_tag(shared_secret, RESUME_SERVER_FINISHED_LABEL,
+                                                      {span(data), nonce});
+    expected_client_tag = compute_finished_tag(shared_secret, RESUME_CLIENT_FINISHED_LABEL,
+                                               {span(data), nonce});
     
-    // 2. Check/request Dilithium key
-    vector<uint8_t> client_dilithium_pubkey;
-    bool has_dilithium_key = get_client_dilithium_key(username, client_dilithium_pubkey);
+    HandshakeMessage flight = {MSG_RESUME_ACCEPT, vector<uint8_t>(server_nonce, server_nonce + sizeof(server_nonce))};
+    flight.data.insert(flight.data.end(), server_tag.begin(), server_tag.end());
+    out.push_back(flight);
+    out.push_back(make_session_ticket_message(client_username, *suite, shared_secret));
     
-    if (!has_dilithium_key) {
+    state = STATE_AWAIT_RESUME_CLIENT_TAG;
+    return true;
+}
+
+// 2-3. Multi-step flow (also the enrollment fallback for 1-RTT HELLOs) after
+// the username has been received
+bool ServerHandshake::start_multi_step(vector<HandshakeMessage>& out) {
+    if (client_dilithium_pubkey.empty() &&
+        !get_client_dilithium_key(client_username, client_dilithium_pubkey)) {
         cout << "SERVER: No Dilithium key found, requesting from client..." << endl;
-        
-        vector<uint8_t> empty;
-        if (!send_message(client_sock, MSG_DILITHIUM_KEY_REQUEST, empty)) {
-            cerr << "SERVER: Failed to send Dilithium key request" << endl;
-            close(client_sock);
-            close(server_sock);
-            OQS_KEM_free(kem);
-            return false;
-        }
-        
-        if (!recv_message(client_sock, msg_type, msg_data) || msg_type != MSG_DILITHIUM_PUBLIC_KEY) {
-            cerr << "SERVER: Failed to receive Dilithium public key" << endl;
-            close(client_sock);
-            close(server_sock);
-            OQS_KEM_free(kem);
-            return false;
-        }
-        
-        client_dilithium_pubkey = msg_data;
-        all_messages.insert(all_messages.end(), msg_data.begin(), msg_data.end());
-        store_client_dilithium_key(username, client_dilithium_pubkey);
-        
-        cout << "SERVER: Received and stored Dilithium public key" << endl;
-    } else {
-        cout << "SERVER: Found existing Dilithium key for " << username << endl;
+        out.push_back({MSG_DILITHIUM_KEY_REQUEST, {}});
+        state = STATE_AWAIT_DILITHIUM_KEY;
+        return true;
+    }
+    if (!key_matches_suite(client_username, client_dilithium_pubkey, *suite)) {
+        return false;
     }
     
-    // 3. Request Kyber public key
+    cout << "SERVER: Found existing Dilithium key for " << client_username << endl;
     cout << "SERVER: Requesting Kyber public key..." << endl;
-    vector<uint8_t> empty;
-    if (!send_message(client_sock, MSG_KYBER_KEY_REQUEST, empty)) {
-        cerr << "SERVER: Failed to send Kyber key request" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    out.push_back({MSG_KYBER_KEY_REQUEST, {}});
+    state = STATE_AWAIT_SIGNED_KYBER;
+    return true;
+}
+
+bool ServerHandshake::handle_dilithium_key(const vector<uint8_t>& data, vector<HandshakeMessage>& out) {
+    if (data.size() != suite->sig_public_key_bytes) {
+        cerr << "SERVER: Invalid Dilithium public key size" << endl;
         return false;
     }
     
-    // 4. Receive signed Kyber public key
-    if (!recv_message(client_sock, msg_type, msg_data) || msg_type != MSG_KYBER_PUBLIC_KEY_SIGNED) {
-        cerr << "SERVER: Failed to receive signed Kyber public key" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    // Fails if another handshake enrolled the same username meanwhile
+    if (!store_client_dilithium_key(client_username, data)) {
+        cerr << "SERVER: Cannot enroll " << client_username << endl;
         return false;
     }
+    client_dilithium_pubkey = data;
+    dilithium_key_received = true;
     
-    if (msg_data.size() < kem->length_public_key) {
+    cout << "SERVER: Received and stored Dilithium public key" << endl;
+    cout << "SERVER: Requesting Kyber public key..." << endl;
+    out.push_back({MSG_KYBER_KEY_REQUEST, {}});
+    state = STATE_AWAIT_SIGNED_KYBER;
+    return true;
+}
+
+// 4-6. Verify the signed Kyber key and send the encapsulated secret
+bool ServerHandshake::handle_signed_kyber(const vector<uint8_t>& data, vector<HandshakeMessage>& out) {
+    if (data.size() != suite->kem_public_key_bytes + suite->sig_bytes) {
         cerr << "SERVER: Invalid Kyber public key size" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
         return false;
     }
     
-    vector<uint8_t> kyber_pubkey(msg_data.begin(), msg_data.begin() + kem->length_public_key);
-    vector<uint8_t> signature(msg_data.begin() + kem->length_public_key, msg_data.end());
+    const uint8_t *kyber_pubkey = data.data();
+    const uint8_t *signature = kyber_pubkey + suite->kem_public_key_bytes;
     
     cout << "SERVER: Received Kyber public key with signature" << endl;
-    all_messages.insert(all_messages.end(), msg_data.begin(), msg_data.end());
     
-    // 5. Verify signature
-    OQS_SIG *sig = OQS_SIG_new(OQS_SIG_alg_ml_dsa_65);
-    if (!sig) {
-        cerr << "SERVER: Failed to initialize ML-DSA-65" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    if (!verify_signed_kyber_key(*suite, kyber_pubkey, signature, client_dilithium_pubkey)) {
         return false;
     }
     
-    if (OQS_SIG_verify(sig, kyber_pubkey.data(), kyber_pubkey.size(), 
-                       signature.data(), signature.size(), 
-                       client_dilithium_pubkey.data()) != OQS_SUCCESS) {
-        cerr << "SERVER: Signature verification FAILED! Possible MITM attack!" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_SIG_free(sig);
-        OQS_KEM_free(kem);
+    HandshakeMessage reply = {MSG_ENCRYPTED_SECRET, vector<uint8_t>(suite->kem_ciphertext_bytes)};
+    if (!suite->encapsulate(kyber_pubkey, reply.data.data(), shared_secret)) {
+        cerr << "SERVER: Encapsulation failed" << endl;
         return false;
     }
     
-    cout << "SERVER: Signature verification SUCCESS!" << endl;
-    OQS_SIG_free(sig);
-    
-    // 6. Encapsulate shared secret
-    vector<uint8_t> ciphertext(kem->length_ciphertext);
-    uint8_t shared_secret[32];
+    // Both sides' HMAC covers username || [Dilithium key, if enrolled now] ||
+    // signed Kyber key || ciphertext
+    ByteSpan enrolled_key = {nullptr, 0};
+    if (dilithium_key_received) {
+        enrolled_key = span(client_dilithium_pubkey);
+    }
+    expected_client_tag = compute_hmac_sha512(shared_secret, 32, {span(client_username), enrolled_key,
+                                                                 span(data), span(reply.data)});
+    out.push_back(reply);
+    state = STATE_AWAIT_CLIENT_HMAC;
+    return true;
+}
+
+// 7-9. Check the client's HMAC, answer with ours plus a session ticket
+bool ServerHandshake::handle_client_hmac(const vector<uint8_t>& data, vector<HandshakeMessage>& out) {
+    if (!tags_equal(expected_client_tag, data)) {
+        cerr << "SERVER: HMAC verification FAILED!" << endl;
+        return false;
+    }
     
-    if (OQS_KEM_encaps(kem, ciphertext.data(), shared_secret, kyber_pubkey.data()) != OQS_SUCCESS) {
-        cerr << "SERVER: Encapsulation failed" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    cout << "SERVER: Client HMAC verification SUCCESS!" << endl;
+    out.push_back({MSG_HMAC_TAG, compute_finished_tag(shared_secret, MULTI_STEP_SERVER_FINISHED_LABEL,
+                                                      {span(expected_client_tag)})});
+    out.push_back(make_session_ticket_message(client_username, *suite, shared_secret));
+    state = STATE_AWAIT_VERIFY_SUCCESS;
+    return true;
+}
+
+bool ServerHandshake::finish() {
+    uint8_t srtp_key[46];
+    if (!derive_srtp_key(shared_secret, srtp_key)) {
+        cerr << "SERVER: SRTP key derivation failed!" << endl;
         return false;
     }
     
-    if (!send_message(client_sock, MSG_ENCRYPTED_SECRET, ciphertext)) {
-        cerr << "SERVER: Failed to send encrypted secret" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    session_srtp_key.assign(srtp_key, srtp_key + 46);
+    memset(srtp_key, 0, sizeof(srtp_key));
+    
+    session_control_secret.resize(CONTROL_SECRET_SIZE);
+    if (!derive_control_secret(shared_secret, session_control_secret.data())) {
+        cerr << "SERVER: Control channel key derivation failed!" << endl;
         return false;
     }
-    all_messages.insert(all_messages.end(), ciphertext.begin(), ciphertext.end());
+    state = STATE_COMPLETE;
+    return true;
+}
+
+// Server-side key exchange implementation. Runs the concurrent handshake
+// server so that a slow or stalled client cannot block other callers.
+bool server_perform_authenticated_key_exchange(int key_exchange_port, string& client_username,
+                                               ControlConnection* control, const atomic<bool>* cancelled) {
+    cout << "\n=== SERVER: Starting Authenticated Key Exchange ===\n" << endl;
     
-    // 7-10. HMAC verification
-    if (!recv_message(client_sock, msg_type, msg_data) || msg_type != MSG_HMAC_TAG) {
-        cerr << "SERVER: Failed to receive client HMAC" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    HandshakeServer server(key_exchange_port);
+    server.keep_completed_connections(control != nullptr);
+    if (!server.start()) {
         return false;
     }
     
-    vector<uint8_t> client_hmac = msg_data;
-    vector<uint8_t> shared_secret_vec(shared_secret, shared_secret + 32);
-    vector<uint8_t> server_hmac = compute_hmac_sha512(shared_secret_vec, all_messages);
+    CompletedHandshake result;
+    if (!cancelled) {
+        if (!server.wait_for_handshake(result)) {
+            return false;
+        }
+    } else {
+        while (!server.wait_for_handshake(result, KEY_EXCHANGE_CANCEL_POLL_MS)) {
+            if (*cancelled) {
+                cout << "SERVER: Key exchange cancelled" << endl;
+                return false;
+            }
+        }
+    }
+    server.stop();
     
-    if (server_hmac != client_hmac) {
-        cerr << "SERVER: HMAC verification FAILED!" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    client_username = result.username;
+    SRTP_KEY = result.srtp_key;
+    if (control) {
+        *control = move(result.control);
+    }
+    
+    cout << "SERVER: SRTP Key established" << endl;
+    cout << "\n=== SERVER: Key Exchange Complete ===\n" << endl;
+    return true;
+}
+
+// Multi-step flow from the first server response onwards. The signed Kyber
+// key is computed up front so it is ready when the server asks for it.
+static bool client_run_multi_step_exchange(HandshakeChannel& channel, const PqSuiteInfo& suite,
+                                           uint8_t msg_type, const string& username,
+                                           const DilithiumKeys& dilithium_keys,
+                                           const SignedKyberKey& ephemeral, uint8_t* shared_secret,
+                                           vector<uint8_t>& ticket_msg) {
+    vector<uint8_t> msg_data;
+    ByteSpan enrolled_key = {nullptr, 0};
+    
+    // 2. Check if server requests Dilithium key
+    if (msg_type == MSG_DILITHIUM_KEY_REQUEST) {
+        if (!channel.send(MSG_DILITHIUM_PUBLIC_KEY, dilithium_keys.public_key)) {
+            cerr << "CLIENT: Failed to send Dilithium public key" << endl;
+            return false;
+        }
+        enrolled_key = span(dilithium_keys.public_key);
+        
+        if (!channel.receive(msg_type, msg_data)) {
+            cerr << "CLIENT: Failed to receive Kyber key request" << endl;
+            return false;
+        }
+    }
+    
+    if (msg_type != MSG_KYBER_KEY_REQUEST) {
+        cerr << "CLIENT: Expected Kyber key request" << endl;
         return false;
     }
     
-    cout << "SERVER: Client HMAC verification SUCCESS!" << endl;
+    // 3-4. Send signed Kyber public key
+    if (!channel.send(MSG_KYBER_PUBLIC_KEY_SIGNED, {span(ephemeral.public_key), span(ephemeral.signature)})) {
+        cerr << "CLIENT: Failed to send signed Kyber public key" << endl;
+        return false;
+    }
     
-    if (!send_message(client_sock, MSG_HMAC_TAG, server_hmac)) {
-        cerr << "SERVER: Failed to send HMAC" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    // 5. Receive encrypted secret
+    if (!channel.receive(msg_type, msg_data) || msg_type != MSG_ENCRYPTED_SECRET) {
+        cerr << "CLIENT: Failed to receive encrypted secret" << endl;
         return false;
     }
     
-    if (!recv_message(client_sock, msg_type, msg_data) || msg_type != MSG_HMAC_VERIFY_SUCCESS) {
-        cerr << "SERVER: Client rejected our HMAC" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    // 6. Decapsulate
+    if (msg_data.size() != suite.kem_ciphertext_bytes ||
+        !suite.decapsulate(msg_data.data(), ephemeral.secret_key.data(), shared_secret)) {
+        cerr << "CLIENT: Decapsulation failed" << endl;
         return false;
     }
     
-    cout << "SERVER: Mutual HMAC verification complete!" << endl;
+    // 7-10. HMAC verification. Both sides MAC username || [Dilithium key] ||
+    // signed Kyber key || ciphertext, fed from the buffers they live in.
+    vector<uint8_t> client_hmac = compute_hmac_sha512(shared_secret, 32,
+                                                      {span(username), enrolled_key,
+                                                       span(ephemeral.public_key), span(ephemeral.signature),
+                                                       span(msg_data)});
     
-    // Derive SRTP key
-    uint8_t srtp_key[46];
-    if (!derive_srtp_key(shared_secret, srtp_key)) {
-        cerr << "SERVER: SRTP key derivation failed!" << endl;
-        close(client_sock);
-        close(server_sock);
-        OQS_KEM_free(kem);
+    if (!channel.send(MSG_HMAC_TAG, client_hmac)) {
+        cerr << "CLIENT: Failed to send HMAC" << endl;
         return false;
     }
     
-    SRTP_KEY.assign(srtp_key, srtp_key + 46);
+    if (!channel.receive(msg_type, msg_data) || msg_type != MSG_HMAC_TAG) {
+        cerr << "CLIENT: Failed to receive server HMAC" << endl;
+        return false;
+    }
     
-    cout << "SERVER: SRTP Key established" << endl;
+    if (!tags_equal(msg_data, compute_finished_tag(shared_secret, MULTI_STEP_SERVER_FINISHED_LABEL,
+                                                   {span(client_hmac)}))) {
+        cerr << "CLIENT: Server HMAC verification FAILED!" << endl;
+        return false;
+    }
     
-    close(client_sock);
-    close(server_sock);
-    OQS_KEM_free(kem);
+    cout << "CLIENT: Server HMAC verification SUCCESS!" << endl;
     
-    cout << "\n=== SERVER: Key Exchange Complete ===\n" << endl;
-    return true;
-}
-
-// Client-side key exchange implementation
-bool client_perform_authenticated_key_exchange(const char* server_ip, int key_exchange_port, 
-                                               const string& username) {
-    cout << "\n=== CLIENT: Starting Authenticated Key Exchange ===\n" << endl;
+    // The ticket travels in the same flight as the server's HMAC
+    if (!channel.receive(msg_type, ticket_msg) || msg_type != MSG_SESSION_TICKET) {
+        cerr << "CLIENT: Failed to receive session ticket" << endl;
+        return false;
+    }
     
-    DilithiumKeys dilithium_keys;
-    if (!load_or_generate_dilithium_keys(dilithium_keys)) {
+    vector<uint8_t> success_msg;
+    if (!channel.send(MSG_HMAC_VERIFY_SUCCESS, success_msg)) {
+        cerr << "CLIENT: Failed to send verification success" << endl;
         return false;
     }
     
-    OQS_KEM *kem = OQS_KEM_new(OQS_KEM_alg_kyber_768);
-    if (!kem) {
-        cerr << "Failed to initialize Kyber-768" << endl;
+    return true;
+}
+
+// 1-RTT flow: verify the server's flight and send our finished tag. Media can
+// start as soon as this returns; we do not wait for any further reply.
+static bool client_finish_1rtt_exchange(HandshakeChannel& channel, const PqSuiteInfo& suite,
+                                        const uint8_t* hello_prefix, const string& username,
+                                        const SignedKyberKey& ephemeral, const vector<uint8_t>& flight,
+                                        uint8_t* shared_secret, vector<uint8_t>& ticket_msg) {
+    if (flight.size() <= suite.kem_ciphertext_bytes) {
+        cerr << "CLIENT: Invalid 1-RTT server flight" << endl;
         return false;
     }
     
-    vector<uint8_t> kyber_public_key(kem->length_public_key);
-    vector<uint8_t> kyber_secret_key(kem->length_secret_key);
+    const uint8_t *ciphertext = flight.data();
+    vector<uint8_t> server_tag(flight.begin() + suite.kem_ciphertext_bytes, flight.end());
     
-    if (OQS_KEM_keypair(kem, kyber_public_key.data(), kyber_secret_key.data()) != OQS_SUCCESS) {
-        cerr << "CLIENT: Kyber keypair generation failed" << endl;
-        OQS_KEM_free(kem);
+    if (!suite.decapsulate(ciphertext, ephemeral.secret_key.data(), shared_secret)) {
+        cerr << "CLIENT: Decapsulation failed" << endl;
         return false;
     }
     
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(key_exchange_port);
-    inet_pton(AF_INET, server_ip, &addr.sin_addr);
+    // Transcript: HELLO_1RTT || ciphertext, in the pieces the HELLO was sent from
+    initializer_list<ByteSpan> transcript = {{hello_prefix, HELLO_1RTT_PREFIX_SIZE}, span(username),
+                                             span(ephemeral.public_key), span(ephemeral.signature),
+                                             {ciphertext, suite.kem_ciphertext_bytes}};
     
-    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        cerr << "CLIENT: Connection failed" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
+    if (!tags_equal(server_tag, compute_finished_tag(shared_secret, SERVER_FINISHED_LABEL, transcript))) {
+        cerr << "CLIENT: Server HMAC verification FAILED!" << endl;
         return false;
     }
     
-    cout << "CLIENT: Connected!" << endl;
+    cout << "CLIENT: Server HMAC verification SUCCESS!" << endl;
     
-    vector<uint8_t> all_messages;
+    vector<uint8_t> client_tag = compute_finished_tag(shared_secret, CLIENT_FINISHED_LABEL, transcript);
     
-    // 1. Send HELLO
-    vector<uint8_t> hello_data(username.begin(), username.end());
-    if (!send_message(sock, MSG_HELLO, hello_data)) {
-        cerr << "CLIENT: Failed to send HELLO" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
+    uint8_t msg_type;
+    if (!channel.receive(msg_type, ticket_msg) || msg_type != MSG_SESSION_TICKET) {
+        cerr << "CLIENT: Failed to receive session ticket" << endl;
         return false;
     }
-    all_messages.insert(all_messages.end(), hello_data.begin(), hello_data.end());
     
-    // 2. Check if server requests Dilithium key
+    if (!channel.send(MSG_HMAC_TAG, client_tag)) {
+        cerr << "CLIENT: Failed to send HMAC" << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+enum ResumeResult {
+    RESUME_ACCEPTED,
+    RESUME_REJECTED,
+    RESUME_FAILED
+};
+
+// Present a cached ticket. Only HKDF and HMAC run on this path.
+static ResumeResult client_try_resume(HandshakeChannel& channel, const ClientSessionTicket& ticket,
+                                      const PqSuiteInfo& suite, uint8_t* shared_secret,
+                                      vector<uint8_t>& ticket_msg) {
+    uint8_t client_nonce[32];
+    if (ticket.ticket.size() > UINT16_MAX || !random_bytes(client_nonce, sizeof(client_nonce))) {
+        return RESUME_FAILED;
+    }
+    
+    uint16_t ticket_len = htons((uint16_t)ticket.ticket.size());
+    ByteSpan resume_suite = {&suite.id, 1};
+    ByteSpan resume_len = {(const uint8_t*)&ticket_len, sizeof(ticket_len)};
+    ByteSpan resume_nonce = {client_nonce, sizeof(client_nonce)};
+    
     uint8_t msg_type;
     vector<uint8_t> msg_data;
-    
-    if (!recv_message(sock, msg_type, msg_data)) {
-        cerr << "CLIENT: Failed to receive response" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
-        return false;
+    if (!channel.send(MSG_RESUME, {resume_suite, resume_len, span(ticket.ticket), resume_nonce}) ||
+        !channel.receive(msg_type, msg_data)) {
+        cerr << "CLIENT: Resumption attempt failed" << endl;
+        return RESUME_FAILED;
     }
     
-    if (msg_type == MSG_DILITHIUM_KEY_REQUEST) {
-        if (!send_message(sock, MSG_DILITHIUM_PUBLIC_KEY, dilithium_keys.public_key)) {
-            cerr << "CLIENT: Failed to send Dilithium public key" << endl;
-            close(sock);
-            OQS_KEM_free(kem);
-            return false;
-        }
-        all_messages.insert(all_messages.end(), dilithium_keys.public_key.begin(), 
-                           dilithium_keys.public_key.end());
-        
-        if (!recv_message(sock, msg_type, msg_data)) {
-            cerr << "CLIENT: Failed to receive Kyber key request" << endl;
-            close(sock);
-            OQS_KEM_free(kem);
-            return false;
-        }
+    if (msg_type == MSG_RESUME_REJECT) {
+        cout << "CLIENT: Session ticket rejected, performing full key exchange" << endl;
+        return RESUME_REJECTED;
     }
     
-    if (msg_type != MSG_KYBER_KEY_REQUEST) {
-        cerr << "CLIENT: Expected Kyber key request" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
-        return false;
+    if (msg_type != MSG_RESUME_ACCEPT || msg_data.size() <= 32) {
+        cerr << "CLIENT: Invalid resumption response" << endl;
+        return RESUME_FAILED;
     }
     
-    // 3. Sign Kyber public key
-    OQS_SIG *sig = OQS_SIG_new(OQS_SIG_alg_ml_dsa_65);
-    if (!sig) {
-        cerr << "CLIENT: Failed to initialize ML-DSA-65 for signing" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
-        return false;
+    const uint8_t *server_nonce = msg_data.data();
+    vector<uint8_t> server_tag(msg_data.begin() + 32, msg_data.end());
+    if (!derive_resumed_secret(ticket.resumption_secret.data(), client_nonce, server_nonce, shared_secret)) {
+        return RESUME_FAILED;
     }
     
-    vector<uint8_t> signature(sig->length_signature);
-    size_t sig_len;
+    // Transcript: RESUME || server nonce
+    initializer_list<ByteSpan> transcript = {resume_suite, resume_len, span(ticket.ticket), resume_nonce,
+                                             {server_nonce, 32}};
     
-    if (OQS_SIG_sign(sig, signature.data(), &sig_len, kyber_public_key.data(), 
-                     kyber_public_key.size(), dilithium_keys.secret_key.data()) != OQS_SUCCESS) {
-        cerr << "CLIENT: Signing failed" << endl;
-        close(sock);
-        OQS_SIG_free(sig);
-        OQS_KEM_free(kem);
-        return false;
+    if (!tags_equal(server_tag, compute_finished_tag(shared_secret, RESUME_SERVER_FINISHED_LABEL, transcript))) {
+        cerr << "CLIENT: Server HMAC verification FAILED!" << endl;
+        return RESUME_FAILED;
     }
     
-    signature.resize(sig_len);
-    OQS_SIG_free(sig);
+    if (!channel.receive(msg_type, ticket_msg) || msg_type != MSG_SESSION_TICKET) {
+        cerr << "CLIENT: Failed to receive session ticket" << endl;
+        return RESUME_FAILED;
+    }
     
-    // 4. Send signed Kyber public key
-    vector<uint8_t> signed_data;
-    signed_data.insert(signed_data.end(), kyber_public_key.begin(), kyber_public_key.end());
-    signed_data.insert(signed_data.end(), signature.begin(), signature.end());
+    vector<uint8_t> client_tag = compute_finished_tag(shared_secret, RESUME_CLIENT_FINISHED_LABEL, transcript);
+    if (!channel.send(MSG_HMAC_TAG, client_tag)) {
+        cerr << "CLIENT: Failed to send HMAC" << endl;
+        return RESUME_FAILED;
+    }
     
-    if (!send_message(sock, MSG_KYBER_PUBLIC_KEY_SIGNED, signed_data)) {
-        cerr << "CLIENT: Failed to send signed Kyber public key" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
+    cout << "CLIENT: Session resumed" << endl;
+    return RESUME_ACCEPTED;
+}
+
+bool generate_signed_kyber_key(const DilithiumKeys& identity, SignedKyberKey& key,
+                               const PqSuiteInfo& suite) {
+    if (identity.secret_key.size() != suite.sig_secret_key_bytes) {
+        cerr << "CLIENT: Identity key does not match " << suite.sig_name << endl;
         return false;
     }
-    all_messages.insert(all_messages.end(), signed_data.begin(), signed_data.end());
     
-    // 5. Receive encrypted secret
-    if (!recv_message(sock, msg_type, msg_data) || msg_type != MSG_ENCRYPTED_SECRET) {
-        cerr << "CLIENT: Failed to receive encrypted secret" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
+    key.public_key.resize(suite.kem_public_key_bytes);
+    key.secret_key.resize(suite.kem_secret_key_bytes);
+    key.signature.resize(suite.sig_bytes);
+    
+    if (!suite.generate_signed_key(identity.secret_key.data(), key.public_key.data(),
+                                   key.secret_key.data(), key.signature.data())) {
+        cerr << "CLIENT: Kyber keypair generation or signing failed" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Full (1-RTT or multi-step) exchange over an already connected socket, using
+// a Kyber key that was generated and signed before connecting
+static bool client_run_full_exchange(HandshakeChannel& channel, const string& username,
+                                     const DilithiumKeys& dilithium_keys, const SignedKyberKey& ephemeral,
+                                     const PqSuiteInfo& suite, HandshakeMode mode,
+                                     uint8_t* shared_secret, vector<uint8_t>& ticket_msg) {
+    // The multi-step HELLO cannot name a suite
+    if (mode == HANDSHAKE_MODE_LEGACY && suite.id != PQ_SUITE_DEFAULT) {
+        cerr << "CLIENT: Legacy mode only supports " << pq_suite_name(default_pq_suite()) << endl;
+        return false;
+    }
+    if (username.empty() || username.size() > UINT16_MAX) {
+        cerr << "CLIENT: Invalid username" << endl;
         return false;
     }
     
-    vector<uint8_t> ciphertext = msg_data;
-    all_messages.insert(all_messages.end(), ciphertext.begin(), ciphertext.end());
+    // 1. Send HELLO
+    uint8_t hello_prefix[HELLO_1RTT_PREFIX_SIZE];
+    bool sent;
+    if (mode == HANDSHAKE_MODE_1RTT) {
+        build_hello_1rtt_prefix(suite, username, hello_prefix);
+        sent = channel.send(MSG_HELLO_1RTT, {{hello_prefix, sizeof(hello_prefix)}, span(username),
+                                             span(ephemeral.public_key), span(ephemeral.signature)});
+    } else {
+        sent = channel.send(MSG_HELLO, {span(username)});
+    }
     
-    // 6. Decapsulate
-    uint8_t shared_secret[32];
-    if (OQS_KEM_decaps(kem, shared_secret, ciphertext.data(), kyber_secret_key.data()) != OQS_SUCCESS) {
-        cerr << "CLIENT: Decapsulation failed" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
-        return false;
+    uint8_t msg_type;
+    vector<uint8_t> msg_data;
+    bool ok = false;
+    
+    if (!sent) {
+        cerr << "CLIENT: Failed to send HELLO" << endl;
+    } else if (!channel.receive(msg_type, msg_data)) {
+        cerr << "CLIENT: Failed to receive response" << endl;
+    } else if (mode == HANDSHAKE_MODE_1RTT && msg_type == MSG_ENCRYPTED_SECRET_CONFIRMED) {
+        ok = client_finish_1rtt_exchange(channel, suite, hello_prefix, username, ephemeral, msg_data,
+                                         shared_secret, ticket_msg);
+    } else {
+        if (mode == HANDSHAKE_MODE_1RTT) {
+            cout << "CLIENT: Server requested enrollment, continuing with multi-step exchange" << endl;
+        }
+        ok = client_run_multi_step_exchange(channel, suite, msg_type, username, dilithium_keys, ephemeral,
+                                            shared_secret, ticket_msg);
     }
     
-    // 7-10. HMAC verification
-    vector<uint8_t> shared_secret_vec(shared_secret, shared_secret + 32);
-    vector<uint8_t> client_hmac = compute_hmac_sha512(shared_secret_vec, all_messages);
+    return ok;
+}
+
+// With timeout_seconds > 0, connect() and every later send / receive on the
+// socket fail after that long instead of blocking forever
+static int connect_to_server(const char* server_ip, int key_exchange_port, int timeout_seconds = 0) {
+    PhaseTimer timer(PHASE_CONNECT);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (timeout_seconds > 0) {
+        struct timeval timeout = {timeout_seconds, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(key_exchange_port);
+    inet_pton(AF_INET, server_ip, &addr.sin_addr);
     
-    if (!send_message(sock, MSG_HMAC_TAG, client_hmac)) {
-        cerr << "CLIENT: Failed to send HMAC" << endl;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        cerr << "CLIENT: Connection failed" << endl;
         close(sock);
-        OQS_KEM_free(kem);
+        return -1;
+    }
+    enable_tcp_nodelay(sock);
+    
+    cout << "CLIENT: Connected!" << endl;
+    return sock;
+}
+
+static bool derive_client_srtp_key(const uint8_t* shared_secret, vector<uint8_t>& srtp_key) {
+    uint8_t key[46];
+    if (!derive_srtp_key(shared_secret, key)) {
+        cerr << "CLIENT: SRTP key derivation failed!" << endl;
         return false;
     }
     
-    if (!recv_message(sock, msg_type, msg_data) || msg_type != MSG_HMAC_TAG) {
-        cerr << "CLIENT: Failed to receive server HMAC" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
+    srtp_key.assign(key, key + 46);
+    memset(key, 0, sizeof(key));
+    return true;
+}
+
+bool client_perform_key_exchange_with_keys(const char* server_ip, int key_exchange_port,
+                                           const string& username, const DilithiumKeys& dilithium_keys,
+                                           HandshakeMode mode, vector<uint8_t>& srtp_key,
+                                           const PqSuiteInfo& suite) {
+    int sock = connect_to_server(server_ip, key_exchange_port, CLIENT_EXCHANGE_TIMEOUT_SECONDS);
+    if (sock < 0) {
         return false;
     }
     
-    vector<uint8_t> server_hmac = msg_data;
-    vector<uint8_t> expected_server_hmac = compute_hmac_sha512(shared_secret_vec, all_messages);
+    HandshakeChannel channel(sock);
+    uint8_t shared_secret[32];
+    vector<uint8_t> ticket_msg;
+    SignedKyberKey ephemeral;
+    bool ok = generate_signed_kyber_key(dilithium_keys, ephemeral, suite) &&
+              client_run_full_exchange(channel, username, dilithium_keys, ephemeral, suite, mode,
+                                       shared_secret, ticket_msg);
+    close(sock);
     
-    if (server_hmac != expected_server_hmac) {
-        cerr << "CLIENT: Server HMAC verification FAILED!" << endl;
-        close(sock);
-        OQS_KEM_free(kem);
+    return ok && derive_client_srtp_key(shared_secret, srtp_key);
+}
+
+// Client-side key exchange implementation
+bool client_perform_authenticated_key_exchange(const char* server_ip, int key_exchange_port, 
+                                               const string& username, HandshakeMode mode,
+                                               const PqSuiteInfo& suite, ControlConnection* control) {
+    cout << "\n=== CLIENT: Starting Authenticated Key Exchange ===\n" << endl;
+    
+    ClientSessionTicket ticket;
+    bool have_ticket = load_client_session_ticket(server_ip, username, ticket);
+    
+    int sock = connect_to_server(server_ip, key_exchange_port);
+    if (sock < 0) {
         return false;
     }
     
-    cout << "CLIENT: Server HMAC verification SUCCESS!" << endl;
+    HandshakeChannel channel(sock);
+    uint8_t shared_secret[32];
+    vector<uint8_t> ticket_msg;
+    bool ok;
+    
+    ResumeResult resumed = RESUME_REJECTED;
+    if (have_ticket) {
+        resumed = client_try_resume(channel, ticket, suite, shared_secret, ticket_msg);
+        // Tickets are single-use; a new one arrives with every exchange
+        discard_client_session_ticket();
+    }
+    
+    if (resumed == RESUME_REJECTED) {
+        // Prefer precomputed keys; without a pool everything is done inline
+        EphemeralKeyPool *pool = client_key_pool();
+        SignedKyberKey ephemeral;
+        if (pool && pool->suite().id == suite.id) {
+            ok = pool->take(ephemeral) &&
+                 client_run_full_exchange(channel, username, pool->identity(), ephemeral, suite, mode,
+                                          shared_secret, ticket_msg);
+        } else {
+            DilithiumKeys dilithium_keys;
+            ok = load_or_generate_dilithium_keys(dilithium_keys, suite) &&
+                 generate_signed_kyber_key(dilithium_keys, ephemeral, suite) &&
+                 client_run_full_exchange(channel, username, dilithium_keys, ephemeral, suite, mode,
+                                          shared_secret, ticket_msg);
+        }
+        memset(ephemeral.secret_key.data(), 0, ephemeral.secret_key.size());
+    } else {
+        ok = resumed == RESUME_ACCEPTED;
+    }
     
-    vector<uint8_t> success_msg;
-    if (!send_message(sock, MSG_HMAC_VERIFY_SUCCESS, success_msg)) {
-        cerr << "CLIENT: Failed to send verification success" << endl;
+    uint8_t control_secret[CONTROL_SECRET_SIZE];
+    if (!ok || !derive_client_srtp_key(shared_secret, SRTP_KEY) ||
+        (control && !derive_control_secret(shared_secret, control_secret))) {
         close(sock);
-        OQS_KEM_free(kem);
         return false;
     }
     
-    // Derive SRTP key
-    uint8_t srtp_key[46];
-    if (!derive_srtp_key(shared_secret, srtp_key)) {
-        cerr << "CLIENT: SRTP key derivation failed!" << endl;
+    if (control) {
+        control->fd = sock;
+        control->secret.assign(control_secret, control_secret + CONTROL_SECRET_SIZE);
+        channel.take_unread(control->unread);
+        memset(control_secret, 0, sizeof(control_secret));
+    } else {
         close(sock);
-        OQS_KEM_free(kem);
-        return false;
     }
     
-    SRTP_KEY.assign(srtp_key, srtp_key + 46);
+    save_session_ticket(server_ip, username, ticket_msg, shared_secret);
     
     cout << "CLIENT: SRTP Key established" << endl;
-    
-    close(sock);
-    OQS_KEM_free(kem);
-    
     cout << "\n=== CLIENT: Key Exchange Complete ===\n" << endl;
     return true;
 }
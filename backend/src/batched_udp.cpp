@@ -0,0 +1,355 @@
+#include "batched_udp.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+using namespace std;
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define UDP_POLL_TIMEOUT_MS 100
+
+int open_udp_socket(int port, int buffer_size) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (buffer_size > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        cerr << "Cannot bind UDP port " << port << ": " << strerror(errno) << endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int send_all(int fd, struct mmsghdr *messages, int count, uint64_t *syscalls) {
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(fd, messages + sent, count - sent, 0);
+        if (syscalls) {
+            (*syscalls)++;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+BatchedUdpReceiver::BatchedUdpReceiver(int fd, GstElement *appsrc, const string& caps, bool gro)
+    : fd(fd), appsrc(GST_ELEMENT(gst_object_ref(appsrc))), gro(gro), running(false), packet_count(0),
+      syscall_count(0), drop_count(0) {
+    int one = 1;
+    if (gro && setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+        this->gro = false;
+    }
+    batch_size = this->gro ? UDP_GRO_BATCH_SIZE : UDP_BATCH_SIZE;
+    slot_size = this->gro ? UDP_GRO_MAX_READ : UDP_MAX_DATAGRAM;
+    for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+        slots[i] = NULL;
+    }
+
+    // Buffers are stamped here with the pipeline's running time on arrival,
+    // each one; appsrc would only stamp the first of a list
+    GstCaps *appsrc_caps = gst_caps_from_string(caps.c_str());
+    g_object_set(appsrc, "caps", appsrc_caps, "is-live", TRUE, "do-timestamp", FALSE, NULL);
+    gst_caps_unref(appsrc_caps);
+    gst_util_set_object_arg(G_OBJECT(appsrc), "format", "time");
+}
+
+BatchedUdpReceiver::~BatchedUdpReceiver() {
+    stop();
+    for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+        if (slots[i]) {
+            gst_buffer_unmap(slots[i], &maps[i]);
+            gst_buffer_unref(slots[i]);
+        }
+    }
+    close(fd);
+    gst_object_unref(appsrc);
+}
+
+bool BatchedUdpReceiver::start() {
+    running = true;
+    receive_thread = thread(&BatchedUdpReceiver::run, this);
+    return true;
+}
+
+void BatchedUdpReceiver::stop() {
+    running = false;
+    if (receive_thread.joinable()) {
+        receive_thread.join();
+    }
+}
+
+UdpIoStats BatchedUdpReceiver::stats() const {
+    UdpIoStats stats;
+    stats.packets = packet_count;
+    stats.syscalls = syscall_count;
+    stats.dropped = drop_count;
+    return stats;
+}
+
+bool BatchedUdpReceiver::refill(int slot) {
+    slots[slot] = gst_buffer_new_allocate(NULL, slot_size, NULL);
+    if (!gst_buffer_map(slots[slot], &maps[slot], GST_MAP_WRITE)) {
+        gst_buffer_unref(slots[slot]);
+        slots[slot] = NULL;
+        return false;
+    }
+    return true;
+}
+
+// A GRO read holds several datagrams of segment_size bytes, the last one
+// possibly shorter; each becomes a buffer sharing the read's memory
+int BatchedUdpReceiver::split(GstBufferList *list, GstBuffer *buffer, int length, int segment_size) {
+    if (segment_size <= 0 || length <= segment_size) {
+        gst_buffer_resize(buffer, 0, length);
+        gst_buffer_list_add(list, buffer);
+        return 1;
+    }
+    int count = 0;
+    for (int offset = 0; offset < length; offset += segment_size) {
+        gst_buffer_list_add(list, gst_buffer_copy_region(buffer, GST_BUFFER_COPY_MEMORY, offset,
+                                                         min(segment_size, length - offset)));
+        count++;
+    }
+    gst_buffer_unref(buffer);
+    return count;
+}
+
+void BatchedUdpReceiver::run() {
+    struct mmsghdr messages[UDP_BATCH_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+    // Room for the GRO segment size of each message
+    char control[UDP_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while (running) {
+        if (poll(&pfd, 1, UDP_POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+
+        int ready = 0;
+        for (; ready < batch_size; ready++) {
+            if (!slots[ready] && !refill(ready)) {
+                break;
+            }
+            iovecs[ready].iov_base = maps[ready].data;
+            iovecs[ready].iov_len = maps[ready].size;
+            memset(&messages[ready], 0, sizeof(messages[ready]));
+            messages[ready].msg_hdr.msg_iov = &iovecs[ready];
+            messages[ready].msg_hdr.msg_iovlen = 1;
+            if (gro) {
+                messages[ready].msg_hdr.msg_control = control[ready];
+                messages[ready].msg_hdr.msg_controllen = sizeof(control[ready]);
+            }
+        }
+        int n = ready > 0 ? recvmmsg(fd, messages, ready, MSG_DONTWAIT, NULL) : -1;
+        syscall_count++;
+        if (n <= 0) {
+            continue;
+        }
+
+        // Nothing is pushed before the pipeline has a clock, i.e. before PLAYING
+        GstClock *clock = gst_element_get_clock(appsrc);
+        GstClockTime now = GST_CLOCK_TIME_NONE;
+        if (clock) {
+            now = gst_clock_get_time(clock) - gst_element_get_base_time(appsrc);
+            gst_object_unref(clock);
+        }
+
+        GstBufferList *list = gst_buffer_list_new_sized(n);
+        int packets = 0;
+        for (int i = 0; i < n; i++) {
+            int segment_size = 0;
+            struct msghdr *header = &messages[i].msg_hdr;
+            for (struct cmsghdr *cmsg = gro ? CMSG_FIRSTHDR(header) : NULL; cmsg; cmsg = CMSG_NXTHDR(header, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+                }
+            }
+            GstBuffer *buffer = slots[i];
+            gst_buffer_unmap(buffer, &maps[i]);
+            slots[i] = NULL;
+            packets += split(list, buffer, messages[i].msg_len, segment_size);
+        }
+        for (guint i = 0; i < gst_buffer_list_length(list); i++) {
+            GstBuffer *buffer = gst_buffer_list_get(list, i);
+            GST_BUFFER_PTS(buffer) = now;
+            GST_BUFFER_DTS(buffer) = now;
+        }
+        packet_count += packets;
+
+        GstFlowReturn ret = GST_FLOW_FLUSHING;
+        if (clock) {
+            // The action signal does not take the list
+            g_signal_emit_by_name(appsrc, "push-buffer-list", list, &ret);
+        }
+        if (ret != GST_FLOW_OK) {
+            drop_count += packets;
+        }
+        gst_buffer_list_unref(list);
+    }
+}
+
+BatchedUdpSender::BatchedUdpSender(int fd, bool owns_fd, const string& host, int port, bool gso)
+    : fd(fd), owns_fd(owns_fd), gso(gso), packet_count(0), syscall_count(0), drop_count(0) {
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &peer.sin_addr);
+}
+
+BatchedUdpSender::~BatchedUdpSender() {
+    if (owns_fd) {
+        close(fd);
+    }
+}
+
+bool BatchedUdpSender::attach(GstElement *appsink) {
+    g_object_set(appsink, "emit-signals", TRUE, "buffer-list", TRUE, "sync", FALSE, "async", FALSE, NULL);
+    g_signal_connect(appsink, "new-sample", G_CALLBACK(on_new_sample), this);
+    return true;
+}
+
+UdpIoStats BatchedUdpSender::stats() const {
+    UdpIoStats stats;
+    stats.packets = packet_count;
+    stats.syscalls = syscall_count;
+    stats.dropped = drop_count;
+    return stats;
+}
+
+GstFlowReturn BatchedUdpSender::on_new_sample(GstElement *appsink, gpointer user_data) {
+    BatchedUdpSender *sender = (BatchedUdpSender*)user_data;
+    GstSample *sample = NULL;
+    g_signal_emit_by_name(appsink, "pull-sample", &sample);
+    if (!sample) {
+        return GST_FLOW_ERROR;
+    }
+
+    GstBufferList *list = gst_sample_get_buffer_list(sample);
+    if (list) {
+        GstBuffer *buffers[UDP_BATCH_SIZE];
+        guint length = gst_buffer_list_length(list);
+        for (guint i = 0; i < length; i += UDP_BATCH_SIZE) {
+            guint count = min<guint>(UDP_BATCH_SIZE, length - i);
+            for (guint j = 0; j < count; j++) {
+                buffers[j] = gst_buffer_list_get(list, i + j);
+            }
+            sender->send_buffers(buffers, count);
+        }
+    } else {
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        if (buffer) {
+            sender->send_buffers(&buffer, 1);
+        }
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void BatchedUdpSender::send_buffers(GstBuffer **buffers, guint count) {
+    GstMapInfo maps[UDP_BATCH_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+    struct mmsghdr messages[UDP_BATCH_SIZE];
+    guint segments[UDP_BATCH_SIZE];
+    char control[UDP_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+
+    guint mapped = 0;
+    for (; mapped < count; mapped++) {
+        if (!gst_buffer_map(buffers[mapped], &maps[mapped], GST_MAP_READ)) {
+            break;
+        }
+        iovecs[mapped].iov_base = maps[mapped].data;
+        iovecs[mapped].iov_len = maps[mapped].size;
+    }
+
+    guint first = 0;
+    while (first < mapped) {
+        // One message per packet, or with GSO one per run of equal sizes
+        int message_count = 0;
+        for (guint i = first; i < mapped;) {
+            guint run = 1;
+            size_t bytes = iovecs[i].iov_len;
+            while (gso && i + run < mapped && run < UDP_GSO_MAX_SEGMENTS &&
+                   iovecs[i + run].iov_len <= iovecs[i].iov_len &&
+                   bytes + iovecs[i + run].iov_len <= UDP_GSO_MAX_BYTES) {
+                bytes += iovecs[i + run].iov_len;
+                run++;
+                // A shorter packet can only end the run
+                if (iovecs[i + run - 1].iov_len < iovecs[i].iov_len) {
+                    break;
+                }
+            }
+
+            struct msghdr *header = &messages[message_count].msg_hdr;
+            memset(&messages[message_count], 0, sizeof(messages[message_count]));
+            header->msg_name = &peer;
+            header->msg_namelen = sizeof(peer);
+            header->msg_iov = &iovecs[i];
+            header->msg_iovlen = run;
+            if (run > 1) {
+                header->msg_control = control[message_count];
+                header->msg_controllen = sizeof(control[message_count]);
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(header);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment_size = iovecs[i].iov_len;
+                memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            }
+            segments[message_count++] = run;
+            i += run;
+        }
+
+        uint64_t calls = 0;
+        int sent = send_all(fd, messages, message_count, &calls);
+        syscall_count += calls;
+        guint packets = 0;
+        for (int i = 0; i < sent; i++) {
+            packets += segments[i];
+        }
+        packet_count += packets;
+        first += packets;
+
+        if (sent < message_count && gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+            // No GSO on this route or kernel: send the rest one by one
+            cerr << "UDP GSO unavailable, sending without it" << endl;
+            gso = false;
+            continue;
+        }
+        break;
+    }
+
+    for (guint i = 0; i < mapped; i++) {
+        gst_buffer_unmap(buffers[i], &maps[i]);
+    }
+    drop_count += count - first;
+}
@@ -0,0 +1,192 @@
+#include "bitrate_controller.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+#define VIDEO_SESSION 0
+
+BitrateController::BitrateController(MediaPipeline& media, const MediaProfile& profile)
+    : media(media), min_video_kbps(profile.min_video_bitrate), max_video_kbps(profile.max_video_bitrate),
+      max_audio_bps(profile.audio_bitrate), hold(0), fec_allowed(profile.fec), fec_enabled(false), fec_percent(0),
+      fec_loss(0), last_highest_seq(0), last_round_trip(0),
+      report_count(0), last(), poll_source(NULL) {
+    int start_kbps = min(max(profile.video_bitrate, min_video_kbps), max_video_kbps);
+    target_kbps = start_kbps + max_audio_bps / 1000.0;
+    video_kbps = start_kbps;
+    audio_bps = max_audio_bps;
+}
+
+BitrateController::~BitrateController() {
+    stop();
+}
+
+void BitrateController::start(GMainContext *context) {
+    if (poll_source) {
+        return;
+    }
+    apply(true);
+    poll_source = g_timeout_source_new(RATE_POLL_INTERVAL_MS);
+    g_source_set_callback(poll_source, on_poll, this, NULL);
+    g_source_attach(poll_source, context);
+}
+
+void BitrateController::stop() {
+    if (poll_source) {
+        g_source_destroy(poll_source);
+        g_source_unref(poll_source);
+        poll_source = NULL;
+    }
+}
+
+void BitrateController::enable_fec() {
+    if (!fec_allowed || fec_enabled) {
+        return;
+    }
+    fec_enabled = true;
+    apply(true);
+}
+
+gboolean BitrateController::on_poll(gpointer user_data) {
+    BitrateController *controller = (BitrateController*)user_data;
+    ReceiverReport report;
+    if (controller->read_report(report)) {
+        controller->on_report(report);
+    }
+    return TRUE;
+}
+
+// The report block the peer sent on our video SSRC, if one arrived since the
+// last poll
+bool BitrateController::read_report(ReceiverReport& report) {
+    GObject *session = NULL;
+    g_signal_emit_by_name(media.rtpbin_send, "get-internal-session", (guint)VIDEO_SESSION, &session);
+    if (!session) {
+        return false;
+    }
+    GstStructure *stats = NULL;
+    g_object_get(session, "stats", &stats, NULL);
+    g_object_unref(session);
+    if (!stats) {
+        return false;
+    }
+
+    bool found = false;
+    const GValue *sources = gst_structure_get_value(stats, "source-stats");
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    GValueArray *array = sources ? (GValueArray*)g_value_get_boxed(sources) : NULL;
+    for (guint i = 0; array && i < array->n_values && !found; i++) {
+        const GstStructure *source = gst_value_get_structure(g_value_array_get_nth(array, i));
+        gboolean internal = FALSE;
+        gboolean have_rb = FALSE;
+        gst_structure_get_boolean(source, "internal", &internal);
+        gst_structure_get_boolean(source, "have-rb", &have_rb);
+        if (!internal || !have_rb) {
+            continue;
+        }
+
+        // With BUNDLE our audio stream is in the same session
+        gint clock_rate = 0;
+        gst_structure_get_int(source, "clock-rate", &clock_rate);
+        if (clock_rate > 0 && clock_rate != VIDEO_CLOCK_RATE) {
+            continue;
+        }
+
+        guint fraction_lost = 0, jitter = 0, round_trip = 0, highest_seq = 0;
+        gst_structure_get_uint(source, "rb-fractionlost", &fraction_lost);
+        gst_structure_get_uint(source, "rb-jitter", &jitter);
+        gst_structure_get_uint(source, "rb-round-trip", &round_trip);
+        gst_structure_get_uint(source, "rb-exthighestseq", &highest_seq);
+        if (highest_seq == last_highest_seq && round_trip == last_round_trip) {
+            break;
+        }
+        last_highest_seq = highest_seq;
+        last_round_trip = round_trip;
+
+        // Fraction lost is out of 256, round trip in 1/65536 s, jitter in
+        // RTP timestamp units
+        report.fraction_lost = fraction_lost / 256.0;
+        report.rtt_ms = round_trip * 1000.0 / 65536.0;
+        report.jitter_ms = clock_rate > 0 ? jitter * 1000.0 / clock_rate : 0;
+        found = true;
+    }
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    gst_structure_free(stats);
+    return found;
+}
+
+void BitrateController::on_report(const ReceiverReport& report) {
+    report_count++;
+    last = report;
+
+    double queue_delay = 0;
+    if (report.rtt_ms > 0) {
+        rtts.push_back(report.rtt_ms);
+        if (rtts.size() > RATE_MIN_RTT_REPORTS) {
+            rtts.pop_front();
+        }
+        queue_delay = report.rtt_ms - *min_element(rtts.begin(), rtts.end());
+    }
+
+    if (hold > 0) {
+        // The last cut has not shown up in this report yet
+        hold--;
+    } else if (report.fraction_lost > RATE_HIGH_LOSS) {
+        // Down to what got through
+        target_kbps *= 1.0 - report.fraction_lost;
+        hold = 1;
+    } else if (queue_delay > RATE_QUEUE_DELAY_MS) {
+        target_kbps *= RATE_DELAY_DECREASE;
+        hold = 1;
+    } else if (report.fraction_lost < RATE_LOW_LOSS) {
+        target_kbps *= RATE_INCREASE;
+    }
+
+    fec_loss = max(report.fraction_lost, fec_loss * FEC_LOSS_DECAY);
+
+    double min_total = min_video_kbps + min(MIN_AUDIO_BITRATE, max_audio_bps) / 1000.0;
+    double max_total = max_video_kbps + max_audio_bps / 1000.0;
+    target_kbps = min(max(target_kbps, min_total), max_total);
+    apply(false);
+}
+
+void BitrateController::apply(bool force) {
+    double audio_kbps = max_audio_bps / 1000.0;
+    int video = (int)min(max(target_kbps - audio_kbps, (double)min_video_kbps), (double)max_video_kbps);
+    int audio = (int)(min(max(target_kbps - min_video_kbps, MIN_AUDIO_BITRATE / 1000.0), audio_kbps) * 1000);
+    audio = min(audio, max_audio_bps);
+
+    int fec = 0;
+    if (fec_enabled) {
+        fec = (int)ceil(FEC_PROTECTION_FACTOR * fec_loss * 100);
+        fec = min(max(fec, FEC_MIN_PERCENTAGE), FEC_MAX_PERCENTAGE);
+    }
+
+    bool video_changed = fabs(video - video_kbps) > RATE_MIN_CHANGE * video_kbps;
+    bool audio_changed = fabs(audio - audio_bps) > RATE_MIN_CHANGE * audio_bps;
+    bool fec_changed = fec != fec_percent;
+    if (!force && !video_changed && !audio_changed && !fec_changed) {
+        return;
+    }
+    if (fec_allowed && (force || fec_changed)) {
+        fec_percent = fec;
+        set_video_fec(media, fec_percent);
+        // Opus sizes its in-band FEC to the expected loss itself
+        set_audio_fec(media, fec_enabled ? max(1, (int)ceil(fec_loss * 100)) : 0);
+    }
+    if (force || video_changed || fec_changed) {
+        // FEC packets are about the size of the media packets they protect
+        video_kbps = video;
+        set_video_bitrate(media, video_kbps * 100 / (100 + fec_percent));
+    }
+    if (force || audio_changed) {
+        audio_bps = audio;
+        set_audio_bitrate(media, audio_bps);
+    }
+    cout << "Rate control: video " << video_kbps << " kbit/s, audio " << audio_bps / 1000 << " kbit/s";
+    if (fec_enabled) {
+        cout << ", FEC " << fec_percent << "%";
+    }
+    cout << " (loss " << (int)(last.fraction_lost * 100) << "%, rtt " << (int)last.rtt_ms << " ms)" << endl;
+}
@@ -0,0 +1,384 @@
+#include <gst/gst.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "crypto_utils.h"
+#include "media_pipeline.h"
+#include "srtp_rekey.h"
+#include "bitrate_controller.h"
+
+using namespace std;
+
+// A client and a server pipeline in one process, sending live test video and
+// audio to each other over loopback through a relay. The relay is the
+// bottleneck of the client's uplink: client-to-server packets leave at the
+// link rate through a drop-tail queue. The link runs one phase at a high rate
+// and one at a low rate, and the client's rate controller has to settle near
+// each: using most of the link, without the queue overflowing. Exits
+// non-zero if it does not.
+
+#define SOAK_IP "127.0.0.1"
+#define CLIENT_BASE_PORT 5200
+#define SERVER_BASE_PORT 5300
+
+// Longest queue at the bottleneck, as time at the link rate
+#define BOTTLENECK_QUEUE_MS 200
+
+// The last third of each phase is judged
+#define SETTLED_FRACTION 3
+
+// A settled controller keeps its average target within these bounds of the
+// link rate, with at most this much loss at the bottleneck
+#define SETTLED_MIN_SHARE 0.5
+#define SETTLED_MAX_SHARE 1.1
+#define SETTLED_MAX_LOSS 0.05
+
+// Offsets from base_port of the client's media and reports to the server,
+// which go through the bottleneck; the others come back unshaped
+static const int upstream_offsets[] = {0, 1, 2, 3, 15, 17};
+static const int downstream_offsets[] = {5, 7, 10, 11, 12, 13};
+
+struct LinkCounters {
+    uint64_t forwarded;
+    uint64_t dropped;
+    uint64_t delay_us;
+};
+
+class Bottleneck {
+public:
+    Bottleneck() : link_kbps(0), running(false), forwarded(0), dropped(0), delay_us(0) {}
+    ~Bottleneck() { stop(); }
+
+    bool start(int kbps);
+    void stop();
+    void set_rate(int kbps) { link_kbps = kbps; }
+
+    LinkCounters counters() const { return {forwarded.load(), dropped.load(), delay_us.load()}; }
+
+private:
+    struct Relay {
+        int fd;
+        int to_port;
+        bool shaped;
+    };
+
+    struct QueuedPacket {
+        chrono::steady_clock::time_point arrival;
+        chrono::steady_clock::time_point departure;
+        const Relay *relay;
+        vector<uint8_t> data;
+    };
+
+    bool add_relay(int from_port, int to_port, bool shaped);
+    void forward(const Relay& relay, const uint8_t* data, size_t len);
+    void run();
+
+    vector<Relay> relays;
+    atomic<int> link_kbps;
+    atomic<bool> running;
+    thread worker;
+    atomic<uint64_t> forwarded;
+    atomic<uint64_t> dropped;
+    atomic<uint64_t> delay_us;
+};
+
+bool Bottleneck::add_relay(int from_port, int to_port, bool shaped) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(from_port);
+    inet_pton(AF_INET, SOAK_IP, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    relays.push_back({fd, to_port, shaped});
+    return true;
+}
+
+bool Bottleneck::start(int kbps) {
+    link_kbps = kbps;
+    for (int offset : upstream_offsets) {
+        if (!add_relay(CLIENT_BASE_PORT + offset, SERVER_BASE_PORT + offset, true)) {
+            return false;
+        }
+    }
+    for (int offset : downstream_offsets) {
+        if (!add_relay(SERVER_BASE_PORT + offset, CLIENT_BASE_PORT + offset, false)) {
+            return false;
+        }
+    }
+    running = true;
+    worker = thread(&Bottleneck::run, this);
+    return true;
+}
+
+void Bottleneck::stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+    for (const Relay& relay : relays) {
+        close(relay.fd);
+    }
+    relays.clear();
+}
+
+void Bottleneck::forward(const Relay& relay, const uint8_t* data, size_t len) {
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(relay.to_port);
+    inet_pton(AF_INET, SOAK_IP, &to.sin_addr);
+    sendto(relay.fd, data, len, 0, (struct sockaddr*)&to, sizeof(to));
+}
+
+void Bottleneck::run() {
+    vector<struct pollfd> fds;
+    for (const Relay& relay : relays) {
+        fds.push_back({relay.fd, POLLIN, 0});
+    }
+
+    deque<QueuedPacket> queue;
+    auto link_free = chrono::steady_clock::now();
+    uint8_t buf[65536];
+    while (running) {
+        int timeout_ms = 20;
+        if (!queue.empty()) {
+            auto wait = chrono::duration_cast<chrono::milliseconds>(
+                queue.front().departure - chrono::steady_clock::now()).count();
+            timeout_ms = (int)max(0LL, min(20LL, (long long)wait));
+        }
+        poll(fds.data(), fds.size(), timeout_ms);
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            const Relay& relay = relays[i];
+            ssize_t n;
+            while ((n = recv(relay.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                if (!relay.shaped) {
+                    forward(relay, buf, n);
+                    continue;
+                }
+
+                // Serialized at the link rate behind everything already queued
+                auto now = chrono::steady_clock::now();
+                auto begin = max(now, link_free);
+                auto departure = begin + chrono::microseconds((long long)n * 8 * 1000 / link_kbps);
+                if (departure - now > chrono::milliseconds(BOTTLENECK_QUEUE_MS)) {
+                    dropped++;
+                    continue;
+                }
+                link_free = departure;
+                queue.push_back({now, departure, &relay, vector<uint8_t>(buf, buf + n)});
+            }
+        }
+
+        auto now = chrono::steady_clock::now();
+        while (!queue.empty() && queue.front().departure <= now) {
+            const QueuedPacket& packet = queue.front();
+            forward(*packet.relay, packet.data.data(), packet.data.size());
+            forwarded++;
+            delay_us += chrono::duration_cast<chrono::microseconds>(now - packet.arrival).count();
+            queue.pop_front();
+        }
+    }
+}
+
+struct SoakState {
+    GMainLoop *loop;
+    BitrateController *controller;
+    Bottleneck *bottleneck;
+    int phase_seconds;
+    int rates[2];
+    int elapsed;
+    bool failed;
+    // Settled part of each phase
+    double target_sum[2];
+    int target_samples[2];
+    LinkCounters settled_start[2];
+    LinkCounters settled_end[2];
+};
+
+static int total_target_kbps(const BitrateController& controller) {
+    return controller.video_bitrate() + controller.audio_bitrate() / 1000;
+}
+
+static gboolean on_second(gpointer data) {
+    SoakState *state = (SoakState*)data;
+    state->elapsed++;
+    int phase = (state->elapsed - 1) / state->phase_seconds;
+    int in_phase = state->elapsed - phase * state->phase_seconds;
+    int settled_from = state->phase_seconds - state->phase_seconds / SETTLED_FRACTION;
+
+    int target = total_target_kbps(*state->controller);
+    const ReceiverReport& report = state->controller->last_report();
+    printf("%3d s  link %5d kbit/s  target %5d kbit/s  loss %4.1f%%  rtt %4.0f ms\n", state->elapsed,
+           state->rates[phase], target, report.fraction_lost * 100, report.rtt_ms);
+
+    if (in_phase == settled_from) {
+        state->settled_start[phase] = state->bottleneck->counters();
+    }
+    if (in_phase > settled_from) {
+        state->target_sum[phase] += target;
+        state->target_samples[phase]++;
+    }
+    if (in_phase == state->phase_seconds) {
+        state->settled_end[phase] = state->bottleneck->counters();
+        if (phase == 1) {
+            g_main_loop_quit(state->loop);
+            return FALSE;
+        }
+        state->bottleneck->set_rate(state->rates[1]);
+    }
+    return TRUE;
+}
+
+static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer data) {
+    SoakState *state = (SoakState*)data;
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError *err;
+        gchar *debug;
+        gst_message_parse_error(msg, &err, &debug);
+        cerr << "Error: " << err->message << endl;
+        g_error_free(err);
+        g_free(debug);
+        state->failed = true;
+        g_main_loop_quit(state->loop);
+    }
+    return TRUE;
+}
+
+static bool judge_phase(const SoakState& state, int phase) {
+    double average = state.target_samples[phase] ? state.target_sum[phase] / state.target_samples[phase] : 0;
+    uint64_t forwarded = state.settled_end[phase].forwarded - state.settled_start[phase].forwarded;
+    uint64_t dropped = state.settled_end[phase].dropped - state.settled_start[phase].dropped;
+    uint64_t delay_us = state.settled_end[phase].delay_us - state.settled_start[phase].delay_us;
+    double loss = forwarded + dropped ? (double)dropped / (forwarded + dropped) : 1.0;
+    double queue_ms = forwarded ? delay_us / 1000.0 / forwarded : 0;
+    int rate = state.rates[phase];
+
+    bool ok = average >= SETTLED_MIN_SHARE * rate && average <= SETTLED_MAX_SHARE * rate && loss <= SETTLED_MAX_LOSS;
+    printf("link %d kbit/s: settled target %.0f kbit/s (%.0f%% of link), bottleneck loss %.1f%%, queue %.1f ms  %s\n",
+           rate, average, 100.0 * average / rate, loss * 100, queue_ms, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    int phase_seconds = argc > 1 ? atoi(argv[1]) : 30;
+    int high_kbps = argc > 2 ? atoi(argv[2]) : 2000;
+    int low_kbps = argc > 3 ? atoi(argv[3]) : 600;
+
+    // The relay's ports cover both transports: bundle only uses +0 and +10
+    MediaProfile client_profile;
+    if (phase_seconds < 2 * SETTLED_FRACTION || low_kbps < 200 || high_kbps < low_kbps ||
+        (argc > 4 && !set_media_option(client_profile, "transport", argv[4]))) {
+        cout << "Usage: " << argv[0] << " [seconds per phase] [high kbit/s] [low kbit/s, >= 200] [legacy|bundle]"
+             << endl;
+        return -1;
+    }
+
+    client_profile.source = "test";
+    client_profile.sink = "none";
+    client_profile.base_port = CLIENT_BASE_PORT;
+    // The link, not the profile, has to be what limits the rate
+    client_profile.max_video_bitrate = 2 * high_kbps;
+    client_profile.video_bitrate = min(client_profile.video_bitrate, client_profile.max_video_bitrate);
+    MediaProfile server_profile = client_profile;
+    server_profile.base_port = SERVER_BASE_PORT;
+
+    // Each side addresses the relay through its own base port
+    MediaPipeline client_media, server_media;
+    if (!build_media_pipeline(client_profile, MEDIA_ROLE_CLIENT, SOAK_IP, client_media)) {
+        return -1;
+    }
+    if (!build_media_pipeline(server_profile, MEDIA_ROLE_SERVER, SOAK_IP, server_media)) {
+        gst_object_unref(client_media.pipeline);
+        return -1;
+    }
+
+    // Rate control logging would bury the per-second lines
+    cout.setstate(ios::badbit);
+
+    Bottleneck bottleneck;
+    if (!bottleneck.start(high_kbps)) {
+        cerr << "Cannot bind relay ports around " << CLIENT_BASE_PORT << " and " << SERVER_BASE_PORT << endl;
+        gst_object_unref(client_media.pipeline);
+        gst_object_unref(server_media.pipeline);
+        return -1;
+    }
+
+    bool ok;
+    {
+        // Both sides share one key; the exchange is not under test here
+        vector<uint8_t> key(SRTP_MASTER_KEY_SIZE);
+        random_bytes(key.data(), key.size());
+        SrtpKeyRing client_ring(client_media.pipeline, client_media.encoder_names, client_media.decoder_names);
+        SrtpKeyRing server_ring(server_media.pipeline, server_media.encoder_names, server_media.decoder_names);
+        client_ring.set_placeholder_key();
+        server_ring.set_placeholder_key();
+        client_ring.start(key);
+        server_ring.start(key);
+
+        GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+        BitrateController controller(client_media, client_profile);
+        SoakState state = {loop, &controller, &bottleneck, phase_seconds, {high_kbps, low_kbps}, 0, false,
+                           {0, 0}, {0, 0}, {}, {}};
+
+        GstBus *client_bus = gst_element_get_bus(client_media.pipeline);
+        GstBus *server_bus = gst_element_get_bus(server_media.pipeline);
+        guint client_watch = gst_bus_add_watch(client_bus, on_bus_message, &state);
+        guint server_watch = gst_bus_add_watch(server_bus, on_bus_message, &state);
+        gst_object_unref(client_bus);
+        gst_object_unref(server_bus);
+
+        gst_element_set_state(server_media.pipeline, GST_STATE_PLAYING);
+        gst_element_set_state(client_media.pipeline, GST_STATE_PLAYING);
+        controller.start();
+        g_timeout_add(1000, on_second, &state);
+
+        printf("%d s at %d kbit/s, then %d s at %d kbit/s; queue %d ms\n", phase_seconds, high_kbps,
+               phase_seconds, low_kbps, BOTTLENECK_QUEUE_MS);
+        g_main_loop_run(loop);
+
+        controller.stop();
+        gst_element_set_state(client_media.pipeline, GST_STATE_NULL);
+        gst_element_set_state(server_media.pipeline, GST_STATE_NULL);
+        g_source_remove(client_watch);
+        g_source_remove(server_watch);
+        g_main_loop_unref(loop);
+
+        ok = !state.failed && controller.reports() > 0;
+        if (!state.failed) {
+            printf("receiver reports: %llu\n", (unsigned long long)controller.reports());
+            ok = judge_phase(state, 0) && ok;
+            ok = judge_phase(state, 1) && ok;
+        }
+        printf("%s\n", ok ? "PASS" : "FAIL");
+    }
+
+    bottleneck.stop();
+    gst_object_unref(client_media.pipeline);
+    gst_object_unref(server_media.pipeline);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+#include "call_session.h"
+#include "auth_protocol.h"
+#include "control_channel.h"
+#include "bitrate_controller.h"
+#include "jitter_controller.h"
+#include "capture_latency.h"
+#include "pipeline_tracer.h"
+#include "call_stats.h"
+#include "ephemeral_key_pool.h"
+#include <glib-unix.h>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <memory>
+
+using namespace std;
+
+// Longest wait for the pipeline to reach PAUSED while the key exchange runs
+#define PIPELINE_WARMUP_TIMEOUT (5 * GST_SECOND)
+
+static long long elapsed_ms(chrono::steady_clock::time_point begin) {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+}
+
+// Ctrl+C ends the call cleanly, so the peer is told
+static gboolean on_interrupt(gpointer data) {
+    g_main_loop_quit((GMainLoop *)data);
+    return FALSE;
+}
+
+// Bus message handler
+static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data) {
+    GMainLoop *loop = (GMainLoop *)data;
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_EOS:
+            cout << "End of stream" << endl;
+            g_main_loop_quit(loop);
+            break;
+
+        case GST_MESSAGE_ERROR: {
+            gchar *debug;
+            GError *error;
+            gst_message_parse_error(msg, &error, &debug);
+            cerr << "Error: " << error->message << endl;
+            g_free(debug);
+            g_error_free(error);
+            g_main_loop_quit(loop);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return TRUE;
+}
+
+CallSession::CallSession(const CallConfig& config)
+    : config(config),
+      tag(config.role == MEDIA_ROLE_CLIENT ? "CLIENT" : "SERVER"),
+      context(g_main_context_new()),
+      cancelled(false) {
+    loop = g_main_loop_new(context, FALSE);
+}
+
+CallSession::~CallSession() {
+    g_main_loop_unref(loop);
+    g_main_context_unref(context);
+}
+
+// Quitting the loop from its own context also covers a stop() that comes
+// before the loop runs, which g_main_loop_quit() alone would miss
+gboolean CallSession::on_stop(gpointer data) {
+    g_main_loop_quit((GMainLoop *)data);
+    return FALSE;
+}
+
+void CallSession::stop() {
+    cancelled = true;
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, on_stop, loop, NULL);
+    g_source_attach(source, context);
+    g_source_unref(source);
+}
+
+int CallSession::run() {
+    bool client = config.role == MEDIA_ROLE_CLIENT;
+    const MediaProfile& profile = config.profile;
+    const PqSuiteInfo& suite = config.suite ? *config.suite : default_pq_suite();
+    const char *peer_ip = config.peer_ip.c_str();
+
+    // Every source of the call goes to our context; so do those GStreamer
+    // and GLib attach to the thread-default one
+    g_main_context_push_thread_default(context);
+
+    // The command line client starts this before gst_init(); then this
+    // finds it running
+    if (client && !start_client_key_pool(2, suite)) {
+        cerr << "CLIENT: Could not start key pool, keys will be generated inline" << endl;
+    }
+
+    // The key exchange runs while the pipeline is parsed and its devices and
+    // encoders are opened; only PLAYING has to wait for the keys
+    auto startup = chrono::steady_clock::now();
+    bool exchange_ok = false;
+    long long exchange_ms = 0;
+    string username = config.username;
+    ControlConnection control;
+    // Per-phase timings of the exchange go to the live statistics
+    HandshakeTrace exchange_trace;
+    reset_handshake_trace(exchange_trace);
+    bool trace_exchange = !profile.stats_socket.empty();
+    thread exchange([&] {
+        current_handshake_trace = trace_exchange ? &exchange_trace : nullptr;
+        if (client) {
+            exchange_ok = client_perform_authenticated_key_exchange(peer_ip, 9000, username,
+                                                                    HANDSHAKE_MODE_1RTT, suite, &control);
+        } else {
+            // The wait for a client ends with stop()
+            exchange_ok = server_perform_authenticated_key_exchange(9000, username, &control, &cancelled);
+        }
+        current_handshake_trace = nullptr;
+        exchange_ms = elapsed_ms(startup);
+    });
+
+    // Encoders, payloaders and rtpbins are reachable through media for tuning
+    // during the call
+    MediaPipeline media;
+    if (!build_media_pipeline(profile, config.role, peer_ip, media)) {
+        cerr << "Cannot build the media pipeline" << endl;
+        cancelled = true;
+        exchange.join();
+        if (client) {
+            stop_client_key_pool();
+        }
+        g_main_context_pop_thread_default(context);
+        return -1;
+    }
+    GstElement *pipeline = media.pipeline;
+    media.on_video_frame = video_callback;
+
+    // Every srtpenc sends with the ring's current key; every srtpdec asks the
+    // ring for keys per SSRC and accepts all keys it holds
+    SrtpKeyRing key_ring(pipeline, media.encoder_names, media.decoder_names);
+    key_ring.set_placeholder_key();
+
+    // Live statistics for the frontend, with stats-socket set; from now on,
+    // so it can show the key exchange under way
+    CallStatsPublisher call_stats(media, profile, config.role);
+    call_stats.start();
+
+    // Live sources do not preroll, so this returns once devices are open
+    GstStateChangeReturn warmup = gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if (warmup == GST_STATE_CHANGE_ASYNC) {
+        warmup = gst_element_get_state(pipeline, NULL, NULL, PIPELINE_WARMUP_TIMEOUT);
+    }
+    long long pipeline_ms = elapsed_ms(startup);
+
+    // A server need not wait for a client it cannot take
+    if (warmup == GST_STATE_CHANGE_FAILURE) {
+        cancelled = true;
+    }
+    exchange.join();
+    call_stats.set_handshake(pipeline_ms, exchange_ms, trace_exchange ? &exchange_trace : NULL);
+    bool stopped = cancelled && warmup != GST_STATE_CHANGE_FAILURE;
+    if (!exchange_ok || stopped || warmup == GST_STATE_CHANGE_FAILURE) {
+        if (stopped) {
+            cout << tag << ": Call abandoned before it was set up" << endl;
+        } else {
+            cerr << (warmup == GST_STATE_CHANGE_FAILURE ? "Pipeline failed to start!" : "Authenticated key exchange failed!") << endl;
+        }
+        call_stats.set_state(stopped ? CALL_STATE_ENDED : CALL_STATE_FAILED);
+        call_stats.stop();
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        if (client) {
+            stop_client_key_pool();
+        }
+        g_main_context_pop_thread_default(context);
+        return stopped ? 0 : -1;
+    }
+
+    if (client) {
+        if (EphemeralKeyPool *pool = client_key_pool()) {
+            KeyPoolStats stats = pool->stats();
+            cout << "CLIENT: Key pool depth " << stats.depth << "/" << stats.capacity
+                 << ", hits " << stats.hits << ", misses " << stats.misses << endl;
+        }
+    }
+    cout << tag << ": Pipeline ready after " << pipeline_ms << " ms, keys after " << exchange_ms << " ms" << endl;
+
+    cout << "\n=== Starting Secure Video/Audio Streaming ===" << endl;
+    cout << (client ? "Logged in as: " : "Connected user: ") << username << "\n" << endl;
+
+    key_ring.start(SRTP_KEY);
+    // The client runs in-call key exchanges against the server's port 9000
+    unique_ptr<ClientRekeyer> client_rekeyer;
+    unique_ptr<ServerRekeyer> server_rekeyer;
+    if (client) {
+        client_rekeyer.reset(new ClientRekeyer(key_ring, peer_ip, 9000, username, suite, config.rekey_seconds));
+    } else {
+        server_rekeyer.reset(new ServerRekeyer(key_ring, 9000, username, peer_ip));
+        if (!server_rekeyer->start()) {
+            cerr << "SERVER: Cannot accept in-call key exchanges, keeping the first key" << endl;
+        }
+    }
+
+    // Not gst_bus_add_watch(): its source could only be removed again from
+    // the default context
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GSource *bus_source = gst_bus_create_watch(bus);
+    g_source_set_callback(bus_source, (GSourceFunc)bus_call, loop, NULL);
+    g_source_attach(bus_source, context);
+    gst_object_unref(bus);
+    GSource *interrupt_source = NULL;
+    if (config.stop_on_interrupt) {
+        interrupt_source = g_unix_signal_source_new(SIGINT);
+        g_source_set_callback(interrupt_source, on_interrupt, loop, NULL);
+        g_source_attach(interrupt_source, context);
+    }
+
+    // Encoder bitrates follow the peer's receiver reports
+    BitrateController rate_control(media, profile);
+    // Playout delay of the peer's streams follows their jitter when adaptive
+    JitterController jitter_control(media, profile);
+    // Stamps what we send with capture-time on; measures what the peer's
+    // stamps allow
+    CaptureLatencyMeter latency(media, profile);
+    // Per-element latency, with trace-interval set
+    PipelineTracer tracer(pipeline, profile);
+
+    // The key exchange connection stays open for signaling during the call;
+    // the call ends when the peer hangs up or the connection drops
+    ControlChannel control_channel(control, client);
+    control_channel.attach(context,
+        [this, client, &rate_control, &jitter_control](uint8_t type, const vector<uint8_t>& payload) {
+            if (type == CTRL_HANGUP) {
+                cout << tag << ": " << (client ? "Server" : "Client") << " hung up" << endl;
+                g_main_loop_quit(loop);
+            } else if (type == CTRL_FEC) {
+                rate_control.enable_fec();
+            } else if (type == CTRL_RTX) {
+                jitter_control.enable_rtx();
+            }
+        },
+        [this, client] {
+            cout << tag << ": Control connection to the " << (client ? "server" : "client") << " lost" << endl;
+            g_main_loop_quit(loop);
+        });
+
+    // FEC is sent only when both sides have it on
+    if (profile.fec) {
+        control_channel.send(CTRL_FEC);
+    }
+    // Retransmissions are asked for only from a side that sends them
+    if (profile.jitter_mode == "adaptive") {
+        control_channel.send(CTRL_RTX);
+    }
+
+    cout << "Setting pipeline to PLAYING state..." << endl;
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    call_stats.set_state(CALL_STATE_CONNECTED);
+
+    if (profile.adaptive_bitrate) {
+        rate_control.start(context);
+    }
+    jitter_control.start(context);
+    latency.start(context);
+    tracer.start(context);
+    if (client_rekeyer) {
+        client_rekeyer->start();
+    }
+
+    g_main_loop_run(loop);
+
+    control_channel.send(CTRL_HANGUP);
+    control_channel.close();
+    rate_control.stop();
+    jitter_control.stop();
+    latency.stop();
+    latency.print_summary();
+    tracer.stop();
+    tracer.dump();
+    call_stats.set_state(CALL_STATE_ENDED);
+    call_stats.stop();
+    if (client_rekeyer) {
+        client_rekeyer->stop();
+    }
+    if (server_rekeyer) {
+        server_rekeyer->stop();
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    g_source_destroy(bus_source);
+    g_source_unref(bus_source);
+    if (interrupt_source) {
+        g_source_destroy(interrupt_source);
+        g_source_unref(interrupt_source);
+    }
+    if (client) {
+        stop_client_key_pool();
+    }
+    g_main_context_pop_thread_default(context);
+
+    return 0;
+}
@@ -0,0 +1,679 @@
+#include "call_stats.h"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+#define VIDEO_SESSION 0
+#define AUDIO_SESSION 1
+
+static const char* const CALL_STATE_NAMES[] = {
+    "waiting",
+    "connecting",
+    "connected",
+    "ended",
+    "failed"
+};
+
+const char* call_state_name(CallState state) {
+    return CALL_STATE_NAMES[state];
+}
+
+static double elapsed_s(Clock::time_point begin, Clock::time_point end) {
+    return chrono::duration<double>(end - begin).count();
+}
+
+// Thread names are the only strings that do not come from us
+static string json_string(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// One decimal is plenty for rates and shares
+static string json_number(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f", value);
+    return text;
+}
+
+// Follows src pads downstream to the element with none
+static GstElement* find_sink(GstElement *element) {
+    gst_object_ref(element);
+    while (true) {
+        GstPad *src = gst_element_get_static_pad(element, "src");
+        if (!src) {
+            return element;
+        }
+        GstPad *peer = gst_pad_get_peer(src);
+        gst_object_unref(src);
+        GstElement *next = peer ? gst_pad_get_parent_element(peer) : NULL;
+        if (peer) {
+            gst_object_unref(peer);
+        }
+        gst_object_unref(element);
+        if (!next) {
+            return NULL;
+        }
+        element = next;
+    }
+}
+
+// autovideosink and autoaudiosink are bins around the sink that keeps the
+// statistics, made once they start
+static GstElement* find_base_sink(GstElement *element) {
+    gst_object_ref(element);
+    while (GST_IS_BIN(element)) {
+        GstIterator *it = gst_bin_iterate_sinks(GST_BIN(element));
+        GValue item = G_VALUE_INIT;
+        GstElement *child = NULL;
+        if (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+            child = GST_ELEMENT(gst_object_ref(g_value_get_object(&item)));
+            g_value_unset(&item);
+        }
+        gst_iterator_free(it);
+        gst_object_unref(element);
+        if (!child) {
+            return NULL;
+        }
+        element = child;
+    }
+    if (!g_object_class_find_property(G_OBJECT_GET_CLASS(element), "stats")) {
+        gst_object_unref(element);
+        return NULL;
+    }
+    return element;
+}
+
+CallStatsPublisher::CallStatsPublisher(MediaPipeline& media, const MediaProfile& profile, MediaRole role)
+    : media(media), socket_path(profile.stats_socket), interval_ms(profile.stats_interval),
+      role(role == MEDIA_ROLE_SERVER ? "server" : "client"), h264(profile.video_codec == "h264"),
+      listen_fd(-1), wake_fd(-1), running(false), stopped(false),
+      state(role == MEDIA_ROLE_SERVER ? CALL_STATE_WAITING : CALL_STATE_CONNECTING),
+      pipeline_ms(-1), exchange_ms(-1), have_trace(false), trace(),
+      encoder_pad(NULL), encoder_probe(0), frames_encoded(0), qp_sum(0), qp_frames(0), h264_parser(NULL),
+      pad_added_id(0), sequence(0), previous_encoded(0), previous_qp_sum(0), previous_qp_frames(0),
+      encoder_fps(0), encoder_qp(-1) {
+    if (!enabled()) {
+        return;
+    }
+    if (h264) {
+        h264_parser = gst_h264_nal_parser_new();
+    } else {
+        gst_vp8_parser_init(&vp8_parser);
+    }
+    encoder_pad = media.video_encoder ? gst_element_get_static_pad(media.video_encoder, "src") : NULL;
+    if (encoder_pad) {
+        encoder_probe = gst_pad_add_probe(encoder_pad, GST_PAD_PROBE_TYPE_BUFFER, on_encoded, this, NULL);
+    }
+    // After the pipeline's own handler, which links the depayloader
+    if (media.rtpbin_recv) {
+        pad_added_id = g_signal_connect(media.rtpbin_recv, "pad-added", G_CALLBACK(on_pad_added), this);
+    }
+}
+
+CallStatsPublisher::~CallStatsPublisher() {
+    stop();
+    if (h264_parser) {
+        gst_h264_nal_parser_free(h264_parser);
+    }
+}
+
+bool CallStatsPublisher::start() {
+    if (!enabled() || running || stopped) {
+        return false;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Stats: Socket path too long: " << socket_path << endl;
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    // A socket file left by an earlier call that did not end cleanly is
+    // replaced; anything else at the path is left alone and bind() fails
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path.c_str());
+    }
+    // The statistics name the peer and the call's rates, so only the owner may
+    // connect; listen() comes after the chmod, so nobody gets in before it
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (!bound || chmod(socket_path.c_str(), 0600) < 0 || listen(listen_fd, STATS_MAX_CLIENTS) < 0) {
+        cerr << "Stats: Cannot listen on " << socket_path << ": " << strerror(errno) << endl;
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        if (bound) {
+            unlink(socket_path.c_str());
+        }
+        return false;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        cerr << "Stats: eventfd failed" << endl;
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path.c_str());
+        return false;
+    }
+
+    started = window_start = Clock::now();
+    running = true;
+    publish_thread = thread(&CallStatsPublisher::run, this);
+    cout << "Stats: Publishing every " << interval_ms << " ms on " << socket_path << endl;
+    return true;
+}
+
+void CallStatsPublisher::stop() {
+    if (stopped) {
+        return;
+    }
+    stopped = true;
+    if (running.exchange(false)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // The poll timeout still ends the loop
+        }
+        publish_thread.join();
+    }
+    for (Client& client : clients) {
+        close(client.fd);
+    }
+    clients.clear();
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    listen_fd = wake_fd = -1;
+
+    if (encoder_pad) {
+        gst_pad_remove_probe(encoder_pad, encoder_probe);
+        gst_object_unref(encoder_pad);
+        encoder_pad = NULL;
+    }
+    if (pad_added_id) {
+        g_signal_handler_disconnect(media.rtpbin_recv, pad_added_id);
+        pad_added_id = 0;
+    }
+    lock_guard<mutex> guard(playback_lock);
+    for (Playback& playback : playbacks) {
+        gst_object_unref(playback.sink);
+        if (playback.base_sink) {
+            gst_object_unref(playback.base_sink);
+        }
+    }
+    playbacks.clear();
+}
+
+void CallStatsPublisher::set_state(CallState new_state) {
+    lock_guard<mutex> guard(state_lock);
+    state = new_state;
+}
+
+void CallStatsPublisher::set_handshake(long long pipeline, long long exchange, const HandshakeTrace *exchange_trace) {
+    lock_guard<mutex> guard(state_lock);
+    pipeline_ms = pipeline;
+    exchange_ms = exchange;
+    have_trace = exchange_trace != NULL;
+    if (exchange_trace) {
+        trace = *exchange_trace;
+    }
+}
+
+GstPadProbeReturn CallStatsPublisher::on_encoded(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    CallStatsPublisher *stats = (CallStatsPublisher*)user_data;
+    stats->frames_encoded.fetch_add(1, memory_order_relaxed);
+    stats->parse_qp(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+// Average QP of the slices of one frame (x264 emits several with
+// sliced-threads), or the base quantizer index of a VP8 frame
+void CallStatsPublisher::parse_qp(GstBuffer *buffer) {
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+    int qp = -1;
+    if (h264) {
+        int sum = 0, slices = 0;
+        GstH264NalUnit nalu;
+        GstH264ParserResult result = gst_h264_parser_identify_nalu(h264_parser, map.data, 0, map.size, &nalu);
+        while (result == GST_H264_PARSER_OK || result == GST_H264_PARSER_NO_NAL_END) {
+            if (nalu.type == GST_H264_NAL_SPS || nalu.type == GST_H264_NAL_PPS) {
+                gst_h264_parser_parse_nal(h264_parser, &nalu);
+            } else if (nalu.type == GST_H264_NAL_SLICE || nalu.type == GST_H264_NAL_SLICE_IDR) {
+                GstH264SliceHdr slice;
+                if (gst_h264_parser_parse_slice_hdr(h264_parser, &nalu, &slice, FALSE, FALSE) == GST_H264_PARSER_OK) {
+                    sum += 26 + slice.pps->pic_init_qp_minus26 + slice.slice_qp_delta;
+                    slices++;
+                }
+            }
+            if (result == GST_H264_PARSER_NO_NAL_END) {
+                break;
+            }
+            result = gst_h264_parser_identify_nalu(h264_parser, map.data, nalu.offset + nalu.size, map.size, &nalu);
+        }
+        if (slices > 0) {
+            qp = sum / slices;
+        }
+    } else {
+        GstVp8FrameHdr frame;
+        if (gst_vp8_parser_parse_frame_header(&vp8_parser, &frame, map.data, map.size) == GST_VP8_PARSER_OK) {
+            qp = frame.quant_indices.y_ac_qi;
+        }
+    }
+    gst_buffer_unmap(buffer, &map);
+    if (qp >= 0) {
+        qp_sum.fetch_add(qp, memory_order_relaxed);
+        qp_frames.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void CallStatsPublisher::on_pad_added(GstElement*, GstPad *pad, gpointer user_data) {
+    CallStatsPublisher *stats = (CallStatsPublisher*)user_data;
+    gchar *name = gst_pad_get_name(pad);
+    unsigned int session, ssrc, pt;
+    bool media_pad = sscanf(name, "recv_rtp_src_%u_%u_%u", &session, &ssrc, &pt) == 3 &&
+                     (pt == VIDEO_PAYLOAD_TYPE || pt == AUDIO_PAYLOAD_TYPE);
+    g_free(name);
+    GstPad *depayloader_sink = media_pad ? gst_pad_get_peer(pad) : NULL;
+    if (!depayloader_sink) {
+        return;
+    }
+    GstElement *depayloader = gst_pad_get_parent_element(depayloader_sink);
+    GstElement *sink = depayloader ? find_sink(depayloader) : NULL;
+    if (sink) {
+        lock_guard<mutex> guard(stats->playback_lock);
+        stats->playbacks.push_back({ssrc, pt == VIDEO_PAYLOAD_TYPE, sink, NULL});
+    }
+    if (depayloader) {
+        gst_object_unref(depayloader);
+    }
+    gst_object_unref(depayloader_sink);
+}
+
+void CallStatsPublisher::run() {
+    Clock::time_point next = Clock::now();
+    vector<struct pollfd> fds;
+    while (running) {
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (const Client& client : clients) {
+            fds.push_back({client.fd, (short)(POLLIN | (client.out.empty() ? 0 : POLLOUT)), 0});
+        }
+        int timeout = (int)max<long long>(0, chrono::duration_cast<chrono::milliseconds>(next - Clock::now()).count());
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            cerr << "Stats: poll failed: " << strerror(errno) << endl;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_clients();
+        }
+
+        // Subscribers send nothing; readable means closed. The clients
+        // accepted above are past the end of fds.
+        vector<Client> kept;
+        for (size_t i = 0; i < clients.size(); i++) {
+            Client& client = clients[i];
+            short revents = i + 2 < fds.size() ? fds[i + 2].revents : 0;
+            bool open = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                char discard[256];
+                ssize_t n = recv(client.fd, discard, sizeof(discard), MSG_DONTWAIT);
+                open = n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR));
+            }
+            if (open && (revents & POLLOUT)) {
+                open = flush(client);
+            }
+            if (open) {
+                kept.push_back(move(client));
+            } else {
+                close(client.fd);
+            }
+        }
+        clients.swap(kept);
+
+        Clock::time_point now = Clock::now();
+        if (now >= next) {
+            if (!clients.empty()) {
+                publish(snapshot(now - window_start >= chrono::milliseconds(STATS_RATE_WINDOW_MS)));
+            }
+            next += chrono::milliseconds(interval_ms);
+            if (next < now) {
+                next = now + chrono::milliseconds(interval_ms);
+            }
+        }
+    }
+
+    // The state the call ended in, for whoever is still listening
+    if (!clients.empty()) {
+        publish(snapshot(false));
+    }
+}
+
+void CallStatsPublisher::accept_clients() {
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (clients.size() >= STATS_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        clients.push_back({fd, string()});
+    }
+}
+
+// A subscriber still sending the previous snapshot skips this one
+void CallStatsPublisher::publish(const string& line) {
+    vector<Client> kept;
+    for (Client& client : clients) {
+        if (client.out.empty()) {
+            client.out = line;
+        }
+        if (flush(client)) {
+            kept.push_back(move(client));
+        } else {
+            close(client.fd);
+        }
+    }
+    clients.swap(kept);
+}
+
+bool CallStatsPublisher::flush(Client& client) {
+    while (!client.out.empty()) {
+        ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        client.out.erase(0, n);
+    }
+    return true;
+}
+
+string CallStatsPublisher::snapshot(bool window_ended) {
+    Clock::time_point now = Clock::now();
+    double window_s = elapsed_s(window_start, now);
+    ostringstream out;
+
+    CallState current_state;
+    {
+        lock_guard<mutex> guard(state_lock);
+        current_state = state;
+        out << "{\"seq\":" << sequence++
+            << ",\"uptime_ms\":" << chrono::duration_cast<chrono::milliseconds>(now - started).count()
+            << ",\"role\":\"" << role << "\",\"state\":\"" << call_state_name(current_state) << "\"";
+        out << ",\"handshake\":{\"pipeline_ms\":" << pipeline_ms << ",\"exchange_ms\":" << exchange_ms;
+        if (have_trace) {
+            out << ",\"phases_ms\":{";
+            for (int phase = 0; phase < PHASE_COUNT; phase++) {
+                out << (phase ? "," : "") << "\"" << handshake_phase_name(phase) << "\":"
+                    << json_number(trace.phase_ns[phase] / 1e6);
+            }
+            out << "},\"flights_ms\":[";
+            for (int flight = 0; flight < trace.flight_count; flight++) {
+                out << (flight ? "," : "") << json_number(trace.flight_ns[flight] / 1e6);
+            }
+            out << "]";
+        }
+        out << "}";
+    }
+
+    // Encoder output since the window began
+    uint64_t encoded = frames_encoded.load(memory_order_relaxed);
+    if (window_ended) {
+        uint64_t sum = qp_sum.load(memory_order_relaxed);
+        uint64_t frames = qp_frames.load(memory_order_relaxed);
+        encoder_fps = (encoded - previous_encoded) / window_s;
+        encoder_qp = frames > previous_qp_frames ? (double)(sum - previous_qp_sum) / (frames - previous_qp_frames) : -1;
+        previous_encoded = encoded;
+        previous_qp_sum = sum;
+        previous_qp_frames = frames;
+    }
+    int bitrate_kbps = 0;
+    if (media.video_encoder) {
+        guint bitrate = 0;
+        // x264enc in kbit/s, vp8enc in bit/s
+        g_object_get(media.video_encoder, h264 ? "bitrate" : "target-bitrate", &bitrate, NULL);
+        bitrate_kbps = h264 ? bitrate : bitrate / 1000;
+    }
+    out << ",\"encoder\":{\"codec\":\"" << (h264 ? "h264" : "vp8") << "\",\"bitrate_kbps\":" << bitrate_kbps
+        << ",\"frames\":" << encoded << ",\"fps\":" << json_number(encoder_fps)
+        << ",\"qp\":" << json_number(encoder_qp) << "}";
+
+    write_sessions(out, window_ended, window_s);
+    write_threads(out, window_ended, window_s);
+    out << "}\n";
+
+    if (window_ended) {
+        window_start = now;
+    }
+    return out.str();
+}
+
+// Every source of every session: ours that send, with the peer's receiver
+// reports on them, and the peer's, with what we received. With BUNDLE both
+// rtpbins are the one.
+void CallStatsPublisher::write_sessions(ostream& out, bool window_ended, double window_s) {
+    ostringstream sent, received;
+    int sent_count = 0, received_count = 0;
+    vector<GstElement*> rtpbins = {media.rtpbin_send};
+    if (media.rtpbin_recv != media.rtpbin_send) {
+        rtpbins.push_back(media.rtpbin_recv);
+    }
+
+    for (GstElement *rtpbin : rtpbins) {
+        for (guint id : {(guint)VIDEO_SESSION, (guint)AUDIO_SESSION}) {
+            GObject *session = NULL;
+            if (rtpbin) {
+                g_signal_emit_by_name(rtpbin, "get-internal-session", id, &session);
+            }
+            if (!session) {
+                continue;
+            }
+            GstStructure *stats = NULL;
+            g_object_get(session, "stats", &stats, NULL);
+            g_object_unref(session);
+            if (!stats) {
+                continue;
+            }
+
+            const GValue *sources = gst_structure_get_value(stats, "source-stats");
+            G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+            GValueArray *array = sources ? (GValueArray*)g_value_get_boxed(sources) : NULL;
+            for (guint i = 0; array && i < array->n_values; i++) {
+                const GstStructure *source = gst_value_get_structure(g_value_array_get_nth(array, i));
+                gboolean internal = FALSE, is_sender = FALSE;
+                gst_structure_get_boolean(source, "internal", &internal);
+                gst_structure_get_boolean(source, "is-sender", &is_sender);
+                if (!is_sender) {
+                    continue;
+                }
+                guint ssrc = 0;
+                gint clock_rate = 0;
+                gst_structure_get_uint(source, "ssrc", &ssrc);
+                gst_structure_get_int(source, "clock-rate", &clock_rate);
+                bool video = clock_rate == VIDEO_CLOCK_RATE || (clock_rate <= 0 && id == VIDEO_SESSION);
+                Previous& before = previous[{(bool)internal, ssrc}];
+
+                if (internal) {
+                    guint64 octets = 0, packets = 0;
+                    guint fraction_lost = 0, jitter = 0, round_trip = 0;
+                    gint packets_lost = 0;
+                    gst_structure_get_uint64(source, "octets-sent", &octets);
+                    gst_structure_get_uint64(source, "packets-sent", &packets);
+                    gst_structure_get_uint(source, "rb-fractionlost", &fraction_lost);
+                    gst_structure_get_int(source, "rb-packetslost", &packets_lost);
+                    gst_structure_get_uint(source, "rb-jitter", &jitter);
+                    gst_structure_get_uint(source, "rb-round-trip", &round_trip);
+                    if (window_ended) {
+                        before.kbps = (octets - before.octets) * 8 / 1000.0 / window_s;
+                        before.octets = octets;
+                    }
+                    // Fraction lost is out of 256, round trip in 1/65536 s,
+                    // jitter in RTP timestamp units
+                    sent << (sent_count++ ? "," : "") << "{\"ssrc\":" << ssrc
+                         << ",\"kind\":\"" << (video ? "video" : "audio") << "\""
+                         << ",\"packets\":" << packets << ",\"bitrate_kbps\":" << json_number(before.kbps)
+                         << ",\"loss_percent\":" << json_number(fraction_lost * 100.0 / 256)
+                         << ",\"packets_lost\":" << packets_lost
+                         << ",\"jitter_ms\":" << json_number(clock_rate > 0 ? jitter * 1000.0 / clock_rate : 0)
+                         << ",\"rtt_ms\":" << json_number(round_trip * 1000.0 / 65536) << "}";
+                    continue;
+                }
+
+                guint64 octets = 0, packets = 0;
+                guint jitter = 0;
+                gint packets_lost = 0;
+                gst_structure_get_uint64(source, "octets-received", &octets);
+                gst_structure_get_uint64(source, "packets-received", &packets);
+                gst_structure_get_int(source, "packets-lost", &packets_lost);
+                gst_structure_get_uint(source, "jitter", &jitter);
+
+                // Frames reach the sink of the stream's own chain
+                bool have_frames = false;
+                guint64 rendered = 0, dropped = 0;
+                {
+                    lock_guard<mutex> guard(playback_lock);
+                    for (Playback& playback : playbacks) {
+                        if (playback.ssrc != ssrc) {
+                            continue;
+                        }
+                        if (!playback.base_sink) {
+                            playback.base_sink = find_base_sink(playback.sink);
+                        }
+                        GstStructure *sink_stats = NULL;
+                        if (playback.base_sink) {
+                            g_object_get(playback.base_sink, "stats", &sink_stats, NULL);
+                        }
+                        if (sink_stats) {
+                            gst_structure_get_uint64(sink_stats, "rendered", &rendered);
+                            gst_structure_get_uint64(sink_stats, "dropped", &dropped);
+                            gst_structure_free(sink_stats);
+                            have_frames = true;
+                        }
+                        break;
+                    }
+                }
+
+                if (window_ended) {
+                    uint64_t arrived = packets - before.packets;
+                    int64_t lost = max<int64_t>(0, packets_lost - before.lost);
+                    before.kbps = (octets - before.octets) * 8 / 1000.0 / window_s;
+                    before.loss = arrived + lost > 0 ? lost * 100.0 / (arrived + lost) : 0;
+                    before.fps = (rendered - before.frames) / window_s;
+                    before.octets = octets;
+                    before.packets = packets;
+                    before.lost = packets_lost;
+                    before.frames = rendered;
+                }
+                received << (received_count++ ? "," : "") << "{\"ssrc\":" << ssrc
+                         << ",\"kind\":\"" << (video ? "video" : "audio") << "\""
+                         << ",\"packets\":" << packets << ",\"bitrate_kbps\":" << json_number(before.kbps)
+                         << ",\"loss_percent\":" << json_number(before.loss) << ",\"packets_lost\":" << packets_lost
+                         << ",\"jitter_ms\":" << json_number(clock_rate > 0 ? jitter * 1000.0 / clock_rate : 0);
+                if (have_frames) {
+                    received << ",\"frames\":" << rendered << ",\"dropped\":" << dropped
+                             << ",\"fps\":" << json_number(before.fps);
+                }
+                received << "}";
+            }
+            G_GNUC_END_IGNORE_DEPRECATIONS
+            gst_structure_free(stats);
+        }
+    }
+    out << ",\"sent\":[" << sent.str() << "],\"received\":[" << received.str() << "]";
+}
+
+// CPU of each thread of the process over the window, from
+// /proc/self/task/<tid>/stat; read once per window, it is the costly part
+void CallStatsPublisher::write_threads(ostream& out, bool window_ended, double window_s) {
+    if (window_ended) {
+        static const long ticks_per_s = sysconf(_SC_CLK_TCK);
+        vector<ThreadCpu> now;
+        DIR *tasks = opendir("/proc/self/task");
+        struct dirent *entry;
+        while (tasks && (entry = readdir(tasks)) != NULL) {
+            int tid = atoi(entry->d_name);
+            if (tid <= 0) {
+                continue;
+            }
+            ifstream file(string("/proc/self/task/") + entry->d_name + "/stat");
+            string line;
+            if (!getline(file, line)) {
+                continue;
+            }
+            // "tid (name) state ..."; the name may hold spaces and parentheses
+            size_t open = line.find('('), close = line.rfind(')');
+            if (open == string::npos || close == string::npos || close < open) {
+                continue;
+            }
+            istringstream fields(line.substr(close + 2));
+            string field;
+            uint64_t utime = 0, stime = 0;
+            // utime and stime are fields 14 and 15; the state is field 3
+            for (int i = 3; i <= 15 && fields >> field; i++) {
+                if (i == 14) {
+                    utime = strtoull(field.c_str(), NULL, 10);
+                } else if (i == 15) {
+                    stime = strtoull(field.c_str(), NULL, 10);
+                }
+            }
+            ThreadCpu cpu = {tid, line.substr(open + 1, close - open - 1), utime + stime, 0};
+            for (const ThreadCpu& before : threads) {
+                if (before.tid == tid && cpu.ticks >= before.ticks) {
+                    cpu.percent = (cpu.ticks - before.ticks) * 100.0 / ticks_per_s / window_s;
+                    break;
+                }
+            }
+            now.push_back(cpu);
+        }
+        if (tasks) {
+            closedir(tasks);
+        }
+        sort(now.begin(), now.end(), [](const ThreadCpu& a, const ThreadCpu& b) { return a.percent > b.percent; });
+        threads.swap(now);
+    }
+
+    out << ",\"threads\":[";
+    for (size_t i = 0; i < threads.size(); i++) {
+        out << (i ? "," : "") << "{\"tid\":" << threads[i].tid << ",\"name\":" << json_string(threads[i].name)
+            << ",\"cpu\":" << json_number(threads[i].percent) << "}";
+    }
+    out << "]";
+}
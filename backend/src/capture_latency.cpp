@@ -0,0 +1,583 @@
+#include "capture_latency.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+#define VIDEO_SESSION 0
+#define AUDIO_SESSION 1
+
+#define RTP_HEADER_SIZE 12
+// Fixed header and 15 CSRCs
+#define RTP_MAX_HEADER_SIZE (RTP_HEADER_SIZE + 15 * 4)
+// What is read to find the stamps: the header, the extension block's own
+// header and room for a few more extensions than ours
+#define STAMP_SCAN_SIZE (RTP_MAX_HEADER_SIZE + 4 + 64)
+#define ONE_BYTE_EXTENSION_PROFILE 0xBEDE
+#define RTCP_SENDER_REPORT 200
+
+// Seconds from the NTP epoch (1900) to the Unix epoch
+#define NTP_UNIX_OFFSET_S 2208988800ULL
+
+static guint64 to_ntp(gint64 unix_us) {
+    guint64 seconds = unix_us / 1000000 + NTP_UNIX_OFFSET_S;
+    guint64 fraction = ((guint64)(unix_us % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+static gint64 from_ntp(guint64 ntp) {
+    return ((gint64)(ntp >> 32) - (gint64)NTP_UNIX_OFFSET_S) * 1000000 +
+           (gint64)(((ntp & 0xFFFFFFFF) * 1000000) >> 32);
+}
+
+// Wall-clock time at which a live source captured what has running time
+// pts; live sources start their segment at 0, so that is the PTS
+static gint64 capture_time_us(GstElement *element, GstClockTime pts) {
+    gint64 now = g_get_real_time();
+    GstClock *clock = gst_element_get_clock(element);
+    if (!clock) {
+        return now;
+    }
+    GstClockTime clock_now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+        return now;
+    }
+    GstClockTime capture = gst_element_get_base_time(element) + pts;
+    return capture < clock_now ? now - (gint64)((clock_now - capture) / GST_USECOND) : now;
+}
+
+// A copy of an RTP packet with both stamps in a one-byte header extension
+// block after its CSRCs. The payload is shared, not copied. NULL for
+// packets that are not RTP or already carry extensions.
+static GstBuffer* stamp_packet(GstBuffer *buffer, gint64 capture_us, gint64 send_us) {
+    uint8_t header[RTP_MAX_HEADER_SIZE + CAPTURE_STAMP_SIZE];
+    gsize size = gst_buffer_get_size(buffer);
+    gsize got = gst_buffer_extract(buffer, 0, header, min(size, (gsize)RTP_MAX_HEADER_SIZE));
+    if (got < RTP_HEADER_SIZE || (header[0] >> 6) != 2 || (header[0] & 0x10)) {
+        return NULL;
+    }
+    gsize header_size = RTP_HEADER_SIZE + 4 * (header[0] & 0x0F);
+    if (got < header_size) {
+        return NULL;
+    }
+
+    header[0] |= 0x10;
+    uint8_t *block = header + header_size;
+    memset(block, 0, CAPTURE_STAMP_SIZE);
+    block[0] = ONE_BYTE_EXTENSION_PROFILE >> 8;
+    block[1] = ONE_BYTE_EXTENSION_PROFILE & 0xFF;
+    block[3] = (CAPTURE_STAMP_SIZE - 4) / 4;
+    // Each element: ID, length - 1, then the data; zero bytes pad the rest
+    guint64 capture_ntp = to_ntp(capture_us);
+    block[4] = CAPTURE_TIME_EXTENSION_ID << 4 | 7;
+    for (int i = 0; i < 8; i++) {
+        block[5 + i] = capture_ntp >> (56 - 8 * i);
+    }
+    guint32 send_time = (to_ntp(send_us) >> 14) & 0xFFFFFF;
+    block[13] = SEND_TIME_EXTENSION_ID << 4 | 2;
+    block[14] = send_time >> 16;
+    block[15] = send_time >> 8;
+    block[16] = send_time;
+
+    GstBuffer *stamped = gst_buffer_new_allocate(NULL, header_size + CAPTURE_STAMP_SIZE, NULL);
+    gst_buffer_fill(stamped, 0, header, header_size + CAPTURE_STAMP_SIZE);
+    gst_buffer_copy_into(stamped, buffer,
+                         (GstBufferCopyFlags)(GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META),
+                         0, -1);
+    GstBuffer *payload = gst_buffer_copy_region(buffer, GST_BUFFER_COPY_MEMORY, header_size, size - header_size);
+    return gst_buffer_append(stamped, payload);
+}
+
+// SSRC and both stamps of a received packet; false when it has none
+static bool read_stamps(GstBuffer *buffer, guint32& ssrc, gint64& capture_us, gint64& send_us) {
+    uint8_t data[STAMP_SCAN_SIZE];
+    gsize got = gst_buffer_extract(buffer, 0, data, sizeof(data));
+    if (got < RTP_HEADER_SIZE || (data[0] >> 6) != 2 || !(data[0] & 0x10)) {
+        return false;
+    }
+    gsize block = RTP_HEADER_SIZE + 4 * (data[0] & 0x0F);
+    if (got < block + 4 || ((data[block] << 8) | data[block + 1]) != ONE_BYTE_EXTENSION_PROFILE) {
+        return false;
+    }
+    gsize end = min(got, block + 4 + 4 * ((data[block + 2] << 8) | data[block + 3]));
+
+    bool have_capture = false, have_send = false;
+    guint64 capture_ntp = 0;
+    guint32 send_time = 0;
+    for (gsize i = block + 4; i < end;) {
+        if (data[i] == 0) {
+            i++;
+            continue;
+        }
+        int id = data[i] >> 4;
+        gsize length = (data[i] & 0x0F) + 1;
+        if (id == 15 || i + 1 + length > end) {
+            break;
+        }
+        if (id == CAPTURE_TIME_EXTENSION_ID && length == 8) {
+            for (gsize j = 0; j < 8; j++) {
+                capture_ntp = (capture_ntp << 8) | data[i + 1 + j];
+            }
+            have_capture = true;
+        } else if (id == SEND_TIME_EXTENSION_ID && length == 3) {
+            send_time = (data[i + 1] << 16) | (data[i + 2] << 8) | data[i + 3];
+            have_send = true;
+        }
+        i += 1 + length;
+    }
+    if (!have_capture || !have_send) {
+        return false;
+    }
+
+    // The send time wraps every 64 s; it is the first such time at or
+    // after capture
+    guint64 capture_units = capture_ntp >> 14;
+    guint64 send_units = (capture_units & ~(guint64)0xFFFFFF) | send_time;
+    if (send_units < capture_units) {
+        send_units += 1 << 24;
+    }
+    ssrc = ((guint32)data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+    capture_us = from_ntp(capture_ntp);
+    send_us = from_ntp(send_units << 14);
+    return true;
+}
+
+// The element a chain ends in: the first one downstream without a src pad
+static GstElement* find_sink(GstElement *element) {
+    gst_object_ref(element);
+    while (true) {
+        GstPad *src = gst_element_get_static_pad(element, "src");
+        if (!src) {
+            return element;
+        }
+        GstPad *peer = gst_pad_get_peer(src);
+        gst_object_unref(src);
+        GstElement *next = peer ? gst_pad_get_parent_element(peer) : NULL;
+        if (peer) {
+            gst_object_unref(peer);
+        }
+        gst_object_unref(element);
+        if (!next) {
+            return NULL;
+        }
+        element = next;
+    }
+}
+
+void LatencyHistogram::add(double ms) {
+    int bucket = ms <= 0 ? 0 : min((int)ms, LATENCY_HISTOGRAM_MS);
+    buckets[bucket]++;
+    count++;
+}
+
+double LatencyHistogram::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * (count - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            // The middle of the bucket
+            return i + 0.5;
+        }
+    }
+    return LATENCY_HISTOGRAM_MS;
+}
+
+void LatencyHistogram::clear() {
+    fill(buckets.begin(), buckets.end(), 0);
+    count = 0;
+}
+
+void CaptureLatencyMeter::Parts::clear() {
+    total.clear();
+    encode.clear();
+    network.clear();
+    playout.clear();
+    unsynced = 0;
+}
+
+LatencySummary CaptureLatencyMeter::Parts::summary() const {
+    LatencySummary summary;
+    summary.frames = total.count;
+    summary.unsynced = unsynced;
+    summary.total_p50 = total.percentile(0.5);
+    summary.total_p95 = total.percentile(0.95);
+    summary.total_p99 = total.percentile(0.99);
+    summary.encode_p50 = encode.percentile(0.5);
+    summary.network_p50 = network.percentile(0.5);
+    summary.playout_p50 = playout.percentile(0.5);
+    return summary;
+}
+
+CaptureLatencyMeter::CaptureLatencyMeter(MediaPipeline& media, const MediaProfile& profile)
+    : media(media), pad_added_id(0), polls(0), poll_source(NULL) {
+    if (profile.capture_time) {
+        for (GstElement *payloader : {media.video_payloader, media.audio_payloader}) {
+            GstPad *pad = payloader ? gst_element_get_static_pad(payloader, "src") : NULL;
+            if (pad) {
+                add_probe(pad, on_payloader_output, payloader);
+                gst_object_unref(pad);
+            }
+        }
+    }
+    if (!media.rtpbin_recv) {
+        return;
+    }
+    // After the pipeline's own handler, which links the depayloader
+    pad_added_id = g_signal_connect(media.rtpbin_recv, "pad-added", G_CALLBACK(on_pad_added), this);
+    // The peer's sender reports arrive at the receiving sessions; with
+    // BUNDLE there is only the one
+    for (guint id : {(guint)VIDEO_SESSION, (guint)AUDIO_SESSION}) {
+        GObject *session = NULL;
+        g_signal_emit_by_name(media.rtpbin_recv, "get-internal-session", id, &session);
+        if (session) {
+            gulong handler = g_signal_connect(session, "on-receiving-rtcp", G_CALLBACK(on_receiving_rtcp), this);
+            rtcp_handlers.push_back({session, handler});
+        }
+    }
+}
+
+CaptureLatencyMeter::~CaptureLatencyMeter() {
+    stop();
+}
+
+void CaptureLatencyMeter::start(GMainContext *context) {
+    if (poll_source) {
+        return;
+    }
+    poll_source = g_timeout_source_new(LATENCY_POLL_INTERVAL_MS);
+    g_source_set_callback(poll_source, on_poll, this, NULL);
+    g_source_attach(poll_source, context);
+}
+
+void CaptureLatencyMeter::stop() {
+    if (poll_source) {
+        g_source_destroy(poll_source);
+        g_source_unref(poll_source);
+        poll_source = NULL;
+    }
+    if (pad_added_id) {
+        g_signal_handler_disconnect(media.rtpbin_recv, pad_added_id);
+        pad_added_id = 0;
+    }
+    for (const auto& handler : rtcp_handlers) {
+        g_signal_handler_disconnect(handler.first, handler.second);
+        g_object_unref(handler.first);
+    }
+    rtcp_handlers.clear();
+    // Chains stay until the meter goes, for a probe call already under way
+    lock_guard<mutex> guard(lock);
+    for (const auto& probe : probes) {
+        gst_pad_remove_probe(probe.first, probe.second);
+        gst_object_unref(probe.first);
+    }
+    probes.clear();
+}
+
+void CaptureLatencyMeter::add_probe(GstPad *pad, GstPadProbeCallback callback, gpointer user_data) {
+    gulong id = gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                                  callback, user_data, NULL);
+    probes.push_back({GST_PAD(gst_object_ref(pad)), id});
+}
+
+GstPadProbeReturn CaptureLatencyMeter::on_payloader_output(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    GstElement *payloader = (GstElement*)user_data;
+    gint64 now = g_get_real_time();
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        guint length = gst_buffer_list_length(list);
+        GstBufferList *stamped_list = gst_buffer_list_new_sized(length);
+        for (guint i = 0; i < length; i++) {
+            GstBuffer *buffer = gst_buffer_list_get(list, i);
+            GstBuffer *stamped = stamp_packet(buffer, capture_time_us(payloader, GST_BUFFER_PTS(buffer)), now);
+            gst_buffer_list_add(stamped_list, stamped ? stamped : gst_buffer_ref(buffer));
+        }
+        gst_buffer_list_unref(list);
+        GST_PAD_PROBE_INFO_DATA(info) = stamped_list;
+    } else {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstBuffer *stamped = stamp_packet(buffer, capture_time_us(payloader, GST_BUFFER_PTS(buffer)), now);
+        if (stamped) {
+            gst_buffer_unref(buffer);
+            GST_PAD_PROBE_INFO_DATA(info) = stamped;
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void CaptureLatencyMeter::on_pad_added(GstElement *rtpbin, GstPad *pad, gpointer user_data) {
+    CaptureLatencyMeter *meter = (CaptureLatencyMeter*)user_data;
+    gchar *name = gst_pad_get_name(pad);
+    unsigned int session, ssrc, pt;
+    bool media_pad = sscanf(name, "recv_rtp_src_%u_%u_%u", &session, &ssrc, &pt) == 3 &&
+                     (pt == VIDEO_PAYLOAD_TYPE || pt == AUDIO_PAYLOAD_TYPE);
+    g_free(name);
+    GstPad *depayloader_sink = media_pad ? gst_pad_get_peer(pad) : NULL;
+    if (!depayloader_sink) {
+        return;
+    }
+    GstElement *depayloader = gst_pad_get_parent_element(depayloader_sink);
+    GstElement *sink = depayloader ? find_sink(depayloader) : NULL;
+    GstPad *sink_pad = sink ? gst_element_get_static_pad(sink, "sink") : NULL;
+    if (sink_pad) {
+        Chain *chain = new Chain();
+        chain->meter = meter;
+        chain->video = pt == VIDEO_PAYLOAD_TYPE;
+        lock_guard<mutex> guard(meter->lock);
+        meter->chains.emplace_back(chain);
+        meter->add_probe(depayloader_sink, on_depayloader_input, chain);
+        meter->add_probe(sink_pad, on_sink_input, chain);
+    }
+    if (sink_pad) {
+        gst_object_unref(sink_pad);
+    }
+    if (sink) {
+        gst_object_unref(sink);
+    }
+    if (depayloader) {
+        gst_object_unref(depayloader);
+    }
+    gst_object_unref(depayloader_sink);
+}
+
+GstPadProbeReturn CaptureLatencyMeter::on_depayloader_input(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    Chain *chain = (Chain*)user_data;
+    gint64 now = g_get_real_time();
+    lock_guard<mutex> guard(chain->meter->lock);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); i++) {
+            chain->meter->depayloaded(*chain, gst_buffer_list_get(list, i), now);
+        }
+    } else {
+        chain->meter->depayloaded(*chain, GST_PAD_PROBE_INFO_BUFFER(info), now);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn CaptureLatencyMeter::on_sink_input(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    Chain *chain = (Chain*)user_data;
+    gint64 now = g_get_real_time();
+    lock_guard<mutex> guard(chain->meter->lock);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); i++) {
+            chain->meter->rendered(*chain, gst_buffer_list_get(list, i), now);
+        }
+    } else {
+        chain->meter->rendered(*chain, GST_PAD_PROBE_INFO_BUFFER(info), now);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// A frame is one PTS; it can be decoded once its last packet is in, so
+// that packet's times count
+void CaptureLatencyMeter::depayloaded(Chain& chain, GstBuffer *buffer, gint64 now_us) {
+    Pending frame;
+    frame.pts = GST_BUFFER_PTS(buffer);
+    frame.depayload_us = now_us;
+    if (!GST_CLOCK_TIME_IS_VALID(frame.pts) || !read_stamps(buffer, frame.ssrc, frame.capture_us, frame.send_us)) {
+        return;
+    }
+    if (!chain.pending.empty() && chain.pending.back().pts == frame.pts) {
+        chain.pending.back() = frame;
+        return;
+    }
+    chain.pending.push_back(frame);
+    if (chain.pending.size() > LATENCY_PENDING_FRAMES) {
+        chain.pending.pop_front();
+    }
+}
+
+void CaptureLatencyMeter::rendered(Chain& chain, GstBuffer *buffer, gint64 now_us) {
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+        return;
+    }
+    // Decoders keep the PTS; the latest frame at or before it is the one
+    auto match = chain.pending.end();
+    for (auto it = chain.pending.begin(); it != chain.pending.end() && it->pts <= pts; ++it) {
+        match = it;
+    }
+    if (match == chain.pending.end()) {
+        return;
+    }
+    Pending frame = *match;
+    chain.pending.erase(chain.pending.begin(), match + 1);
+    if (pts - frame.pts > LATENCY_MATCH_WINDOW_MS * GST_MSECOND) {
+        return;
+    }
+
+    Parts& call = chain.video ? video_call : audio_call;
+    Parts& window = chain.video ? video_window : audio_window;
+    auto offset = offsets.find(frame.ssrc);
+    if (offset == offsets.end() || !offset->second.known) {
+        call.unsynced++;
+        window.unsynced++;
+        return;
+    }
+    // Sender times in our clock
+    gint64 capture_us = frame.capture_us + offset->second.offset_us;
+    gint64 send_us = frame.send_us + offset->second.offset_us;
+    for (Parts *parts : {&call, &window}) {
+        parts->total.add((now_us - capture_us) / 1000.0);
+        parts->encode.add((frame.send_us - frame.capture_us) / 1000.0);
+        parts->network.add((frame.depayload_us - send_us) / 1000.0);
+        parts->playout.add((now_us - frame.depayload_us) / 1000.0);
+    }
+}
+
+// Each sender report's NTP time is the sender's clock as it went out; the
+// least delayed of the last few is closest to a one-way trip
+void CaptureLatencyMeter::on_receiving_rtcp(GObject*, GstBuffer *buffer, gpointer user_data) {
+    CaptureLatencyMeter *meter = (CaptureLatencyMeter*)user_data;
+    gint64 now = g_get_real_time();
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+    lock_guard<mutex> guard(meter->lock);
+    // A compound packet: each starts with its length in 32-bit words, less one
+    for (gsize i = 0; i + 4 <= map.size;) {
+        const uint8_t *packet = map.data + i;
+        gsize length = 4 * (((packet[2] << 8) | packet[3]) + 1);
+        if ((packet[0] >> 6) != 2 || i + length > map.size) {
+            break;
+        }
+        if (packet[1] == RTCP_SENDER_REPORT && length >= 16) {
+            guint32 ssrc = ((guint32)packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+            guint64 ntp = 0;
+            for (int j = 0; j < 8; j++) {
+                ntp = (ntp << 8) | packet[8 + j];
+            }
+            deque<gint64>& samples = meter->offsets[ssrc].samples_us;
+            samples.push_back(now - from_ntp(ntp));
+            if (samples.size() > LATENCY_OFFSET_REPORTS) {
+                samples.pop_front();
+            }
+        }
+        i += length;
+    }
+    gst_buffer_unmap(buffer, &map);
+}
+
+// Round trip from the peer's receiver reports on what we send; 0 until the
+// peer has seen a sender report
+double CaptureLatencyMeter::read_rtt_ms() {
+    GObject *session = NULL;
+    g_signal_emit_by_name(media.rtpbin_send, "get-internal-session", (guint)VIDEO_SESSION, &session);
+    if (!session) {
+        return 0;
+    }
+    GstStructure *stats = NULL;
+    g_object_get(session, "stats", &stats, NULL);
+    g_object_unref(session);
+    if (!stats) {
+        return 0;
+    }
+
+    double rtt_ms = 0;
+    const GValue *sources = gst_structure_get_value(stats, "source-stats");
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    GValueArray *array = sources ? (GValueArray*)g_value_get_boxed(sources) : NULL;
+    for (guint i = 0; array && i < array->n_values; i++) {
+        const GstStructure *source = gst_value_get_structure(g_value_array_get_nth(array, i));
+        gboolean internal = FALSE;
+        gboolean have_rb = FALSE;
+        guint round_trip = 0;
+        gst_structure_get_boolean(source, "internal", &internal);
+        gst_structure_get_boolean(source, "have-rb", &have_rb);
+        gst_structure_get_uint(source, "rb-round-trip", &round_trip);
+        if (internal && have_rb && round_trip > 0) {
+            // In 1/65536 s
+            rtt_ms = max(rtt_ms, round_trip * 1000.0 / 65536.0);
+        }
+    }
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    gst_structure_free(stats);
+    return rtt_ms;
+}
+
+gboolean CaptureLatencyMeter::on_poll(gpointer user_data) {
+    CaptureLatencyMeter *meter = (CaptureLatencyMeter*)user_data;
+    double rtt_ms = meter->read_rtt_ms();
+    lock_guard<mutex> guard(meter->lock);
+    // Without a round trip the offset would carry the whole one-way delay
+    if (rtt_ms > 0) {
+        for (auto& entry : meter->offsets) {
+            Offset& offset = entry.second;
+            if (!offset.samples_us.empty()) {
+                gint64 least = *min_element(offset.samples_us.begin(), offset.samples_us.end());
+                offset.offset_us = least - (gint64)(rtt_ms * 1000 / 2);
+                offset.known = true;
+            }
+        }
+    }
+    if (++meter->polls % LATENCY_REPORT_POLLS == 0) {
+        meter->report("video", meter->video_window);
+        meter->report("audio", meter->audio_window);
+    }
+    return TRUE;
+}
+
+void CaptureLatencyMeter::report(const char* kind, Parts& window) {
+    LatencySummary summary = window.summary();
+    window.clear();
+    if (summary.frames == 0) {
+        return;
+    }
+    cout << "Latency " << kind << ": " << (int)summary.total_p50 << " ms median, " << (int)summary.total_p95
+         << " ms p95 over " << summary.frames << " frames (encode " << (int)summary.encode_p50
+         << ", network + jitter buffer " << (int)summary.network_p50 << ", decode + render "
+         << (int)summary.playout_p50 << ")" << endl;
+}
+
+LatencySummary CaptureLatencyMeter::video_summary() {
+    lock_guard<mutex> guard(lock);
+    return video_call.summary();
+}
+
+LatencySummary CaptureLatencyMeter::audio_summary() {
+    lock_guard<mutex> guard(lock);
+    return audio_call.summary();
+}
+
+void CaptureLatencyMeter::reset_summaries() {
+    lock_guard<mutex> guard(lock);
+    video_call.clear();
+    audio_call.clear();
+}
+
+vector<double> CaptureLatencyMeter::clock_offsets_ms() {
+    lock_guard<mutex> guard(lock);
+    vector<double> result;
+    for (const auto& entry : offsets) {
+        if (entry.second.known) {
+            result.push_back(entry.second.offset_us / 1000.0);
+        }
+    }
+    return result;
+}
+
+void CaptureLatencyMeter::print_summary() {
+    for (const char* kind : {"video", "audio"}) {
+        LatencySummary summary = kind[0] == 'v' ? video_summary() : audio_summary();
+        if (summary.frames == 0 && summary.unsynced == 0) {
+            continue;
+        }
+        cout << "Call latency " << kind << ": " << (int)summary.total_p50 << " ms median, "
+             << (int)summary.total_p95 << " ms p95 over " << summary.frames << " frames (encode "
+             << (int)summary.encode_p50 << ", network + jitter buffer " << (int)summary.network_p50
+             << ", decode + render " << (int)summary.playout_p50 << ")";
+        if (summary.unsynced) {
+            cout << "; " << summary.unsynced << " frames before the clock offset was known";
+        }
+        cout << endl;
+    }
+}
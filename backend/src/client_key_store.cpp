@@ -0,0 +1,248 @@
+#include "client_key_store.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+using namespace std;
+using json = nlohmann::json;
+
+static const char STORE_MAGIC[8] = {'Q', 'S', 'V', 'C', 'K', 'E', 'Y', '1'};
+static const size_t RECORD_HEADER_SIZE = 10;  // crc + name length + key length
+static const size_t MAX_KEY_SIZE = 1 << 16;
+
+static uint32_t crc32(const uint8_t* data, size_t len) {
+    static uint32_t table[256];
+    static bool table_ready = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)table_ready;
+    
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+ClientKeyStore::ClientKeyStore(const string& path) : path(path), fd(-1) {
+}
+
+ClientKeyStore::~ClientKeyStore() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool ClientKeyStore::open() {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        cerr << "SERVER: Cannot open key store " << path << endl;
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return false;
+    }
+    
+    if (st.st_size == 0) {
+        if (write(fd, STORE_MAGIC, sizeof(STORE_MAGIC)) != (ssize_t)sizeof(STORE_MAGIC) || fdatasync(fd) < 0) {
+            cerr << "SERVER: Cannot initialize key store " << path << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    size_t file_size = st.st_size;
+    void *map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        cerr << "SERVER: Cannot map key store " << path << endl;
+        return false;
+    }
+    
+    const uint8_t *data = (const uint8_t*)map;
+    if (file_size < sizeof(STORE_MAGIC) || memcmp(data, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) {
+        cerr << "SERVER: " << path << " is not a key store" << endl;
+        munmap(map, file_size);
+        return false;
+    }
+    
+    size_t offset = sizeof(STORE_MAGIC);
+    while (offset + RECORD_HEADER_SIZE <= file_size) {
+        const uint8_t *rec = data + offset;
+        size_t name_len = (rec[4] << 8) | rec[5];
+        size_t key_len = get_u32(rec + 6);
+        size_t rec_len = RECORD_HEADER_SIZE + name_len + key_len;
+        
+        if (key_len > MAX_KEY_SIZE || offset + rec_len > file_size ||
+            crc32(rec + 4, rec_len - 4) != get_u32(rec)) {
+            break;
+        }
+        
+        string username((const char*)rec + RECORD_HEADER_SIZE, name_len);
+        const uint8_t *key = rec + RECORD_HEADER_SIZE + name_len;
+        // Stores written before enrollment became once-only may hold a later
+        // record for the same name; only the original enrollment is trusted
+        if (!index.emplace(username, vector<uint8_t>(key, key + key_len)).second) {
+            cerr << "SERVER: Ignoring duplicate key store record for " << username << endl;
+        }
+        offset += rec_len;
+    }
+    
+    munmap(map, file_size);
+    
+    if (offset != file_size) {
+        cerr << "SERVER: Discarding " << (file_size - offset) << " bytes of incomplete key store record" << endl;
+        if (ftruncate(fd, offset) < 0) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool ClientKeyStore::lookup(const string& username, vector<uint8_t>& public_key) const {
+    shared_lock<shared_mutex> lock(index_mutex);
+    auto it = index.find(username);
+    if (it == index.end()) {
+        return false;
+    }
+    public_key = it->second;
+    return true;
+}
+
+bool ClientKeyStore::enroll(const string& username, const vector<uint8_t>& public_key) {
+    if (username.size() > 0xFFFF || public_key.size() > MAX_KEY_SIZE) {
+        return false;
+    }
+    
+    vector<uint8_t> rec(RECORD_HEADER_SIZE + username.size() + public_key.size());
+    rec[4] = username.size() >> 8;
+    rec[5] = username.size() & 0xFF;
+    put_u32(rec.data() + 6, public_key.size());
+    memcpy(rec.data() + RECORD_HEADER_SIZE, username.data(), username.size());
+    memcpy(rec.data() + RECORD_HEADER_SIZE + username.size(), public_key.data(), public_key.size());
+    put_u32(rec.data(), crc32(rec.data() + 4, rec.size() - 4));
+    
+    // Only enroll() adds to the index, so holding append_mutex keeps the check
+    // and the insert atomic while lookups go on under the shared lock
+    lock_guard<mutex> append_lock(append_mutex);
+    {
+        shared_lock<shared_mutex> lock(index_mutex);
+        if (index.count(username)) {
+            cerr << "SERVER: " << username << " is already enrolled" << endl;
+            return false;
+        }
+    }
+    
+    // A single O_APPEND write keeps records contiguous; the record only enters
+    // the index once it is durable
+    if (write(fd, rec.data(), rec.size()) != (ssize_t)rec.size() || fdatasync(fd) < 0) {
+        cerr << "SERVER: Failed to append to key store" << endl;
+        return false;
+    }
+    
+    unique_lock<shared_mutex> lock(index_mutex);
+    index[username] = public_key;
+    return true;
+}
+
+size_t ClientKeyStore::size() const {
+    shared_lock<shared_mutex> lock(index_mutex);
+    return index.size();
+}
+
+bool ClientKeyStore::migrate_from_json(const string& json_path) {
+    ifstream file(json_path);
+    if (!file.is_open()) {
+        return false;
+    }
+    
+    json db;
+    try {
+        file >> db;
+    } catch (const json::exception& e) {
+        cerr << "SERVER: Cannot parse " << json_path << ": " << e.what() << endl;
+        return false;
+    }
+    file.close();
+    
+    if (!db.is_object()) {
+        cerr << "SERVER: " << json_path << " is not a JSON object, not migrating" << endl;
+        return false;
+    }
+    
+    // This runs during the key store's static initialization, so nothing in a
+    // hand-edited or corrupt file may throw out of here
+    size_t migrated = 0, skipped = 0;
+    try {
+        for (auto it = db.begin(); it != db.end(); ++it) {
+            const json& entry = it.value();
+            if (!entry.is_object() || !entry.contains("dilithium_public_key")) {
+                cerr << "SERVER: Skipping malformed entry for " << it.key() << " in " << json_path << endl;
+                skipped++;
+                continue;
+            }
+            
+            const json& key_json = entry["dilithium_public_key"];
+            bool valid = key_json.is_array() && !key_json.empty() && key_json.size() <= MAX_KEY_SIZE;
+            vector<uint8_t> key;
+            for (size_t i = 0; valid && i < key_json.size(); i++) {
+                const json& byte = key_json[i];
+                valid = byte.is_number_unsigned() && byte.get<uint64_t>() <= 0xFF;
+                key.push_back(valid ? byte.get<uint8_t>() : 0);
+            }
+            if (!valid) {
+                cerr << "SERVER: Skipping invalid key for " << it.key() << " in " << json_path << endl;
+                skipped++;
+                continue;
+            }
+            
+            // Keys enrolled in the binary store are newer than anything in the JSON file
+            vector<uint8_t> existing;
+            if (lookup(it.key(), existing)) {
+                continue;
+            }
+            if (!enroll(it.key(), key)) {
+                return false;
+            }
+            migrated++;
+        }
+    } catch (const json::exception& e) {
+        cerr << "SERVER: Cannot migrate " << json_path << ": " << e.what() << endl;
+        return false;
+    }
+    
+    rename(json_path.c_str(), (json_path + ".migrated").c_str());
+    cout << "SERVER: Migrated " << migrated << " Dilithium keys from " << json_path;
+    if (skipped) {
+        cout << " (" << skipped << " invalid entries skipped)";
+    }
+    cout << endl;
+    return true;
+}
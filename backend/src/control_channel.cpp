@@ -0,0 +1,291 @@
+#include "control_channel.h"
+#include "handshake_codec.h"
+#include "crypto_utils.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define CONTROL_TAG_SIZE 16
+#define CONTROL_NONCE_SIZE 12
+
+// 4 zero bytes || 64-bit big-endian record sequence number
+static void record_nonce(uint64_t seq, uint8_t* nonce) {
+    memset(nonce, 0, CONTROL_NONCE_SIZE);
+    for (int i = 0; i < 8; i++) {
+        nonce[CONTROL_NONCE_SIZE - 1 - i] = (uint8_t)(seq >> (8 * i));
+    }
+}
+
+ControlChannel::ControlChannel(ControlConnection& connection, bool is_client)
+    : fd(connection.fd), recv_seq(0), in(move(connection.unread)), out(move(connection.unsent)),
+      send_seq(0), context(NULL), io(NULL), read_source(NULL), write_source(NULL),
+      pending_source(NULL) {
+    connection.fd = -1;
+
+    // Client-to-server key first
+    const uint8_t *client_key = connection.secret.data();
+    const uint8_t *server_key = connection.secret.data() + 32;
+    if (connection.secret.size() != CONTROL_SECRET_SIZE) {
+        cerr << "Control channel: invalid secret" << endl;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+        memset(send_key, 0, sizeof(send_key));
+        memset(recv_key, 0, sizeof(recv_key));
+        return;
+    }
+    memcpy(send_key, is_client ? client_key : server_key, sizeof(send_key));
+    memcpy(recv_key, is_client ? server_key : client_key, sizeof(recv_key));
+
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+ControlChannel::~ControlChannel() {
+    close(0);
+    memset(send_key, 0, sizeof(send_key));
+    memset(recv_key, 0, sizeof(recv_key));
+}
+
+bool ControlChannel::attach(GMainContext *context, MessageHandler on_message, CloseHandler on_close) {
+    if (fd < 0) {
+        return false;
+    }
+
+    this->context = context;
+    message_handler = on_message;
+    close_handler = on_close;
+
+    io = g_io_channel_unix_new(fd);
+    read_source = g_io_create_watch(io, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR));
+    g_source_set_callback(read_source, (GSourceFunc)on_readable, this, NULL);
+    g_source_attach(read_source, context);
+
+    // Bytes that came in with the last handshake message are handled on the
+    // loop too, not here
+    if (!in.empty()) {
+        pending_source = g_idle_source_new();
+        g_source_set_callback(pending_source, on_pending, this, NULL);
+        g_source_attach(pending_source, context);
+    }
+
+    lock_guard<mutex> lock(out_mutex);
+    flush_locked();
+    return true;
+}
+
+bool ControlChannel::send(uint8_t type, const vector<uint8_t>& payload) {
+    uint32_t record_len = 1 + payload.size() + CONTROL_TAG_SIZE;
+    if (record_len > MAX_HANDSHAKE_MESSAGE_SIZE) {
+        return false;
+    }
+
+    vector<uint8_t> plaintext(1 + payload.size());
+    plaintext[0] = type;
+    if (!payload.empty()) {
+        memcpy(plaintext.data() + 1, payload.data(), payload.size());
+    }
+
+    lock_guard<mutex> lock(out_mutex);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Sealed in place behind its header, which is authenticated as AAD
+    size_t offset = out.size();
+    out.resize(offset + HANDSHAKE_HEADER_SIZE + record_len);
+    uint8_t *header = out.data() + offset;
+    header[0] = MSG_CONTROL;
+    memcpy(header + 1, &record_len, sizeof(record_len));
+
+    uint8_t nonce[CONTROL_NONCE_SIZE];
+    record_nonce(send_seq++, nonce);
+    if (!aes256_gcm_seal_with_nonce(send_key, nonce, plaintext.data(), plaintext.size(), header,
+                                    HANDSHAKE_HEADER_SIZE, header + HANDSHAKE_HEADER_SIZE)) {
+        out.resize(offset);
+        return false;
+    }
+    return flush_locked();
+}
+
+// Write without blocking; the rest waits for a G_IO_OUT watch
+bool ControlChannel::flush_locked() {
+    size_t written = 0;
+    while (written < out.size()) {
+        ssize_t n = ::send(fd, out.data() + written, out.size() - written, MSG_NOSIGNAL);
+        if (n > 0) {
+            written += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // The read watch reports the broken connection
+        return false;
+    }
+    out.erase(out.begin(), out.begin() + written);
+
+    if (!out.empty() && io && !write_source) {
+        write_source = g_io_create_watch(io, G_IO_OUT);
+        g_source_set_callback(write_source, (GSourceFunc)on_writable, this, NULL);
+        g_source_attach(write_source, context);
+    }
+    return true;
+}
+
+gboolean ControlChannel::on_writable(GIOChannel *io, GIOCondition condition, gpointer user_data) {
+    ControlChannel *channel = (ControlChannel*)user_data;
+    lock_guard<mutex> lock(channel->out_mutex);
+    if (!channel->write_source) {
+        // Closed while this dispatch waited for the lock
+        return FALSE;
+    }
+    if (channel->flush_locked() && !channel->out.empty()) {
+        return TRUE;
+    }
+    g_source_unref(channel->write_source);
+    channel->write_source = NULL;
+    return FALSE;
+}
+
+gboolean ControlChannel::on_readable(GIOChannel *io, GIOCondition condition, gpointer user_data) {
+    ControlChannel *channel = (ControlChannel*)user_data;
+    uint8_t buf[4096];
+    bool peer_closed = false;
+    while (true) {
+        ssize_t n = recv(channel->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            channel->in.insert(channel->in.end(), buf, buf + n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            peer_closed = true;
+        }
+        break;
+    }
+
+    if (!channel->receive_records() || peer_closed) {
+        // fail() destroys this source
+        channel->fail();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean ControlChannel::on_pending(gpointer user_data) {
+    ControlChannel *channel = (ControlChannel*)user_data;
+    g_source_unref(channel->pending_source);
+    channel->pending_source = NULL;
+    if (!channel->receive_records()) {
+        channel->fail();
+    }
+    return FALSE;
+}
+
+// Open and deliver every complete record in the receive buffer
+bool ControlChannel::receive_records() {
+    size_t offset = 0;
+    vector<uint8_t> plaintext;
+    while (fd >= 0) {
+        uint8_t msg_type;
+        uint32_t record_len;
+        if (!peek_frame_header(in.data() + offset, in.size() - offset, msg_type, record_len)) {
+            break;
+        }
+        if (msg_type != MSG_CONTROL || record_len <= CONTROL_TAG_SIZE ||
+            record_len > MAX_HANDSHAKE_MESSAGE_SIZE) {
+            cerr << "Control channel: malformed record" << endl;
+            return false;
+        }
+        if (in.size() - offset < HANDSHAKE_HEADER_SIZE + record_len) {
+            break;
+        }
+
+        const uint8_t *header = in.data() + offset;
+        uint8_t nonce[CONTROL_NONCE_SIZE];
+        record_nonce(recv_seq++, nonce);
+        plaintext.resize(record_len - CONTROL_TAG_SIZE);
+        if (!aes256_gcm_open_with_nonce(recv_key, nonce, header + HANDSHAKE_HEADER_SIZE, record_len,
+                                        header, HANDSHAKE_HEADER_SIZE, plaintext.data())) {
+            cerr << "Control channel: record failed authentication" << endl;
+            return false;
+        }
+        offset += HANDSHAKE_HEADER_SIZE + record_len;
+
+        if (message_handler) {
+            message_handler(plaintext[0], vector<uint8_t>(plaintext.begin() + 1, plaintext.end()));
+        }
+    }
+
+    if (fd >= 0) {
+        in.erase(in.begin(), in.begin() + offset);
+    }
+    return true;
+}
+
+void ControlChannel::fail() {
+    if (fd < 0) {
+        return;
+    }
+    close(0);
+    if (close_handler) {
+        close_handler();
+    }
+}
+
+void ControlChannel::close(int timeout_ms) {
+    lock_guard<mutex> lock(out_mutex);
+    if (fd < 0) {
+        return;
+    }
+
+    // Best effort: a hang-up should reach the peer if the socket allows it
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    while (!out.empty() && flush_locked() && !out.empty()) {
+        int remaining = (int)chrono::duration_cast<chrono::milliseconds>(
+            deadline - chrono::steady_clock::now()).count();
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0) {
+            break;
+        }
+    }
+
+    if (pending_source) {
+        g_source_destroy(pending_source);
+        g_source_unref(pending_source);
+        pending_source = NULL;
+    }
+    if (read_source) {
+        g_source_destroy(read_source);
+        g_source_unref(read_source);
+        read_source = NULL;
+    }
+    if (write_source) {
+        g_source_destroy(write_source);
+        g_source_unref(write_source);
+        write_source = NULL;
+    }
+    if (io) {
+        g_io_channel_unref(io);
+        io = NULL;
+    }
+    ::close(fd);
+    fd = -1;
+    out.clear();
+    in.clear();
+}
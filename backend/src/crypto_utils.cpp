@@ -1,12 +1,22 @@
 #include "crypto_utils.h"
+#include "handshake_trace.h"
 #include <openssl/evp.h>
 #include <openssl/kdf.h>
 #include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <openssl/core_names.h>
 #include <iostream>
+#include <cstring>
 
 using namespace std;
 
-bool derive_srtp_key(const uint8_t* kyber_secret, uint8_t* srtp_key) {
+static const size_t GCM_IV_LEN = 12;
+static const size_t GCM_TAG_LEN = 16;
+
+bool hkdf_sha256(const uint8_t* ikm, size_t ikm_len, const uint8_t* salt, size_t salt_len,
+                 const string& info, uint8_t* out, size_t out_len) {
+    PhaseTimer timer(PHASE_HKDF);
     EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
     if (pctx == NULL) {
         cerr << "Failed to create HKDF context" << endl;
@@ -25,21 +35,26 @@ bool derive_srtp_key(const uint8_t* kyber_secret, uint8_t* srtp_key) {
         return false;
     }
 
-    if (EVP_PKEY_CTX_set1_hkdf_key(pctx, kyber_secret, 32) <= 0) {
+    if (salt_len > 0 && EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, salt_len) <= 0) {
+        cerr << "HKDF set salt failed" << endl;
+        EVP_PKEY_CTX_free(pctx);
+        return false;
+    }
+
+    if (EVP_PKEY_CTX_set1_hkdf_key(pctx, ikm, ikm_len) <= 0) {
         cerr << "HKDF set key failed" << endl;
         EVP_PKEY_CTX_free(pctx);
         return false;
     }
 
-    const unsigned char info[] = "SRTP-AES256-SALT";
-    if (EVP_PKEY_CTX_add1_hkdf_info(pctx, info, sizeof(info) - 1) <= 0) {
+    if (EVP_PKEY_CTX_add1_hkdf_info(pctx, (const unsigned char*)info.data(), info.size()) <= 0) {
         cerr << "HKDF add info failed" << endl;
         EVP_PKEY_CTX_free(pctx);
         return false;
     }
 
-    size_t outlen = 46;
-    if (EVP_PKEY_derive(pctx, srtp_key, &outlen) <= 0) {
+    size_t outlen = out_len;
+    if (EVP_PKEY_derive(pctx, out, &outlen) <= 0 || outlen != out_len) {
         cerr << "HKDF derive failed" << endl;
         EVP_PKEY_CTX_free(pctx);
         return false;
@@ -49,6 +64,15 @@ bool derive_srtp_key(const uint8_t* kyber_secret, uint8_t* srtp_key) {
     return true;
 }
 
+bool derive_srtp_key(const uint8_t* kyber_secret, uint8_t* srtp_key) {
+    return hkdf_sha256(kyber_secret, 32, NULL, 0, "SRTP-AES256-SALT", srtp_key, 46);
+}
+
+bool derive_control_secret(const uint8_t* kyber_secret, uint8_t* control_secret) {
+    return hkdf_sha256(kyber_secret, 32, NULL, 0, "QSVC control channel", control_secret,
+                       CONTROL_SECRET_SIZE);
+}
+
 vector<uint8_t> compute_hmac_sha512(const vector<uint8_t>& key, const vector<uint8_t>& data) {
     unsigned char hmac_result[EVP_MAX_MD_SIZE];
     unsigned int hmac_len;
@@ -57,3 +81,118 @@ vector<uint8_t> compute_hmac_sha512(const vector<uint8_t>& key, const vector<uin
     
     return vector<uint8_t>(hmac_result, hmac_result + hmac_len);
 }
+
+vector<uint8_t> compute_hmac_sha512(const uint8_t* key, size_t key_len,
+                                    const ByteSpan* parts, size_t count) {
+    PhaseTimer timer(PHASE_HMAC);
+    vector<uint8_t> tag;
+    EVP_MAC *mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    EVP_MAC_CTX *ctx = mac ? EVP_MAC_CTX_new(mac) : NULL;
+    
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA512", 0),
+        OSSL_PARAM_construct_end()
+    };
+    
+    bool ok = ctx && EVP_MAC_init(ctx, key, key_len, params) == 1;
+    for (size_t i = 0; i < count; i++) {
+        ok = ok && (parts[i].len == 0 || EVP_MAC_update(ctx, parts[i].data, parts[i].len) == 1);
+    }
+    
+    unsigned char out[EVP_MAX_MD_SIZE];
+    size_t out_len;
+    if (ok && EVP_MAC_final(ctx, out, &out_len, sizeof(out)) == 1) {
+        tag.assign(out, out + out_len);
+    } else {
+        cerr << "HMAC-SHA512 failed" << endl;
+    }
+    
+    EVP_MAC_CTX_free(ctx);
+    EVP_MAC_free(mac);
+    return tag;
+}
+
+bool tags_equal(const vector<uint8_t>& a, const vector<uint8_t>& b) {
+    return !a.empty() && a.size() == b.size() && CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+bool random_bytes(uint8_t* out, size_t len) {
+    return RAND_bytes(out, (int)len) == 1;
+}
+
+bool aes256_gcm_seal_with_nonce(const uint8_t* key, const uint8_t* nonce, const uint8_t* plaintext,
+                                size_t len, const uint8_t* aad, size_t aad_len, uint8_t* sealed) {
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        cerr << "Failed to create cipher context" << endl;
+        return false;
+    }
+
+    int out_len;
+    bool ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, nonce) == 1 &&
+              (aad_len == 0 || EVP_EncryptUpdate(ctx, NULL, &out_len, aad, aad_len) == 1) &&
+              (len == 0 || EVP_EncryptUpdate(ctx, sealed, &out_len, plaintext, len) == 1) &&
+              EVP_EncryptFinal_ex(ctx, sealed + len, &out_len) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LEN, sealed + len) == 1;
+
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        cerr << "GCM encryption failed" << endl;
+    }
+    return ok;
+}
+
+bool aes256_gcm_open_with_nonce(const uint8_t* key, const uint8_t* nonce, const uint8_t* sealed,
+                                size_t sealed_len, const uint8_t* aad, size_t aad_len, uint8_t* plaintext) {
+    if (sealed_len < GCM_TAG_LEN) {
+        return false;
+    }
+
+    size_t ct_len = sealed_len - GCM_TAG_LEN;
+    uint8_t tag[GCM_TAG_LEN];
+    memcpy(tag, sealed + ct_len, GCM_TAG_LEN);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        cerr << "Failed to create cipher context" << endl;
+        return false;
+    }
+
+    int out_len;
+    bool ok = EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, nonce) == 1 &&
+              (aad_len == 0 || EVP_DecryptUpdate(ctx, NULL, &out_len, aad, aad_len) == 1) &&
+              (ct_len == 0 || EVP_DecryptUpdate(ctx, plaintext, &out_len, sealed, ct_len) == 1) &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LEN, tag) == 1 &&
+              EVP_DecryptFinal_ex(ctx, plaintext + ct_len, &out_len) == 1;
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+bool aes256_gcm_seal(const uint8_t* key, const vector<uint8_t>& plaintext,
+                     const vector<uint8_t>& aad, vector<uint8_t>& sealed) {
+    sealed.resize(GCM_IV_LEN + plaintext.size() + GCM_TAG_LEN);
+    if (!random_bytes(sealed.data(), GCM_IV_LEN)) {
+        cerr << "GCM IV generation failed" << endl;
+        return false;
+    }
+
+    return aes256_gcm_seal_with_nonce(key, sealed.data(), plaintext.data(), plaintext.size(),
+                                      aad.data(), aad.size(), sealed.data() + GCM_IV_LEN);
+}
+
+bool aes256_gcm_open(const uint8_t* key, const vector<uint8_t>& sealed,
+                     const vector<uint8_t>& aad, vector<uint8_t>& plaintext) {
+    if (sealed.size() < GCM_IV_LEN + GCM_TAG_LEN) {
+        return false;
+    }
+
+    plaintext.resize(sealed.size() - GCM_IV_LEN - GCM_TAG_LEN);
+    bool ok = aes256_gcm_open_with_nonce(key, sealed.data(), sealed.data() + GCM_IV_LEN,
+                                         sealed.size() - GCM_IV_LEN, aad.data(), aad.size(),
+                                         plaintext.data());
+    if (!ok) {
+        plaintext.clear();
+    }
+    return ok;
+}
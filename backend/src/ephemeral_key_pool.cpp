@@ -0,0 +1,125 @@
+#include "ephemeral_key_pool.h"
+#include <iostream>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static EphemeralKeyPool *global_key_pool = nullptr;
+
+static void wipe(SignedKyberKey& key) {
+    memset(key.secret_key.data(), 0, key.secret_key.size());
+}
+
+EphemeralKeyPool::EphemeralKeyPool(const DilithiumKeys& identity, const PqSuiteInfo& suite, size_t capacity)
+    : client_identity(identity), key_suite(suite), capacity(capacity), running(false),
+      hits(0), misses(0), generated(0) {
+}
+
+EphemeralKeyPool::~EphemeralKeyPool() {
+    stop();
+    memset(client_identity.secret_key.data(), 0, client_identity.secret_key.size());
+}
+
+void EphemeralKeyPool::start() {
+    lock_guard<mutex> lock(pool_mutex);
+    if (running) {
+        return;
+    }
+    running = true;
+    refill_thread = thread(&EphemeralKeyPool::refill_loop, this);
+}
+
+void EphemeralKeyPool::stop() {
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    pool_cv.notify_all();
+    refill_thread.join();
+    
+    for (SignedKyberKey& key : ready) {
+        wipe(key);
+    }
+    ready.clear();
+}
+
+bool EphemeralKeyPool::take(SignedKyberKey& key) {
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        if (!ready.empty()) {
+            key = move(ready.front());
+            ready.pop_front();
+            hits++;
+            pool_cv.notify_one();
+            return true;
+        }
+    }
+    
+    misses++;
+    return generate_signed_kyber_key(client_identity, key, key_suite);
+}
+
+KeyPoolStats EphemeralKeyPool::stats() const {
+    lock_guard<mutex> lock(pool_mutex);
+    return {ready.size(), capacity, hits.load(), misses.load(), generated.load()};
+}
+
+void EphemeralKeyPool::refill_loop() {
+    // Stay out of the way of the media and UI threads
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+    
+    while (true) {
+        {
+            unique_lock<mutex> lock(pool_mutex);
+            pool_cv.wait(lock, [this] { return !running || ready.size() < capacity; });
+            if (!running) {
+                return;
+            }
+        }
+        
+        SignedKyberKey key;
+        if (!generate_signed_kyber_key(client_identity, key, key_suite)) {
+            cerr << "CLIENT: Key pool refill failed" << endl;
+            return;
+        }
+        
+        lock_guard<mutex> lock(pool_mutex);
+        if (!running) {
+            wipe(key);
+            return;
+        }
+        ready.push_back(move(key));
+        generated++;
+    }
+}
+
+bool start_client_key_pool(size_t capacity, const PqSuiteInfo& suite) {
+    if (global_key_pool) {
+        return true;
+    }
+    
+    DilithiumKeys identity;
+    if (!load_or_generate_dilithium_keys(identity, suite)) {
+        return false;
+    }
+    
+    global_key_pool = new EphemeralKeyPool(identity, suite, capacity);
+    memset(identity.secret_key.data(), 0, identity.secret_key.size());
+    global_key_pool->start();
+    return true;
+}
+
+EphemeralKeyPool* client_key_pool() {
+    return global_key_pool;
+}
+
+void stop_client_key_pool() {
+    delete global_key_pool;
+    global_key_pool = nullptr;
+}
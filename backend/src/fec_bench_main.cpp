@@ -0,0 +1,412 @@
+#include <gst/gst.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "crypto_utils.h"
+#include "media_pipeline.h"
+#include "srtp_rekey.h"
+#include "bitrate_controller.h"
+
+using namespace std;
+
+// What FEC recovers and what it costs. A client and a server pipeline in one
+// process send live test video and audio to each other over loopback with the
+// bundle transport. A relay drops the client's RTP packets at random, at each
+// loss rate once without FEC and once with it, and reads the RTP headers
+// (sent in the clear under SRTP) of everything it passes or drops. A probe in
+// front of the server's video depayloader sees what survived the jitterbuffer
+// and the FEC decoder. A frame (one RTP timestamp) is intact when every one
+// of its packets got there; it is recovered when it is intact although the
+// relay dropped some of them. Overhead is FEC bytes over video bytes. Exits
+// non-zero if no frames get through or FEC recovers none.
+
+#define BENCH_IP "127.0.0.1"
+#define CLIENT_BASE_PORT 5700
+#define SERVER_BASE_PORT 5800
+#define BENCH_DRAIN_MS 500
+#define RTP_HEADER_SIZE 12
+
+struct FrameCount {
+    uint64_t frames;
+    uint64_t hit;         // Lost at least one packet at the relay
+    uint64_t intact;      // All packets reached the depayloader
+    uint64_t recovered;   // Hit, yet intact
+};
+
+struct RunResult {
+    FrameCount video;
+    uint64_t video_bytes;
+    uint64_t fec_bytes;
+    int fec_percentage;
+    bool failed;
+};
+
+struct RtpHeader {
+    int pt;
+    uint16_t seq;
+    uint32_t timestamp;
+};
+
+// RTP packets only; muxed RTCP (RFC 5761: second byte 192..223) is not
+static bool parse_rtp(const uint8_t* data, size_t len, RtpHeader& header) {
+    if (len < RTP_HEADER_SIZE || (data[0] >> 6) != 2 || (data[1] >= 192 && data[1] <= 223)) {
+        return false;
+    }
+    header.pt = data[1] & 0x7F;
+    header.seq = (data[2] << 8) | data[3];
+    header.timestamp = ((uint32_t)data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+    return true;
+}
+
+static uint64_t packet_key(uint32_t timestamp, uint16_t seq) {
+    return ((uint64_t)timestamp << 16) | seq;
+}
+
+// Client to server through a random drop, server to client untouched
+class LossyRelay {
+public:
+    LossyRelay() : running(false), video_bytes(0), fec_bytes(0) {}
+    ~LossyRelay() { stop(); }
+
+    bool start(double loss, unsigned int seed);
+    void stop();
+
+    // Video packets per timestamp, and which were dropped
+    map<uint32_t, vector<pair<uint16_t, bool>>> video_frames();
+    uint64_t video_byte_count() const { return video_bytes; }
+    uint64_t fec_byte_count() const { return fec_bytes; }
+
+private:
+    struct Relay {
+        int fd;
+        int to_port;
+        bool lossy;
+    };
+
+    bool add_relay(int from_port, int to_port, bool lossy);
+    void run();
+
+    vector<Relay> relays;
+    double loss;
+    mt19937 random;
+    atomic<bool> running;
+    thread worker;
+
+    mutex frames_mutex;
+    map<uint32_t, vector<pair<uint16_t, bool>>> frames;
+    atomic<uint64_t> video_bytes;
+    atomic<uint64_t> fec_bytes;
+};
+
+bool LossyRelay::add_relay(int from_port, int to_port, bool lossy) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(from_port);
+    inet_pton(AF_INET, BENCH_IP, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    relays.push_back({fd, to_port, lossy});
+    return true;
+}
+
+bool LossyRelay::start(double loss_rate, unsigned int seed) {
+    loss = loss_rate;
+    random.seed(seed);
+    // With BUNDLE the client sends to +0 and the server to +10
+    if (!add_relay(CLIENT_BASE_PORT + CLIENT_TO_SERVER_PORT_OFFSET, SERVER_BASE_PORT + CLIENT_TO_SERVER_PORT_OFFSET,
+                   true) ||
+        !add_relay(SERVER_BASE_PORT + SERVER_TO_CLIENT_PORT_OFFSET, CLIENT_BASE_PORT + SERVER_TO_CLIENT_PORT_OFFSET,
+                   false)) {
+        stop();
+        return false;
+    }
+    running = true;
+    worker = thread(&LossyRelay::run, this);
+    return true;
+}
+
+void LossyRelay::stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+    for (const Relay& relay : relays) {
+        close(relay.fd);
+    }
+    relays.clear();
+}
+
+map<uint32_t, vector<pair<uint16_t, bool>>> LossyRelay::video_frames() {
+    lock_guard<mutex> lock(frames_mutex);
+    return frames;
+}
+
+void LossyRelay::run() {
+    vector<struct pollfd> fds;
+    for (const Relay& relay : relays) {
+        fds.push_back({relay.fd, POLLIN, 0});
+    }
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    uint8_t buf[65536];
+    while (running) {
+        if (poll(fds.data(), fds.size(), 20) <= 0) {
+            continue;
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            const Relay& relay = relays[i];
+            ssize_t n;
+            while ((n = recv(relay.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                RtpHeader header;
+                bool rtp = relay.lossy && parse_rtp(buf, n, header);
+                bool drop = rtp && uniform(random) < loss;
+                if (rtp && header.pt == VIDEO_PAYLOAD_TYPE) {
+                    video_bytes += n;
+                    lock_guard<mutex> lock(frames_mutex);
+                    frames[header.timestamp].push_back({header.seq, drop});
+                } else if (rtp && header.pt == FEC_PAYLOAD_TYPE) {
+                    fec_bytes += n;
+                }
+                if (drop) {
+                    continue;
+                }
+
+                struct sockaddr_in to;
+                memset(&to, 0, sizeof(to));
+                to.sin_family = AF_INET;
+                to.sin_port = htons(relay.to_port);
+                inet_pton(AF_INET, BENCH_IP, &to.sin_addr);
+                sendto(relay.fd, buf, n, 0, (struct sockaddr*)&to, sizeof(to));
+            }
+        }
+    }
+}
+
+// Video packets that reached the server's depayloader
+struct Arrivals {
+    mutex lock;
+    set<uint64_t> packets;
+};
+
+static GstPadProbeReturn on_depayloader_input(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    Arrivals *arrivals = (Arrivals*)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    uint8_t header_bytes[RTP_HEADER_SIZE];
+    RtpHeader header;
+    if (gst_buffer_extract(buffer, 0, header_bytes, sizeof(header_bytes)) == sizeof(header_bytes) &&
+        parse_rtp(header_bytes, sizeof(header_bytes), header)) {
+        lock_guard<mutex> lock(arrivals->lock);
+        arrivals->packets.insert(packet_key(header.timestamp, header.seq));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+struct BenchState {
+    GMainLoop *loop;
+    bool failed;
+};
+
+static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer data) {
+    BenchState *state = (BenchState*)data;
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError *err;
+        gchar *debug;
+        gst_message_parse_error(msg, &err, &debug);
+        cerr << "Error: " << err->message << endl;
+        g_error_free(err);
+        g_free(debug);
+        state->failed = true;
+        g_main_loop_quit(state->loop);
+    }
+    return TRUE;
+}
+
+static gboolean on_done(gpointer data) {
+    g_main_loop_quit((GMainLoop*)data);
+    return FALSE;
+}
+
+static bool run(double loss, bool fec, int seconds, unsigned int seed, RunResult& result) {
+    result = RunResult();
+    MediaProfile client_profile;
+    client_profile.source = "test";
+    client_profile.sink = "none";
+    client_profile.transport = "bundle";
+    client_profile.fec = fec;
+    client_profile.base_port = CLIENT_BASE_PORT;
+    MediaProfile server_profile = client_profile;
+    server_profile.base_port = SERVER_BASE_PORT;
+
+    // Each side addresses the relay through its own base port
+    MediaPipeline client_media, server_media;
+    if (!build_media_pipeline(client_profile, MEDIA_ROLE_CLIENT, BENCH_IP, client_media)) {
+        return false;
+    }
+    if (!build_media_pipeline(server_profile, MEDIA_ROLE_SERVER, BENCH_IP, server_media)) {
+        gst_object_unref(client_media.pipeline);
+        return false;
+    }
+    LossyRelay relay;
+    if (!relay.start(loss, seed)) {
+        cerr << "Cannot bind relay ports " << CLIENT_BASE_PORT << " and " << SERVER_BASE_PORT + 10 << endl;
+        gst_object_unref(client_media.pipeline);
+        gst_object_unref(server_media.pipeline);
+        return false;
+    }
+
+    Arrivals arrivals;
+    GstPad *pad = gst_element_get_static_pad(server_media.video_depayloader, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_depayloader_input, &arrivals, NULL);
+    gst_object_unref(pad);
+
+    {
+        // Both sides share one key; the exchange is not under test here
+        vector<uint8_t> key(SRTP_MASTER_KEY_SIZE);
+        random_bytes(key.data(), key.size());
+        SrtpKeyRing client_ring(client_media.pipeline, client_media.encoder_names, client_media.decoder_names);
+        SrtpKeyRing server_ring(server_media.pipeline, server_media.encoder_names, server_media.decoder_names);
+        client_ring.set_placeholder_key();
+        server_ring.set_placeholder_key();
+        client_ring.start(key);
+        server_ring.start(key);
+
+        GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+        BenchState state = {loop, false};
+        GstBus *client_bus = gst_element_get_bus(client_media.pipeline);
+        GstBus *server_bus = gst_element_get_bus(server_media.pipeline);
+        guint client_watch = gst_bus_add_watch(client_bus, on_bus_message, &state);
+        guint server_watch = gst_bus_add_watch(server_bus, on_bus_message, &state);
+        gst_object_unref(client_bus);
+        gst_object_unref(server_bus);
+
+        // Control messages are not under test either: the server's CTRL_FEC
+        // is taken as read
+        BitrateController controller(client_media, client_profile);
+        if (fec) {
+            controller.enable_fec();
+        }
+        gst_element_set_state(server_media.pipeline, GST_STATE_PLAYING);
+        gst_element_set_state(client_media.pipeline, GST_STATE_PLAYING);
+        controller.start();
+        g_timeout_add_seconds(seconds, on_done, loop);
+        g_main_loop_run(loop);
+
+        // What is still in flight lands before the counting
+        controller.stop();
+        result.fec_percentage = controller.fec_percentage();
+        result.failed = state.failed;
+        gst_element_set_state(client_media.pipeline, GST_STATE_NULL);
+        g_usleep(BENCH_DRAIN_MS * 1000);
+        gst_element_set_state(server_media.pipeline, GST_STATE_NULL);
+        g_source_remove(client_watch);
+        g_source_remove(server_watch);
+        g_main_loop_unref(loop);
+    }
+    relay.stop();
+    gst_object_unref(client_media.pipeline);
+    gst_object_unref(server_media.pipeline);
+
+    lock_guard<mutex> lock(arrivals.lock);
+    for (const auto& frame : relay.video_frames()) {
+        bool hit = false, intact = true;
+        for (const auto& packet : frame.second) {
+            hit = hit || packet.second;
+            intact = intact && arrivals.packets.count(packet_key(frame.first, packet.first));
+        }
+        result.video.frames++;
+        result.video.hit += hit;
+        result.video.intact += intact;
+        result.video.recovered += hit && intact;
+    }
+    result.video_bytes = relay.video_byte_count();
+    result.fec_bytes = relay.fec_byte_count();
+    return true;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    vector<double> losses;
+    stringstream list(argc > 1 ? argv[1] : "1,2,5,10");
+    string item;
+    while (getline(list, item, ',')) {
+        losses.push_back(atof(item.c_str()) / 100);
+    }
+    int seconds = argc > 2 ? atoi(argv[2]) : 20;
+    unsigned int seed = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+
+    bool valid = !losses.empty() && seconds > 0;
+    for (double loss : losses) {
+        valid = valid && loss > 0 && loss < 0.5;
+    }
+    if (!valid) {
+        cout << "Usage: " << argv[0] << " [loss percentages, e.g. 1,2,5,10] [seconds per run] [seed]" << endl;
+        return -1;
+    }
+
+    // Rate control logging would bury the table
+    cout.setstate(ios::badbit);
+    printf("%d s per run, random drop of the client's RTP packets, seed %u\n", seconds, seed);
+    printf("%-6s %-4s %9s %7s %8s %8s %8s %10s\n", "loss", "FEC", "overhead", "FEC %", "frames", "hit", "intact",
+           "recovered");
+    printf("%-6s %-4s %9s %7s %8s %8s %8s %10s\n", "", "", "(bytes)", "(final)", "", "", "", "(of hit)");
+
+    bool failed = false;
+    uint64_t frames = 0, recovered = 0;
+    for (size_t i = 0; i < losses.size(); i++) {
+        for (bool fec : {false, true}) {
+            RunResult result;
+            // The same seed for both runs at a loss rate
+            if (!run(losses[i], fec, seconds, seed + i, result)) {
+                fprintf(stderr, "Cannot set up the pipelines and relay\n");
+                return 1;
+            }
+            failed = failed || result.failed;
+            frames += result.video.intact;
+            if (fec) {
+                recovered += result.video.recovered;
+            }
+            printf("%5.1f%% %-4s %8.1f%% %6d%% %8llu %7.1f%% %7.1f%% %9.1f%%\n", losses[i] * 100, fec ? "on" : "off",
+                   percent(result.fec_bytes, result.video_bytes), result.fec_percentage,
+                   (unsigned long long)result.video.frames, percent(result.video.hit, result.video.frames),
+                   percent(result.video.intact, result.video.frames),
+                   percent(result.video.recovered, result.video.hit));
+        }
+    }
+
+    if (frames == 0 || recovered == 0) {
+        fprintf(stderr, "%llu intact frames, %llu recovered by FEC\n", (unsigned long long)frames,
+                (unsigned long long)recovered);
+        failed = true;
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+#include "handshake_codec.h"
+#include "handshake_trace.h"
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace std;
+
+#define RECEIVE_BUFFER_SIZE 16384
+#define MAX_SEND_PARTS 8
+
+void append_frame(vector<uint8_t>& out, uint8_t msg_type, const vector<uint8_t>& data) {
+    uint32_t data_len = data.size();
+    size_t offset = out.size();
+    out.resize(offset + HANDSHAKE_HEADER_SIZE + data.size());
+    out[offset] = msg_type;
+    memcpy(out.data() + offset + 1, &data_len, sizeof(data_len));
+    if (!data.empty()) {
+        memcpy(out.data() + offset + HANDSHAKE_HEADER_SIZE, data.data(), data.size());
+    }
+}
+
+bool peek_frame_header(const uint8_t* buf, size_t len, uint8_t& msg_type, uint32_t& data_len) {
+    if (len < HANDSHAKE_HEADER_SIZE) {
+        return false;
+    }
+    msg_type = buf[0];
+    memcpy(&data_len, buf + 1, sizeof(data_len));
+    return true;
+}
+
+void enable_tcp_nodelay(int sock) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// sendmsg() until every iovec is written, advancing past partial writes
+static bool send_all(int sock, struct iovec* iov, size_t count) {
+    while (count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+HandshakeChannel::HandshakeChannel(int sock)
+    : sock(sock), buffer(RECEIVE_BUFFER_SIZE), start(0), end(0), sent(false) {
+}
+
+bool HandshakeChannel::send(uint8_t msg_type, const vector<uint8_t>& data) {
+    return send(msg_type, {{data.data(), data.size()}});
+}
+
+bool HandshakeChannel::send(uint8_t msg_type, initializer_list<ByteSpan> parts) {
+    if (parts.size() >= MAX_SEND_PARTS) {
+        return false;
+    }
+    
+    struct iovec iov[MAX_SEND_PARTS];
+    size_t count = 1;
+    uint32_t data_len = 0;
+    for (const ByteSpan& part : parts) {
+        if (part.len == 0) continue;
+        iov[count].iov_base = (void*)part.data;
+        iov[count].iov_len = part.len;
+        data_len += part.len;
+        count++;
+    }
+    
+    uint8_t header[HANDSHAKE_HEADER_SIZE];
+    header[0] = msg_type;
+    memcpy(header + 1, &data_len, sizeof(data_len));
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    
+    // Stamped before writing: on a loaded host the peer may answer before
+    // sendmsg() returns to us
+    if (current_handshake_trace) {
+        sent = true;
+        last_send = chrono::steady_clock::now();
+    }
+    return send_all(sock, iov, count);
+}
+
+// A reply that had to be read from the socket closes the flight opened by our
+// last send
+static void record_flight(bool& sent, chrono::steady_clock::time_point last_send) {
+    HandshakeTrace *trace = current_handshake_trace;
+    if (!trace || !sent) {
+        return;
+    }
+    sent = false;
+    if (trace->flight_count < MAX_TRACED_FLIGHTS) {
+        trace->flight_ns[trace->flight_count++] = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - last_send).count();
+    }
+}
+
+bool HandshakeChannel::receive(uint8_t& msg_type, vector<uint8_t>& data) {
+    bool waited = false;
+    while (true) {
+        size_t needed = HANDSHAKE_HEADER_SIZE;
+        uint32_t data_len;
+        if (peek_frame_header(buffer.data() + start, end - start, msg_type, data_len)) {
+            if (data_len > MAX_HANDSHAKE_MESSAGE_SIZE) {
+                return false;
+            }
+            
+            needed = HANDSHAKE_HEADER_SIZE + data_len;
+            if (end - start >= needed) {
+                const uint8_t *payload = buffer.data() + start + HANDSHAKE_HEADER_SIZE;
+                data.assign(payload, payload + data_len);
+                start += needed;
+                if (start == end) {
+                    start = end = 0;
+                }
+                if (waited) {
+                    record_flight(sent, last_send);
+                }
+                return true;
+            }
+        }
+        
+        // Make room for the rest of the current frame
+        if (buffer.size() - start < needed) {
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            if (buffer.size() < needed) {
+                buffer.resize(needed);
+            }
+        }
+        
+        ssize_t n = recv(sock, buffer.data() + end, buffer.size() - end, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        end += n;
+        waited = true;
+    }
+}
+
+void HandshakeChannel::take_unread(vector<uint8_t>& out) {
+    out.assign(buffer.begin() + start, buffer.begin() + end);
+    start = end = 0;
+}
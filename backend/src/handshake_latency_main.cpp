@@ -0,0 +1,429 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "auth_protocol.h"
+#include "handshake_codec.h"
+#include "handshake_trace.h"
+#include "session_ticket.h"
+
+using namespace std;
+
+// Latency of complete key exchanges over loopback, one at a time, with a
+// per-phase breakdown on both sides. The client is the normal client code
+// path (without the key pool, so key loading, keygen and signing are on the
+// critical path); the server drives ServerHandshake from a plain blocking
+// loop so that every phase it runs is traced on one thread. An optional
+// proxy delays each direction by half of the requested round trip time.
+
+#define BENCH_SERVER_IP "127.0.0.1"
+#define BENCH_WARMUP_EXCHANGES 1
+#define PROXY_BUFFER_SIZE 16384
+#define SERVER_FINISH_TIMEOUT_SECONDS 5
+
+struct ServerSample {
+    HandshakeTrace trace;
+    uint64_t compute_ns;
+};
+
+static mutex server_samples_mutex;
+static condition_variable server_samples_cv;
+static vector<ServerSample> server_samples;
+
+static uint64_t elapsed_ns(chrono::steady_clock::time_point begin) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int sock, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// One connection, with the trace installed only while ServerHandshake runs
+static void serve_connection(int sock) {
+    enable_tcp_nodelay(sock);
+    HandshakeChannel channel(sock);
+    ServerHandshake handshake;
+    ServerSample sample;
+    reset_handshake_trace(sample.trace);
+    sample.compute_ns = 0;
+    
+    uint8_t msg_type;
+    vector<uint8_t> data;
+    vector<HandshakeMessage> out;
+    vector<uint8_t> flight;
+    
+    while (!handshake.is_complete() && channel.receive(msg_type, data)) {
+        out.clear();
+        current_handshake_trace = &sample.trace;
+        auto begin = chrono::steady_clock::now();
+        bool ok = handshake.on_message(msg_type, data, out);
+        sample.compute_ns += elapsed_ns(begin);
+        current_handshake_trace = nullptr;
+        if (!ok) {
+            break;
+        }
+        
+        // Same coalescing as HandshakeServer: one write per flight
+        flight.clear();
+        for (const HandshakeMessage& msg : out) {
+            append_frame(flight, msg.type, msg.data);
+        }
+        if (!flight.empty() && !send_all(sock, flight.data(), flight.size())) {
+            break;
+        }
+    }
+    
+    close(sock);
+    
+    lock_guard<mutex> lock(server_samples_mutex);
+    if (handshake.is_complete()) {
+        server_samples.push_back(sample);
+    }
+    server_samples_cv.notify_all();
+}
+
+// A 1-RTT client is done before its last message reaches the server; waiting
+// keeps the next exchange from queueing behind it
+static bool wait_for_server(size_t completed) {
+    unique_lock<mutex> lock(server_samples_mutex);
+    return server_samples_cv.wait_for(lock, chrono::seconds(SERVER_FINISH_TIMEOUT_SECONDS),
+                                      [&] { return server_samples.size() >= completed; });
+}
+
+static void run_server(int listen_fd) {
+    while (true) {
+        int sock = accept(listen_fd, nullptr, nullptr);
+        if (sock < 0) {
+            return;
+        }
+        serve_connection(sock);
+    }
+}
+
+struct DelayedChunk {
+    chrono::steady_clock::time_point due;
+    vector<uint8_t> data;
+};
+
+// Forward src to dst. Chunks are stamped as they are read and written by a
+// second thread once their delay has passed, so a message that arrives in
+// several reads is delayed once, not once per read.
+static void pump(int src, int dst, chrono::microseconds delay) {
+    mutex queue_mutex;
+    condition_variable queue_cv;
+    deque<DelayedChunk> queue;
+    bool eof = false;
+    
+    thread writer([&] {
+        unique_lock<mutex> lock(queue_mutex);
+        while (true) {
+            queue_cv.wait(lock, [&] { return eof || !queue.empty(); });
+            if (queue.empty()) {
+                break;
+            }
+            DelayedChunk chunk = move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            this_thread::sleep_until(chunk.due);
+            send_all(dst, chunk.data.data(), chunk.data.size());
+            lock.lock();
+        }
+        shutdown(dst, SHUT_WR);
+    });
+    
+    vector<uint8_t> buf(PROXY_BUFFER_SIZE);
+    while (true) {
+        ssize_t n = recv(src, buf.data(), buf.size(), 0);
+        lock_guard<mutex> lock(queue_mutex);
+        if (n <= 0) {
+            eof = true;
+            queue_cv.notify_one();
+            break;
+        }
+        queue.push_back({chrono::steady_clock::now() + delay, vector<uint8_t>(buf.begin(), buf.begin() + n)});
+        queue_cv.notify_one();
+    }
+    writer.join();
+}
+
+static void run_delay_proxy(int listen_fd, int server_port, chrono::microseconds one_way) {
+    while (true) {
+        int client = accept(listen_fd, nullptr, nullptr);
+        if (client < 0) {
+            return;
+        }
+        
+        int server = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server_port);
+        inet_pton(AF_INET, BENCH_SERVER_IP, &addr.sin_addr);
+        
+        if (connect(server, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            enable_tcp_nodelay(client);
+            enable_tcp_nodelay(server);
+            thread upstream(pump, client, server, one_way);
+            pump(server, client, one_way);
+            upstream.join();
+        }
+        close(server);
+        close(client);
+    }
+}
+
+struct Percentiles {
+    double p50_us;
+    double p99_us;
+};
+
+// Nearest-rank percentiles
+static Percentiles percentiles(vector<uint64_t> samples) {
+    Percentiles p = {0, 0};
+    if (samples.empty()) {
+        return p;
+    }
+    sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    p.p50_us = samples[(size_t)ceil(0.50 * n) - 1] / 1000.0;
+    p.p99_us = samples[(size_t)ceil(0.99 * n) - 1] / 1000.0;
+    return p;
+}
+
+struct Row {
+    string side;
+    string phase;
+    Percentiles value;
+};
+
+static void add_row(vector<Row>& rows, const string& side, const string& phase,
+                    const vector<uint64_t>& samples) {
+    rows.push_back({side, phase, percentiles(samples)});
+}
+
+// Phases that never ran on a side (e.g. decaps on the server) are left out
+static void add_phase_rows(vector<Row>& rows, const string& side, const vector<HandshakeTrace>& traces) {
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        vector<uint64_t> samples;
+        bool ran = false;
+        for (const HandshakeTrace& trace : traces) {
+            samples.push_back(trace.phase_ns[phase]);
+            ran = ran || trace.phase_ns[phase] > 0;
+        }
+        if (ran) {
+            add_row(rows, side, handshake_phase_name(phase), samples);
+        }
+    }
+}
+
+static void write_json(FILE* out, const string& mode, const PqSuiteInfo& suite, int iterations,
+                       int rtt_ms, const vector<Row>& rows) {
+    fprintf(out, "{\n  \"mode\": \"%s\",\n  \"suite\": \"%s\",\n  \"iterations\": %d,\n  \"rtt_ms\": %d,\n",
+            mode.c_str(), pq_suite_name(suite).c_str(), iterations, rtt_ms);
+    fprintf(out, "  \"phases\": [\n");
+    for (size_t i = 0; i < rows.size(); i++) {
+        fprintf(out, "    {\"side\": \"%s\", \"phase\": \"%s\", \"p50_us\": %.1f, \"p99_us\": %.1f}%s\n",
+                rows[i].side.c_str(), rows[i].phase.c_str(), rows[i].value.p50_us, rows[i].value.p99_us,
+                i + 1 < rows.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Run in a scratch directory so the key store, identity files and tickets of
+// the benchmark never mix with a real client's or server's
+static bool enter_scratch_dir(string& dir) {
+    char path[] = "/tmp/handshake_latency.XXXXXX";
+    if (!mkdtemp(path) || chdir(path) != 0) {
+        return false;
+    }
+    dir = path;
+    return true;
+}
+
+static void remove_scratch_dir(const string& dir) {
+    DIR *d = opendir(dir.c_str());
+    if (d) {
+        struct dirent *entry;
+        while ((entry = readdir(d)) != nullptr) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                unlink((dir + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+    string mode = argc > 2 ? argv[2] : "1rtt";
+    int rtt_ms = argc > 3 ? atoi(argv[3]) : 0;
+    int port = argc > 4 ? atoi(argv[4]) : 9150;
+    const PqSuiteInfo *suite = argc > 5 ? find_pq_suite(string(argv[5])) : &default_pq_suite();
+    const char *json_path = argc > 6 ? argv[6] : nullptr;
+    
+    bool valid_mode = mode == "1rtt" || mode == "legacy" || mode == "enroll" || mode == "resume";
+    if (iterations <= 0 || !valid_mode || rtt_ms < 0 || port <= 0 || !suite) {
+        cout << "Usage: " << argv[0] << " [iterations] [1rtt|legacy|enroll|resume] [rtt_ms] [port] "
+             << "[suite] [json_file]" << endl;
+        return -1;
+    }
+    HandshakeMode handshake_mode = mode == "legacy" ? HANDSHAKE_MODE_LEGACY : HANDSHAKE_MODE_1RTT;
+    if (handshake_mode == HANDSHAKE_MODE_LEGACY && suite->id != PQ_SUITE_DEFAULT) {
+        cerr << "Legacy mode only supports " << pq_suite_name(default_pq_suite()) << endl;
+        return -1;
+    }
+    
+    FILE *json = nullptr;
+    if (json_path && !(json = fopen(json_path, "w"))) {
+        cerr << "Cannot open " << json_path << endl;
+        return -1;
+    }
+    
+    string scratch_dir;
+    if (!enter_scratch_dir(scratch_dir)) {
+        cerr << "Cannot create scratch directory" << endl;
+        return -1;
+    }
+    
+    int server_fd = listen_on(port);
+    int proxy_fd = rtt_ms > 0 ? listen_on(port + 1) : -1;
+    if (server_fd < 0 || (rtt_ms > 0 && proxy_fd < 0)) {
+        cerr << "Cannot listen on port " << (server_fd < 0 ? port : port + 1) << endl;
+        remove_scratch_dir(scratch_dir);
+        return -1;
+    }
+    
+    thread server_thread(run_server, server_fd);
+    thread proxy_thread;
+    int connect_port = port;
+    if (proxy_fd >= 0) {
+        proxy_thread = thread(run_delay_proxy, proxy_fd, port, chrono::microseconds(rtt_ms * 500));
+        connect_port = port + 1;
+    }
+    
+    // Per-step protocol logging would dominate the measurement
+    cout.setstate(ios::badbit);
+    
+    vector<HandshakeTrace> client_traces;
+    vector<uint64_t> client_totals;
+    bool ok = true;
+    
+    for (int i = 0; i < BENCH_WARMUP_EXCHANGES + iterations && ok; i++) {
+        // Enrollment needs a user the server has not seen; the warm-up
+        // exchange enrolls the returning user for the other modes
+        string username = mode == "enroll" ? "latency_user_" + to_string(i) : "latency_user";
+        if (mode != "resume") {
+            discard_client_session_ticket();
+        }
+        
+        HandshakeTrace trace;
+        reset_handshake_trace(trace);
+        current_handshake_trace = &trace;
+        auto begin = chrono::steady_clock::now();
+        ok = client_perform_authenticated_key_exchange(BENCH_SERVER_IP, connect_port, username,
+                                                       handshake_mode, *suite);
+        uint64_t total = elapsed_ns(begin);
+        current_handshake_trace = nullptr;
+        ok = ok && wait_for_server(i + 1);
+        
+        if (ok && i >= BENCH_WARMUP_EXCHANGES) {
+            client_traces.push_back(trace);
+            client_totals.push_back(total);
+        }
+    }
+    
+    shutdown(server_fd, SHUT_RDWR);
+    server_thread.join();
+    close(server_fd);
+    if (proxy_fd >= 0) {
+        shutdown(proxy_fd, SHUT_RDWR);
+        proxy_thread.join();
+        close(proxy_fd);
+    }
+    remove_scratch_dir(scratch_dir);
+    
+    if (!ok) {
+        fprintf(stderr, "Key exchange failed after %zu iterations\n", client_traces.size());
+        if (json) fclose(json);
+        return -1;
+    }
+    
+    vector<HandshakeTrace> server_traces;
+    vector<uint64_t> server_compute;
+    for (size_t i = BENCH_WARMUP_EXCHANGES; i < server_samples.size(); i++) {
+        server_traces.push_back(server_samples[i].trace);
+        server_compute.push_back(server_samples[i].compute_ns);
+    }
+    
+    vector<Row> rows;
+    add_row(rows, "client", "total", client_totals);
+    add_phase_rows(rows, "client", client_traces);
+    for (int flight = 0; flight < MAX_TRACED_FLIGHTS; flight++) {
+        vector<uint64_t> samples;
+        for (const HandshakeTrace& trace : client_traces) {
+            if (trace.flight_count > flight) {
+                samples.push_back(trace.flight_ns[flight]);
+            }
+        }
+        if (!samples.empty()) {
+            add_row(rows, "client", "flight_" + to_string(flight + 1), samples);
+        }
+    }
+    add_row(rows, "server", "compute", server_compute);
+    add_phase_rows(rows, "server", server_traces);
+    
+    printf("mode: %s  suite: %s  iterations: %d  rtt: %d ms\n", mode.c_str(),
+           pq_suite_name(*suite).c_str(), iterations, rtt_ms);
+    printf("%-8s %-14s %12s %12s\n", "side", "phase", "p50 (us)", "p99 (us)");
+    for (const Row& row : rows) {
+        printf("%-8s %-14s %12.1f %12.1f\n", row.side.c_str(), row.phase.c_str(),
+               row.value.p50_us, row.value.p99_us);
+    }
+    
+    if (json) {
+        write_json(json, mode, *suite, iterations, rtt_ms, rows);
+        fclose(json);
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "auth_protocol.h"
+
+using namespace std;
+
+// Open-loop load against a running key exchange server (handshake_server or
+// server): handshakes are started at a fixed rate whether or not earlier ones
+// have finished, each as a different user, through the normal client code.
+// Latency is measured from the scheduled start, so time spent waiting for a
+// free client thread counts against the server instead of slowing the load.
+
+#define LOADGEN_SERVER_IP "127.0.0.1"
+#define LOADGEN_MAX_IN_FLIGHT 256
+
+typedef chrono::steady_clock Clock;
+
+struct LoadJob {
+    Clock::time_point due;
+    string username;
+    size_t identity;
+};
+
+struct LoadResult {
+    uint64_t latency_ns;
+    bool ok;
+    Clock::time_point finished;
+};
+
+class JobQueue {
+public:
+    JobQueue() : closed(false) {}
+    
+    void push(LoadJob job) {
+        lock_guard<mutex> lock(queue_mutex);
+        jobs.push_back(move(job));
+        queue_cv.notify_one();
+    }
+    
+    void close() {
+        lock_guard<mutex> lock(queue_mutex);
+        closed = true;
+        queue_cv.notify_all();
+    }
+    
+    // Returns false once the queue is closed and empty
+    bool pop(LoadJob& job) {
+        unique_lock<mutex> lock(queue_mutex);
+        queue_cv.wait(lock, [this] { return closed || !jobs.empty(); });
+        if (jobs.empty()) {
+            return false;
+        }
+        job = move(jobs.front());
+        jobs.pop_front();
+        return true;
+    }
+
+private:
+    mutex queue_mutex;
+    condition_variable queue_cv;
+    deque<LoadJob> jobs;
+    bool closed;
+};
+
+// utime + stime of a process in seconds, from /proc/<pid>/stat
+static bool process_cpu_seconds(int pid, double& seconds) {
+    ifstream file("/proc/" + to_string(pid) + "/stat");
+    string stat;
+    if (!getline(file, stat)) {
+        return false;
+    }
+    
+    // The command name may contain spaces; fields are counted after it
+    size_t comm_end = stat.rfind(')');
+    if (comm_end == string::npos) {
+        return false;
+    }
+    istringstream fields(stat.substr(comm_end + 2));
+    string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) utime = strtoull(field.c_str(), nullptr, 10);
+        if (i == 15) stime = strtoull(field.c_str(), nullptr, 10);
+    }
+    seconds = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+    return true;
+}
+
+static double own_cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Nearest-rank percentile of sorted samples, in milliseconds
+static double percentile_ms(const vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[(size_t)ceil(p * sorted.size()) - 1] / 1e6;
+}
+
+static void run_client(JobQueue& queue, const vector<DilithiumKeys>& identities, int port,
+                       const PqSuiteInfo& suite, vector<LoadResult>& results) {
+    LoadJob job;
+    vector<uint8_t> srtp_key;
+    while (queue.pop(job)) {
+        bool ok = client_perform_key_exchange_with_keys(LOADGEN_SERVER_IP, port, job.username,
+                                                        identities[job.identity], HANDSHAKE_MODE_1RTT,
+                                                        srtp_key, suite);
+        Clock::time_point finished = Clock::now();
+        uint64_t latency = chrono::duration_cast<chrono::nanoseconds>(finished - job.due).count();
+        results.push_back({latency, ok, finished});
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double rate = argc > 1 ? atof(argv[1]) : 50;
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    int users = argc > 3 ? atoi(argv[3]) : 100;
+    string mode = argc > 4 ? argv[4] : "returning";
+    int port = argc > 5 ? atoi(argv[5]) : 9000;
+    int server_pid = argc > 6 ? atoi(argv[6]) : 0;
+    const PqSuiteInfo *suite = argc > 7 ? find_pq_suite(string(argv[7])) : &default_pq_suite();
+    
+    if (rate <= 0 || seconds <= 0 || users <= 0 || (mode != "returning" && mode != "enroll") ||
+        port <= 0 || server_pid < 0 || !suite) {
+        cout << "Usage: " << argv[0] << " [rate/s] [seconds] [users] [returning|enroll] [port] "
+             << "[server_pid] [suite]" << endl;
+        return -1;
+    }
+    
+    double server_cpu_start = 0;
+    if (server_pid > 0 && !process_cpu_seconds(server_pid, server_cpu_start)) {
+        cerr << "Cannot read CPU time of process " << server_pid << endl;
+        return -1;
+    }
+    
+    vector<DilithiumKeys> identities(users);
+    for (DilithiumKeys& keys : identities) {
+        if (!generate_dilithium_keys(keys, *suite)) {
+            cerr << "Failed to generate Dilithium keys" << endl;
+            return -1;
+        }
+    }
+    
+    // Usernames are unique per run, so "enroll" really is a first contact
+    // even against a server that keeps its key store between runs
+    string prefix = "load_" + to_string(getpid()) + "_" + to_string(time(nullptr)) + "_";
+    
+    // Per-step protocol logging would dominate the measurement; failures are
+    // counted instead of logged
+    cout.setstate(ios::badbit);
+    cerr.setstate(ios::badbit);
+    
+    if (mode == "returning") {
+        vector<uint8_t> srtp_key;
+        for (int i = 0; i < users; i++) {
+            if (!client_perform_key_exchange_with_keys(LOADGEN_SERVER_IP, port, prefix + to_string(i),
+                                                       identities[i], HANDSHAKE_MODE_1RTT, srtp_key,
+                                                       *suite)) {
+                cerr.clear();
+                cerr << "Enrollment of user " << i << " failed; is the server running on port "
+                     << port << "?" << endl;
+                return -1;
+            }
+        }
+    }
+    
+    if (server_pid > 0) {
+        process_cpu_seconds(server_pid, server_cpu_start);
+    }
+    double own_cpu_start = own_cpu_seconds();
+    
+    JobQueue queue;
+    int thread_count = min(LOADGEN_MAX_IN_FLIGHT, max(1, (int)ceil(rate * seconds)));
+    vector<vector<LoadResult>> results(thread_count);
+    vector<thread> threads;
+    for (int i = 0; i < thread_count; i++) {
+        threads.emplace_back(run_client, ref(queue), cref(identities), port, cref(*suite), ref(results[i]));
+    }
+    
+    // Arrivals are scheduled against the start time, never against the
+    // previous arrival, so a slow server cannot lower the offered rate
+    uint64_t total_jobs = (uint64_t)llround(rate * seconds);
+    Clock::time_point start = Clock::now();
+    for (uint64_t n = 0; n < total_jobs; n++) {
+        Clock::time_point due = start + chrono::nanoseconds((int64_t)(n * 1e9 / rate));
+        this_thread::sleep_until(due);
+        
+        LoadJob job;
+        job.due = due;
+        job.identity = n % users;
+        job.username = mode == "enroll" ? prefix + "e" + to_string(n) : prefix + to_string(job.identity);
+        queue.push(move(job));
+    }
+    queue.close();
+    for (thread& t : threads) {
+        t.join();
+    }
+    
+    double own_cpu = own_cpu_seconds() - own_cpu_start;
+    double server_cpu = -1;
+    if (server_pid > 0 && process_cpu_seconds(server_pid, server_cpu)) {
+        server_cpu -= server_cpu_start;
+    }
+    
+    vector<uint64_t> latencies;
+    uint64_t failures = 0;
+    Clock::time_point last = start;
+    for (const vector<LoadResult>& thread_results : results) {
+        for (const LoadResult& result : thread_results) {
+            if (result.ok) {
+                latencies.push_back(result.latency_ns);
+            } else {
+                failures++;
+            }
+            last = max(last, result.finished);
+        }
+    }
+    sort(latencies.begin(), latencies.end());
+    double elapsed = max(chrono::duration<double>(last - start).count(), 1e-9);
+    
+    printf("mode: %s  suite: %s  users: %d  offered: %.1f/s for %d s\n", mode.c_str(),
+           pq_suite_name(*suite).c_str(), users, rate, seconds);
+    printf("completed  %zu (%.1f/s)  failed %llu\n", latencies.size(),
+           elapsed > 0 ? latencies.size() / elapsed : 0.0, (unsigned long long)failures);
+    printf("latency ms p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", percentile_ms(latencies, 0.50),
+           percentile_ms(latencies, 0.90), percentile_ms(latencies, 0.99), percentile_ms(latencies, 1.0));
+    if (server_cpu >= 0) {
+        printf("server CPU %.1f%% of one core, %.3f ms per handshake\n", 100 * server_cpu / elapsed,
+               latencies.empty() ? 0.0 : 1000 * server_cpu / latencies.size());
+    }
+    printf("loadgen CPU %.1f%% of one core\n", 100 * own_cpu / elapsed);
+    return 0;
+}
@@ -0,0 +1,495 @@
+#include "handshake_server.h"
+#include "handshake_codec.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct HandshakeServer::Connection {
+    int fd;
+    string peer_ip;
+    ServerHandshake handshake;
+    vector<uint8_t> in;          // Received bytes; framing resumes at in_offset
+    size_t in_offset = 0;
+    vector<uint8_t> out;         // Reply bytes not yet sent
+    size_t out_offset = 0;
+    bool busy = false;           // A worker currently owns 'handshake'
+    bool peer_closed = false;
+    bool want_write = false;
+    uint32_t interest = EPOLLIN | EPOLLRDHUP;  // Events currently registered
+    Clock::time_point deadline;
+};
+
+HandshakeServer::HandshakeServer(int port, int worker_count)
+    : port(port), worker_count(worker_count), keep_connections(false), listen_fd(-1), epoll_fd(-1), wake_fd(-1),
+      running(false), accepted_count(0), completed_count(0), failed_count(0), timed_out_count(0) {
+    if (this->worker_count <= 0) {
+        this->worker_count = max(1u, thread::hardware_concurrency());
+    }
+}
+
+HandshakeServer::~HandshakeServer() {
+    stop();
+}
+
+bool HandshakeServer::start() {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        cerr << "SERVER: Socket creation failed" << endl;
+        return false;
+    }
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        cerr << "SERVER: Bind failed" << endl;
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    
+    listen(listen_fd, SOMAXCONN);
+    
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        cerr << "SERVER: epoll setup failed" << endl;
+        stop();
+        return false;
+    }
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    
+    running = true;
+    for (int i = 0; i < worker_count; i++) {
+        worker_threads.emplace_back(&HandshakeServer::worker_loop, this);
+    }
+    event_thread = thread(&HandshakeServer::event_loop, this);
+    
+    cout << "SERVER: Listening on port " << port << " (" << worker_count << " crypto workers)..." << endl;
+    return true;
+}
+
+void HandshakeServer::stop() {
+    bool was_running = running.exchange(false);
+    
+    if (was_running) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // The epoll timeout still ends the loop
+        }
+        event_thread.join();
+        
+        job_cv.notify_all();
+        for (thread& t : worker_threads) {
+            t.join();
+        }
+        worker_threads.clear();
+        completed_cv.notify_all();
+    }
+    
+    for (auto& entry : connections) {
+        close(entry.first);
+    }
+    connections.clear();
+    
+    {
+        // Kept connections nobody collected
+        lock_guard<mutex> lock(completed_mutex);
+        for (CompletedHandshake& done : completed) {
+            if (done.control.fd >= 0) {
+                close(done.control.fd);
+            }
+        }
+        completed.clear();
+    }
+    
+    if (listen_fd >= 0) close(listen_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (wake_fd >= 0) close(wake_fd);
+    listen_fd = epoll_fd = wake_fd = -1;
+}
+
+bool HandshakeServer::wait_for_handshake(CompletedHandshake& result, int timeout_ms) {
+    unique_lock<mutex> lock(completed_mutex);
+    auto ready = [this] { return !completed.empty() || !running; };
+    
+    if (timeout_ms < 0) {
+        completed_cv.wait(lock, ready);
+    } else if (!completed_cv.wait_for(lock, chrono::milliseconds(timeout_ms), ready)) {
+        return false;
+    }
+    
+    if (completed.empty()) {
+        return false;
+    }
+    result = move(completed.front());
+    completed.pop_front();
+    return true;
+}
+
+HandshakeServerStats HandshakeServer::stats() const {
+    return {accepted_count.load(), completed_count.load(), failed_count.load(), timed_out_count.load()};
+}
+
+void HandshakeServer::submit(function<void()> job) {
+    {
+        lock_guard<mutex> lock(job_mutex);
+        jobs.push_back(move(job));
+    }
+    job_cv.notify_one();
+}
+
+void HandshakeServer::worker_loop() {
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(job_mutex);
+            job_cv.wait(lock, [this] { return !jobs.empty() || !running; });
+            if (jobs.empty()) {
+                return;
+            }
+            job = move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+void HandshakeServer::event_loop() {
+    struct epoll_event events[64];
+    
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, 64, 1000);
+        
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_connections();
+            } else if (fd == wake_fd) {
+                uint64_t count;
+                while (read(wake_fd, &count, sizeof(count)) > 0) {
+                }
+                process_results();
+            } else {
+                handle_io(fd, events[i].events);
+            }
+        }
+        
+        expire_connections();
+    }
+}
+
+void HandshakeServer::accept_connections() {
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(listen_fd, (struct sockaddr*)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                cerr << "SERVER: Accept failed" << endl;
+            }
+            return;
+        }
+        
+        unique_ptr<Connection> conn(new Connection());
+        conn->fd = fd;
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        conn->peer_ip = ip;
+        conn->deadline = Clock::now() + chrono::seconds(HANDSHAKE_TIMEOUT_SECONDS);
+        enable_tcp_nodelay(fd);
+        
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = conn->interest;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        
+        connections[fd] = move(conn);
+        accepted_count++;
+        cout << "SERVER: Client connected from " << ip << endl;
+    }
+}
+
+void HandshakeServer::handle_io(int fd, uint32_t events) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) {
+        return;
+    }
+    Connection& conn = *it->second;
+    
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        // Drop already framed bytes once per burst rather than once per message
+        if (conn.in_offset > 0) {
+            conn.in.erase(conn.in.begin(), conn.in.begin() + conn.in_offset);
+            conn.in_offset = 0;
+        }
+        
+        uint8_t buf[16384];
+        while (true) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                conn.in.insert(conn.in.end(), buf, buf + n);
+                if (conn.in.size() > 2 * (HANDSHAKE_HEADER_SIZE + MAX_HANDSHAKE_MESSAGE_SIZE)) {
+                    close_connection(fd, true);
+                    return;
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                conn.peer_closed = true;
+            }
+            break;
+        }
+    }
+    
+    if ((events & EPOLLOUT) && !flush(conn)) {
+        close_connection(fd, true);
+        return;
+    }
+    
+    dispatch_next(conn);
+    
+    // A peer that hung up with no complete message left has abandoned the exchange
+    if (conn.peer_closed && !conn.busy) {
+        close_connection(fd, true);
+    }
+}
+
+// Frame the next message and hand it to a worker
+void HandshakeServer::dispatch_next(Connection& conn) {
+    uint8_t msg_type;
+    uint32_t data_len;
+    if (conn.busy || !peek_frame_header(conn.in.data() + conn.in_offset, conn.in.size() - conn.in_offset,
+                                        msg_type, data_len)) {
+        return;
+    }
+    
+    if (data_len > MAX_HANDSHAKE_MESSAGE_SIZE) {
+        conn.peer_closed = true;
+        return;
+    }
+    if (conn.in.size() - conn.in_offset < HANDSHAKE_HEADER_SIZE + data_len) {
+        return;
+    }
+    
+    const uint8_t *payload = conn.in.data() + conn.in_offset + HANDSHAKE_HEADER_SIZE;
+    vector<uint8_t> data(payload, payload + data_len);
+    conn.in_offset += HANDSHAKE_HEADER_SIZE + data_len;
+    if (conn.in_offset == conn.in.size()) {
+        conn.in.clear();
+        conn.in_offset = 0;
+    }
+    
+    // The connection is not closed while busy, so the pointer stays valid
+    conn.busy = true;
+    update_interest(conn);
+    Connection *c = &conn;
+    submit([this, c, msg_type, data = move(data)] {
+        vector<HandshakeMessage> replies;
+        WorkResult result;
+        result.fd = c->fd;
+        result.ok = c->handshake.on_message(msg_type, data, replies);
+        
+        // The whole flight goes out in one send()
+        for (const HandshakeMessage& msg : replies) {
+            append_frame(result.bytes, msg.type, msg.data);
+        }
+        
+        {
+            lock_guard<mutex> lock(result_mutex);
+            results.push_back(move(result));
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // Counter overflow is impossible in practice; the loop polls anyway
+        }
+    });
+}
+
+void HandshakeServer::process_results() {
+    deque<WorkResult> ready;
+    {
+        lock_guard<mutex> lock(result_mutex);
+        ready.swap(results);
+    }
+    
+    for (WorkResult& result : ready) {
+        auto it = connections.find(result.fd);
+        if (it == connections.end()) {
+            continue;
+        }
+        Connection& conn = *it->second;
+        conn.busy = false;
+        update_interest(conn);
+        
+        if (!result.ok) {
+            close_connection(conn.fd, true);
+            continue;
+        }
+        
+        if (conn.out.empty()) {
+            conn.out = move(result.bytes);
+        } else {
+            conn.out.insert(conn.out.end(), result.bytes.begin(), result.bytes.end());
+        }
+        if (!flush(conn)) {
+            close_connection(conn.fd, true);
+            continue;
+        }
+        
+        if (conn.handshake.is_complete()) {
+            CompletedHandshake done;
+            done.username = conn.handshake.username();
+            done.peer_ip = conn.peer_ip;
+            done.srtp_key = conn.handshake.srtp_key();
+            if (keep_connections) {
+                hand_over(conn, done.control);
+            }
+            {
+                lock_guard<mutex> lock(completed_mutex);
+                completed.push_back(move(done));
+            }
+            completed_count++;
+            completed_cv.notify_one();
+            if (!keep_connections) {
+                close_connection(conn.fd, false);
+            }
+            continue;
+        }
+        
+        dispatch_next(conn);
+        if (conn.peer_closed && !conn.busy) {
+            close_connection(conn.fd, true);
+        }
+    }
+}
+
+bool HandshakeServer::flush(Connection& conn) {
+    while (conn.out_offset < conn.out.size()) {
+        ssize_t n = send(conn.fd, conn.out.data() + conn.out_offset,
+                         conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn.out_offset += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn.want_write = true;
+            update_interest(conn);
+            return true;
+        }
+        return false;
+    }
+    
+    conn.out.clear();
+    conn.out_offset = 0;
+    conn.want_write = false;
+    update_interest(conn);
+    return true;
+}
+
+// While a worker owns the connection nothing read could be dispatched, and a
+// peer that half-closed would keep a level-triggered EPOLLIN / EPOLLRDHUP
+// firing on every epoll_wait until the result arrives, so read interest is
+// dropped and restored with the result. EPOLLHUP / EPOLLERR cannot be masked;
+// a fully closed peer simply fails the pending reply.
+void HandshakeServer::update_interest(Connection& conn) {
+    uint32_t interest = conn.want_write ? (uint32_t)EPOLLOUT : 0u;
+    if (!conn.busy) {
+        interest |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (interest == conn.interest) {
+        return;
+    }
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = interest;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.interest = interest;
+}
+
+void HandshakeServer::close_connection(int fd, bool failed) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) {
+        return;
+    }
+    
+    // A worker may still hold this connection; it is closed when its result arrives
+    if (it->second->busy) {
+        it->second->peer_closed = true;
+        return;
+    }
+    
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+    
+    if (failed) {
+        failed_count++;
+    }
+}
+
+// Stop serving a completed connection without closing it; whatever was read
+// past the last message or not yet written goes with it
+void HandshakeServer::hand_over(Connection& conn, ControlConnection& control) {
+    int fd = conn.fd;
+    control.fd = fd;
+    control.secret = conn.handshake.control_secret();
+    control.unread.assign(conn.in.begin() + conn.in_offset, conn.in.end());
+    control.unsent.assign(conn.out.begin() + conn.out_offset, conn.out.end());
+    
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    connections.erase(fd);
+}
+
+void HandshakeServer::expire_connections() {
+    Clock::time_point now = Clock::now();
+    vector<int> expired;
+    
+    for (auto& entry : connections) {
+        if (!entry.second->busy && entry.second->deadline < now) {
+            expired.push_back(entry.first);
+        }
+    }
+    
+    for (int fd : expired) {
+        cerr << "SERVER: Handshake timed out for " << connections[fd]->peer_ip << endl;
+        timed_out_count++;
+        close_connection(fd, true);
+    }
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "auth_protocol.h"
+#include "handshake_server.h"
+
+using namespace std;
+
+// Measures returning-user 1-RTT handshakes per second against an in-process
+// HandshakeServer with 1, 4 and N crypto workers over loopback
+static double run_round(int port, int workers, int clients, int seconds,
+                        const vector<DilithiumKeys>& identities, const PqSuiteInfo& suite,
+                        uint64_t& failures) {
+    HandshakeServer server(port, workers);
+    if (!server.start()) {
+        return -1;
+    }
+    
+    atomic<bool> running(true);
+    thread drainer([&] {
+        CompletedHandshake done;
+        while (running) {
+            server.wait_for_handshake(done, 100);
+        }
+    });
+    
+    // Enroll every identity once so the timed phase only sees returning users
+    for (int i = 0; i < clients; i++) {
+        vector<uint8_t> key;
+        client_perform_key_exchange_with_keys("127.0.0.1", port, "bench_user_" + to_string(i),
+                                              identities[i], HANDSHAKE_MODE_1RTT, key, suite);
+    }
+    
+    atomic<uint64_t> ok_count(0), fail_count(0);
+    atomic<bool> timed(true);
+    vector<thread> threads;
+    auto begin = chrono::steady_clock::now();
+    
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back([&, i] {
+            string username = "bench_user_" + to_string(i);
+            vector<uint8_t> key;
+            while (timed) {
+                if (client_perform_key_exchange_with_keys("127.0.0.1", port, username, identities[i],
+                                                          HANDSHAKE_MODE_1RTT, key, suite)) {
+                    ok_count++;
+                } else {
+                    fail_count++;
+                }
+            }
+        });
+    }
+    
+    this_thread::sleep_for(chrono::seconds(seconds));
+    timed = false;
+    for (thread& t : threads) {
+        t.join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    
+    running = false;
+    drainer.join();
+    server.stop();
+    
+    failures = fail_count;
+    return ok_count / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    int clients = argc > 2 ? atoi(argv[2]) : 64;
+    int port = argc > 3 ? atoi(argv[3]) : 9100;
+    const PqSuiteInfo *suite = argc > 4 ? find_pq_suite(string(argv[4])) : &default_pq_suite();
+    
+    if (seconds <= 0 || clients <= 0 || !suite) {
+        cout << "Usage: " << argv[0] << " [seconds] [concurrent_clients] [port] [suite]" << endl;
+        return -1;
+    }
+    
+    vector<DilithiumKeys> identities(clients);
+    for (DilithiumKeys& keys : identities) {
+        if (!generate_dilithium_keys(keys, *suite)) {
+            cerr << "Failed to generate Dilithium keys" << endl;
+            return -1;
+        }
+    }
+    
+    int cores = max(1u, thread::hardware_concurrency());
+    vector<int> worker_counts = {1, 4};
+    if (cores != 1 && cores != 4) {
+        worker_counts.push_back(cores);
+    }
+    
+    // Per-step protocol logging would dominate the measurement
+    cout.setstate(ios::badbit);
+    
+    printf("suite: %s\n", pq_suite_name(*suite).c_str());
+    printf("%-10s %-10s %-14s %s\n", "workers", "clients", "handshakes/s", "failures");
+    for (int workers : worker_counts) {
+        uint64_t failures = 0;
+        double rate = run_round(port, workers, clients, seconds, identities, *suite, failures);
+        if (rate < 0) {
+            fprintf(stderr, "Could not start server on port %d\n", port);
+            return -1;
+        }
+        printf("%-10d %-10d %-14.1f %llu\n", workers, clients, rate, (unsigned long long)failures);
+        fflush(stdout);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "handshake_trace.h"
+#include <cstring>
+
+thread_local HandshakeTrace* current_handshake_trace = nullptr;
+
+static const char* PHASE_NAMES[PHASE_COUNT] = {
+    "connect",
+    "key_file_load",
+    "kem_keygen",
+    "sign",
+    "verify",
+    "encaps",
+    "decaps",
+    "hkdf",
+    "hmac",
+    "key_store",
+    "ticket"
+};
+
+void reset_handshake_trace(HandshakeTrace& trace) {
+    memset(&trace, 0, sizeof(trace));
+}
+
+const char* handshake_phase_name(int phase) {
+    if (phase < 0 || phase >= PHASE_COUNT) {
+        return "unknown";
+    }
+    return PHASE_NAMES[phase];
+}
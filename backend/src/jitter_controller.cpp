@@ -0,0 +1,202 @@
+#include "jitter_controller.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+#define VIDEO_SESSION 0
+
+JitterController::JitterController(MediaPipeline& media, const MediaProfile& profile)
+    : media(media), adaptive(profile.jitter_mode == "adaptive"), start_latency_ms(profile.jitter_latency),
+      max_latency_ms(max(profile.max_jitter_latency, JITTER_MIN_LATENCY_MS)), peer_rtx(false), handler_id(0),
+      poll_source(NULL) {
+    if (adaptive && media.rtpbin_recv) {
+        // After the pipeline's own handler, which sets the start values
+        handler_id = g_signal_connect(media.rtpbin_recv, "new-jitterbuffer", G_CALLBACK(on_new_jitterbuffer), this);
+    }
+}
+
+JitterController::~JitterController() {
+    stop();
+}
+
+void JitterController::start(GMainContext *context) {
+    if (!adaptive || poll_source) {
+        return;
+    }
+    poll_source = g_timeout_source_new(JITTER_POLL_INTERVAL_MS);
+    g_source_set_callback(poll_source, on_poll, this, NULL);
+    g_source_attach(poll_source, context);
+}
+
+void JitterController::stop() {
+    if (poll_source) {
+        g_source_destroy(poll_source);
+        g_source_unref(poll_source);
+        poll_source = NULL;
+    }
+    if (handler_id) {
+        g_signal_handler_disconnect(media.rtpbin_recv, handler_id);
+        handler_id = 0;
+    }
+    lock_guard<mutex> lock(streams_mutex);
+    for (Stream& stream : streams) {
+        gst_object_unref(stream.jitterbuffer);
+    }
+    streams.clear();
+}
+
+void JitterController::enable_rtx() {
+    peer_rtx = adaptive;
+}
+
+void JitterController::on_new_jitterbuffer(GstElement *rtpbin, GstElement *jitterbuffer, guint session, guint ssrc,
+                                           gpointer user_data) {
+    JitterController *controller = (JitterController*)user_data;
+    Stream stream = {};
+    stream.jitterbuffer = GST_ELEMENT(gst_object_ref(jitterbuffer));
+    stream.session = session;
+    stream.ssrc = ssrc;
+    stream.latency_ms = controller->start_latency_ms;
+    lock_guard<mutex> lock(controller->streams_mutex);
+    controller->streams.push_back(stream);
+}
+
+gboolean JitterController::on_poll(gpointer user_data) {
+    JitterController *controller = (JitterController*)user_data;
+    double rtt_ms = controller->read_rtt_ms();
+    lock_guard<mutex> lock(controller->streams_mutex);
+    auto& streams = controller->streams;
+    for (auto it = streams.begin(); it != streams.end();) {
+        // rtpbin drops the jitterbuffer of a stream that has left
+        if (!GST_OBJECT_PARENT(it->jitterbuffer)) {
+            gst_object_unref(it->jitterbuffer);
+            it = streams.erase(it);
+            continue;
+        }
+        controller->update(*it, rtt_ms);
+        ++it;
+    }
+    return TRUE;
+}
+
+// RFC 3550 interarrival jitter of the stream, from its source in the
+// receiving session
+double JitterController::read_jitter_ms(const Stream& stream) {
+    GObject *session = NULL;
+    g_signal_emit_by_name(media.rtpbin_recv, "get-internal-session", stream.session, &session);
+    if (!session) {
+        return 0;
+    }
+    GObject *source = NULL;
+    g_signal_emit_by_name(session, "get-source-by-ssrc", stream.ssrc, &source);
+    g_object_unref(session);
+    if (!source) {
+        return 0;
+    }
+    GstStructure *stats = NULL;
+    g_object_get(source, "stats", &stats, NULL);
+    g_object_unref(source);
+    if (!stats) {
+        return 0;
+    }
+    guint jitter = 0;
+    gint clock_rate = 0;
+    gst_structure_get_uint(stats, "jitter", &jitter);
+    gst_structure_get_int(stats, "clock-rate", &clock_rate);
+    gst_structure_free(stats);
+    return clock_rate > 0 ? jitter * 1000.0 / clock_rate : 0;
+}
+
+// Round trip from the peer's receiver reports on what we send; 0 until the
+// peer has seen a sender report
+double JitterController::read_rtt_ms() {
+    GObject *session = NULL;
+    g_signal_emit_by_name(media.rtpbin_send, "get-internal-session", (guint)VIDEO_SESSION, &session);
+    if (!session) {
+        return 0;
+    }
+    GstStructure *stats = NULL;
+    g_object_get(session, "stats", &stats, NULL);
+    g_object_unref(session);
+    if (!stats) {
+        return 0;
+    }
+
+    double rtt_ms = 0;
+    const GValue *sources = gst_structure_get_value(stats, "source-stats");
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    GValueArray *array = sources ? (GValueArray*)g_value_get_boxed(sources) : NULL;
+    for (guint i = 0; array && i < array->n_values; i++) {
+        const GstStructure *source = gst_value_get_structure(g_value_array_get_nth(array, i));
+        gboolean internal = FALSE;
+        gboolean have_rb = FALSE;
+        guint round_trip = 0;
+        gst_structure_get_boolean(source, "internal", &internal);
+        gst_structure_get_boolean(source, "have-rb", &have_rb);
+        gst_structure_get_uint(source, "rb-round-trip", &round_trip);
+        if (internal && have_rb && round_trip > 0) {
+            // In 1/65536 s
+            rtt_ms = max(rtt_ms, round_trip * 1000.0 / 65536.0);
+        }
+    }
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    gst_structure_free(stats);
+    return rtt_ms;
+}
+
+void JitterController::update(Stream& stream, double rtt_ms) {
+    GstStructure *stats = NULL;
+    g_object_get(stream.jitterbuffer, "stats", &stats, NULL);
+    if (!stats) {
+        return;
+    }
+    guint64 pushed = 0, late = 0;
+    gst_structure_get_uint64(stats, "num-pushed", &pushed);
+    gst_structure_get_uint64(stats, "num-late", &late);
+    gst_structure_free(stats);
+
+    guint64 new_packets = pushed - min(pushed, stream.pushed);
+    guint64 new_late = late - min(late, stream.late);
+    stream.pushed = pushed;
+    stream.late = late;
+    stream.calm_packets += new_packets;
+    stream.calm_late += new_late;
+
+    if (new_late > 0 && new_late > JITTER_TARGET_LATE_RATE * (new_packets + new_late)) {
+        stream.margin_ms = max(stream.margin_ms * JITTER_MARGIN_GROWTH, stream.margin_ms + JITTER_MARGIN_STEP_MS);
+        stream.calm_packets = 0;
+        stream.calm_late = 0;
+    } else if (stream.calm_packets >= JITTER_CALM_PACKETS &&
+               stream.calm_late <= JITTER_TARGET_LATE_RATE / 4 * stream.calm_packets) {
+        stream.margin_ms *= JITTER_MARGIN_DECAY;
+    }
+
+    double jitter_ms = read_jitter_ms(stream);
+    double floor_ms = JITTER_DEVIATIONS * jitter_ms + JITTER_MIN_LATENCY_MS;
+    stream.margin_ms = min(stream.margin_ms, (double)max_latency_ms);
+    int latency = (int)ceil(min(max(floor_ms + stream.margin_ms, (double)JITTER_MIN_LATENCY_MS),
+                                (double)max_latency_ms));
+
+    // The jitterbuffer waits about two jitters before it sends a NACK
+    double rtx_wait_ms = 2 * jitter_ms;
+    bool rtx = peer_rtx && rtt_ms > 0 && rtt_ms + rtx_wait_ms + JITTER_RTX_MARGIN_MS <= latency;
+
+    bool latency_changed = abs(latency - stream.latency_ms) >= JITTER_MIN_CHANGE_MS;
+    if (!latency_changed && rtx == stream.rtx) {
+        return;
+    }
+    if (latency_changed) {
+        stream.latency_ms = latency;
+        g_object_set(stream.jitterbuffer, "latency", (guint)latency, NULL);
+    }
+    if (rtx != stream.rtx) {
+        stream.rtx = rtx;
+        // -1: the wait before a NACK follows the measured jitter
+        g_object_set(stream.jitterbuffer, "do-retransmission", rtx ? TRUE : FALSE, "rtx-delay", -1, NULL);
+    }
+    cout << "Jitter buffer " << stream.ssrc << ": latency " << stream.latency_ms << " ms (jitter "
+         << (int)jitter_ms << " ms, rtt " << (int)rtt_ms << " ms, late " << new_late << "/" << new_packets
+         << "), retransmission " << (stream.rtx ? "on" : "off") << endl;
+}
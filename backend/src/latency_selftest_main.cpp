@@ -0,0 +1,338 @@
+#include <gst/gst.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "crypto_utils.h"
+#include "media_pipeline.h"
+#include "srtp_rekey.h"
+#include "capture_latency.h"
+
+using namespace std;
+
+// Checks the capture-to-render measurement against a delay we know. A client
+// and a server pipeline in one process send stamped live test video and
+// audio to each other over loopback with the bundle transport, through a
+// relay that holds every packet, both ways, for a fixed time. Both sides
+// share one clock, so the offset estimated from RTCP should be close to 0;
+// and going from no added delay to each delay should move the server's
+// network + jitter buffer part, and its total, by that delay. Exits
+// non-zero if a run measures nothing or misses either by more than the
+// tolerance.
+
+#define BENCH_IP "127.0.0.1"
+#define CLIENT_BASE_PORT 6100
+#define SERVER_BASE_PORT 6200
+#define BENCH_DRAIN_MS 500
+#define OFFSET_TOLERANCE_MS 5
+#define DELAY_TOLERANCE_MS 10
+
+struct RunResult {
+    LatencySummary video;
+    LatencySummary audio;
+    vector<double> offsets_ms;
+    bool failed;
+};
+
+// Every datagram, both ways, sent on after a fixed delay
+class DelayRelay {
+public:
+    DelayRelay() : running(false) {}
+    ~DelayRelay() { stop(); }
+
+    bool start(int delay_ms);
+    void stop();
+
+private:
+    struct Held {
+        chrono::steady_clock::time_point due;
+        vector<uint8_t> data;
+    };
+
+    struct Relay {
+        int fd;
+        int to_port;
+        deque<Held> held;
+    };
+
+    bool add_relay(int from_port, int to_port);
+    void run();
+
+    vector<Relay> relays;
+    chrono::milliseconds delay;
+    atomic<bool> running;
+    thread worker;
+};
+
+bool DelayRelay::add_relay(int from_port, int to_port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(from_port);
+    inet_pton(AF_INET, BENCH_IP, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    relays.push_back({fd, to_port, {}});
+    return true;
+}
+
+bool DelayRelay::start(int delay_ms) {
+    delay = chrono::milliseconds(delay_ms);
+    // With BUNDLE the client sends to +0 and the server to +10
+    if (!add_relay(CLIENT_BASE_PORT + CLIENT_TO_SERVER_PORT_OFFSET, SERVER_BASE_PORT + CLIENT_TO_SERVER_PORT_OFFSET) ||
+        !add_relay(SERVER_BASE_PORT + SERVER_TO_CLIENT_PORT_OFFSET, CLIENT_BASE_PORT + SERVER_TO_CLIENT_PORT_OFFSET)) {
+        stop();
+        return false;
+    }
+    running = true;
+    worker = thread(&DelayRelay::run, this);
+    return true;
+}
+
+void DelayRelay::stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+    for (const Relay& relay : relays) {
+        close(relay.fd);
+    }
+    relays.clear();
+}
+
+void DelayRelay::run() {
+    vector<struct pollfd> fds;
+    for (const Relay& relay : relays) {
+        fds.push_back({relay.fd, POLLIN, 0});
+    }
+    uint8_t buf[65536];
+    while (running) {
+        // Until the next packet is due, at most 20 ms
+        auto now = chrono::steady_clock::now();
+        int timeout_ms = 20;
+        for (const Relay& relay : relays) {
+            if (!relay.held.empty()) {
+                auto wait = chrono::duration_cast<chrono::milliseconds>(relay.held.front().due - now).count();
+                timeout_ms = max(0, min(timeout_ms, (int)wait));
+            }
+        }
+        poll(fds.data(), fds.size(), timeout_ms);
+
+        now = chrono::steady_clock::now();
+        for (size_t i = 0; i < fds.size(); i++) {
+            Relay& relay = relays[i];
+            ssize_t n;
+            while ((fds[i].revents & POLLIN) && (n = recv(relay.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                relay.held.push_back({now + delay, vector<uint8_t>(buf, buf + n)});
+            }
+
+            struct sockaddr_in to;
+            memset(&to, 0, sizeof(to));
+            to.sin_family = AF_INET;
+            to.sin_port = htons(relay.to_port);
+            inet_pton(AF_INET, BENCH_IP, &to.sin_addr);
+            // The delay is the same for all, so packets come due in order
+            while (!relay.held.empty() && relay.held.front().due <= now) {
+                const vector<uint8_t>& data = relay.held.front().data;
+                sendto(relay.fd, data.data(), data.size(), 0, (struct sockaddr*)&to, sizeof(to));
+                relay.held.pop_front();
+            }
+        }
+    }
+}
+
+struct BenchState {
+    GMainLoop *loop;
+    bool failed;
+};
+
+static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer data) {
+    BenchState *state = (BenchState*)data;
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError *err;
+        gchar *debug;
+        gst_message_parse_error(msg, &err, &debug);
+        cerr << "Error: " << err->message << endl;
+        g_error_free(err);
+        g_free(debug);
+        state->failed = true;
+        g_main_loop_quit(state->loop);
+    }
+    return TRUE;
+}
+
+static gboolean on_done(gpointer data) {
+    g_main_loop_quit((GMainLoop*)data);
+    return FALSE;
+}
+
+static bool run(int delay_ms, int seconds, RunResult& result) {
+    result = RunResult();
+    MediaProfile client_profile;
+    client_profile.source = "test";
+    client_profile.sink = "none";
+    client_profile.transport = "bundle";
+    client_profile.capture_time = true;
+    client_profile.base_port = CLIENT_BASE_PORT;
+    MediaProfile server_profile = client_profile;
+    server_profile.base_port = SERVER_BASE_PORT;
+
+    // Each side addresses the relay through its own base port
+    MediaPipeline client_media, server_media;
+    if (!build_media_pipeline(client_profile, MEDIA_ROLE_CLIENT, BENCH_IP, client_media)) {
+        return false;
+    }
+    if (!build_media_pipeline(server_profile, MEDIA_ROLE_SERVER, BENCH_IP, server_media)) {
+        gst_object_unref(client_media.pipeline);
+        return false;
+    }
+    DelayRelay relay;
+    if (!relay.start(delay_ms)) {
+        cerr << "Cannot bind relay ports " << CLIENT_BASE_PORT << " and " << SERVER_BASE_PORT + 10 << endl;
+        gst_object_unref(client_media.pipeline);
+        gst_object_unref(server_media.pipeline);
+        return false;
+    }
+
+    {
+        // Both sides share one key; the exchange is not under test here
+        vector<uint8_t> key(SRTP_MASTER_KEY_SIZE);
+        random_bytes(key.data(), key.size());
+        SrtpKeyRing client_ring(client_media.pipeline, client_media.encoder_names, client_media.decoder_names);
+        SrtpKeyRing server_ring(server_media.pipeline, server_media.encoder_names, server_media.decoder_names);
+        client_ring.set_placeholder_key();
+        server_ring.set_placeholder_key();
+        client_ring.start(key);
+        server_ring.start(key);
+
+        GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+        BenchState state = {loop, false};
+        GstBus *client_bus = gst_element_get_bus(client_media.pipeline);
+        GstBus *server_bus = gst_element_get_bus(server_media.pipeline);
+        guint client_watch = gst_bus_add_watch(client_bus, on_bus_message, &state);
+        guint server_watch = gst_bus_add_watch(server_bus, on_bus_message, &state);
+        gst_object_unref(client_bus);
+        gst_object_unref(server_bus);
+
+        // The client stamps what it sends; the server measures it, and needs
+        // the client's receiver reports for the RTT
+        CaptureLatencyMeter client_meter(client_media, client_profile);
+        CaptureLatencyMeter server_meter(server_media, server_profile);
+        gst_element_set_state(server_media.pipeline, GST_STATE_PLAYING);
+        gst_element_set_state(client_media.pipeline, GST_STATE_PLAYING);
+        client_meter.start();
+        server_meter.start();
+        g_timeout_add_seconds(seconds, on_done, loop);
+        g_main_loop_run(loop);
+
+        client_meter.stop();
+        server_meter.stop();
+        result.video = server_meter.video_summary();
+        result.audio = server_meter.audio_summary();
+        result.offsets_ms = server_meter.clock_offsets_ms();
+        result.failed = state.failed;
+        gst_element_set_state(client_media.pipeline, GST_STATE_NULL);
+        g_usleep(BENCH_DRAIN_MS * 1000);
+        gst_element_set_state(server_media.pipeline, GST_STATE_NULL);
+        g_source_remove(client_watch);
+        g_source_remove(server_watch);
+        g_main_loop_unref(loop);
+    }
+    relay.stop();
+    gst_object_unref(client_media.pipeline);
+    gst_object_unref(server_media.pipeline);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    vector<int> delays = {0};
+    stringstream list(argc > 1 ? argv[1] : "50,100");
+    string item;
+    while (getline(list, item, ',')) {
+        delays.push_back(atoi(item.c_str()));
+    }
+    int seconds = argc > 2 ? atoi(argv[2]) : 15;
+
+    bool valid = delays.size() > 1 && seconds > 0;
+    for (size_t i = 1; i < delays.size(); i++) {
+        valid = valid && delays[i] > 0 && delays[i] <= 1000;
+    }
+    if (!valid) {
+        cout << "Usage: " << argv[0] << " [added one-way delays in ms, e.g. 50,100] [seconds per run]" << endl;
+        return -1;
+    }
+
+    // Pipeline and meter logging would bury the table
+    cout.setstate(ios::badbit);
+    printf("%d s per run, client to server, stamped test video and audio; every run is compared with the first\n",
+           seconds);
+    printf("%-6s %7s %8s %8s %7s %8s %8s %8s %8s %8s\n", "delay", "offset", "frames", "total", "encode", "network",
+           "playout", "audio", "network", "total");
+    printf("%-6s %7s %8s %8s %7s %8s %8s %8s %8s %8s\n", "(ms)", "(ms)", "video", "p50", "p50", "p50", "p50", "p50",
+           "change", "change");
+
+    bool failed = false;
+    RunResult baseline;
+    for (size_t i = 0; i < delays.size(); i++) {
+        RunResult result;
+        if (!run(delays[i], seconds, result)) {
+            fprintf(stderr, "Cannot set up the pipelines and relay\n");
+            return 1;
+        }
+        if (i == 0) {
+            baseline = result;
+        }
+        double worst_offset = 0;
+        for (double offset : result.offsets_ms) {
+            worst_offset = fabs(offset) > fabs(worst_offset) ? offset : worst_offset;
+        }
+        double network_change = result.video.network_p50 - baseline.video.network_p50;
+        double total_change = result.video.total_p50 - baseline.video.total_p50;
+        printf("%-6d %7.1f %8llu %8.1f %7.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", delays[i], worst_offset,
+               (unsigned long long)result.video.frames, result.video.total_p50, result.video.encode_p50,
+               result.video.network_p50, result.video.playout_p50, result.audio.total_p50, network_change,
+               total_change);
+
+        if (result.failed || result.video.frames == 0 || result.audio.frames == 0 || result.offsets_ms.empty()) {
+            fprintf(stderr, "%d ms: %llu video and %llu audio frames measured, %zu clock offsets\n", delays[i],
+                    (unsigned long long)result.video.frames, (unsigned long long)result.audio.frames,
+                    result.offsets_ms.size());
+            failed = true;
+        }
+        if (fabs(worst_offset) > OFFSET_TOLERANCE_MS) {
+            fprintf(stderr, "%d ms: clock offset %.1f ms on one clock\n", delays[i], worst_offset);
+            failed = true;
+        }
+        if (fabs(network_change - delays[i]) > DELAY_TOLERANCE_MS ||
+            fabs(total_change - delays[i]) > DELAY_TOLERANCE_MS) {
+            fprintf(stderr, "%d ms: network moved by %.1f ms, total by %.1f ms\n", delays[i], network_change,
+                    total_change);
+            failed = true;
+        }
+    }
+
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
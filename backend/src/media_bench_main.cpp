@@ -0,0 +1,369 @@
+#include <gst/gst.h>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+#include "crypto_utils.h"
+#include "media_pipeline.h"
+#include "srtp_rekey.h"
+#include "capture_latency.h"
+#include "network_impairment.h"
+
+using namespace std;
+
+// Media path benchmark that needs no camera, display or audio device. A
+// client and a server pipeline in one process call each other over loopback
+// with live test video (noise, so the encoder always reaches its bitrate)
+// and a test tone, and discard what they receive. Every resolution and
+// bitrate runs for a warm-up, then for a measured window:
+// - fps: stamped frames of the client's video rendered by the server, per s
+// - latency: capture to render of those frames, p50/p95/p99
+// - cpu: the process's CPU time over wall time, in cores, and the busiest
+//   core of the machine
+// - rss: the process's resident memory at the end of the window
+// - packets: SRTP and SRTCP packets reaching each side's decoders, per s
+// Rates are fixed rather than adaptive and the runs go in a fixed order, so
+// two commits on one idle machine can be compared row by row.
+
+#define BENCH_IP "127.0.0.1"
+#define BENCH_BASE_PORT 6300
+#define BENCH_FPS 30
+#define BENCH_WARMUP_MS 3000
+#define BENCH_DRAIN_MS 500
+
+struct BenchConfig {
+    int width;
+    int height;
+    int kbps;
+};
+
+struct RunResult {
+    LatencySummary video;
+    double fps = 0;
+    double cpu_cores = 0;
+    double busiest_core = 0;    // %
+    long rss_kb = 0;
+    double client_to_server_pps = 0;
+    double server_to_client_pps = 0;
+    bool failed = false;
+};
+
+// SRTP and SRTCP packets reaching a pipeline's srtpdecs
+class PacketCounter {
+public:
+    explicit PacketCounter(const MediaPipeline& media);
+    ~PacketCounter();
+
+    // Since the last call
+    uint64_t take() { return packets.exchange(0); }
+
+private:
+    static GstPadProbeReturn on_packets(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    vector<pair<GstPad*, gulong>> probes;
+    atomic<uint64_t> packets;
+};
+
+PacketCounter::PacketCounter(const MediaPipeline& media) : packets(0) {
+    for (const string& name : media.decoder_names) {
+        GstElement *decoder = gst_bin_get_by_name(GST_BIN(media.pipeline), name.c_str());
+        if (!decoder) {
+            continue;
+        }
+        for (const char *pad_name : {"rtp_sink", "rtcp_sink"}) {
+            GstPad *pad = gst_element_get_static_pad(decoder, pad_name);
+            if (pad) {
+                gulong id = gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                                              on_packets, this, NULL);
+                probes.push_back({pad, id});
+            }
+        }
+        gst_object_unref(decoder);
+    }
+}
+
+PacketCounter::~PacketCounter() {
+    for (const auto& probe : probes) {
+        gst_pad_remove_probe(probe.first, probe.second);
+        gst_object_unref(probe.first);
+    }
+}
+
+GstPadProbeReturn PacketCounter::on_packets(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    PacketCounter *counter = (PacketCounter*)user_data;
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        counter->packets += gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+    } else {
+        counter->packets++;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Busy and total ticks of every core, from /proc/stat
+static vector<pair<uint64_t, uint64_t>> read_core_ticks() {
+    vector<pair<uint64_t, uint64_t>> cores;
+    ifstream stat("/proc/stat");
+    string line;
+    while (getline(stat, line)) {
+        if (line.compare(0, 3, "cpu") != 0 || line.size() < 4 || !isdigit((unsigned char)line[3])) {
+            continue;
+        }
+        istringstream fields(line);
+        string name;
+        uint64_t user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+        fields >> name >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal;
+        uint64_t total = user + nice + system + idle + iowait + irq + softirq + steal;
+        cores.push_back({total - idle - iowait, total});
+    }
+    return cores;
+}
+
+static double process_cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static long read_rss_kb() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return atol(line.c_str() + 6);
+        }
+    }
+    return 0;
+}
+
+struct BenchState {
+    GMainLoop *loop;
+    bool failed;
+    int seconds;
+    CaptureLatencyMeter *meter;
+    PacketCounter *client_packets;
+    PacketCounter *server_packets;
+    // At the end of the warm-up
+    chrono::steady_clock::time_point window_start;
+    double cpu_start;
+    vector<pair<uint64_t, uint64_t>> cores_start;
+};
+
+static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer data) {
+    BenchState *state = (BenchState*)data;
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError *err;
+        gchar *debug;
+        gst_message_parse_error(msg, &err, &debug);
+        cerr << "Error: " << err->message << endl;
+        g_error_free(err);
+        g_free(debug);
+        state->failed = true;
+        g_main_loop_quit(state->loop);
+    }
+    return TRUE;
+}
+
+static gboolean on_done(gpointer data) {
+    g_main_loop_quit((GMainLoop*)data);
+    return FALSE;
+}
+
+// Encoders have settled and the clock offset is known: the window starts
+static gboolean on_warmed_up(gpointer data) {
+    BenchState *state = (BenchState*)data;
+    state->meter->reset_summaries();
+    state->client_packets->take();
+    state->server_packets->take();
+    state->window_start = chrono::steady_clock::now();
+    state->cpu_start = process_cpu_seconds();
+    state->cores_start = read_core_ticks();
+    g_timeout_add_seconds(state->seconds, on_done, state->loop);
+    return FALSE;
+}
+
+static bool run(const MediaProfile& base, const BenchConfig& config, int seconds, RunResult& result) {
+    result = RunResult();
+    MediaProfile profile = base;
+    profile.source = "test";
+    profile.sink = "none";
+    profile.capture_time = true;
+    profile.adaptive_bitrate = false;
+    profile.base_port = BENCH_BASE_PORT;
+    profile.width = config.width;
+    profile.height = config.height;
+    profile.fps = base.fps > 0 ? base.fps : BENCH_FPS;
+    profile.video_bitrate = config.kbps;
+    profile.min_video_bitrate = min(profile.min_video_bitrate, config.kbps);
+    profile.max_video_bitrate = max(profile.max_video_bitrate, config.kbps);
+
+    // Both sides use the same ports, as across two machines
+    MediaPipeline client_media, server_media;
+    if (!build_media_pipeline(profile, MEDIA_ROLE_CLIENT, BENCH_IP, client_media)) {
+        return false;
+    }
+    if (!build_media_pipeline(profile, MEDIA_ROLE_SERVER, BENCH_IP, server_media)) {
+        gst_object_unref(client_media.pipeline);
+        return false;
+    }
+
+    {
+        // Both sides share one key; the exchange is not under test here
+        vector<uint8_t> key(SRTP_MASTER_KEY_SIZE);
+        random_bytes(key.data(), key.size());
+        SrtpKeyRing client_ring(client_media.pipeline, client_media.encoder_names, client_media.decoder_names);
+        SrtpKeyRing server_ring(server_media.pipeline, server_media.encoder_names, server_media.decoder_names);
+        client_ring.set_placeholder_key();
+        server_ring.set_placeholder_key();
+        client_ring.start(key);
+        server_ring.start(key);
+
+        GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+        // The client stamps what it sends; the server measures it, and needs
+        // the client's receiver reports for the RTT
+        CaptureLatencyMeter client_meter(client_media, profile);
+        CaptureLatencyMeter server_meter(server_media, profile);
+        PacketCounter client_packets(client_media);
+        PacketCounter server_packets(server_media);
+        BenchState state = {loop, false, seconds, &server_meter, &client_packets, &server_packets,
+                            chrono::steady_clock::now(), 0, {}};
+
+        GstBus *client_bus = gst_element_get_bus(client_media.pipeline);
+        GstBus *server_bus = gst_element_get_bus(server_media.pipeline);
+        guint client_watch = gst_bus_add_watch(client_bus, on_bus_message, &state);
+        guint server_watch = gst_bus_add_watch(server_bus, on_bus_message, &state);
+        gst_object_unref(client_bus);
+        gst_object_unref(server_bus);
+
+        gst_element_set_state(server_media.pipeline, GST_STATE_PLAYING);
+        gst_element_set_state(client_media.pipeline, GST_STATE_PLAYING);
+        client_meter.start();
+        server_meter.start();
+        g_timeout_add(BENCH_WARMUP_MS, on_warmed_up, &state);
+        g_main_loop_run(loop);
+
+        double window_s = chrono::duration<double>(chrono::steady_clock::now() - state.window_start).count();
+        double cpu_s = process_cpu_seconds() - state.cpu_start;
+        vector<pair<uint64_t, uint64_t>> cores = read_core_ticks();
+        result.rss_kb = read_rss_kb();
+        result.client_to_server_pps = server_packets.take() / window_s;
+        result.server_to_client_pps = client_packets.take() / window_s;
+        client_meter.stop();
+        server_meter.stop();
+        result.video = server_meter.video_summary();
+        result.fps = (result.video.frames + result.video.unsynced) / window_s;
+        result.cpu_cores = cpu_s / window_s;
+        for (size_t i = 0; i < cores.size() && i < state.cores_start.size(); i++) {
+            uint64_t busy = cores[i].first - state.cores_start[i].first;
+            uint64_t total = cores[i].second - state.cores_start[i].second;
+            if (total > 0) {
+                result.busiest_core = max(result.busiest_core, 100.0 * busy / total);
+            }
+        }
+        result.failed = state.failed;
+
+        gst_element_set_state(client_media.pipeline, GST_STATE_NULL);
+        g_usleep(BENCH_DRAIN_MS * 1000);
+        gst_element_set_state(server_media.pipeline, GST_STATE_NULL);
+        g_source_remove(client_watch);
+        g_source_remove(server_watch);
+        g_main_loop_unref(loop);
+    }
+    gst_object_unref(client_media.pipeline);
+    gst_object_unref(server_media.pipeline);
+    return true;
+}
+
+// "640x360,1280x720"
+static bool parse_resolutions(const string& text, vector<pair<int, int>>& resolutions) {
+    stringstream list(text);
+    string item;
+    while (getline(list, item, ',')) {
+        int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0 ||
+            width > 7680 || height > 4320) {
+            return false;
+        }
+        resolutions.push_back({width, height});
+    }
+    return !resolutions.empty();
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    // Media options such as --video-codec=vp8 or --udp-io=batched apply to
+    // every run; source, sink, size and bitrate are the benchmark's
+    MediaProfile base;
+    if (!parse_media_args(argc, argv, base)) {
+        return -1;
+    }
+
+    vector<pair<int, int>> resolutions;
+    vector<int> bitrates;
+    bool valid = argc <= 4 && parse_resolutions(argc > 1 ? argv[1] : "640x360,1280x720", resolutions);
+    stringstream list(argc > 2 ? argv[2] : "500,2000");
+    string item;
+    while (getline(list, item, ',')) {
+        int kbps = atoi(item.c_str());
+        valid = valid && kbps >= 50 && kbps <= 50000;
+        bitrates.push_back(kbps);
+    }
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    if (!valid || bitrates.empty() || seconds <= 0) {
+        cout << "Usage: " << argv[0] << " [resolutions, e.g. 640x360,1280x720] [video kbit/s, e.g. 500,2000]"
+             << " [seconds per run] [options]" << endl;
+        cout << media_options_help() << endl;
+        return -1;
+    }
+
+    vector<BenchConfig> configs;
+    for (const auto& resolution : resolutions) {
+        for (int kbps : bitrates) {
+            configs.push_back({resolution.first, resolution.second, kbps});
+        }
+    }
+
+    // Pipeline and meter logging would bury the table
+    cout.setstate(ios::badbit);
+    printf("%s at %d fps, %s transport, %s UDP I/O; %d s per run after %d ms warm-up\n", base.video_codec.c_str(),
+           base.fps > 0 ? base.fps : BENCH_FPS, base.transport.c_str(), base.udp_io.c_str(), seconds,
+           BENCH_WARMUP_MS);
+    if (impairment_enabled(base)) {
+        printf("impaired: delay %d +/- %d ms, loss %.2f%% in runs of %d, reorder %.2f%%, duplicate %.2f%%, "
+               "rate %d kbit/s, seed %d\n", base.impair_delay, base.impair_jitter, base.impair_loss, base.impair_burst,
+               base.impair_reorder, base.impair_duplicate, base.impair_rate, base.impair_seed);
+    }
+    printf("%-10s %6s %6s %7s %7s %7s %7s %6s %7s %9s %9s\n", "size", "kbit/s", "fps", "p50", "p95", "p99",
+           "cpu", "core", "rss", "pkt/s", "pkt/s");
+    printf("%-10s %6s %6s %7s %7s %7s %7s %6s %7s %9s %9s\n", "", "", "", "(ms)", "(ms)", "(ms)", "(cores)",
+           "max %", "(MB)", "c->s", "s->c");
+
+    bool failed = false;
+    for (const BenchConfig& config : configs) {
+        RunResult result;
+        if (!run(base, config, seconds, result)) {
+            fprintf(stderr, "Cannot set up the pipelines on ports %d+\n", BENCH_BASE_PORT);
+            return 1;
+        }
+        string size = to_string(config.width) + "x" + to_string(config.height);
+        printf("%-10s %6d %6.1f %7.1f %7.1f %7.1f %7.2f %6.0f %7.1f %9.0f %9.0f\n", size.c_str(), config.kbps,
+               result.fps, result.video.total_p50, result.video.total_p95, result.video.total_p99, result.cpu_cores,
+               result.busiest_core, result.rss_kb / 1024.0, result.client_to_server_pps,
+               result.server_to_client_pps);
+        if (result.failed || result.video.frames == 0) {
+            fprintf(stderr, "%s at %d kbit/s: %llu frames measured%s\n", size.c_str(), config.kbps,
+                    (unsigned long long)result.video.frames, result.failed ? ", pipeline error" : "");
+            failed = true;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
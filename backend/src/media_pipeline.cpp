@@ -0,0 +1,1144 @@
+#include "media_pipeline.h"
+#include "batched_udp.h"
+#include "network_impairment.h"
+#include <gio/gio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <initializer_list>
+#include <utility>
+#include <unistd.h>
+
+using namespace std;
+
+#define VIDEO_SESSION 0
+#define AUDIO_SESSION 1
+
+#define SRTP_CIPHER "aes-256-icm"
+#define SRTP_AUTH "hmac-sha1-80"
+#define SRTCP_CAPS "application/x-srtcp"
+#define BUNDLE_CAPS "application/x-srtp"
+
+// Packets kept for FEC recovery beyond the jitterbuffer latency
+#define FEC_STORAGE_MARGIN_MS 100
+
+// What sink "app" hands over: 32-bit pixels, as QImage::Format_RGB32 and
+// most toolkits take them, so nothing has to be converted again
+#define APP_SINK_CAPS "video/x-raw,format=BGRx"
+
+static const char* const x264_presets[] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow", "placebo"
+};
+
+static bool parse_bool(const string& value, bool& out) {
+    if (value == "1" || value == "on" || value == "true") {
+        out = true;
+        return true;
+    }
+    if (value == "0" || value == "off" || value == "false") {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+bool parse_int(const string& value, int min, int max, int& out) {
+    if (value.empty()) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    long parsed = strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || errno != 0 || parsed < min || parsed > max) {
+        return false;
+    }
+    out = (int)parsed;
+    return true;
+}
+
+static bool parse_double(const string& value, double min, double max, double& out) {
+    if (value.empty()) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    double parsed = strtod(value.c_str(), &end);
+    if (*end != '\0' || errno != 0 || !(parsed >= min && parsed <= max)) {
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+static string trim(const string& s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+bool set_media_option(MediaProfile& profile, const string& name, const string& value) {
+    if (name == "width") {
+        return parse_int(value, 0, 7680, profile.width);
+    }
+    if (name == "height") {
+        return parse_int(value, 0, 4320, profile.height);
+    }
+    if (name == "fps") {
+        return parse_int(value, 0, 240, profile.fps);
+    }
+    if (name == "video-codec") {
+        if (value != "h264" && value != "vp8") {
+            return false;
+        }
+        profile.video_codec = value;
+        return true;
+    }
+    if (name == "video-bitrate") {
+        return parse_int(value, 16, 100000, profile.video_bitrate);
+    }
+    if (name == "min-video-bitrate") {
+        return parse_int(value, 16, 100000, profile.min_video_bitrate);
+    }
+    if (name == "max-video-bitrate") {
+        return parse_int(value, 16, 100000, profile.max_video_bitrate);
+    }
+    if (name == "adaptive-bitrate") {
+        return parse_bool(value, profile.adaptive_bitrate);
+    }
+    if (name == "fec") {
+        return parse_bool(value, profile.fec);
+    }
+    if (name == "gop") {
+        return parse_int(value, 1, 3000, profile.gop);
+    }
+    if (name == "x264-preset") {
+        for (const char* preset : x264_presets) {
+            if (value == preset) {
+                profile.x264_preset = value;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (name == "audio-bitrate") {
+        return parse_int(value, 4000, 650000, profile.audio_bitrate);
+    }
+    if (name == "mtu") {
+        return parse_int(value, 256, 9000, profile.mtu);
+    }
+    if (name == "udp-buffer") {
+        return parse_int(value, 0, INT_MAX, profile.udp_buffer_size);
+    }
+    if (name == "jitter-latency") {
+        return parse_int(value, 0, 10000, profile.jitter_latency);
+    }
+    if (name == "jitter-mode") {
+        if (value != "fixed" && value != "adaptive") {
+            return false;
+        }
+        profile.jitter_mode = value;
+        return true;
+    }
+    if (name == "max-jitter-latency") {
+        return parse_int(value, 1, 10000, profile.max_jitter_latency);
+    }
+    if (name == "capture-time") {
+        return parse_bool(value, profile.capture_time);
+    }
+    if (name == "rtcp-interval") {
+        return parse_int(value, 100, 10000, profile.rtcp_interval);
+    }
+    if (name == "source") {
+        if (value != "camera" && value != "test") {
+            return false;
+        }
+        profile.source = value;
+        return true;
+    }
+    if (name == "sink") {
+        if (value != "screen" && value != "app" && value != "none") {
+            return false;
+        }
+        profile.sink = value;
+        return true;
+    }
+    if (name == "transport") {
+        if (value != "legacy" && value != "bundle") {
+            return false;
+        }
+        profile.transport = value;
+        return true;
+    }
+    if (name == "udp-io") {
+        if (value != "stock" && value != "batched") {
+            return false;
+        }
+        profile.udp_io = value;
+        return true;
+    }
+    if (name == "udp-offload") {
+        return parse_bool(value, profile.udp_offload);
+    }
+    if (name == "trace-interval") {
+        return parse_int(value, 0, 86400, profile.trace_interval);
+    }
+    if (name == "trace-file") {
+        profile.trace_file = value;
+        return !value.empty();
+    }
+    if (name == "stats-socket") {
+        profile.stats_socket = value;
+        return !value.empty();
+    }
+    if (name == "stats-interval") {
+        return parse_int(value, 20, 60000, profile.stats_interval);
+    }
+    if (name == "impair-delay") {
+        return parse_int(value, 0, 10000, profile.impair_delay);
+    }
+    if (name == "impair-jitter") {
+        return parse_int(value, 0, 10000, profile.impair_jitter);
+    }
+    if (name == "impair-loss") {
+        return parse_double(value, 0, 100, profile.impair_loss);
+    }
+    if (name == "impair-burst") {
+        return parse_int(value, 1, 1000, profile.impair_burst);
+    }
+    if (name == "impair-reorder") {
+        return parse_double(value, 0, 100, profile.impair_reorder);
+    }
+    if (name == "impair-duplicate") {
+        return parse_double(value, 0, 100, profile.impair_duplicate);
+    }
+    if (name == "impair-rate") {
+        return parse_int(value, 0, 10000000, profile.impair_rate);
+    }
+    if (name == "impair-seed") {
+        return parse_int(value, 0, INT_MAX, profile.impair_seed);
+    }
+    if (name == "base-port") {
+        return parse_int(value, 1024, 65535 - SERVER_FEEDBACK_PORT_OFFSET - 2, profile.base_port);
+    }
+    return false;
+}
+
+bool load_media_profile(const string& path, MediaProfile& profile) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "Cannot read media profile: " << path << endl;
+        return false;
+    }
+
+    string line;
+    int line_number = 0;
+    while (getline(file, line)) {
+        line_number++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == string::npos || !set_media_option(profile, trim(line.substr(0, eq)), trim(line.substr(eq + 1)))) {
+            cerr << path << ":" << line_number << ": invalid setting: " << line << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool validate_media_profile(const MediaProfile& profile) {
+    if (profile.min_video_bitrate > profile.max_video_bitrate) {
+        cerr << "min-video-bitrate is above max-video-bitrate" << endl;
+        return false;
+    }
+    if (profile.video_bitrate < profile.min_video_bitrate || profile.video_bitrate > profile.max_video_bitrate) {
+        cerr << "video-bitrate " << profile.video_bitrate << " is outside min-video-bitrate "
+             << profile.min_video_bitrate << " to max-video-bitrate " << profile.max_video_bitrate << endl;
+        return false;
+    }
+    return true;
+}
+
+bool parse_media_args(int& argc, char** argv, MediaProfile& profile) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        // --gst-* options are left for gst_init()
+        if (arg.compare(0, 2, "--") != 0 || arg.compare(0, 6, "--gst-") == 0) {
+            argv[kept++] = argv[i];
+            continue;
+        }
+
+        size_t eq = arg.find('=');
+        string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+        bool ok = name == "profile" ? load_media_profile(value, profile) : set_media_option(profile, name, value);
+        if (!ok) {
+            cerr << "Invalid option: " << arg << endl;
+            return false;
+        }
+    }
+    argc = kept;
+    argv[argc] = NULL;
+    return validate_media_profile(profile);
+}
+
+string media_options_help() {
+    MediaProfile defaults;
+    ostringstream help;
+    help << "Media options (--name=value; the same names, one per line as name = value, in a file):\n"
+         << "  --profile=<file>        read options from a file; later options override it\n"
+         << "  --width=<pixels>        capture width, 0 for the camera's (" << defaults.width << ")\n"
+         << "  --height=<pixels>       capture height, 0 for the camera's (" << defaults.height << ")\n"
+         << "  --fps=<frames>          capture frame rate, 0 for the camera's (" << defaults.fps << ")\n"
+         << "  --video-codec=h264|vp8  video codec, same on both sides (" << defaults.video_codec << ")\n"
+         << "  --video-bitrate=<kbit>  video bitrate, or start bitrate when adaptive, in kbit/s (" << defaults.video_bitrate << ")\n"
+         << "  --min-video-bitrate=<kbit>  lowest adaptive video bitrate (" << defaults.min_video_bitrate << ")\n"
+         << "  --max-video-bitrate=<kbit>  highest adaptive video bitrate (" << defaults.max_video_bitrate << ")\n"
+         << "  --adaptive-bitrate=on|off   follow the peer's receiver reports (" << (defaults.adaptive_bitrate ? "on" : "off") << ")\n"
+         << "  --fec=on|off            send and recover FEC when the peer has it on too (" << (defaults.fec ? "on" : "off") << ")\n"
+         << "  --gop=<frames>          frames between keyframes (" << defaults.gop << ")\n"
+         << "  --x264-preset=<preset>  x264 speed preset (" << defaults.x264_preset << ")\n"
+         << "  --audio-bitrate=<bit>   Opus bitrate in bit/s (" << defaults.audio_bitrate << ")\n"
+         << "  --mtu=<bytes>           largest RTP packet (" << defaults.mtu << ")\n"
+         << "  --udp-buffer=<bytes>    receive socket buffer, 0 for the OS default (" << defaults.udp_buffer_size << ")\n"
+         << "  --jitter-latency=<ms>   jitter buffer latency, or start latency when adaptive (" << defaults.jitter_latency << ")\n"
+         << "  --jitter-mode=fixed|adaptive  fixed latency, or sized per stream with NACK/RTX (" << defaults.jitter_mode << ")\n"
+         << "  --max-jitter-latency=<ms>  highest adaptive latency (" << defaults.max_jitter_latency << ")\n"
+         << "  --capture-time=on|off   stamp sent packets with capture and send time (" << (defaults.capture_time ? "on" : "off") << ")\n"
+         << "  --rtcp-interval=<ms>    minimum RTCP report interval (" << defaults.rtcp_interval << ")\n"
+         << "  --source=camera|test    capture devices, or live test noise and tone (" << defaults.source << ")\n"
+         << "  --sink=screen|app|none  play what arrives, hand video to the application, or discard\n"
+         << "                          it (" << defaults.sink << ")\n"
+         << "  --impair-delay=<ms>     delay everything sent, in userspace, like netem (" << defaults.impair_delay << ")\n"
+         << "  --impair-jitter=<ms>    vary each packet's delay by up to this either way (" << defaults.impair_jitter << ")\n"
+         << "  --impair-loss=<%>       drop this share of sent packets (" << defaults.impair_loss << ")\n"
+         << "  --impair-burst=<packets>  mean run of lost packets, 1 for independent losses (" << defaults.impair_burst << ")\n"
+         << "  --impair-reorder=<%>    send this share at once, ahead of delayed packets (" << defaults.impair_reorder << ")\n"
+         << "  --impair-duplicate=<%>  send this share twice (" << defaults.impair_duplicate << ")\n"
+         << "  --impair-rate=<kbit>    cap each sender's rate, 0 for no cap (" << defaults.impair_rate << ")\n"
+         << "  --impair-seed=<n>       seed of the impairment decisions (" << defaults.impair_seed << ")\n"
+         << "  --base-port=<port>      first media port, same on both sides (" << defaults.base_port << ")\n"
+         << "  --transport=legacy|bundle  a UDP port per stream, or everything on one port, same on\n"
+         << "                          both sides (" << defaults.transport << ")\n"
+         << "  --udp-io=stock|batched  udpsrc/udpsink, or recvmmsg/sendmmsg batches (" << defaults.udp_io << ")\n"
+         << "  --udp-offload=on|off    UDP GSO/GRO for batched I/O (" << (defaults.udp_offload ? "on" : "off") << ")\n"
+         << "  --trace-interval=<s>    log per-element latency every s seconds and at exit, 0 for off (" << defaults.trace_interval << ")\n"
+         << "  --trace-file=<path>     with tracing, also write the histograms to a CSV file\n"
+         << "  --stats-socket=<path>   serve live call statistics on a Unix socket\n"
+         << "  --stats-interval=<ms>   time between statistics snapshots (" << defaults.stats_interval << ")";
+    return help.str();
+}
+
+// Properties are set from strings, so the same call works for numbers,
+// booleans, enums and caps
+static void set_properties(GstElement *element, initializer_list<pair<const char*, string>> properties) {
+    for (const auto& property : properties) {
+        gst_util_set_object_arg(G_OBJECT(element), property.first, property.second.c_str());
+    }
+}
+
+// The new element belongs to the pipeline, so an early return leaks nothing
+static GstElement* add_element(GstElement *pipeline, const char* factory, const string& name = "") {
+    GstElement *element = gst_element_factory_make(factory, name.empty() ? NULL : name.c_str());
+    if (!element) {
+        cerr << "Missing GStreamer element: " << factory << endl;
+        return NULL;
+    }
+    gst_bin_add(GST_BIN(pipeline), element);
+    return element;
+}
+
+static bool link(GstElement *src, const string& src_pad, GstElement *sink, const string& sink_pad) {
+    if (!gst_element_link_pads(src, src_pad.c_str(), sink, sink_pad.c_str())) {
+        cerr << "Cannot link " << GST_ELEMENT_NAME(src) << "." << src_pad << " to "
+             << GST_ELEMENT_NAME(sink) << "." << sink_pad << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool link_chain(initializer_list<GstElement*> elements) {
+    GstElement *previous = NULL;
+    for (GstElement *element : elements) {
+        if (!element) {
+            return false;
+        }
+        if (previous && !link(previous, "src", element, "sink")) {
+            return false;
+        }
+        previous = element;
+    }
+    return true;
+}
+
+static void on_new_jitterbuffer(GstElement *rtpbin, GstElement *jitterbuffer,
+                                guint session, guint ssrc, gpointer user_data) {
+    MediaPipeline *media = (MediaPipeline*)user_data;
+    // FEC recovers a packet when the jitterbuffer gives it up as lost. With
+    // adaptive jitter a JitterController takes latency and retransmission
+    // over from here.
+    set_properties(jitterbuffer, {
+        {"latency", to_string(media->jitter_latency)},
+        {"drop-on-latency", "true"},
+        {"do-lost", media->fec ? "true" : "false"},
+        {"do-retransmission", "false"},
+        {"rtx-delay", "20"},
+    });
+}
+
+// depayloader -> decoder -> sink for one received stream, linked. The first
+// stream of each kind gets the named elements; returns the chain, empty when
+// an element is missing. With fec, Opus fills a lost packet from the FEC
+// data in the next one.
+static vector<GstElement*> add_playback(GstElement *pipeline, bool video, const string& video_codec,
+                                        const string& sink_kind, bool fec, bool first) {
+    bool h264 = video_codec == "h264";
+    vector<GstElement*> chain;
+    if (video) {
+        chain = {
+            add_element(pipeline, h264 ? "rtph264depay" : "rtpvp8depay", first ? "video_depayloader" : ""),
+            add_element(pipeline, h264 ? "avdec_h264" : "vp8dec", first ? "video_decoder" : ""),
+            add_element(pipeline, "videoconvert"),
+            add_element(pipeline, sink_kind == "none" ? "fakesink" : sink_kind == "app" ? "appsink" : "autovideosink"),
+        };
+    } else {
+        chain = {
+            add_element(pipeline, "rtpopusdepay", first ? "audio_depayloader" : ""),
+            add_element(pipeline, "opusdec", first ? "audio_decoder" : ""),
+            add_element(pipeline, "audioconvert"),
+            add_element(pipeline, "audioresample"),
+            add_element(pipeline, sink_kind == "none" ? "fakesink" : "autoaudiosink"),
+        };
+    }
+    for (GstElement *element : chain) {
+        if (!element) {
+            return {};
+        }
+    }
+    if (!video && fec) {
+        set_properties(chain[1], {{"use-inband-fec", "true"}, {"plc", "true"}});
+    }
+    GstElement *sink = chain.back();
+    set_properties(sink, {{"sync", "false"}});
+    if (sink_kind == "none") {
+        set_properties(sink, {{"async", "false"}});
+    }
+    for (size_t i = 1; i < chain.size(); i++) {
+        if (!link(chain[i - 1], "src", chain[i], "sink")) {
+            return {};
+        }
+    }
+    return chain;
+}
+
+VideoFrame::VideoFrame(GstSample *sample, int stream) : sample(sample), mapped(false), stream_index(stream) {
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstVideoInfo info;
+    mapped = caps && buffer && gst_video_info_from_caps(&info, caps) &&
+             gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ);
+}
+
+VideoFrame::~VideoFrame() {
+    if (mapped) {
+        gst_video_frame_unmap(&frame);
+    }
+    gst_sample_unref(sample);
+}
+
+// appsink "new-sample", on the stream's streaming thread
+static GstFlowReturn on_new_sample(GstElement *appsink, gpointer user_data) {
+    MediaPipeline *media = (MediaPipeline*)user_data;
+    GstSample *sample = NULL;
+    g_signal_emit_by_name(appsink, "pull-sample", &sample);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    int stream = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(appsink), "stream"));
+    shared_ptr<VideoFrame> frame = make_shared<VideoFrame>(sample, stream);
+    if (frame->valid() && media->on_video_frame) {
+        media->on_video_frame(frame);
+    }
+    return GST_FLOW_OK;
+}
+
+// Frames reaching a video chain's appsink go to media.on_video_frame. Only
+// the newest two wait for the application; older ones are dropped.
+static void deliver_frames(GstElement *appsink, MediaPipeline *media) {
+    set_properties(appsink, {
+        {"caps", APP_SINK_CAPS},
+        {"emit-signals", "true"},
+        {"max-buffers", "2"},
+        {"drop", "true"},
+    });
+    g_object_set_data(G_OBJECT(appsink), "stream", GINT_TO_POINTER(media->video_streams++));
+    g_signal_connect(appsink, "new-sample", G_CALLBACK(on_new_sample), media);
+}
+
+// rtpbin adds recv_rtp_src_<session>_<ssrc>_<pt> once the peer's first packet
+// of a session arrives
+static void on_rtp_pad_added(GstElement *rtpbin, GstPad *pad, gpointer user_data) {
+    MediaPipeline *media = (MediaPipeline*)user_data;
+    gchar *name = gst_pad_get_name(pad);
+    unsigned int session, ssrc, pt;
+    GstElement *depayloader = NULL;
+    // The payload type picks the chain; with BUNDLE both share a session
+    if (sscanf(name, "recv_rtp_src_%u_%u_%u", &session, &ssrc, &pt) == 3) {
+        depayloader = pt == VIDEO_PAYLOAD_TYPE ? media->video_depayloader :
+                      pt == AUDIO_PAYLOAD_TYPE ? media->audio_depayloader : NULL;
+    }
+    if (!depayloader) {
+        g_free(name);
+        return;
+    }
+
+    // Behind an SFU every other participant is one more SSRC in the session:
+    // the first plays through the pipeline's own chain, later ones get a chain
+    // of their own, started in the pipeline's state
+    GstPad *sink = gst_element_get_static_pad(depayloader, "sink");
+    if (gst_pad_is_linked(sink)) {
+        gst_object_unref(sink);
+        vector<GstElement*> chain = add_playback(media->pipeline, pt == VIDEO_PAYLOAD_TYPE, media->video_codec,
+                                                 media->sink, media->fec, false);
+        if (chain.empty()) {
+            cerr << "Cannot play " << name << endl;
+            g_free(name);
+            return;
+        }
+        if (pt == VIDEO_PAYLOAD_TYPE && media->sink == "app") {
+            deliver_frames(chain.back(), media);
+        }
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            gst_element_sync_state_with_parent(*it);
+        }
+        sink = gst_element_get_static_pad(chain.front(), "sink");
+    }
+    if (gst_pad_link(pad, sink) != GST_PAD_LINK_OK) {
+        cerr << "Cannot link " << name << " to its depayloader" << endl;
+    }
+    gst_object_unref(sink);
+    g_free(name);
+}
+
+// udpsink to host:port, or an appsink sending with sendmmsg(). shared_fd, if
+// not -1, is the socket of the matching source.
+static GstElement* add_udp_sink(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media,
+                                const string& host, int port, int shared_fd = -1) {
+    if (profile.udp_io != "batched") {
+        GstElement *sink = add_element(pipeline, "udpsink");
+        if (sink) {
+            set_properties(sink, {{"host", host}, {"port", to_string(port)}, {"sync", "false"}, {"async", "false"}});
+        }
+        return sink;
+    }
+
+    GstElement *sink = add_element(pipeline, "appsink");
+    int fd = shared_fd >= 0 ? shared_fd : socket(AF_INET, SOCK_DGRAM, 0);
+    if (!sink || fd < 0) {
+        return NULL;
+    }
+    shared_ptr<BatchedUdpSender> sender(new BatchedUdpSender(fd, shared_fd < 0, host, port, profile.udp_offload));
+    sender->attach(sink);
+    media.udp_senders.push_back(sender);
+    return sink;
+}
+
+// udpsrc on port, or an appsrc fed by recvmmsg(). A given fd is used instead
+// of binding port.
+static GstElement* add_udp_source(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media,
+                                  int port, const string& name, const string& caps, int fd = -1) {
+    if (profile.udp_io != "batched") {
+        GstElement *source = add_element(pipeline, "udpsrc", name);
+        if (source) {
+            set_properties(source, {
+                {"port", to_string(port)},
+                {"buffer-size", to_string(profile.udp_buffer_size)},
+                {"caps", caps},
+            });
+        }
+        return source;
+    }
+
+    GstElement *source = add_element(pipeline, "appsrc", name);
+    if (fd < 0) {
+        fd = open_udp_socket(port, profile.udp_buffer_size);
+    }
+    if (!source || fd < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    shared_ptr<BatchedUdpReceiver> receiver(new BatchedUdpReceiver(fd, source, caps, profile.udp_offload));
+    media.udp_receivers.push_back(receiver);
+    return source;
+}
+
+// With impairment on, sink is fed through appsink -> NetworkImpairment ->
+// appsrc. Returns what the sender links to: sink itself when off.
+static GstElement* add_impairment(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media,
+                                  GstElement *sink, int port) {
+    if (!impairment_enabled(profile)) {
+        return sink;
+    }
+    GstElement *input = add_element(pipeline, "appsink");
+    GstElement *output = add_element(pipeline, "appsrc");
+    if (!input || !output || !link(output, "src", sink, "sink")) {
+        return NULL;
+    }
+    shared_ptr<NetworkImpairment> impairment(new NetworkImpairment(profile, input, output, port));
+    media.impairments.push_back(impairment);
+    return input;
+}
+
+// rtpbin session pad -> srtpenc -> udpsink to the peer
+static bool add_srtp_sender(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media,
+                            GstElement *rtpbin, const string& rtpbin_pad, const string& encoder_name, bool rtcp,
+                            const string& host, int port) {
+    GstElement *encoder = add_element(pipeline, "srtpenc", encoder_name);
+    GstElement *sink = add_udp_sink(pipeline, profile, media, host, port);
+    if (sink) {
+        sink = add_impairment(pipeline, profile, media, sink, port);
+    }
+    if (!encoder || !sink) {
+        return false;
+    }
+    set_properties(encoder, {
+        {"rtp-cipher", SRTP_CIPHER}, {"rtcp-cipher", SRTP_CIPHER},
+        {"rtp-auth", SRTP_AUTH}, {"rtcp-auth", SRTP_AUTH},
+    });
+
+    string kind = rtcp ? "rtcp" : "rtp";
+    return link(rtpbin, rtpbin_pad, encoder, kind + "_sink_0") && link(encoder, kind + "_src_0", sink, "sink");
+}
+
+// udpsrc -> srtpdec -> rtpbin session pad
+static bool add_srtp_receiver(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media, int port,
+                              const string& source_name, const string& decoder_name, const string& caps,
+                              GstElement *rtpbin, const string& rtpbin_pad) {
+    GstElement *source = add_udp_source(pipeline, profile, media, port, source_name, caps);
+    GstElement *decoder = add_element(pipeline, "srtpdec", decoder_name);
+    if (!source || !decoder) {
+        return false;
+    }
+
+    string kind = caps == SRTCP_CAPS ? "rtcp" : "rtp";
+    return link(source, "src", decoder, kind + "_sink") && link(decoder, kind + "_src", rtpbin, rtpbin_pad);
+}
+
+static string raw_video_caps(const MediaProfile& profile) {
+    string caps = "video/x-raw,format=I420";
+    if (profile.width > 0) {
+        caps += ",width=" + to_string(profile.width);
+    }
+    if (profile.height > 0) {
+        caps += ",height=" + to_string(profile.height);
+    }
+    if (profile.fps > 0) {
+        caps += ",framerate=" + to_string(profile.fps) + "/1";
+    }
+    return caps;
+}
+
+// Payloaders leave room for the capture timestamps added after them
+static int payload_mtu(const MediaProfile& profile) {
+    return profile.capture_time ? profile.mtu - CAPTURE_STAMP_SIZE : profile.mtu;
+}
+
+// Senders link their payloader to target.pad: an rtpbin session, or the
+// funnel that bundles both streams into one
+static bool add_video_sender(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media,
+                             GstElement *target, const string& pad) {
+    GstElement *source = add_element(pipeline, profile.source == "test" ? "videotestsrc" : "autovideosrc");
+    GstElement *convert = add_element(pipeline, "videoconvert");
+    GstElement *caps = add_element(pipeline, "capsfilter", "video_caps");
+    if (!source || !convert || !caps) {
+        return false;
+    }
+    if (profile.source == "test") {
+        // Noise does not compress, so the encoder always reaches its bitrate
+        set_properties(source, {{"is-live", "true"}, {"pattern", "snow"}});
+    }
+    set_properties(caps, {{"caps", raw_video_caps(profile)}});
+
+    bool h264 = profile.video_codec == "h264";
+    media.video_encoder = add_element(pipeline, h264 ? "x264enc" : "vp8enc", "video_encoder");
+    media.video_payloader = add_element(pipeline, h264 ? "rtph264pay" : "rtpvp8pay", "video_payloader");
+    if (!media.video_encoder || !media.video_payloader) {
+        return false;
+    }
+    if (h264) {
+        set_properties(media.video_encoder, {
+            {"tune", "zerolatency"},
+            {"bitrate", to_string(profile.video_bitrate)},
+            {"speed-preset", profile.x264_preset},
+            {"key-int-max", to_string(profile.gop)},
+            {"bframes", "0"},
+            {"aud", "false"},
+            {"byte-stream", "true"},
+            {"sliced-threads", "true"},
+            {"rc-lookahead", "0"},
+            {"sync-lookahead", "0"},
+        });
+        set_properties(media.video_payloader, {{"config-interval", "1"}});
+    } else {
+        set_properties(media.video_encoder, {
+            {"deadline", "1"},
+            {"end-usage", "cbr"},
+            {"target-bitrate", to_string(profile.video_bitrate * 1000)},
+            {"keyframe-max-dist", to_string(profile.gop)},
+            {"lag-in-frames", "0"},
+            {"cpu-used", "4"},
+        });
+    }
+    set_properties(media.video_payloader, {
+        {"pt", to_string(VIDEO_PAYLOAD_TYPE)},
+        {"mtu", to_string(payload_mtu(profile))},
+    });
+
+    // Scaling and rate conversion only when the profile asks for them
+    if (profile.width > 0 || profile.height > 0 || profile.fps > 0) {
+        GstElement *scale = add_element(pipeline, "videoscale");
+        GstElement *rate = add_element(pipeline, "videorate");
+        if (!link_chain({source, convert, scale, rate, caps})) {
+            return false;
+        }
+    } else if (!link_chain({source, convert, caps})) {
+        return false;
+    }
+    if (!link_chain({caps, media.video_encoder, media.video_payloader})) {
+        return false;
+    }
+    if (!profile.fec) {
+        return link(media.video_payloader, "src", target, pad);
+    }
+
+    // ULPFEC packets go out in the video stream with their own payload type;
+    // none until set_video_fec() once the peer has said it recovers them
+    media.fec_encoder = add_element(pipeline, "rtpulpfecenc", "video_fec_encoder");
+    if (!media.fec_encoder) {
+        return false;
+    }
+    set_properties(media.fec_encoder, {
+        {"pt", to_string(FEC_PAYLOAD_TYPE)},
+        {"percentage", "0"},
+        {"multipacket", "true"},
+    });
+    return link_chain({media.video_payloader, media.fec_encoder}) && link(media.fec_encoder, "src", target, pad);
+}
+
+static bool add_audio_sender(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media,
+                             GstElement *target, const string& pad) {
+    GstElement *source = add_element(pipeline, profile.source == "test" ? "audiotestsrc" : "autoaudiosrc");
+    GstElement *convert = add_element(pipeline, "audioconvert");
+    GstElement *resample = add_element(pipeline, "audioresample");
+    if (source && profile.source == "test") {
+        set_properties(source, {{"is-live", "true"}});
+    }
+    media.audio_encoder = add_element(pipeline, "opusenc", "audio_encoder");
+    media.audio_payloader = add_element(pipeline, "rtpopuspay", "audio_payloader");
+    if (!media.audio_encoder || !media.audio_payloader) {
+        return false;
+    }
+    set_properties(media.audio_encoder, {{"bitrate", to_string(profile.audio_bitrate)}});
+    set_properties(media.audio_payloader, {
+        {"pt", to_string(AUDIO_PAYLOAD_TYPE)},
+        {"mtu", to_string(payload_mtu(profile))},
+    });
+
+    return link_chain({source, convert, resample, media.audio_encoder, media.audio_payloader}) &&
+           link(media.audio_payloader, "src", target, pad);
+}
+
+// Depayloader to sink; the depayloader is linked to rtpbin when the peer's
+// stream shows up
+static bool add_video_receiver(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media) {
+    vector<GstElement*> chain = add_playback(pipeline, true, profile.video_codec, profile.sink, profile.fec, true);
+    media.video_depayloader = chain.empty() ? NULL : chain.front();
+    if (!chain.empty() && profile.sink == "app") {
+        deliver_frames(chain.back(), &media);
+    }
+    return !chain.empty();
+}
+
+static bool add_audio_receiver(GstElement *pipeline, const MediaProfile& profile, MediaPipeline& media) {
+    vector<GstElement*> chain = add_playback(pipeline, false, profile.video_codec, profile.sink, profile.fec, true);
+    media.audio_depayloader = chain.empty() ? NULL : chain.front();
+    return !chain.empty();
+}
+
+// Sessions exist once their first pad has been requested. RFC 3550's 5 s
+// minimum is too slow for rate control to follow the network.
+static void set_rtcp_interval(GstElement *rtpbin, guint session_id, int interval_ms) {
+    GObject *session = NULL;
+    g_signal_emit_by_name(rtpbin, "get-internal-session", session_id, &session);
+    if (!session) {
+        return;
+    }
+    g_object_set(session, "rtcp-min-interval", (guint64)interval_ms * GST_MSECOND, NULL);
+    g_object_unref(session);
+}
+
+static string rtp_caps(const string& media_type, const string& video_codec) {
+    if (media_type == "video") {
+        return string("media=video,clock-rate=") + to_string(VIDEO_CLOCK_RATE) + ",encoding-name=" +
+               (video_codec == "h264" ? "H264" : "VP8") + ",payload=" + to_string(VIDEO_PAYLOAD_TYPE);
+    }
+    return "media=audio,clock-rate=48000,encoding-name=OPUS,payload=" + to_string(AUDIO_PAYLOAD_TYPE);
+}
+
+// With BUNDLE, caps come per payload type rather than from udpsrc; FEC
+// packets need theirs with either transport. They only protect video.
+static GstCaps* on_request_pt_map(GstElement *rtpbin, guint session, guint pt, gpointer user_data) {
+    MediaPipeline *media = (MediaPipeline*)user_data;
+    if (pt == FEC_PAYLOAD_TYPE && media->fec) {
+        string caps = "application/x-rtp,media=video,clock-rate=" + to_string(VIDEO_CLOCK_RATE) +
+                      ",encoding-name=ULPFEC,payload=" + to_string(FEC_PAYLOAD_TYPE);
+        return gst_caps_from_string(caps.c_str());
+    }
+    if (pt == RTX_PAYLOAD_TYPE && media->rtx) {
+        string caps = "application/x-rtp,media=video,clock-rate=" + to_string(VIDEO_CLOCK_RATE) +
+                      ",encoding-name=RTX,apt=" + to_string(VIDEO_PAYLOAD_TYPE) +
+                      ",payload=" + to_string(RTX_PAYLOAD_TYPE);
+        return gst_caps_from_string(caps.c_str());
+    }
+    if (pt != VIDEO_PAYLOAD_TYPE && pt != AUDIO_PAYLOAD_TYPE) {
+        return NULL;
+    }
+    string caps = "application/x-rtp," + rtp_caps(pt == VIDEO_PAYLOAD_TYPE ? "video" : "audio", media->video_codec);
+    return gst_caps_from_string(caps.c_str());
+}
+
+// rtpbin keeps each session's recent packets in an rtpstorage for the FEC
+// decoder; by default it keeps none
+static void on_new_storage(GstElement *rtpbin, GstElement *storage, guint session, gpointer user_data) {
+    MediaPipeline *media = (MediaPipeline*)user_data;
+    guint64 keep_ms = media->jitter_latency + FEC_STORAGE_MARGIN_MS;
+    g_object_set(storage, "size-time", keep_ms * GST_MSECOND, NULL);
+}
+
+// One decoder per received stream, between its jitterbuffer and the
+// depayloader. Audio has in-band FEC instead, so with the legacy transport
+// its session gets none; with BUNDLE the audio stream's decoder just passes
+// packets through.
+static GstElement* on_request_fec_decoder(GstElement *rtpbin, guint session, gpointer user_data) {
+    if (session == AUDIO_SESSION) {
+        return NULL;
+    }
+    GstElement *decoder = gst_element_factory_make("rtpulpfecdec", NULL);
+    if (!decoder) {
+        cerr << "Missing GStreamer element: rtpulpfecdec" << endl;
+        return NULL;
+    }
+    GObject *storage = NULL;
+    g_signal_emit_by_name(rtpbin, "get-internal-storage", session, &storage);
+    g_object_set(decoder, "storage", storage, "pt", (guint)FEC_PAYLOAD_TYPE, NULL);
+    if (storage) {
+        g_object_unref(storage);
+    }
+    return decoder;
+}
+
+// rtprtxsend (or rtprtxreceive) in a bin with the session's pad names, as
+// rtpbin wants its aux elements
+static GstElement* make_rtx_bin(const char* factory, guint session, const char* from_pt, guint to_pt) {
+    GstElement *rtx = gst_element_factory_make(factory, NULL);
+    if (!rtx) {
+        cerr << "Missing GStreamer element: " << factory << endl;
+        return NULL;
+    }
+    GstStructure *pt_map = gst_structure_new("application/x-rtp-pt-map", from_pt, G_TYPE_UINT, to_pt, NULL);
+    g_object_set(rtx, "payload-type-map", pt_map, NULL);
+    gst_structure_free(pt_map);
+
+    GstElement *bin = gst_bin_new(NULL);
+    gst_bin_add(GST_BIN(bin), rtx);
+    for (const char* direction : {"src", "sink"}) {
+        GstPad *pad = gst_element_get_static_pad(rtx, direction);
+        string name = string(direction) + "_" + to_string(session);
+        gst_element_add_pad(bin, gst_ghost_pad_new(name.c_str(), pad));
+        gst_object_unref(pad);
+    }
+    return bin;
+}
+
+// Only video is retransmitted; with BUNDLE audio passes the RTX elements
+// untouched
+static GstElement* on_request_aux_sender(GstElement *rtpbin, guint session, gpointer user_data) {
+    if (session == AUDIO_SESSION) {
+        return NULL;
+    }
+    return make_rtx_bin("rtprtxsend", session, to_string(VIDEO_PAYLOAD_TYPE).c_str(), RTX_PAYLOAD_TYPE);
+}
+
+static GstElement* on_request_aux_receiver(GstElement *rtpbin, guint session, gpointer user_data) {
+    if (session == AUDIO_SESSION) {
+        return NULL;
+    }
+    return make_rtx_bin("rtprtxreceive", session, to_string(RTX_PAYLOAD_TYPE).c_str(), VIDEO_PAYLOAD_TYPE);
+}
+
+// Two rtpbins, each session on its own ports: the sending rtpbin takes the
+// peer's receiver reports, the receiving one sends ours
+static bool add_legacy_transport(GstElement *pipeline, const MediaProfile& profile, MediaRole role,
+                                 const string& peer_ip, MediaPipeline& media) {
+    bool client = role == MEDIA_ROLE_CLIENT;
+    int out_port = profile.base_port + (client ? CLIENT_TO_SERVER_PORT_OFFSET : SERVER_TO_CLIENT_PORT_OFFSET);
+    int in_port = profile.base_port + (client ? SERVER_TO_CLIENT_PORT_OFFSET : CLIENT_TO_SERVER_PORT_OFFSET);
+    int feedback_port = profile.base_port + (client ? CLIENT_FEEDBACK_PORT_OFFSET : SERVER_FEEDBACK_PORT_OFFSET);
+    int peer_feedback_port = profile.base_port + (client ? SERVER_FEEDBACK_PORT_OFFSET : CLIENT_FEEDBACK_PORT_OFFSET);
+
+    for (int session : {VIDEO_SESSION, AUDIO_SESSION}) {
+        string kind = session == VIDEO_SESSION ? "video" : "audio";
+        string id = to_string(session);
+        int offset = 2 * session;
+
+        if (!add_srtp_sender(pipeline, profile, media, media.rtpbin_send, "send_rtp_src_" + id, kind + "_send_encrypt",
+                             false, peer_ip, out_port + offset) ||
+            !add_srtp_sender(pipeline, profile, media, media.rtpbin_send, "send_rtcp_src_" + id, kind + "_rtcp_enc",
+                             true, peer_ip, out_port + offset + 1) ||
+            !add_srtp_receiver(pipeline, profile, media, feedback_port + offset, "", kind + "_rtcp_recv_dec",
+                               SRTCP_CAPS, media.rtpbin_send, "recv_rtcp_sink_" + id) ||
+            !add_srtp_sender(pipeline, profile, media, media.rtpbin_recv, "send_rtcp_src_" + id, kind + "_report_enc",
+                             true, peer_ip, peer_feedback_port + offset) ||
+            !add_srtp_receiver(pipeline, profile, media, in_port + offset, kind + "_rtp_recv", kind + "_dec",
+                               "application/x-srtp," + rtp_caps(kind, profile.video_codec),
+                               media.rtpbin_recv, "recv_rtp_sink_" + id) ||
+            !add_srtp_receiver(pipeline, profile, media, in_port + offset + 1, "", kind + "_rtcp_dec",
+                               SRTCP_CAPS, media.rtpbin_recv, "recv_rtcp_sink_" + id)) {
+            return false;
+        }
+    }
+
+    media.encoder_names = {"video_send_encrypt", "audio_send_encrypt", "video_rtcp_enc", "audio_rtcp_enc",
+                           "video_report_enc", "audio_report_enc"};
+    media.decoder_names = {"video_dec", "audio_dec", "video_rtcp_dec", "audio_rtcp_dec",
+                           "video_rtcp_recv_dec", "audio_rtcp_recv_dec"};
+    return true;
+}
+
+// Bind one socket to port for udpsrc to receive on and udpsink to send from
+static bool share_socket(GstElement *source, GstElement *sink, int port) {
+    GError *error = NULL;
+    GSocket *socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error);
+    GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(any, port);
+    bool bound = socket && g_socket_bind(socket, address, FALSE, &error);
+    g_object_unref(address);
+    g_object_unref(any);
+    if (!bound) {
+        cerr << "Cannot bind UDP port " << port << ": " << (error ? error->message : "") << endl;
+        if (error) {
+            g_error_free(error);
+        }
+        if (socket) {
+            g_object_unref(socket);
+        }
+        return false;
+    }
+    // udpsrc closes the socket when it stops; udpsink only sends from it
+    g_object_set(source, "socket", socket, NULL);
+    g_object_set(sink, "socket", socket, "close-socket", FALSE, NULL);
+    g_object_unref(socket);
+    return true;
+}
+
+// One session, one srtpenc, one srtpdec and one UDP socket that both sends
+// and receives, so the call is a single 5-tuple. srtpdec takes RTCP muxed on
+// its RTP pad and puts it out on its RTCP pad.
+static bool add_bundle_transport(GstElement *pipeline, const MediaProfile& profile, MediaRole role,
+                                 const string& peer_ip, MediaPipeline& media) {
+    bool client = role == MEDIA_ROLE_CLIENT;
+    int local_port = profile.base_port + (client ? SERVER_TO_CLIENT_PORT_OFFSET : CLIENT_TO_SERVER_PORT_OFFSET);
+    int peer_port = profile.base_port + (client ? CLIENT_TO_SERVER_PORT_OFFSET : SERVER_TO_CLIENT_PORT_OFFSET);
+
+    GstElement *encoder = add_element(pipeline, "srtpenc", "bundle_encrypt");
+    GstElement *mux = add_element(pipeline, "funnel");
+    GstElement *decoder = add_element(pipeline, "srtpdec", "bundle_dec");
+    if (!encoder || !mux || !decoder) {
+        return false;
+    }
+
+    GstElement *source;
+    GstElement *sink;
+    if (profile.udp_io == "batched") {
+        // The receiver owns the socket; the sender only sends from it
+        int fd = open_udp_socket(local_port, profile.udp_buffer_size);
+        if (fd < 0) {
+            return false;
+        }
+        source = add_udp_source(pipeline, profile, media, local_port, "bundle_recv", BUNDLE_CAPS, fd);
+        if (!source) {
+            close(fd);
+            return false;
+        }
+        sink = add_udp_sink(pipeline, profile, media, peer_ip, peer_port, fd);
+    } else {
+        source = add_udp_source(pipeline, profile, media, local_port, "bundle_recv", BUNDLE_CAPS);
+        sink = add_udp_sink(pipeline, profile, media, peer_ip, peer_port);
+        if (source && sink && !share_socket(source, sink, local_port)) {
+            return false;
+        }
+    }
+    if (!source || !sink) {
+        return false;
+    }
+    sink = add_impairment(pipeline, profile, media, sink, peer_port);
+    if (!sink) {
+        return false;
+    }
+
+    set_properties(encoder, {
+        {"rtp-cipher", SRTP_CIPHER}, {"rtcp-cipher", SRTP_CIPHER},
+        {"rtp-auth", SRTP_AUTH}, {"rtcp-auth", SRTP_AUTH},
+    });
+    string id = to_string(VIDEO_SESSION);
+    if (!link(media.rtpbin_send, "send_rtp_src_" + id, encoder, "rtp_sink_0") ||
+        !link(media.rtpbin_send, "send_rtcp_src_" + id, encoder, "rtcp_sink_0") ||
+        !link(encoder, "rtp_src_0", mux, "sink_%u") || !link(encoder, "rtcp_src_0", mux, "sink_%u") ||
+        !link(mux, "src", sink, "sink") ||
+        !link(source, "src", decoder, "rtp_sink") ||
+        !link(decoder, "rtp_src", media.rtpbin_recv, "recv_rtp_sink_" + id) ||
+        !link(decoder, "rtcp_src", media.rtpbin_recv, "recv_rtcp_sink_" + id)) {
+        return false;
+    }
+
+    media.encoder_names = {"bundle_encrypt"};
+    media.decoder_names = {"bundle_dec"};
+    return true;
+}
+
+static bool add_elements(GstElement *pipeline, const MediaProfile& profile, MediaRole role,
+                         const string& peer_ip, MediaPipeline& media) {
+    bool bundle = profile.transport == "bundle";
+    media.rtpbin_send = add_element(pipeline, "rtpbin", bundle ? "rtpbin" : "rtpbin_send");
+    media.rtpbin_recv = bundle ? media.rtpbin_send : add_element(pipeline, "rtpbin", "rtpbin_recv");
+    GstElement *funnel = bundle ? add_element(pipeline, "rtpfunnel", "bundle_funnel") : NULL;
+    if (!media.rtpbin_send || !media.rtpbin_recv || (bundle && !funnel)) {
+        return false;
+    }
+    vector<GstElement*> rtpbins = {media.rtpbin_send};
+    if (!bundle) {
+        rtpbins.push_back(media.rtpbin_recv);
+    }
+    for (GstElement *rtpbin : rtpbins) {
+        set_properties(rtpbin, {
+            {"latency", to_string(profile.jitter_latency)},
+            {"drop-on-latency", "true"},
+            {"do-retransmission", "false"},
+        });
+        g_signal_connect(rtpbin, "new-jitterbuffer", G_CALLBACK(on_new_jitterbuffer), &media);
+        if (media.rtx) {
+            // NACKs are AVPF feedback
+            set_properties(rtpbin, {{"rtp-profile", "avpf"}});
+        }
+    }
+    // Aux elements are asked for when a session is created, by the pad
+    // requests below
+    if (media.rtx) {
+        g_signal_connect(media.rtpbin_send, "request-aux-sender", G_CALLBACK(on_request_aux_sender), &media);
+        g_signal_connect(media.rtpbin_recv, "request-aux-receiver", G_CALLBACK(on_request_aux_receiver), &media);
+    }
+    g_signal_connect(media.rtpbin_recv, "pad-added", G_CALLBACK(on_rtp_pad_added), &media);
+    g_signal_connect(media.rtpbin_recv, "request-pt-map", G_CALLBACK(on_request_pt_map), &media);
+    if (profile.fec) {
+        g_signal_connect(media.rtpbin_recv, "new-storage", G_CALLBACK(on_new_storage), &media);
+        g_signal_connect(media.rtpbin_recv, "request-fec-decoder", G_CALLBACK(on_request_fec_decoder), &media);
+    }
+
+    // Requesting the send_rtp_sink pads creates the send_rtp_src pads the
+    // encryptors link to
+    if (bundle && !link(funnel, "src", media.rtpbin_send, "send_rtp_sink_" + to_string(VIDEO_SESSION))) {
+        return false;
+    }
+    if (!add_video_sender(pipeline, profile, media, bundle ? funnel : media.rtpbin_send,
+                          bundle ? "sink_%u" : "send_rtp_sink_" + to_string(VIDEO_SESSION)) ||
+        !add_audio_sender(pipeline, profile, media, bundle ? funnel : media.rtpbin_send,
+                          bundle ? "sink_%u" : "send_rtp_sink_" + to_string(AUDIO_SESSION)) ||
+        !add_video_receiver(pipeline, profile, media) || !add_audio_receiver(pipeline, profile, media)) {
+        return false;
+    }
+
+    bool ok = bundle ? add_bundle_transport(pipeline, profile, role, peer_ip, media)
+                     : add_legacy_transport(pipeline, profile, role, peer_ip, media);
+    if (!ok) {
+        return false;
+    }
+
+    for (GstElement *rtpbin : rtpbins) {
+        for (guint session : {VIDEO_SESSION, AUDIO_SESSION}) {
+            if (!bundle || session == VIDEO_SESSION) {
+                set_rtcp_interval(rtpbin, session, profile.rtcp_interval);
+            }
+        }
+    }
+    return true;
+}
+
+bool build_media_pipeline(const MediaProfile& profile, MediaRole role, const string& peer_ip,
+                          MediaPipeline& media) {
+    media = MediaPipeline();
+    if (!validate_media_profile(profile)) {
+        return false;
+    }
+    media.video_codec = profile.video_codec;
+    media.jitter_latency = profile.jitter_latency;
+    media.sink = profile.sink;
+    media.fec = profile.fec;
+    media.rtx = profile.jitter_mode == "adaptive";
+    media.pipeline = gst_pipeline_new("media_pipeline");
+    if (!add_elements(media.pipeline, profile, role, peer_ip, media)) {
+        gst_object_unref(media.pipeline);
+        media = MediaPipeline();
+        return false;
+    }
+    for (auto& receiver : media.udp_receivers) {
+        receiver->start();
+    }
+    for (auto& impairment : media.impairments) {
+        impairment->start();
+    }
+    return true;
+}
+
+void set_video_bitrate(MediaPipeline& media, int kbps) {
+    if (!media.video_encoder) {
+        return;
+    }
+    if (media.video_codec == "h264") {
+        set_properties(media.video_encoder, {{"bitrate", to_string(kbps)}});
+    } else {
+        set_properties(media.video_encoder, {{"target-bitrate", to_string(kbps * 1000)}});
+    }
+}
+
+void set_audio_bitrate(MediaPipeline& media, int bps) {
+    if (media.audio_encoder) {
+        set_properties(media.audio_encoder, {{"bitrate", to_string(bps)}});
+    }
+}
+
+void set_video_fec(MediaPipeline& media, int percentage) {
+    if (media.fec_encoder) {
+        set_properties(media.fec_encoder, {{"percentage", to_string(percentage)}});
+    }
+}
+
+void set_audio_fec(MediaPipeline& media, int loss_percentage) {
+    if (media.audio_encoder) {
+        set_properties(media.audio_encoder, {
+            {"inband-fec", loss_percentage > 0 ? "true" : "false"},
+            {"packet-loss-percentage", to_string(loss_percentage)},
+        });
+    }
+}
@@ -0,0 +1,195 @@
+#include "network_impairment.h"
+#include "media_pipeline.h"
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+static gint64 now_us() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool impairment_enabled(const MediaProfile& profile) {
+    return profile.impair_delay > 0 || profile.impair_jitter > 0 || profile.impair_loss > 0 ||
+           profile.impair_reorder > 0 || profile.impair_duplicate > 0 || profile.impair_rate > 0;
+}
+
+NetworkImpairment::NetworkImpairment(const MediaProfile& profile, GstElement *appsink, GstElement *appsrc, int port)
+    : appsrc(GST_ELEMENT(gst_object_ref(appsrc))),
+      delay_ms(profile.impair_delay),
+      jitter_ms(profile.impair_jitter),
+      loss_percent(profile.impair_loss),
+      burst(profile.impair_burst),
+      reorder_percent(profile.impair_reorder),
+      duplicate_percent(profile.impair_duplicate),
+      rate_kbps(profile.impair_rate),
+      // Every stream of a call draws its own sequence, the same in every run
+      generator((uint32_t)profile.impair_seed * 2654435761u ^ (uint32_t)port),
+      in_burst(false),
+      link_free_us(0),
+      last_due_us(0),
+      next_order(0),
+      running(false),
+      packet_count(0),
+      lost_count(0),
+      queue_drop_count(0),
+      duplicate_count(0),
+      reorder_count(0) {
+    g_object_set(appsink, "emit-signals", TRUE, "sync", FALSE, "async", FALSE, NULL);
+    g_signal_connect(appsink, "new-sample", G_CALLBACK(on_new_sample), this);
+    // Packets keep srtpenc's timestamps; the sink sends them as they come
+    g_object_set(appsrc, "is-live", TRUE, "do-timestamp", FALSE, NULL);
+    gst_util_set_object_arg(G_OBJECT(appsrc), "format", "time");
+}
+
+NetworkImpairment::~NetworkImpairment() {
+    stop();
+    gst_object_unref(appsrc);
+}
+
+bool NetworkImpairment::start() {
+    running = true;
+    release_thread = thread(&NetworkImpairment::run, this);
+    return true;
+}
+
+void NetworkImpairment::stop() {
+    {
+        lock_guard<mutex> guard(lock);
+        running = false;
+    }
+    wake.notify_all();
+    if (release_thread.joinable()) {
+        release_thread.join();
+    }
+    while (!held.empty()) {
+        gst_buffer_unref(held.top().buffer);
+        held.pop();
+    }
+}
+
+ImpairmentStats NetworkImpairment::stats() const {
+    ImpairmentStats stats;
+    stats.packets = packet_count;
+    stats.lost = lost_count;
+    stats.queue_drops = queue_drop_count;
+    stats.duplicated = duplicate_count;
+    stats.reordered = reorder_count;
+    return stats;
+}
+
+GstFlowReturn NetworkImpairment::on_new_sample(GstElement *appsink, gpointer user_data) {
+    NetworkImpairment *impairment = (NetworkImpairment*)user_data;
+    GstSample *sample = NULL;
+    g_signal_emit_by_name(appsink, "pull-sample", &sample);
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (buffer) {
+        impairment->impair(gst_buffer_ref(buffer));
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// One draw per call whatever the odds, so changing one setting leaves the
+// others' decisions alone. mt19937's output is the same everywhere; the
+// standard distributions are not, so they are not used.
+bool NetworkImpairment::chance(double percent) {
+    return generator() / 4294967296.0 * 100 < percent;
+}
+
+// Takes the buffer
+void NetworkImpairment::impair(GstBuffer *buffer) {
+    packet_count++;
+
+    bool lost;
+    if (burst <= 1) {
+        lost = chance(loss_percent);
+    } else {
+        // Gilbert-Elliott with every packet lost in the bad state: leaving it
+        // with odds 1/burst per packet makes bursts that long on average, and
+        // the odds of entering it are set so loss_percent of packets are lost
+        double exit_percent = 100.0 / burst;
+        double enter_percent = loss_percent >= 100 ? 100 : loss_percent * exit_percent / (100 - loss_percent);
+        if (in_burst) {
+            in_burst = !chance(exit_percent);
+        } else {
+            in_burst = chance(enter_percent);
+        }
+        lost = in_burst;
+    }
+    bool duplicate = chance(duplicate_percent);
+    bool reorder = chance(reorder_percent);
+    gint64 jitter_us = (gint64)((generator() / 4294967296.0 * 2 - 1) * jitter_ms * 1000);
+
+    if (lost) {
+        lost_count++;
+        gst_buffer_unref(buffer);
+        return;
+    }
+
+    // Under the rate cap a packet waits for the ones before it, and leaves
+    // once its last bit is on the link
+    gint64 now = now_us();
+    gint64 sent_us = now;
+    if (rate_kbps > 0) {
+        gint64 start_us = max(now, link_free_us);
+        if (start_us - now > IMPAIR_RATE_QUEUE_MS * 1000) {
+            queue_drop_count++;
+            gst_buffer_unref(buffer);
+            return;
+        }
+        link_free_us = start_us + (gint64)gst_buffer_get_size(buffer) * 8000 / rate_kbps;
+        sent_us = link_free_us;
+    }
+
+    // Jitter varies the delay but, as in netem, never lets a packet overtake
+    // the one before it; only the packets picked for reordering do that
+    gint64 due_us = sent_us;
+    if (reorder) {
+        reorder_count++;
+    } else {
+        due_us += max((gint64)0, delay_ms * 1000 + jitter_us);
+        due_us = max(due_us, last_due_us);
+        last_due_us = due_us;
+    }
+    GstBuffer *copy = duplicate ? gst_buffer_ref(buffer) : NULL;
+    hold(buffer, due_us);
+    if (copy) {
+        duplicate_count++;
+        hold(copy, due_us);
+    }
+}
+
+void NetworkImpairment::hold(GstBuffer *buffer, gint64 due_us) {
+    {
+        lock_guard<mutex> guard(lock);
+        held.push({due_us, next_order++, buffer});
+    }
+    wake.notify_one();
+}
+
+void NetworkImpairment::run() {
+    unique_lock<mutex> guard(lock);
+    while (running) {
+        if (held.empty()) {
+            wake.wait(guard);
+            continue;
+        }
+        gint64 due_us = held.top().due_us;
+        if (due_us > now_us()) {
+            wake.wait_until(guard, chrono::steady_clock::time_point(chrono::microseconds(due_us)));
+            continue;
+        }
+        GstBuffer *buffer = held.top().buffer;
+        held.pop();
+
+        guard.unlock();
+        GstFlowReturn ret;
+        g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
+        gst_buffer_unref(buffer);
+        guard.lock();
+    }
+}
@@ -0,0 +1,371 @@
+#include "pipeline_tracer.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <pthread.h>
+
+using namespace std;
+
+// Tells one tracer's threads from an earlier one's
+static atomic<uint64_t> tracer_generations(0);
+static thread_local uint64_t current_generation = 0;
+static thread_local void *current_state = NULL;
+
+static uint64_t now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Owner thread only, so a load and a store do without a locked add
+static void bump(atomic<uint64_t>& value, uint64_t by) {
+    value.store(value.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+static int bucket_of(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    if (us == 0) {
+        return 0;
+    }
+    int octave = 63 - __builtin_clzll(us);
+    // The two bits after the leading one
+    int step = (int)(((us << 2) >> octave) & (TRACE_BUCKETS_PER_OCTAVE - 1));
+    return min(1 + octave * TRACE_BUCKETS_PER_OCTAVE + step, TRACE_BUCKETS - 1);
+}
+
+// Upper end of a bucket, us
+static double bucket_limit_us(int bucket) {
+    if (bucket == 0) {
+        return 1;
+    }
+    int octave = (bucket - 1) / TRACE_BUCKETS_PER_OCTAVE;
+    int step = (bucket - 1) % TRACE_BUCKETS_PER_OCTAVE;
+    return (double)(1ULL << octave) * (TRACE_BUCKETS_PER_OCTAVE + step + 1) / TRACE_BUCKETS_PER_OCTAVE;
+}
+
+void TraceHistogram::add(uint64_t ns) {
+    int bucket = bucket_of(ns);
+    buckets[bucket].store(buckets[bucket].load(memory_order_relaxed) + 1, memory_order_relaxed);
+    bump(count, 1);
+    bump(total_ns, ns);
+    if (ns > max_ns.load(memory_order_relaxed)) {
+        max_ns.store(ns, memory_order_relaxed);
+    }
+}
+
+// Sums of one element's histograms over all threads
+struct Totals {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    vector<uint64_t> buckets = vector<uint64_t>(TRACE_BUCKETS);
+
+    void add(const TraceHistogram *histogram) {
+        if (!histogram) {
+            return;
+        }
+        count += histogram->count.load(memory_order_relaxed);
+        total_ns += histogram->total_ns.load(memory_order_relaxed);
+        max_ns = max(max_ns, histogram->max_ns.load(memory_order_relaxed));
+        for (int i = 0; i < TRACE_BUCKETS; i++) {
+            buckets[i] += histogram->buckets[i].load(memory_order_relaxed);
+        }
+    }
+
+    // Upper end of the bucket holding the p-th fraction, us
+    double percentile_us(double p) const {
+        uint64_t sum = 0;
+        for (int i = 0; i < TRACE_BUCKETS; i++) {
+            sum += buckets[i];
+        }
+        uint64_t rank = (uint64_t)(p * sum);
+        uint64_t seen = 0;
+        for (int i = 0; i < TRACE_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return bucket_limit_us(i);
+            }
+        }
+        return 0;
+    }
+};
+
+struct PipelineTracer::ThreadState {
+    string name;
+    // Histograms by element id, made by this thread when first needed
+    atomic<TraceHistogram*> processing[TRACE_MAX_ELEMENTS];
+    atomic<TraceHistogram*> residency[TRACE_MAX_ELEMENTS];
+    // When the input now being handled on this thread came in, 0 for none
+    uint64_t input_ns[TRACE_MAX_ELEMENTS];
+};
+
+struct PipelineTracer::ElementTrace {
+    PipelineTracer *tracer;
+    int id;
+    string name;
+    // Buffers that came in, by address, for an output on another thread.
+    // A slot may be overwritten before it is read; that buffer goes untimed.
+    atomic<uintptr_t> slot_buffers[TRACE_RESIDENCY_SLOTS];
+    atomic<uint64_t> slot_ns[TRACE_RESIDENCY_SLOTS];
+};
+
+static gpointer first_buffer(GstPadProbeInfo *info) {
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        return gst_buffer_list_length(list) ? (gpointer)gst_buffer_list_get(list, 0) : NULL;
+    }
+    return GST_PAD_PROBE_INFO_BUFFER(info);
+}
+
+static int residency_slot(gpointer buffer) {
+    return (int)(((uintptr_t)buffer >> 4) % TRACE_RESIDENCY_SLOTS);
+}
+
+PipelineTracer::PipelineTracer(GstElement *pipeline, const MediaProfile& profile)
+    : pipeline(pipeline), interval_s(profile.trace_interval), csv_path(profile.trace_file),
+      generation(++tracer_generations), started(chrono::steady_clock::now()), stopped(false),
+      interval_source(NULL) {
+    if (!enabled() || !pipeline) {
+        return;
+    }
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    gst_iterator_foreach(it, [](const GValue *value, gpointer user_data) {
+        ((PipelineTracer*)user_data)->hook(GST_ELEMENT(g_value_get_object(value)));
+    }, this);
+    gst_iterator_free(it);
+    // rtpbin's jitterbuffers and demuxers, and chains for SFU participants
+    gulong id = g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(on_element_added), this);
+    handlers.push_back({GST_ELEMENT(gst_object_ref(pipeline)), id});
+}
+
+PipelineTracer::~PipelineTracer() {
+    stop();
+}
+
+void PipelineTracer::start(GMainContext *context) {
+    if (!enabled() || interval_source) {
+        return;
+    }
+    started = chrono::steady_clock::now();
+    interval_source = g_timeout_source_new_seconds(interval_s);
+    g_source_set_callback(interval_source, on_interval, this, NULL);
+    g_source_attach(interval_source, context);
+}
+
+void PipelineTracer::stop() {
+    if (interval_source) {
+        g_source_destroy(interval_source);
+        g_source_unref(interval_source);
+        interval_source = NULL;
+    }
+    // Element and thread records stay until the tracer goes, for probe calls
+    // already under way
+    lock_guard<mutex> lock(registry);
+    stopped = true;
+    for (const auto& handler : handlers) {
+        g_signal_handler_disconnect(handler.first, handler.second);
+        gst_object_unref(handler.first);
+    }
+    handlers.clear();
+    for (const auto& probe : probes) {
+        gst_pad_remove_probe(probe.first, probe.second);
+        gst_object_unref(probe.first);
+    }
+    probes.clear();
+}
+
+void PipelineTracer::hook(GstElement *element) {
+    // Bins pass buffers through ghost pads; their children are hooked instead
+    if (GST_IS_BIN(element)) {
+        return;
+    }
+    ElementTrace *trace;
+    {
+        lock_guard<mutex> lock(registry);
+        if (stopped || hooked.count(element) || elements.size() >= TRACE_MAX_ELEMENTS) {
+            return;
+        }
+        hooked.insert(element);
+        trace = new ElementTrace();
+        trace->tracer = this;
+        trace->id = elements.size();
+        gchar *name = gst_element_get_name(element);
+        trace->name = name;
+        g_free(name);
+        elements.emplace_back(trace);
+        gulong id = g_signal_connect(element, "pad-added", G_CALLBACK(on_pad_added), trace);
+        handlers.push_back({GST_ELEMENT(gst_object_ref(element)), id});
+    }
+    gst_element_foreach_pad(element, hook_pad, trace);
+}
+
+gboolean PipelineTracer::hook_pad(GstElement*, GstPad *pad, gpointer user_data) {
+    ElementTrace *trace = (ElementTrace*)user_data;
+    PipelineTracer *tracer = trace->tracer;
+    lock_guard<mutex> lock(tracer->registry);
+    if (tracer->stopped) {
+        return FALSE;
+    }
+    bool input = GST_PAD_DIRECTION(pad) == GST_PAD_SINK;
+    gulong id = gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                                  input ? on_input : on_output, trace, NULL);
+    tracer->probes.push_back({GST_PAD(gst_object_ref(pad)), id});
+    return TRUE;
+}
+
+void PipelineTracer::on_pad_added(GstElement *element, GstPad *pad, gpointer user_data) {
+    hook_pad(element, pad, user_data);
+}
+
+void PipelineTracer::on_element_added(GstBin*, GstBin*, GstElement *element, gpointer user_data) {
+    ((PipelineTracer*)user_data)->hook(element);
+}
+
+PipelineTracer::ThreadState* PipelineTracer::thread_state() {
+    if (current_generation == generation) {
+        return (ThreadState*)current_state;
+    }
+    ThreadState *state = new ThreadState();
+    char name[16] = "";
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    state->name = name;
+    {
+        lock_guard<mutex> lock(registry);
+        threads.emplace_back(state);
+    }
+    current_generation = generation;
+    current_state = state;
+    return state;
+}
+
+TraceHistogram* PipelineTracer::histogram(atomic<TraceHistogram*>& slot) {
+    TraceHistogram *histogram = slot.load(memory_order_relaxed);
+    if (!histogram) {
+        // Zeroed; published for the dump once complete
+        histogram = new TraceHistogram();
+        slot.store(histogram, memory_order_release);
+    }
+    return histogram;
+}
+
+GstPadProbeReturn PipelineTracer::on_input(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    ElementTrace *trace = (ElementTrace*)user_data;
+    uint64_t now = now_ns();
+    trace->tracer->thread_state()->input_ns[trace->id] = now;
+    gpointer buffer = first_buffer(info);
+    if (buffer) {
+        int slot = residency_slot(buffer);
+        trace->slot_buffers[slot].store(0, memory_order_relaxed);
+        trace->slot_ns[slot].store(now, memory_order_relaxed);
+        trace->slot_buffers[slot].store((uintptr_t)buffer, memory_order_release);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn PipelineTracer::on_output(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    ElementTrace *trace = (ElementTrace*)user_data;
+    PipelineTracer *tracer = trace->tracer;
+    uint64_t now = now_ns();
+    ThreadState *state = tracer->thread_state();
+    uint64_t input = state->input_ns[trace->id];
+    if (input) {
+        // Pushed while handling an input on this thread; later outputs of
+        // the same input would count the time spent downstream
+        state->input_ns[trace->id] = 0;
+        tracer->histogram(state->processing[trace->id])->add(now - input);
+        return GST_PAD_PROBE_OK;
+    }
+    gpointer buffer = first_buffer(info);
+    if (!buffer) {
+        return GST_PAD_PROBE_OK;
+    }
+    int slot = residency_slot(buffer);
+    if (trace->slot_buffers[slot].load(memory_order_acquire) == (uintptr_t)buffer) {
+        uint64_t came_in = trace->slot_ns[slot].load(memory_order_relaxed);
+        trace->slot_buffers[slot].store(0, memory_order_relaxed);
+        if (came_in <= now) {
+            tracer->histogram(state->residency[trace->id])->add(now - came_in);
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+gboolean PipelineTracer::on_interval(gpointer user_data) {
+    ((PipelineTracer*)user_data)->dump();
+    return TRUE;
+}
+
+void PipelineTracer::dump() {
+    if (!enabled()) {
+        return;
+    }
+    struct Row {
+        string name;
+        Totals processing;
+        Totals residency;
+    };
+    vector<Row> rows;
+    {
+        lock_guard<mutex> lock(registry);
+        for (const auto& element : elements) {
+            Row row;
+            row.name = element->name;
+            for (const auto& thread : threads) {
+                row.processing.add(thread->processing[element->id].load(memory_order_acquire));
+                row.residency.add(thread->residency[element->id].load(memory_order_acquire));
+            }
+            if (row.processing.count || row.residency.count) {
+                rows.push_back(row);
+            }
+        }
+    }
+    sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.processing.total_ns + a.residency.total_ns > b.processing.total_ns + b.residency.total_ns;
+    });
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    printf("Pipeline trace after %.0f s, by time spent (processing: input to output on one thread; "
+           "queued: one buffer across threads)\n", elapsed);
+    printf("  %-28s %9s %9s %8s %8s %8s %9s %8s %8s\n", "element", "buffers", "busy %", "p50 us", "p99 us",
+           "max us", "queued", "p50 ms", "p99 ms");
+    for (size_t i = 0; i < rows.size() && i < TRACE_TOP_ELEMENTS; i++) {
+        const Row& row = rows[i];
+        printf("  %-28s %9llu %8.2f%% %8.0f %8.0f %8.0f %9llu %8.1f %8.1f\n", row.name.c_str(),
+               (unsigned long long)row.processing.count,
+               elapsed > 0 ? row.processing.total_ns / (elapsed * 1e7) : 0, row.processing.percentile_us(0.5),
+               row.processing.percentile_us(0.99), row.processing.max_ns / 1000.0,
+               (unsigned long long)row.residency.count, row.residency.percentile_us(0.5) / 1000,
+               row.residency.percentile_us(0.99) / 1000);
+    }
+    fflush(stdout);
+    if (!csv_path.empty()) {
+        write_csv();
+    }
+}
+
+// Every non-empty bucket of every thread's histograms, rewritten each dump
+void PipelineTracer::write_csv() {
+    ofstream out(csv_path, ios::trunc);
+    if (!out) {
+        cerr << "Cannot write " << csv_path << endl;
+        return;
+    }
+    out << "element,thread,kind,bucket_upper_us,count\n";
+    lock_guard<mutex> lock(registry);
+    for (const auto& element : elements) {
+        for (const auto& thread : threads) {
+            const TraceHistogram *kinds[] = {
+                thread->processing[element->id].load(memory_order_acquire),
+                thread->residency[element->id].load(memory_order_acquire),
+            };
+            for (int kind = 0; kind < 2; kind++) {
+                for (int i = 0; kinds[kind] && i < TRACE_BUCKETS; i++) {
+                    uint32_t count = kinds[kind]->buckets[i].load(memory_order_relaxed);
+                    if (count) {
+                        out << element->name << "," << thread->name << "," << (kind ? "queued" : "processing")
+                            << "," << bucket_limit_us(i) << "," << count << "\n";
+                    }
+                }
+            }
+        }
+    }
+}
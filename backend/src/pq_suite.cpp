@@ -0,0 +1,70 @@
+#include "pq_suite.h"
+
+using namespace std;
+
+// Only pairs whose algorithms are both enabled in liboqs are registered
+static const PqSuiteInfo SUITES[] = {
+#ifdef OQS_ENABLE_KEM_kyber_768
+    PqSuite<Kyber768, MlDsa65>::info(),
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_512
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+    PqSuite<MlKem512, MlDsa44>::info(),
+#endif
+    PqSuite<MlKem512, MlDsa65>::info(),
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+    PqSuite<MlKem512, MlDsa87>::info(),
+#endif
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_768
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+    PqSuite<MlKem768, MlDsa44>::info(),
+#endif
+    PqSuite<MlKem768, MlDsa65>::info(),
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+    PqSuite<MlKem768, MlDsa87>::info(),
+#endif
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_1024
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+    PqSuite<MlKem1024, MlDsa44>::info(),
+#endif
+    PqSuite<MlKem1024, MlDsa65>::info(),
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+    PqSuite<MlKem1024, MlDsa87>::info(),
+#endif
+#endif
+};
+
+static const size_t SUITE_COUNT = sizeof(SUITES) / sizeof(SUITES[0]);
+
+const PqSuiteInfo* pq_suites(size_t& count) {
+    count = SUITE_COUNT;
+    return SUITES;
+}
+
+const PqSuiteInfo* find_pq_suite(uint8_t id) {
+    for (size_t i = 0; i < SUITE_COUNT; i++) {
+        if (SUITES[i].id == id) {
+            return &SUITES[i];
+        }
+    }
+    return nullptr;
+}
+
+const PqSuiteInfo* find_pq_suite(const string& name) {
+    for (size_t i = 0; i < SUITE_COUNT; i++) {
+        if (pq_suite_name(SUITES[i]) == name) {
+            return &SUITES[i];
+        }
+    }
+    return nullptr;
+}
+
+const PqSuiteInfo& default_pq_suite() {
+    return *find_pq_suite((uint8_t)PQ_SUITE_DEFAULT);
+}
+
+string pq_suite_name(const PqSuiteInfo& suite) {
+    return string(suite.kem_token) + "-" + suite.sig_token;
+}
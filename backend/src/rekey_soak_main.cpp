@@ -0,0 +1,257 @@
+#include <gst/gst.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <dirent.h>
+#include "auth_protocol.h"
+#include "srtp_rekey.h"
+
+using namespace std;
+
+// Both ends of a call in one process over loopback: each side sends a live
+// RTP stream through srtpenc to the other side's srtpdec, and the client
+// rekeys every few seconds through the real key exchange and key ring. Every
+// decrypted packet is counted by sequence number, so a single packet lost
+// or failing authentication across a key switch shows up as a gap. Exits
+// non-zero on any loss or if the rekeys did not happen.
+
+#define SOAK_IP "127.0.0.1"
+#define SOAK_USERNAME "rekey_soak"
+#define SOAK_CLIENT_RTP_PORT 5120
+#define SOAK_SERVER_RTP_PORT 5122
+#define SOAK_DRAIN_MS 200
+
+// Sequence numbers seen after one srtpdec
+struct StreamCounter {
+    atomic<uint64_t> received;
+    uint64_t expected;
+    bool started;
+    uint16_t last_seq;
+
+    StreamCounter() : received(0), expected(0), started(false), last_seq(0) {}
+};
+
+static GstPadProbeReturn on_decrypted_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    StreamCounter *counter = (StreamCounter*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    uint8_t header[4];
+    if (gst_buffer_extract(buf, 0, header, sizeof(header)) != sizeof(header)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    uint16_t seq = (uint16_t)(header[2] << 8 | header[3]);
+    if (!counter->started) {
+        counter->started = true;
+        counter->expected = 1;
+    } else {
+        // Loopback does not reorder, so every step forward is one packet
+        // plus whatever went missing in between
+        counter->expected += (uint16_t)(seq - counter->last_seq);
+    }
+    counter->last_seq = seq;
+    counter->received++;
+    return GST_PAD_PROBE_OK;
+}
+
+static bool count_decrypted(GstElement *pipeline, const char* decoder, StreamCounter& counter) {
+    GstElement *dec = gst_bin_get_by_name(GST_BIN(pipeline), decoder);
+    if (!dec) {
+        return false;
+    }
+    GstPad *pad = gst_element_get_static_pad(dec, "rtp_src");
+    gst_object_unref(dec);
+    if (!pad) {
+        return false;
+    }
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_decrypted_packet, &counter, NULL);
+    gst_object_unref(pad);
+    return true;
+}
+
+static string sender(int packets_per_second, const char* encoder, int port) {
+    int samples = 48000 / packets_per_second;
+    long long ptime_ns = 1000000000LL / packets_per_second;
+    return "audiotestsrc is-live=true samplesperbuffer=" + to_string(samples) + " ! "
+           "audio/x-raw,format=S16BE,rate=48000,channels=1 ! "
+           "rtpL16pay pt=96 min-ptime=" + to_string(ptime_ns) + " max-ptime=" + to_string(ptime_ns) + " ! "
+           "srtpenc name=" + string(encoder) + " "
+           "rtp-cipher=aes-256-icm rtcp-cipher=aes-256-icm rtp-auth=hmac-sha1-80 rtcp-auth=hmac-sha1-80 ! "
+           "udpsink host=" SOAK_IP " port=" + to_string(port) + " sync=false async=false ";
+}
+
+static string receiver(const char* decoder, int port) {
+    return "udpsrc port=" + to_string(port) + " buffer-size=212992 ! srtpdec name=" + string(decoder) + " ! "
+           "fakesink sync=false async=false ";
+}
+
+// Run in a scratch directory so the key store, identity files and tickets of
+// the soak never mix with a real client's or server's
+static bool enter_scratch_dir(string& dir) {
+    char path[] = "/tmp/rekey_soak.XXXXXX";
+    if (!mkdtemp(path) || chdir(path) != 0) {
+        return false;
+    }
+    dir = path;
+    return true;
+}
+
+static void remove_scratch_dir(const string& dir) {
+    DIR *d = opendir(dir.c_str());
+    if (d) {
+        struct dirent *entry;
+        while ((entry = readdir(d)) != nullptr) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                unlink((dir + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+static uint64_t lost(const StreamCounter& counter) {
+    return counter.expected - counter.received;
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    int seconds = argc > 1 ? atoi(argv[1]) : 30;
+    int rekey_seconds = argc > 2 ? atoi(argv[2]) : 3;
+    int packets_per_second = argc > 3 ? atoi(argv[3]) : 1000;
+    int port = argc > 4 ? atoi(argv[4]) : 9100;
+
+    if (seconds <= 0 || rekey_seconds <= 0 || rekey_seconds >= seconds || packets_per_second <= 0 ||
+        packets_per_second > 48000 || 48000 % packets_per_second != 0 || port <= 0) {
+        cout << "Usage: " << argv[0] << " [seconds] [rekey_seconds] [packets/s, divides 48000] [port]" << endl;
+        return -1;
+    }
+
+    string scratch_dir;
+    if (!enter_scratch_dir(scratch_dir)) {
+        cerr << "Cannot create scratch directory" << endl;
+        return -1;
+    }
+
+    // Per-step protocol logging of every rekey would bury the result
+    cout.setstate(ios::badbit);
+
+    // First key of the call, exactly as client and server get it
+    string client_username;
+    thread first_exchange([&] {
+        server_perform_authenticated_key_exchange(port, client_username);
+    });
+    DilithiumKeys identity;
+    vector<uint8_t> client_key;
+    // The server may not be listening yet
+    bool exchange_ok = false;
+    for (int attempt = 0; attempt < 50 && !exchange_ok; attempt++) {
+        exchange_ok = load_or_generate_dilithium_keys(identity) &&
+                      client_perform_key_exchange_with_keys(SOAK_IP, port, SOAK_USERNAME, identity,
+                                                            HANDSHAKE_MODE_1RTT, client_key);
+        if (!exchange_ok) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+    }
+    if (!exchange_ok) {
+        cerr << "Initial key exchange failed; is port " << port << " free?" << endl;
+        first_exchange.detach();
+        remove_scratch_dir(scratch_dir);
+        return -1;
+    }
+    first_exchange.join();
+
+    string pipeline_desc =
+        sender(packets_per_second, "client_enc", SOAK_CLIENT_RTP_PORT) +
+        receiver("server_dec", SOAK_CLIENT_RTP_PORT) +
+        sender(packets_per_second, "server_enc", SOAK_SERVER_RTP_PORT) +
+        receiver("client_dec", SOAK_SERVER_RTP_PORT);
+
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(pipeline_desc.c_str(), &error);
+    if (error) {
+        cerr << "Pipeline parse error: " << error->message << endl;
+        g_error_free(error);
+        remove_scratch_dir(scratch_dir);
+        return -1;
+    }
+
+    StreamCounter to_server, to_client;
+    int result = 1;
+    {
+        SrtpKeyRing client_ring(pipeline, {"client_enc"}, {"client_dec"});
+        SrtpKeyRing server_ring(pipeline, {"server_enc"}, {"server_dec"});
+        client_ring.set_placeholder_key();
+        server_ring.set_placeholder_key();
+        client_ring.start(client_key);
+        server_ring.start(SRTP_KEY);
+
+        if (!count_decrypted(pipeline, "server_dec", to_server) ||
+            !count_decrypted(pipeline, "client_dec", to_client)) {
+            cerr << "srtpdec has no rtp_src pad" << endl;
+            gst_object_unref(pipeline);
+            remove_scratch_dir(scratch_dir);
+            return -1;
+        }
+
+        ServerRekeyer server_rekeyer(server_ring, port, client_username, SOAK_IP);
+        ClientRekeyer client_rekeyer(client_ring, SOAK_IP, port, SOAK_USERNAME, default_pq_suite(), rekey_seconds);
+        if (!server_rekeyer.start() || !client_rekeyer.start()) {
+            cerr << "Cannot start rekeying on port " << port << endl;
+            gst_object_unref(pipeline);
+            remove_scratch_dir(scratch_dir);
+            return -1;
+        }
+
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        GstBus *bus = gst_element_get_bus(pipeline);
+        bool failed = false;
+        auto end = chrono::steady_clock::now() + chrono::seconds(seconds);
+        while (!failed && chrono::steady_clock::now() < end) {
+            GstMessage *msg = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND, GST_MESSAGE_ERROR);
+            if (msg) {
+                GError *err;
+                gchar *debug;
+                gst_message_parse_error(msg, &err, &debug);
+                cerr << "Error: " << err->message << endl;
+                g_error_free(err);
+                g_free(debug);
+                gst_message_unref(msg);
+                failed = true;
+            }
+        }
+        gst_object_unref(bus);
+
+        // Stop rekeying first, then let the last packets arrive
+        client_rekeyer.stop();
+        server_rekeyer.stop();
+        this_thread::sleep_for(chrono::milliseconds(SOAK_DRAIN_MS));
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+
+        uint64_t expected_rekeys = (uint64_t)(seconds / rekey_seconds) - 1;
+        printf("%d s at %d packets/s each way, rekey every %d s\n", seconds, packets_per_second, rekey_seconds);
+        printf("rekeys: client %llu (switched %llu)  server %llu (switched %llu)\n",
+               (unsigned long long)client_ring.rekeys(), (unsigned long long)client_ring.switches(),
+               (unsigned long long)server_ring.rekeys(), (unsigned long long)server_ring.switches());
+        printf("client -> server: received %llu  lost %llu\n", (unsigned long long)to_server.received.load(),
+               (unsigned long long)lost(to_server));
+        printf("server -> client: received %llu  lost %llu\n", (unsigned long long)to_client.received.load(),
+               (unsigned long long)lost(to_client));
+
+        bool ok = !failed && to_server.received > 0 && to_client.received > 0 &&
+                  lost(to_server) == 0 && lost(to_client) == 0 &&
+                  client_ring.switches() >= expected_rekeys && server_ring.switches() >= expected_rekeys;
+        printf("%s\n", ok ? "PASS" : "FAIL");
+        result = ok ? 0 : 1;
+    }
+
+    gst_object_unref(pipeline);
+    remove_scratch_dir(scratch_dir);
+    return result;
+}
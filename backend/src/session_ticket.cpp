@@ -0,0 +1,197 @@
+#include "session_ticket.h"
+#include "crypto_utils.h"
+#include "handshake_trace.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+const string SERVER_TICKET_KEY_FILE = "server_ticket_key.bin";
+const string CLIENT_TICKET_FILE = "client_session_ticket.bin";
+
+// Version 2 added the suite id; version 1 tickets fail to open and fall back
+// to a full exchange
+static const vector<uint8_t> TICKET_AAD = {'Q', 'S', 'V', 'C', '-', 'T', 'K', 'T', '2'};
+
+static void put_u16(vector<uint8_t>& out, uint16_t v) {
+    out.push_back(v >> 8);
+    out.push_back(v & 0xff);
+}
+
+static void put_u64(vector<uint8_t>& out, uint64_t v) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.push_back((v >> shift) & 0xff);
+    }
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Secrets are written owner-only regardless of the umask, like the key store.
+// fchmod also tightens a file left behind by an older build.
+static bool write_private_file(const string& path, const uint8_t* data, size_t len) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    
+    bool ok = fchmod(fd, 0600) == 0;
+    while (ok && len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+    return close(fd) == 0 && ok;
+}
+
+// The ticket key is loaded (or generated) once per process. It is persisted
+// so that tickets survive a server restart between calls.
+static const vector<uint8_t>& server_ticket_key() {
+    static const vector<uint8_t> key = [] {
+        vector<uint8_t> k(32);
+        ifstream file(SERVER_TICKET_KEY_FILE, ios::binary);
+        if (file.read((char*)k.data(), k.size())) {
+            return k;
+        }
+        
+        if (!random_bytes(k.data(), k.size())) {
+            cerr << "SERVER: Failed to generate ticket key" << endl;
+            return vector<uint8_t>();
+        }
+        
+        // Still usable for this process if it cannot be saved
+        if (!write_private_file(SERVER_TICKET_KEY_FILE, k.data(), k.size())) {
+            cerr << "SERVER: Failed to save ticket key to " << SERVER_TICKET_KEY_FILE << endl;
+        }
+        cout << "SERVER: Generated new session ticket key" << endl;
+        return k;
+    }();
+    return key;
+}
+
+bool derive_resumption_secret(const uint8_t* shared_secret, uint8_t* resumption_secret) {
+    return hkdf_sha256(shared_secret, 32, NULL, 0, "QSVC resumption secret", resumption_secret, 32);
+}
+
+bool derive_resumed_secret(const uint8_t* resumption_secret, const uint8_t* client_nonce,
+                           const uint8_t* server_nonce, uint8_t* shared_secret) {
+    uint8_t salt[64];
+    memcpy(salt, client_nonce, 32);
+    memcpy(salt + 32, server_nonce, 32);
+    return hkdf_sha256(resumption_secret, 32, salt, sizeof(salt), "QSVC resumed session",
+                       shared_secret, 32);
+}
+
+// Ticket plaintext: [u64 expiry][u8 suite id][32-byte resumption secret][username]
+bool issue_session_ticket(const string& username, uint8_t suite_id, const uint8_t* resumption_secret,
+                          vector<uint8_t>& ticket) {
+    PhaseTimer timer(PHASE_TICKET);
+    const vector<uint8_t>& key = server_ticket_key();
+    if (key.empty()) {
+        return false;
+    }
+    
+    vector<uint8_t> plaintext;
+    put_u64(plaintext, (uint64_t)time(nullptr) + SESSION_TICKET_LIFETIME_SECONDS);
+    plaintext.push_back(suite_id);
+    plaintext.insert(plaintext.end(), resumption_secret, resumption_secret + 32);
+    plaintext.insert(plaintext.end(), username.begin(), username.end());
+    
+    bool ok = aes256_gcm_seal(key.data(), plaintext, TICKET_AAD, ticket);
+    memset(plaintext.data(), 0, plaintext.size());
+    return ok;
+}
+
+bool open_session_ticket(const vector<uint8_t>& ticket, string& username, uint8_t& suite_id,
+                         uint8_t* resumption_secret) {
+    PhaseTimer timer(PHASE_TICKET);
+    const vector<uint8_t>& key = server_ticket_key();
+    if (key.empty()) {
+        return false;
+    }
+    
+    vector<uint8_t> plaintext;
+    if (!aes256_gcm_open(key.data(), ticket, TICKET_AAD, plaintext) || plaintext.size() <= 41) {
+        cerr << "SERVER: Session ticket rejected (invalid)" << endl;
+        return false;
+    }
+    
+    if (get_u64(plaintext.data()) < (uint64_t)time(nullptr)) {
+        cerr << "SERVER: Session ticket rejected (expired)" << endl;
+        return false;
+    }
+    
+    suite_id = plaintext[8];
+    memcpy(resumption_secret, plaintext.data() + 9, 32);
+    username.assign(plaintext.begin() + 41, plaintext.end());
+    memset(plaintext.data(), 0, plaintext.size());
+    return true;
+}
+
+// Client cache file: [u16 len][server][u16 len][username][u64 expiry][32 secret][ticket]
+bool load_client_session_ticket(const string& server, const string& username,
+                                ClientSessionTicket& ticket) {
+    ifstream file(CLIENT_TICKET_FILE, ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    vector<uint8_t> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    
+    size_t offset = 0;
+    string fields[2];
+    for (string& field : fields) {
+        if (data.size() < offset + 2) return false;
+        size_t len = (data[offset] << 8) | data[offset + 1];
+        offset += 2;
+        if (data.size() < offset + len) return false;
+        field.assign(data.begin() + offset, data.begin() + offset + len);
+        offset += len;
+    }
+    
+    if (fields[0] != server || fields[1] != username || data.size() <= offset + 40) {
+        return false;
+    }
+    
+    ticket.expiry = get_u64(data.data() + offset);
+    ticket.resumption_secret.assign(data.begin() + offset + 8, data.begin() + offset + 40);
+    ticket.ticket.assign(data.begin() + offset + 40, data.end());
+    
+    // Leave a little slack so the ticket does not expire in flight
+    return ticket.expiry > (uint64_t)time(nullptr) + 5;
+}
+
+void store_client_session_ticket(const string& server, const string& username,
+                                 const ClientSessionTicket& ticket) {
+    vector<uint8_t> data;
+    put_u16(data, server.size());
+    data.insert(data.end(), server.begin(), server.end());
+    put_u16(data, username.size());
+    data.insert(data.end(), username.begin(), username.end());
+    put_u64(data, ticket.expiry);
+    data.insert(data.end(), ticket.resumption_secret.begin(), ticket.resumption_secret.end());
+    data.insert(data.end(), ticket.ticket.begin(), ticket.ticket.end());
+    
+    if (!write_private_file(CLIENT_TICKET_FILE, data.data(), data.size())) {
+        cerr << "CLIENT: Failed to save session ticket" << endl;
+        discard_client_session_ticket();
+    }
+}
+
+void discard_client_session_ticket() {
+    remove(CLIENT_TICKET_FILE.c_str());
+}
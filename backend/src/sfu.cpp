@@ -0,0 +1,487 @@
+#include "sfu.h"
+#include "srtp_rekey.h"
+#include "media_pipeline.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SRTP_REPLAY_WINDOW 128
+#define SFU_POLL_TIMEOUT_MS 50
+
+// Packets taken from one socket before the others get their turn
+#define SFU_RECV_BATCH 64
+
+// What participants send to base_port + offset goes to the other participants
+// at base_port + forward offset, the ports a client listens on in a 1:1 call:
+// RTP and sender reports to the receiving rtpbin, receiver reports to the
+// sending one
+struct PortMapping {
+    int offset;
+    int forward_offset;
+    bool rtcp;
+};
+
+static const PortMapping port_mappings[] = {
+    // Video RTP and RTCP, audio RTP and RTCP
+    {CLIENT_TO_SERVER_PORT_OFFSET, SERVER_TO_CLIENT_PORT_OFFSET, false},
+    {CLIENT_TO_SERVER_PORT_OFFSET + 1, SERVER_TO_CLIENT_PORT_OFFSET + 1, true},
+    {CLIENT_TO_SERVER_PORT_OFFSET + 2, SERVER_TO_CLIENT_PORT_OFFSET + 2, false},
+    {CLIENT_TO_SERVER_PORT_OFFSET + 3, SERVER_TO_CLIENT_PORT_OFFSET + 3, true},
+    // Receiver reports on video and audio
+    {SERVER_FEEDBACK_PORT_OFFSET, CLIENT_FEEDBACK_PORT_OFFSET, true},
+    {SERVER_FEEDBACK_PORT_OFFSET + 2, CLIENT_FEEDBACK_PORT_OFFSET + 2, true},
+};
+
+SfuForwarder::SfuForwarder(int base_port)
+    : base_port(base_port), running(false), next_id(0), pending_switches(0), received_count(0),
+      forwarded_count(0), auth_failure_count(0), unknown_key_count(0), send_error_count(0), cpu_ns(0) {
+    srtp_init();
+}
+
+SfuForwarder::~SfuForwarder() {
+    stop();
+    lock_guard<mutex> lock(participants_mutex);
+    for (auto& entry : participants) {
+        destroy_sessions(*entry.second);
+    }
+    participants.clear();
+    by_mki.clear();
+}
+
+bool SfuForwarder::start() {
+    for (const PortMapping& mapping : port_mappings) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            stop();
+            return false;
+        }
+        int buffer_size = SFU_SOCKET_BUFFER_SIZE;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(base_port + mapping.offset);
+        if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            cerr << "SFU: Cannot bind UDP port " << base_port + mapping.offset << ": " << strerror(errno) << endl;
+            close(fd);
+            stop();
+            return false;
+        }
+        sockets.push_back({fd, mapping.forward_offset, mapping.rtcp});
+    }
+
+    running = true;
+    forward_thread = thread(&SfuForwarder::run, this);
+    return true;
+}
+
+void SfuForwarder::stop() {
+    running = false;
+    if (forward_thread.joinable()) {
+        forward_thread.join();
+    }
+    for (const Socket& socket : sockets) {
+        close(socket.fd);
+    }
+    sockets.clear();
+}
+
+// Both sessions hold every key of the ring, each tagged with its MKI. The
+// first call creates them; later calls go through srtp_update(), which keeps
+// each stream's rollover counter and replay window.
+bool SfuForwarder::update_sessions(Participant& participant, bool create) {
+    vector<srtp_master_key_t> master_keys(participant.keys.size());
+    vector<srtp_master_key_t*> key_list;
+    for (size_t i = 0; i < participant.keys.size(); i++) {
+        master_keys[i].key = participant.keys[i].key.data();
+        master_keys[i].mki_id = (unsigned char*)&participant.keys[i].mki;
+        master_keys[i].mki_size = SRTP_MKI_SIZE;
+        key_list.push_back(&master_keys[i]);
+    }
+
+    srtp_policy_t policy;
+    memset(&policy, 0, sizeof(policy));
+    // Same protection as srtpenc in the client pipeline
+    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtp);
+    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtcp);
+    policy.keys = key_list.data();
+    policy.num_master_keys = key_list.size();
+    policy.window_size = SRTP_REPLAY_WINDOW;
+
+    policy.ssrc.type = ssrc_any_inbound;
+    srtp_err_status_t status = create ? srtp_create(&participant.inbound, &policy)
+                                      : srtp_update(participant.inbound, &policy);
+    if (status != srtp_err_status_ok) {
+        return false;
+    }
+    policy.ssrc.type = ssrc_any_outbound;
+    status = create ? srtp_create(&participant.outbound, &policy) : srtp_update(participant.outbound, &policy);
+    return status == srtp_err_status_ok;
+}
+
+void SfuForwarder::destroy_sessions(Participant& participant) {
+    if (participant.inbound) {
+        srtp_dealloc(participant.inbound);
+        participant.inbound = NULL;
+    }
+    if (participant.outbound) {
+        srtp_dealloc(participant.outbound);
+        participant.outbound = NULL;
+    }
+}
+
+// Drop the oldest keys beyond SRTP_KEY_RING_SIZE, except the one we send with
+// and the one the participant last sent with
+void SfuForwarder::trim_keys(Participant& participant) {
+    size_t i = 0;
+    while (participant.keys.size() > SRTP_KEY_RING_SIZE && i < participant.keys.size()) {
+        if (i == participant.sending_index || participant.keys[i].mki == participant.last_inbound_mki) {
+            i++;
+            continue;
+        }
+        by_mki.erase(participant.keys[i].mki);
+        participant.keys.erase(participant.keys.begin() + i);
+        if (participant.sending_index > i) {
+            participant.sending_index--;
+        }
+    }
+}
+
+int SfuForwarder::add_participant(const string& username, const string& ip, const vector<uint8_t>& key) {
+    unique_ptr<Participant> participant(new Participant());
+    participant->username = username;
+    participant->ip = ip;
+    memset(&participant->addr, 0, sizeof(participant->addr));
+    participant->addr.sin_family = AF_INET;
+    if (key.size() != SRTP_MASTER_KEY_SIZE || inet_pton(AF_INET, ip.c_str(), &participant->addr.sin_addr) != 1) {
+        return -1;
+    }
+
+    SfuKey first;
+    first.key = key;
+    if (!derive_srtp_mki(key, first.mki)) {
+        return -1;
+    }
+    participant->keys.push_back(first);
+    participant->inbound = NULL;
+    participant->outbound = NULL;
+    participant->sending_index = 0;
+    participant->switch_pending = false;
+    participant->last_inbound_mki = first.mki;
+
+    lock_guard<mutex> lock(participants_mutex);
+    if (by_mki.count(first.mki) || !update_sessions(*participant, true)) {
+        destroy_sessions(*participant);
+        return -1;
+    }
+    participant->id = next_id++;
+    by_mki[first.mki] = participant.get();
+    int id = participant->id;
+    participants[id] = move(participant);
+    return id;
+}
+
+bool SfuForwarder::rekey_participant(int id, const vector<uint8_t>& key) {
+    SfuKey next;
+    next.key = key;
+    if (key.size() != SRTP_MASTER_KEY_SIZE || !derive_srtp_mki(key, next.mki)) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(participants_mutex);
+    auto it = participants.find(id);
+    if (it == participants.end() || by_mki.count(next.mki)) {
+        return false;
+    }
+    Participant& participant = *it->second;
+    participant.keys.push_back(next);
+    if (!update_sessions(participant, false)) {
+        participant.keys.pop_back();
+        return false;
+    }
+    by_mki[next.mki] = &participant;
+
+    // The participant's decoders may not have the key yet
+    if (!participant.switch_pending) {
+        pending_switches++;
+    }
+    participant.switch_pending = true;
+    participant.switch_at = chrono::steady_clock::now() + chrono::milliseconds(REKEY_SWITCH_DELAY_MS);
+    return true;
+}
+
+void SfuForwarder::remove_participant(int id) {
+    lock_guard<mutex> lock(participants_mutex);
+    auto it = participants.find(id);
+    if (it == participants.end()) {
+        return;
+    }
+    Participant& participant = *it->second;
+    for (const SfuKey& key : participant.keys) {
+        by_mki.erase(key.mki);
+    }
+    if (participant.switch_pending) {
+        pending_switches--;
+    }
+    destroy_sessions(participant);
+    participants.erase(it);
+}
+
+int SfuForwarder::find_participant(const string& username, const string& ip) {
+    lock_guard<mutex> lock(participants_mutex);
+    for (const auto& entry : participants) {
+        if (entry.second->username == username && entry.second->ip == ip) {
+            return entry.first;
+        }
+    }
+    return -1;
+}
+
+SfuStats SfuForwarder::stats() {
+    SfuStats stats;
+    stats.received = received_count;
+    stats.forwarded = forwarded_count;
+    stats.auth_failures = auth_failure_count;
+    stats.unknown_key = unknown_key_count;
+    stats.send_errors = send_error_count;
+    stats.cpu_ns = cpu_ns;
+    lock_guard<mutex> lock(participants_mutex);
+    stats.participants = participants.size();
+    return stats;
+}
+
+void SfuForwarder::switch_due_participants() {
+    lock_guard<mutex> lock(participants_mutex);
+    auto now = chrono::steady_clock::now();
+    for (auto& entry : participants) {
+        Participant& participant = *entry.second;
+        if (!participant.switch_pending || now < participant.switch_at) {
+            continue;
+        }
+        participant.switch_pending = false;
+        pending_switches--;
+        participant.sending_index = participant.keys.size() - 1;
+        size_t key_count = participant.keys.size();
+        trim_keys(participant);
+        if (participant.keys.size() != key_count && !update_sessions(participant, false)) {
+            cerr << "SFU: Could not drop old keys of " << participant.username << endl;
+        }
+    }
+}
+
+void SfuForwarder::forward(const Socket& socket, uint8_t* packet, int len) {
+    received_count++;
+    if (len < 12 + SRTP_MKI_SIZE + SRTP_AUTH_TAG_SIZE) {
+        unknown_key_count++;
+        return;
+    }
+    uint32_t mki;
+    memcpy(&mki, packet + len - SRTP_AUTH_TAG_SIZE - SRTP_MKI_SIZE, sizeof(mki));
+
+    lock_guard<mutex> lock(participants_mutex);
+    auto sender_it = by_mki.find(mki);
+    if (sender_it == by_mki.end()) {
+        unknown_key_count++;
+        return;
+    }
+    Participant& sender = *sender_it->second;
+
+    int plain_len = len;
+    srtp_err_status_t status = socket.rtcp ? srtp_unprotect_rtcp_mki(sender.inbound, packet, &plain_len, 1)
+                                           : srtp_unprotect_mki(sender.inbound, packet, &plain_len, 1);
+    if (status != srtp_err_status_ok) {
+        auth_failure_count++;
+        return;
+    }
+    sender.last_inbound_mki = mki;
+
+    uint8_t out[SFU_MAX_PACKET_SIZE + SRTP_MAX_TRAILER_LEN];
+    for (auto& entry : participants) {
+        Participant& receiver = *entry.second;
+        if (&receiver == &sender) {
+            continue;
+        }
+
+        memcpy(out, packet, plain_len);
+        int out_len = plain_len;
+        status = socket.rtcp
+            ? srtp_protect_rtcp_mki(receiver.outbound, out, &out_len, 1, receiver.sending_index)
+            : srtp_protect_mki(receiver.outbound, out, &out_len, 1, receiver.sending_index);
+        if (status != srtp_err_status_ok) {
+            send_error_count++;
+            continue;
+        }
+
+        struct sockaddr_in to = receiver.addr;
+        to.sin_port = htons(base_port + socket.forward_offset);
+        if (sendto(socket.fd, out, out_len, 0, (struct sockaddr*)&to, sizeof(to)) < 0) {
+            send_error_count++;
+        } else {
+            forwarded_count++;
+        }
+    }
+}
+
+void SfuForwarder::run() {
+    vector<struct pollfd> fds;
+    for (const Socket& socket : sockets) {
+        fds.push_back({socket.fd, POLLIN, 0});
+    }
+
+    uint8_t packet[SFU_MAX_PACKET_SIZE];
+    while (running) {
+        int ready = poll(fds.data(), fds.size(), SFU_POLL_TIMEOUT_MS);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        for (size_t i = 0; i < fds.size() && ready > 0; i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            for (int batch = 0; batch < SFU_RECV_BATCH; batch++) {
+                ssize_t n = recv(sockets[i].fd, packet, sizeof(packet), MSG_DONTWAIT);
+                if (n <= 0) {
+                    break;
+                }
+                forward(sockets[i], packet, n);
+            }
+        }
+        if (pending_switches > 0) {
+            switch_due_participants();
+        }
+
+        struct timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        cpu_ns = (uint64_t)cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+    }
+}
+
+SfuServer::SfuServer(int key_exchange_port, int base_port, int max_participants)
+    : max_participants(max_participants), handshake_server(key_exchange_port), forwarder(base_port),
+      running(false) {}
+
+SfuServer::~SfuServer() {
+    stop();
+}
+
+bool SfuServer::start() {
+    handshake_server.keep_completed_connections(true);
+    if (!forwarder.start()) {
+        return false;
+    }
+    if (!handshake_server.start()) {
+        forwarder.stop();
+        return false;
+    }
+    running = true;
+    accept_thread = thread(&SfuServer::accept_loop, this);
+    return true;
+}
+
+void SfuServer::stop() {
+    if (!running) {
+        return;
+    }
+    running = false;
+    if (accept_thread.joinable()) {
+        accept_thread.join();
+    }
+    handshake_server.stop();
+
+    {
+        lock_guard<mutex> lock(channels_mutex);
+        for (auto& entry : channels) {
+            entry.second->send(CTRL_HANGUP);
+            entry.second->close();
+        }
+        channels.clear();
+    }
+    forwarder.stop();
+}
+
+void SfuServer::accept_loop() {
+    CompletedHandshake done;
+    while (running) {
+        if (handshake_server.wait_for_handshake(done, 200)) {
+            admit(done);
+        }
+    }
+}
+
+void SfuServer::admit(CompletedHandshake& done) {
+    // A participant's in-call exchanges come from the same user and address;
+    // they only bring a new key, and their connection is not kept
+    int id = forwarder.find_participant(done.username, done.peer_ip);
+    if (id >= 0) {
+        if (done.control.fd >= 0) {
+            close(done.control.fd);
+        }
+        if (forwarder.rekey_participant(id, done.srtp_key)) {
+            cout << "SFU: Rekeyed " << done.username << " (" << done.peer_ip << ")" << endl;
+        }
+        return;
+    }
+
+    if (forwarder.stats().participants >= max_participants) {
+        cout << "SFU: Call is full, turning away " << done.username << " (" << done.peer_ip << ")" << endl;
+        if (done.control.fd >= 0) {
+            close(done.control.fd);
+        }
+        return;
+    }
+
+    id = forwarder.add_participant(done.username, done.peer_ip, done.srtp_key);
+    if (id < 0) {
+        cerr << "SFU: Cannot add " << done.username << " (" << done.peer_ip << ")" << endl;
+        if (done.control.fd >= 0) {
+            close(done.control.fd);
+        }
+        return;
+    }
+
+    ControlChannel *channel = new ControlChannel(done.control, false);
+    {
+        lock_guard<mutex> lock(channels_mutex);
+        channels[id].reset(channel);
+    }
+    string username = done.username;
+    channel->attach(NULL,
+        [this, id, username](uint8_t type, const vector<uint8_t>& payload) {
+            if (type == CTRL_HANGUP) {
+                cout << "SFU: " << username << " hung up" << endl;
+                schedule_removal(id);
+            }
+        },
+        [this, id, username] {
+            cout << "SFU: Control connection to " << username << " lost" << endl;
+            schedule_removal(id);
+        });
+    cout << "SFU: " << done.username << " (" << done.peer_ip << ") joined, "
+         << forwarder.stats().participants << " in the call" << endl;
+}
+
+// The channel that reported the hang-up is still on the stack; it is
+// destroyed from the main loop afterwards
+void SfuServer::schedule_removal(int id) {
+    g_idle_add(on_remove, new Removal{this, id});
+}
+
+gboolean SfuServer::on_remove(gpointer data) {
+    Removal *removal = (Removal*)data;
+    removal->server->forwarder.remove_participant(removal->id);
+    {
+        lock_guard<mutex> lock(removal->server->channels_mutex);
+        removal->server->channels.erase(removal->id);
+    }
+    delete removal;
+    return FALSE;
+}
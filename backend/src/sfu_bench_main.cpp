@@ -0,0 +1,303 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "crypto_utils.h"
+#include "srtp_rekey.h"
+#include "sfu.h"
+#include "media_pipeline.h"
+
+using namespace std;
+
+// Forwarding cost of the SFU as the call grows. An in-process SfuForwarder
+// serves N synthetic participants over loopback, each on its own address
+// (127.0.0.2, 127.0.0.3, ...) with its own SRTP key, sending a paced video
+// RTP stream. Each packet carries its send time, so every receiver measures
+// the one-way latency through the SFU: the sender's encryption, then receive,
+// decrypt, re-encrypt for each other participant and send. Exits non-zero if any packet fails
+// authentication on either side.
+
+#define BENCH_SFU_IP "127.0.0.1"
+#define BENCH_SSRC_BASE 0x5F000000
+#define BENCH_RTP_HEADER_SIZE 12
+#define BENCH_DRAIN_MS 300
+#define BENCH_RECV_TIMEOUT_MS 100
+
+struct BenchParticipant {
+    vector<uint8_t> key;
+    uint32_t mki;
+    srtp_t outbound = NULL;
+    srtp_t inbound = NULL;
+    int fd = -1;
+    uint16_t seq = 0;
+
+    // Written by this participant's receiver thread only
+    vector<uint32_t> latencies_us;
+    uint64_t received = 0;
+    uint64_t auth_failures = 0;
+};
+
+struct RunResult {
+    uint64_t sent;
+    uint64_t received;
+    uint64_t auth_failures;
+    double seconds;
+    vector<uint32_t> latencies_us;
+    SfuStats sfu;
+};
+
+static uint64_t now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same policy as the SFU and the client pipelines, one key with its MKI
+static bool create_session(BenchParticipant& participant, srtp_t& session, bool outbound) {
+    srtp_master_key_t master_key;
+    master_key.key = participant.key.data();
+    master_key.mki_id = (unsigned char*)&participant.mki;
+    master_key.mki_size = SRTP_MKI_SIZE;
+    srtp_master_key_t *keys[] = {&master_key};
+
+    srtp_policy_t policy;
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtp);
+    srtp_crypto_policy_set_aes_cm_256_hmac_sha1_80(&policy.rtcp);
+    policy.ssrc.type = outbound ? ssrc_any_outbound : ssrc_any_inbound;
+    policy.keys = keys;
+    policy.num_master_keys = 1;
+    policy.window_size = 1024;
+    return srtp_create(&session, &policy) == srtp_err_status_ok;
+}
+
+static string participant_ip(int index) {
+    return "127.0.0." + to_string(index + 2);
+}
+
+static bool open_participant(BenchParticipant& participant, int index, int base_port) {
+    participant.key.resize(SRTP_MASTER_KEY_SIZE);
+    if (!random_bytes(participant.key.data(), participant.key.size()) ||
+        !derive_srtp_mki(participant.key, participant.mki) ||
+        !create_session(participant, participant.outbound, true) ||
+        !create_session(participant, participant.inbound, false)) {
+        return false;
+    }
+
+    // Sends from and receives on the video RTP port of its own address, as a
+    // client would
+    participant.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (participant.fd < 0) {
+        return false;
+    }
+    int buffer_size = SFU_SOCKET_BUFFER_SIZE;
+    setsockopt(participant.fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    struct timeval timeout = {0, BENCH_RECV_TIMEOUT_MS * 1000};
+    setsockopt(participant.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(base_port + SERVER_TO_CLIENT_PORT_OFFSET);
+    inet_pton(AF_INET, participant_ip(index).c_str(), &addr.sin_addr);
+    return ::bind(participant.fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+}
+
+static void close_participant(BenchParticipant& participant) {
+    if (participant.fd >= 0) {
+        close(participant.fd);
+    }
+    if (participant.outbound) {
+        srtp_dealloc(participant.outbound);
+    }
+    if (participant.inbound) {
+        srtp_dealloc(participant.inbound);
+    }
+}
+
+static void receive_loop(BenchParticipant& participant, const atomic<bool>& running) {
+    uint8_t packet[SFU_MAX_PACKET_SIZE];
+    while (running) {
+        ssize_t n = recv(participant.fd, packet, sizeof(packet), 0);
+        if (n <= 0) {
+            continue;
+        }
+        uint64_t arrived = now_ns();
+        int len = n;
+        if (srtp_unprotect_mki(participant.inbound, packet, &len, 1) != srtp_err_status_ok) {
+            participant.auth_failures++;
+            continue;
+        }
+        uint64_t sent;
+        if (len < BENCH_RTP_HEADER_SIZE + (int)sizeof(sent)) {
+            continue;
+        }
+        memcpy(&sent, packet + BENCH_RTP_HEADER_SIZE, sizeof(sent));
+        participant.latencies_us.push_back((uint32_t)((arrived - sent) / 1000));
+        participant.received++;
+    }
+}
+
+// Every participant sends one packet per tick, round-robin, so the SFU sees
+// N * packets_per_second in and N * (N - 1) * packets_per_second out
+static uint64_t send_loop(vector<BenchParticipant>& participants, int base_port, int packets_per_second,
+                          int seconds, int payload_size) {
+    struct sockaddr_in sfu;
+    memset(&sfu, 0, sizeof(sfu));
+    sfu.sin_family = AF_INET;
+    sfu.sin_port = htons(base_port + CLIENT_TO_SERVER_PORT_OFFSET);
+    inet_pton(AF_INET, BENCH_SFU_IP, &sfu.sin_addr);
+
+    uint8_t packet[SFU_MAX_PACKET_SIZE];
+    uint64_t sent = 0;
+    auto interval = chrono::nanoseconds(1000000000LL / packets_per_second);
+    auto next = chrono::steady_clock::now();
+    auto end = next + chrono::seconds(seconds);
+    uint32_t rtp_timestamp = 0;
+    while (next < end) {
+        this_thread::sleep_until(next);
+        next += interval;
+        rtp_timestamp += 90000 / packets_per_second;
+
+        for (size_t i = 0; i < participants.size(); i++) {
+            BenchParticipant& participant = participants[i];
+            uint32_t ssrc = htonl(BENCH_SSRC_BASE + i);
+            uint16_t seq = htons(participant.seq++);
+            uint32_t timestamp = htonl(rtp_timestamp);
+            memset(packet, 0, BENCH_RTP_HEADER_SIZE + payload_size);
+            packet[0] = 0x80;
+            packet[1] = VIDEO_PAYLOAD_TYPE;
+            memcpy(packet + 2, &seq, sizeof(seq));
+            memcpy(packet + 4, &timestamp, sizeof(timestamp));
+            memcpy(packet + 8, &ssrc, sizeof(ssrc));
+            uint64_t send_time = now_ns();
+            memcpy(packet + BENCH_RTP_HEADER_SIZE, &send_time, sizeof(send_time));
+
+            int len = BENCH_RTP_HEADER_SIZE + payload_size;
+            if (srtp_protect_mki(participant.outbound, packet, &len, 1, 0) != srtp_err_status_ok) {
+                continue;
+            }
+            if (sendto(participant.fd, packet, len, 0, (struct sockaddr*)&sfu, sizeof(sfu)) == len) {
+                sent++;
+            }
+        }
+    }
+    return sent;
+}
+
+static bool run(int participant_count, int packets_per_second, int seconds, int payload_size, int base_port,
+                RunResult& result) {
+    SfuForwarder forwarder(base_port);
+    vector<BenchParticipant> participants(participant_count);
+    bool ok = forwarder.start();
+    for (int i = 0; i < participant_count && ok; i++) {
+        ok = open_participant(participants[i], i, base_port) &&
+             forwarder.add_participant("bench" + to_string(i), participant_ip(i), participants[i].key) >= 0;
+    }
+
+    if (ok) {
+        atomic<bool> receiving(true);
+        vector<thread> receivers;
+        for (BenchParticipant& participant : participants) {
+            receivers.emplace_back(receive_loop, ref(participant), cref(receiving));
+        }
+
+        auto begin = chrono::steady_clock::now();
+        result.sent = send_loop(participants, base_port, packets_per_second, seconds, payload_size);
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        this_thread::sleep_for(chrono::milliseconds(BENCH_DRAIN_MS));
+        receiving = false;
+        for (thread& receiver : receivers) {
+            receiver.join();
+        }
+
+        result.received = 0;
+        result.auth_failures = 0;
+        result.latencies_us.clear();
+        for (BenchParticipant& participant : participants) {
+            result.received += participant.received;
+            result.auth_failures += participant.auth_failures;
+            result.latencies_us.insert(result.latencies_us.end(), participant.latencies_us.begin(),
+                                       participant.latencies_us.end());
+        }
+        result.sfu = forwarder.stats();
+    }
+
+    forwarder.stop();
+    for (BenchParticipant& participant : participants) {
+        close_participant(participant);
+    }
+    return ok;
+}
+
+static double percentile(vector<uint32_t>& values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = min(values.size() - 1, (size_t)(p * values.size()));
+    nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, char *argv[]) {
+    vector<int> counts;
+    stringstream list(argc > 1 ? argv[1] : "2,4,8,16");
+    string item;
+    while (getline(list, item, ',')) {
+        counts.push_back(atoi(item.c_str()));
+    }
+    int packets_per_second = argc > 2 ? atoi(argv[2]) : 500;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    int payload_size = argc > 4 ? atoi(argv[4]) : 1100;
+    int base_port = argc > 5 ? atoi(argv[5]) : 5400;
+
+    bool valid = !counts.empty() && packets_per_second > 0 && packets_per_second <= 90000 && seconds > 0 &&
+                 payload_size >= 8 && payload_size <= SFU_MAX_PACKET_SIZE - 100 && base_port > 0;
+    for (int count : counts) {
+        valid = valid && count >= 2 && count <= 250;
+    }
+    if (!valid) {
+        cout << "Usage: " << argv[0]
+             << " [participant counts, e.g. 2,4,8,16] [packets/s per participant] [seconds] [payload bytes]"
+             << " [base_port]" << endl;
+        return -1;
+    }
+
+    printf("%d packets/s of %d bytes per participant, %d s per run\n", packets_per_second, payload_size, seconds);
+    printf("%-12s %12s %12s %8s %10s %10s %14s\n", "participants", "in (pkt/s)", "out (pkt/s)", "loss",
+           "p50 (us)", "p99 (us)", "SFU CPU (us)");
+    printf("%-12s %12s %12s %8s %10s %10s %14s\n", "", "", "", "", "", "", "per packet out");
+
+    bool failed = false;
+    for (int count : counts) {
+        RunResult result;
+        if (!run(count, packets_per_second, seconds, payload_size, base_port, result)) {
+            fprintf(stderr, "Cannot set up %d participants (addresses 127.0.0.2 and up, ports %d+)\n", count,
+                    base_port);
+            return 1;
+        }
+        uint64_t expected = result.sent * (count - 1);
+        double loss = expected ? 100.0 * (expected - min(expected, result.received)) / expected : 0;
+        double cpu_per_packet = result.sfu.forwarded ? result.sfu.cpu_ns / 1000.0 / result.sfu.forwarded : 0;
+        printf("%-12d %12.0f %12.0f %7.2f%% %10.0f %10.0f %14.2f\n", count, result.sfu.received / result.seconds,
+               result.sfu.forwarded / result.seconds, loss, percentile(result.latencies_us, 0.50),
+               percentile(result.latencies_us, 0.99), cpu_per_packet);
+        if (result.auth_failures || result.sfu.auth_failures || result.sfu.unknown_key) {
+            fprintf(stderr, "%d participants: %llu packets failed authentication at the receivers, %llu at the "
+                    "SFU, %llu with an unknown key\n", count, (unsigned long long)result.auth_failures,
+                    (unsigned long long)result.sfu.auth_failures, (unsigned long long)result.sfu.unknown_key);
+            failed = true;
+        }
+    }
+
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,348 @@
+#include "srtp_rekey.h"
+#include "crypto_utils.h"
+#include <iostream>
+#include <cstring>
+#include <chrono>
+
+using namespace std;
+
+static GstBuffer* make_buffer(const uint8_t* data, size_t len) {
+    GstBuffer *buf = gst_buffer_new_allocate(NULL, len, NULL);
+    gst_buffer_fill(buf, 0, data, len);
+    return buf;
+}
+
+bool derive_srtp_mki(const vector<uint8_t>& key, uint32_t& mki) {
+    uint8_t out[SRTP_MKI_SIZE];
+    if (!hkdf_sha256(key.data(), key.size(), NULL, 0, "QSVC SRTP MKI", out, sizeof(out))) {
+        return false;
+    }
+    memcpy(&mki, out, sizeof(mki));
+    return true;
+}
+
+SrtpKeyRing::SrtpKeyRing(GstElement *pipeline, const vector<string>& encoder_names,
+                         const vector<string>& decoder_names)
+    : pipeline(pipeline), encoder_names(encoder_names), decoder_names(decoder_names),
+      peer_mki(0), sending_mki(0), pending_mki(0), switch_pending(false), rekey_count(0),
+      switch_count(0) {
+    for (const string& name : decoder_names) {
+        GstElement *dec = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+        if (!dec) {
+            continue;
+        }
+        g_signal_connect(dec, "request-key", G_CALLBACK(on_request_key), this);
+
+        // Both sink pads: the MKI sits just before the auth tag in SRTP and
+        // SRTCP alike
+        for (const char* pad_name : {"rtp_sink", "rtcp_sink"}) {
+            GstPad *pad = gst_element_get_static_pad(dec, pad_name);
+            if (pad) {
+                gulong id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_decoder_packet, this, NULL);
+                probes.push_back(make_pair(pad, id));
+            }
+        }
+        gst_object_unref(dec);
+    }
+}
+
+SrtpKeyRing::~SrtpKeyRing() {
+    for (auto& probe : probes) {
+        gst_pad_remove_probe(probe.first, probe.second);
+        gst_object_unref(probe.first);
+    }
+}
+
+void SrtpKeyRing::set_placeholder_key() {
+    MasterKey placeholder;
+    placeholder.key.resize(SRTP_MASTER_KEY_SIZE);
+    random_bytes(placeholder.key.data(), placeholder.key.size());
+    placeholder.mki = 0;
+    set_encoder_key(placeholder);
+}
+
+void SrtpKeyRing::start(const vector<uint8_t>& key) {
+    MasterKey first;
+    first.key = key;
+    if (!derive_srtp_mki(key, first.mki)) {
+        cerr << "Could not derive SRTP MKI" << endl;
+        return;
+    }
+    {
+        lock_guard<mutex> lock(ring_mutex);
+        keys.assign(1, first);
+    }
+    set_encoder_key(first);
+}
+
+void SrtpKeyRing::add_key(const vector<uint8_t>& key) {
+    MasterKey next;
+    next.key = key;
+    if (!derive_srtp_mki(key, next.mki)) {
+        cerr << "Could not derive SRTP MKI" << endl;
+        return;
+    }
+    {
+        lock_guard<mutex> lock(ring_mutex);
+        keys.push_front(next);
+
+        // Oldest keys go first, but the peer may not have switched yet
+        uint32_t peer = peer_mki;
+        for (size_t i = keys.size(); i-- > 1 && keys.size() > SRTP_KEY_RING_SIZE;) {
+            if (keys[i].mki != peer && keys[i].mki != sending_mki) {
+                keys.erase(keys.begin() + i);
+            }
+        }
+    }
+    rekey_count++;
+
+    // Decoders only ask for keys when they meet an unknown SSRC, so drop
+    // their streams; the next packet of each fetches the new ring in the
+    // streaming thread and no packet goes undecrypted
+    refresh_decoders();
+}
+
+void SrtpKeyRing::switch_encoders() {
+    MasterKey newest;
+    {
+        lock_guard<mutex> lock(ring_mutex);
+        if (keys.empty()) {
+            return;
+        }
+        newest = keys.front();
+    }
+    switch_pending = false;
+    if (newest.mki != sending_mki) {
+        set_encoder_key(newest);
+        switch_count++;
+    }
+}
+
+void SrtpKeyRing::switch_encoders_when_peer_does() {
+    {
+        lock_guard<mutex> lock(ring_mutex);
+        if (keys.empty() || keys.front().mki == sending_mki) {
+            return;
+        }
+        pending_mki = keys.front().mki;
+        switch_pending = true;
+    }
+
+    // The peer may have switched before this side got here
+    if (peer_mki == pending_mki && switch_pending.exchange(false)) {
+        switch_encoders();
+    }
+}
+
+void SrtpKeyRing::set_encoder_key(const MasterKey& key) {
+    for (const string& name : encoder_names) {
+        GstElement *enc = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+        if (enc) {
+            GstBuffer *key_buf = make_buffer(key.key.data(), key.key.size());
+            GstBuffer *mki_buf = make_buffer((const uint8_t*)&key.mki, SRTP_MKI_SIZE);
+            g_object_set(enc, "key", key_buf, "mki", mki_buf, NULL);
+            gst_buffer_unref(key_buf);
+            gst_buffer_unref(mki_buf);
+            gst_object_unref(enc);
+        }
+    }
+    sending_mki = key.mki;
+}
+
+void SrtpKeyRing::refresh_decoders() {
+    for (const string& name : decoder_names) {
+        GstElement *dec = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+        if (!dec) {
+            continue;
+        }
+
+        // A new stream would restart the rollover counter at 0 and fail to
+        // authenticate once the sequence number has wrapped
+        GstStructure *stats = NULL;
+        g_object_get(dec, "stats", &stats, NULL);
+        if (stats) {
+            const GValue *streams = gst_structure_get_value(stats, "streams");
+            if (streams && GST_VALUE_HOLDS_ARRAY(streams)) {
+                lock_guard<mutex> lock(ring_mutex);
+                for (guint i = 0; i < gst_value_array_get_size(streams); i++) {
+                    const GstStructure *stream = gst_value_get_structure(gst_value_array_get_value(streams, i));
+                    guint ssrc, roc;
+                    if (gst_structure_get_uint(stream, "ssrc", &ssrc) &&
+                        gst_structure_get_uint(stream, "roc", &roc)) {
+                        rollover_counters[name][ssrc] = roc;
+                    }
+                }
+            }
+            gst_structure_free(stats);
+        }
+
+        // Not under ring_mutex: the streaming thread may be inside
+        // request-key, which takes it
+        g_signal_emit_by_name(dec, "clear-keys");
+        gst_object_unref(dec);
+    }
+}
+
+GstCaps* SrtpKeyRing::decoder_caps(GstElement *srtpdec, guint ssrc) {
+    GstCaps *caps = gst_caps_new_simple("application/x-srtp",
+        "srtp-cipher", G_TYPE_STRING, "aes-256-icm",
+        "srtcp-cipher", G_TYPE_STRING, "aes-256-icm",
+        "srtp-auth", G_TYPE_STRING, "hmac-sha1-80",
+        "srtcp-auth", G_TYPE_STRING, "hmac-sha1-80",
+        NULL);
+    GstStructure *s = gst_caps_get_structure(caps, 0);
+
+    lock_guard<mutex> lock(ring_mutex);
+    // srtp-key/mki, srtp-key2/mki2, ...; srtpdec picks the key by the MKI of
+    // each packet
+    for (size_t i = 0; i < keys.size(); i++) {
+        string suffix = i == 0 ? "" : to_string(i + 1);
+        GstBuffer *key_buf = make_buffer(keys[i].key.data(), keys[i].key.size());
+        GstBuffer *mki_buf = make_buffer((const uint8_t*)&keys[i].mki, SRTP_MKI_SIZE);
+        gst_structure_set(s, ("srtp-key" + suffix).c_str(), GST_TYPE_BUFFER, key_buf,
+                          ("mki" + suffix).c_str(), GST_TYPE_BUFFER, mki_buf, NULL);
+        gst_buffer_unref(key_buf);
+        gst_buffer_unref(mki_buf);
+    }
+
+    auto decoder = rollover_counters.find(GST_ELEMENT_NAME(srtpdec));
+    if (decoder != rollover_counters.end()) {
+        auto stream = decoder->second.find(ssrc);
+        if (stream != decoder->second.end()) {
+            gst_structure_set(s, "roc", G_TYPE_UINT, stream->second, NULL);
+        }
+    }
+    return caps;
+}
+
+GstCaps* SrtpKeyRing::on_request_key(GstElement *srtpdec, guint ssrc, gpointer user_data) {
+    cout << "Key requested for SSRC: " << ssrc << endl;
+    return ((SrtpKeyRing*)user_data)->decoder_caps(srtpdec, ssrc);
+}
+
+GstPadProbeReturn SrtpKeyRing::on_decoder_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    SrtpKeyRing *ring = (SrtpKeyRing*)user_data;
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    gsize size = gst_buffer_get_size(buf);
+    if (size < 12 + SRTP_MKI_SIZE + SRTP_AUTH_TAG_SIZE) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    uint32_t mki;
+    gst_buffer_extract(buf, size - SRTP_AUTH_TAG_SIZE - SRTP_MKI_SIZE, &mki, sizeof(mki));
+    if (mki == ring->peer_mki) {
+        return GST_PAD_PROBE_OK;
+    }
+    ring->peer_mki = mki;
+
+    // The peer encrypts with the newest key, so it surely decrypts with it
+    if (mki == ring->pending_mki && ring->switch_pending.exchange(false)) {
+        ring->switch_encoders();
+        cout << "SRTP: Switched to the new key after the peer did" << endl;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+ClientRekeyer::ClientRekeyer(SrtpKeyRing& ring, const string& server_ip, int port, const string& username,
+                             const PqSuiteInfo& suite, int interval_seconds)
+    : ring(ring), server_ip(server_ip), port(port), username(username), suite(suite),
+      interval_seconds(interval_seconds), stopping(false) {}
+
+ClientRekeyer::~ClientRekeyer() {
+    stop();
+}
+
+bool ClientRekeyer::start() {
+    if (interval_seconds <= 0) {
+        return true;
+    }
+    if (!load_or_generate_dilithium_keys(identity, suite)) {
+        cerr << "CLIENT: Cannot load Dilithium keys, in-call rekeying disabled" << endl;
+        return false;
+    }
+    rekey_thread = thread(&ClientRekeyer::run, this);
+    return true;
+}
+
+void ClientRekeyer::stop() {
+    {
+        lock_guard<mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    if (rekey_thread.joinable()) {
+        rekey_thread.join();
+    }
+}
+
+void ClientRekeyer::run() {
+    unique_lock<mutex> lock(stop_mutex);
+    while (!stop_cv.wait_for(lock, chrono::seconds(interval_seconds), [this] { return stopping; })) {
+        lock.unlock();
+
+        // A fresh ML-KEM key every time, so each SRTP key has its own
+        // forward secrecy; session resumption would not give that
+        vector<uint8_t> key;
+        if (client_perform_key_exchange_with_keys(server_ip.c_str(), port, username, identity,
+                                                  HANDSHAKE_MODE_1RTT, key, suite)) {
+            ring.add_key(key);
+            ring.switch_encoders_when_peer_does();
+            cout << "CLIENT: Rekeyed (" << ring.rekeys() << " so far)" << endl;
+        } else {
+            cerr << "CLIENT: In-call rekey failed, keeping the current key" << endl;
+        }
+
+        lock.lock();
+    }
+}
+
+ServerRekeyer::ServerRekeyer(SrtpKeyRing& ring, int port, const string& username, const string& peer_ip)
+    : ring(ring), port(port), username(username), peer_ip(peer_ip), running(false) {}
+
+ServerRekeyer::~ServerRekeyer() {
+    stop();
+}
+
+bool ServerRekeyer::start() {
+    server.reset(new HandshakeServer(port, 1));
+    if (!server->start()) {
+        server.reset();
+        return false;
+    }
+    running = true;
+    rekey_thread = thread(&ServerRekeyer::run, this);
+    return true;
+}
+
+void ServerRekeyer::stop() {
+    running = false;
+    if (rekey_thread.joinable()) {
+        rekey_thread.join();
+    }
+    if (server) {
+        server->stop();
+        server.reset();
+    }
+}
+
+void ServerRekeyer::run() {
+    CompletedHandshake done;
+    while (running) {
+        if (!server->wait_for_handshake(done, 200)) {
+            continue;
+        }
+
+        if (done.username != username || done.peer_ip != peer_ip) {
+            cout << "SERVER: Ignoring key exchange from " << done.username << " (" << done.peer_ip
+                 << ") during the call" << endl;
+            continue;
+        }
+
+        // The client derived this key before sending its final tag, but may
+        // not have handed it to its decoders yet
+        ring.add_key(done.srtp_key);
+        this_thread::sleep_for(chrono::milliseconds(REKEY_SWITCH_DELAY_MS));
+        ring.switch_encoders();
+        cout << "SERVER: Rekeyed (" << ring.rekeys() << " so far)" << endl;
+    }
+}
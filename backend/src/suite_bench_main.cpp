@@ -0,0 +1,135 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <array>
+#include "auth_protocol.h"
+#include "pq_suite.h"
+
+using namespace std;
+
+// Per-suite cost of the 1-RTT handshake crypto and the bytes it puts on the
+// wire. The timed loops call the traits directly on fixed-size arrays, so
+// they measure the crypto alone, without the handshake's vectors or dispatch.
+
+#define BENCH_USERNAME_LENGTH 8
+#define FINISHED_TAG_SIZE 64
+
+static double elapsed_us(chrono::steady_clock::time_point begin, int iterations) {
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count() / iterations;
+}
+
+template <class Kem, class Sig>
+static bool bench_suite(int iterations) {
+    using Suite = PqSuite<Kem, Sig>;
+
+    array<uint8_t, Sig::public_key_bytes> identity_pk;
+    array<uint8_t, Sig::secret_key_bytes> identity_sk;
+    array<uint8_t, Kem::public_key_bytes> kem_pk;
+    array<uint8_t, Kem::secret_key_bytes> kem_sk;
+    array<uint8_t, Sig::signature_bytes> signature;
+    array<uint8_t, Kem::ciphertext_bytes> ciphertext;
+    array<uint8_t, PQ_SHARED_SECRET_SIZE> server_ss, client_ss;
+
+    if (!Suite::generate_identity(identity_pk.data(), identity_sk.data())) {
+        return false;
+    }
+
+    // Client: ephemeral keypair + signature (what the key pool precomputes)
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (!Suite::generate_signed_key(identity_sk.data(), kem_pk.data(), kem_sk.data(), signature.data())) {
+            return false;
+        }
+    }
+    double client_keygen = elapsed_us(begin, iterations);
+
+    // Server: verify the signed key and encapsulate
+    begin = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (!Suite::verify_signed_key(kem_pk.data(), signature.data(), identity_pk.data()) ||
+            !Suite::encapsulate(kem_pk.data(), ciphertext.data(), server_ss.data())) {
+            return false;
+        }
+    }
+    double server_verify_encaps = elapsed_us(begin, iterations);
+
+    // Client: decapsulate the server's flight
+    begin = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (!Suite::decapsulate(ciphertext.data(), kem_sk.data(), client_ss.data())) {
+            return false;
+        }
+    }
+    double client_decaps = elapsed_us(begin, iterations);
+
+    if (server_ss != client_ss) {
+        fprintf(stderr, "%s-%s: shared secrets differ\n", Kem::token, Sig::token);
+        return false;
+    }
+
+    // HELLO_1RTT: suite id, name length, username, KEM key, signature
+    size_t hello_bytes = HANDSHAKE_HEADER_SIZE + 3 + BENCH_USERNAME_LENGTH + Kem::public_key_bytes +
+                         Sig::signature_bytes;
+    size_t flight_bytes = HANDSHAKE_HEADER_SIZE + Kem::ciphertext_bytes + FINISHED_TAG_SIZE;
+
+    printf("%-20s %12.1f %14.1f %12.1f %10zu %10zu %10zu\n",
+           (string(Kem::token) + "-" + Sig::token).c_str(),
+           client_keygen, server_verify_encaps, client_decaps,
+           hello_bytes, flight_bytes, (size_t)Sig::public_key_bytes);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+    if (iterations <= 0) {
+        cout << "Usage: " << argv[0] << " [iterations]" << endl;
+        return -1;
+    }
+
+    printf("%-20s %12s %14s %12s %10s %10s %10s\n", "suite", "keygen+sign", "verify+encaps",
+           "decaps", "hello", "flight", "enroll");
+    printf("%-20s %12s %14s %12s %10s %10s %10s\n", "", "(us)", "(us)", "(us)", "(bytes)",
+           "(bytes)", "(bytes)");
+
+    // Same pairs, in the same order, as the suite table in pq_suite.cpp
+    bool ok = true;
+#ifdef OQS_ENABLE_KEM_kyber_768
+    ok = ok && bench_suite<Kyber768, MlDsa65>(iterations);
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_512
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+    ok = ok && bench_suite<MlKem512, MlDsa44>(iterations);
+#endif
+    ok = ok && bench_suite<MlKem512, MlDsa65>(iterations);
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+    ok = ok && bench_suite<MlKem512, MlDsa87>(iterations);
+#endif
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_768
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+    ok = ok && bench_suite<MlKem768, MlDsa44>(iterations);
+#endif
+    ok = ok && bench_suite<MlKem768, MlDsa65>(iterations);
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+    ok = ok && bench_suite<MlKem768, MlDsa87>(iterations);
+#endif
+#endif
+#ifdef OQS_ENABLE_KEM_ml_kem_1024
+#ifdef OQS_ENABLE_SIG_ml_dsa_44
+    ok = ok && bench_suite<MlKem1024, MlDsa44>(iterations);
+#endif
+    ok = ok && bench_suite<MlKem1024, MlDsa65>(iterations);
+#ifdef OQS_ENABLE_SIG_ml_dsa_87
+    ok = ok && bench_suite<MlKem1024, MlDsa87>(iterations);
+#endif
+#endif
+
+    if (!ok) {
+        fprintf(stderr, "Benchmark failed\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+#include <gst/gst.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "batched_udp.h"
+
+using namespace std;
+
+// Packets per second through the pipeline's UDP stages on loopback: stock
+// udpsrc/udpsink against the batched appsrc/appsink stages of --udp-io=batched.
+// An appsrc pushes buffer lists of equal-size packets, as a payloader does,
+// as fast as the sink takes them; the receiving pipeline counts what reaches
+// its fakesink. CPU is that of the whole process (generator, both pipelines)
+// per packet received. Exits non-zero if a mode delivers nothing or delivers
+// packets of the wrong size.
+
+#define BENCH_IP "127.0.0.1"
+#define BENCH_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+#define BENCH_CAPS "application/x-rtp"
+// Queued in the sending appsrc before the generator blocks
+#define BENCH_QUEUE_BYTES (1024 * 1024)
+#define BENCH_DRAIN_MS 300
+
+struct Counter {
+    atomic<uint64_t> packets{0};
+    atomic<uint64_t> wrong_size{0};
+    gsize payload_size = 0;
+};
+
+struct RunResult {
+    uint64_t sent;
+    uint64_t received;
+    uint64_t wrong_size;
+    double seconds;
+    double cpu_seconds;
+    // 0 when the mode does not count its system calls
+    uint64_t send_syscalls;
+    uint64_t receive_syscalls;
+};
+
+static double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void count_buffer(GstBuffer *buffer, Counter *counter) {
+    counter->packets++;
+    if (gst_buffer_get_size(buffer) != counter->payload_size) {
+        counter->wrong_size++;
+    }
+}
+
+static GstPadProbeReturn on_received(GstPad*, GstPadProbeInfo *info, gpointer user_data) {
+    Counter *counter = (Counter*)user_data;
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); i++) {
+            count_buffer(gst_buffer_list_get(list, i), counter);
+        }
+    } else {
+        count_buffer(GST_PAD_PROBE_INFO_BUFFER(info), counter);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstElement* make(GstElement *pipeline, const char* factory) {
+    GstElement *element = gst_element_factory_make(factory, NULL);
+    if (!element) {
+        cerr << "Missing GStreamer element: " << factory << endl;
+        return NULL;
+    }
+    gst_bin_add(GST_BIN(pipeline), element);
+    return element;
+}
+
+static bool run(bool batched, bool offload, int seconds, int payload_size, int batch, int port, RunResult& result) {
+    GstElement *receive_pipeline = gst_pipeline_new("receive");
+    GstElement *send_pipeline = gst_pipeline_new("send");
+    GstElement *source = make(receive_pipeline, batched ? "appsrc" : "udpsrc");
+    GstElement *fakesink = make(receive_pipeline, "fakesink");
+    GstElement *generator = make(send_pipeline, "appsrc");
+    GstElement *sink = make(send_pipeline, batched ? "appsink" : "udpsink");
+    BatchedUdpReceiver *receiver = NULL;
+    BatchedUdpSender *sender = NULL;
+    bool ok = source && fakesink && generator && sink && gst_element_link(source, fakesink) &&
+              gst_element_link(generator, sink);
+
+    if (ok && batched) {
+        int receive_fd = open_udp_socket(port, BENCH_SOCKET_BUFFER_SIZE);
+        int send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        ok = receive_fd >= 0 && send_fd >= 0;
+        if (ok) {
+            receiver = new BatchedUdpReceiver(receive_fd, source, BENCH_CAPS, offload);
+            sender = new BatchedUdpSender(send_fd, true, BENCH_IP, port, offload);
+            sender->attach(sink);
+        } else {
+            if (receive_fd >= 0) {
+                close(receive_fd);
+            }
+            if (send_fd >= 0) {
+                close(send_fd);
+            }
+        }
+    } else if (ok) {
+        gst_util_set_object_arg(G_OBJECT(source), "port", to_string(port).c_str());
+        gst_util_set_object_arg(G_OBJECT(source), "buffer-size", to_string(BENCH_SOCKET_BUFFER_SIZE).c_str());
+        gst_util_set_object_arg(G_OBJECT(source), "caps", BENCH_CAPS);
+        gst_util_set_object_arg(G_OBJECT(sink), "host", BENCH_IP);
+        gst_util_set_object_arg(G_OBJECT(sink), "port", to_string(port).c_str());
+        g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+    }
+    if (ok) {
+        g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+        // Blocks the generator when the sink falls behind, instead of queueing
+        g_object_set(generator, "block", TRUE, "max-bytes", (guint64)BENCH_QUEUE_BYTES, NULL);
+        gst_util_set_object_arg(G_OBJECT(generator), "caps", BENCH_CAPS);
+    }
+
+    Counter counter;
+    counter.payload_size = payload_size;
+    if (ok) {
+        GstPad *pad = gst_element_get_static_pad(fakesink, "sink");
+        gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                          on_received, &counter, NULL);
+        gst_object_unref(pad);
+        ok = gst_element_set_state(receive_pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE &&
+             gst_element_set_state(send_pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE &&
+             (!receiver || receiver->start());
+    }
+
+    if (ok) {
+        vector<uint8_t> payload(payload_size, 0x5A);
+        uint64_t sent = 0;
+        double cpu_start = cpu_seconds();
+        auto start = chrono::steady_clock::now();
+        auto deadline = start + chrono::seconds(seconds);
+        while (chrono::steady_clock::now() < deadline) {
+            GstBufferList *list = gst_buffer_list_new_sized(batch);
+            for (int i = 0; i < batch; i++) {
+                GstBuffer *buffer = gst_buffer_new_allocate(NULL, payload_size, NULL);
+                gst_buffer_fill(buffer, 0, payload.data(), payload.size());
+                gst_buffer_list_add(list, buffer);
+            }
+            GstFlowReturn ret = GST_FLOW_ERROR;
+            g_signal_emit_by_name(generator, "push-buffer-list", list, &ret);
+            gst_buffer_list_unref(list);
+            if (ret != GST_FLOW_OK) {
+                break;
+            }
+            sent += batch;
+        }
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        this_thread::sleep_for(chrono::milliseconds(BENCH_DRAIN_MS));
+        result.cpu_seconds = cpu_seconds() - cpu_start;
+        result.sent = sent;
+        result.received = counter.packets;
+        result.wrong_size = counter.wrong_size;
+        result.send_syscalls = sender ? sender->stats().syscalls : 0;
+        result.receive_syscalls = receiver ? receiver->stats().syscalls : 0;
+    }
+
+    gst_element_set_state(send_pipeline, GST_STATE_NULL);
+    gst_element_set_state(receive_pipeline, GST_STATE_NULL);
+    delete receiver;
+    delete sender;
+    gst_object_unref(send_pipeline);
+    gst_object_unref(receive_pipeline);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    int payload_size = argc > 2 ? atoi(argv[2]) : 1200;
+    int batch = argc > 3 ? atoi(argv[3]) : UDP_BATCH_SIZE;
+    int port = argc > 4 ? atoi(argv[4]) : 5600;
+    string offload = argc > 5 ? argv[5] : "off";
+    if (seconds <= 0 || payload_size < 12 || payload_size > UDP_MAX_DATAGRAM || batch <= 0 || batch > 1024 ||
+        port <= 0 || port > 65535 || (offload != "on" && offload != "off")) {
+        cout << "Usage: " << argv[0] << " [seconds] [payload bytes] [packets per list] [port] [GSO/GRO on|off]"
+             << endl;
+        return -1;
+    }
+
+    printf("%d-byte packets in lists of %d, %d s per run, GSO/GRO %s for batched\n", payload_size, batch, seconds,
+           offload.c_str());
+    printf("%-8s %12s %12s %8s %12s %12s %12s\n", "mode", "sent (pkt/s)", "recv (pkt/s)", "loss", "CPU (us)",
+           "send calls", "recv calls");
+    printf("%-8s %12s %12s %8s %12s %12s %12s\n", "", "", "", "", "per packet", "per packet", "per packet");
+
+    bool failed = false;
+    for (bool batched : {false, true}) {
+        RunResult result;
+        const char* mode = batched ? "batched" : "stock";
+        if (!run(batched, offload == "on", seconds, payload_size, batch, port, result)) {
+            fprintf(stderr, "Cannot run %s UDP I/O on port %d\n", mode, port);
+            return 1;
+        }
+        double loss = result.sent ? 100.0 * (result.sent - min(result.sent, result.received)) / result.sent : 0;
+        double cpu_per_packet = result.received ? result.cpu_seconds * 1e6 / result.received : 0;
+        // udpsink sends a list with one sendmmsg(); udpsrc reads one datagram
+        // per recvmsg(). Neither is counted, so only batched has numbers.
+        string send_calls = "-", receive_calls = "-";
+        if (batched) {
+            char text[32];
+            snprintf(text, sizeof(text), "%.3f", result.sent ? (double)result.send_syscalls / result.sent : 0);
+            send_calls = text;
+            snprintf(text, sizeof(text), "%.3f",
+                     result.received ? (double)result.receive_syscalls / result.received : 0);
+            receive_calls = text;
+        }
+        printf("%-8s %12.0f %12.0f %7.2f%% %12.2f %12s %12s\n", mode, result.sent / result.seconds,
+               result.received / result.seconds, loss, cpu_per_packet, send_calls.c_str(), receive_calls.c_str());
+        if (result.received == 0 || result.wrong_size) {
+            fprintf(stderr, "%s: %llu packets received, %llu of the wrong size\n", mode,
+                    (unsigned long long)result.received, (unsigned long long)result.wrong_size);
+            failed = true;
+        }
+    }
+
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -8,10 +8,19 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += \
     main.cpp \
-    launchwindow.cpp
+    launchwindow.cpp \
+    videowidget.cpp
 
 HEADERS += \
-    launchwindow.h
+    launchwindow.h \
+    videowidget.h
+
+# Calls run in-process, from the backend built as a library (make libbackend.a)
+INCLUDEPATH += $$PWD/../backend/include
+LIBS += $$PWD/../backend/libbackend.a -loqs -lssl -lcrypto -lsrtp2
+PRE_TARGETDEPS += $$PWD/../backend/libbackend.a
+CONFIG += link_pkgconfig
+PKGCONFIG += gstreamer-1.0 gstreamer-video-1.0 gstreamer-codecparsers-1.0 gio-2.0 glib-2.0
 
 # Default rules for deployment
 qnx: target.path = /tmp/$${TARGET}/bin
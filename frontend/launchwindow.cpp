@@ -4,25 +4,42 @@
 #include <QMessageBox>
 #include <QNetworkInterface>
 #include <QRegularExpression>
-#include <QProcess>
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonArray>
 
 LaunchWindow::LaunchWindow(QWidget *parent)
-    : QMainWindow(parent)
+    : QMainWindow(parent),
+      callThread(nullptr)
 {
     setWindowTitle("Secure Video Conference");
     setFixedSize(550, 800);
     // setMinimumSize(500, 700);
     // setMaximumSize(500, 800);
 
-    backendProcess = new QProcess(this);
+    // One socket per frontend instance, so two windows on one machine can
+    // each run a backend
+    statsPath = QDir::temp().filePath(
+        QString("quantum-call-stats-%1.sock").arg(QCoreApplication::applicationPid()));
+    statsSocket = new QLocalSocket(this);
+    statsConnectTimer = new QTimer(this);
+    statsConnectTimer->setInterval(200);
+    connect(statsConnectTimer, &QTimer::timeout, this, &LaunchWindow::onStatsConnectTimer);
+    connect(statsSocket, &QLocalSocket::readyRead, this, &LaunchWindow::onStatsReadyRead);
 
     setupUI();
 }
 
 LaunchWindow::~LaunchWindow()
 {
+    // The call's callbacks point into this window
+    if (session) {
+        session->stop();
+        callThread->wait();
+        delete callThread;
+    }
 }
 
 void LaunchWindow::setupUI()
@@ -58,7 +75,7 @@ void LaunchWindow::setupUI()
     mainLayout->addWidget(subtitleLabel);
 
     // ========== MODE SELECTION CARD ==========
-    QGroupBox *modeGroup = new QGroupBox("Connection Mode", this);
+    modeGroup = new QGroupBox("Connection Mode", this);
     modeGroup->setStyleSheet(
         "QGroupBox {"
         "    font-weight: bold; "
@@ -116,7 +133,7 @@ void LaunchWindow::setupUI()
     mainLayout->addWidget(modeGroup);
 
     // ========== NETWORK CONFIGURATION CARD ==========
-    QGroupBox *networkGroup = new QGroupBox("Network Configuration", this);
+    networkGroup = new QGroupBox("Network Configuration", this);
     networkGroup->setStyleSheet(
         "QGroupBox {"
         "    font-weight: bold; "
@@ -296,6 +313,11 @@ void LaunchWindow::setupUI()
 
     mainLayout->addWidget(networkGroup);
 
+    // ========== VIDEO (during a call) ==========
+    videoWidget = new VideoWidget(this);
+    videoWidget->setVisible(false);
+    mainLayout->addWidget(videoWidget, 1);
+
     // ========== STATUS BAR ==========
     QHBoxLayout *bottomLayout = new QHBoxLayout();
     bottomLayout->setSpacing(15);
@@ -366,6 +388,14 @@ void LaunchWindow::onRefreshIpClicked()
 
 void LaunchWindow::onConnectClicked()
 {
+    // During a call the button hangs up; the call's thread then finishes
+    if (session) {
+        updateStatusMessage("Hanging up...", "info");
+        connectBtn->setEnabled(false);
+        session->stop();
+        return;
+    }
+
     QString peerIp = peerIpEdit->text().trimmed();
     QString username = usernameEdit->text().trimmed();
     bool isServer = serverRadio->isChecked();
@@ -397,52 +427,53 @@ void LaunchWindow::onConnectClicked()
         }
     }
 
-    // Stop any existing backend process
-    if (backendProcess->state() != QProcess::NotRunning) {
-        backendProcess->kill();
-        backendProcess->waitForFinished();
-    }
-
-    // Connect backend signals
-    connect(backendProcess, &QProcess::started, this, &LaunchWindow::onBackendStarted);
-    connect(backendProcess, &QProcess::readyReadStandardOutput, this, &LaunchWindow::onBackendOutput);
-    connect(backendProcess, &QProcess::readyReadStandardError, this, &LaunchWindow::onBackendError);
-    connect(backendProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
-            this, &LaunchWindow::onBackendFinished);
-
-    // Build path to backend executable
-    QString backendPath = QCoreApplication::applicationDirPath() + "/../../../backend/";
-    QString executable;
-    QStringList arguments;
-
-    if (isServer) {
-        executable = backendPath + "server";
-        arguments << peerIp;  // server takes peer IP as argument
+    CallConfig config;
+    config.role = isServer ? MEDIA_ROLE_SERVER : MEDIA_ROLE_CLIENT;
+    config.peer_ip = peerIp.toStdString();
+    config.username = username.toStdString();
+    // Video comes to videoWidget; call state and statistics come back over
+    // the stats socket
+    config.profile.sink = "app";
+    config.profile.stats_socket = statsPath.toStdString();
+
+    session.reset(new CallSession(config));
+    VideoWidget *widget = videoWidget;
+    session->set_video_callback([widget](const std::shared_ptr<VideoFrame> &frame) {
+        // A 1:1 call has one video stream
+        if (frame->stream() == 0) {
+            widget->presentFrame(frame);
+        }
+    });
+
+    CallSession *call = session.get();
+    callThread = QThread::create([this, call] {
+        int result = call->run();
+        QMetaObject::invokeMethod(this, [this, result] { onCallFinished(result); }, Qt::QueuedConnection);
+    });
+
+    updateStatusMessage(isServer ? "Starting server..." : "Connecting to server...", "info");
+    connectBtn->setText("Hang Up");
+    showCallView(true);
+
+    callState.clear();
+    statsSocket->abort();
+    callThread->start();
+    statsConnectTimer->start();
+}
 
-        updateStatusMessage("Starting server...", "info");
+void LaunchWindow::showCallView(bool inCall)
+{
+    modeGroup->setVisible(!inCall);
+    networkGroup->setVisible(!inCall);
+    videoWidget->setVisible(inCall);
+    if (inCall) {
+        // The video may be resized, even to full screen
+        setMinimumSize(550, 500);
+        setMaximumSize(QWIDGETSIZE_MAX, QWIDGETSIZE_MAX);
+        resize(960, 720);
     } else {
-        executable = backendPath + "client";
-        arguments << peerIp << username;  // client takes IP and username
-
-        updateStatusMessage("Connecting to server...", "info");
-    }
-
-    // Disable connect button while connecting
-    connectBtn->setEnabled(false);
-    connectBtn->setText("Connecting...");
-
-    // Launch backend
-    backendProcess->start(executable, arguments);
-
-    if (!backendProcess->waitForStarted(3000)) {
-        updateStatusMessage("Failed to start backend", "error");
-        QMessageBox::critical(this, "Backend Error",
-                              "Could not start backend process.\n\n"
-                              "Executable: " + executable + "\n"
-                                                 "Make sure backend is compiled:\n"
-                                                 "cd backend && make");
-        connectBtn->setEnabled(true);
-        connectBtn->setText("Connect");
+        videoWidget->clear();
+        setFixedSize(550, 800);
     }
 }
 
@@ -566,61 +597,100 @@ bool LaunchWindow::validateIP(const QString &ip)
     return ipRegex.match(ip).hasMatch();
 }
 
-void LaunchWindow::onBackendStarted()
+void LaunchWindow::onStatsConnectTimer()
 {
-    qDebug() << "Backend process started successfully";
-    updateStatusMessage("Backend started, authenticating...", "info");
+    // The backend creates the socket once its pipeline is built
+    if (statsSocket->state() == QLocalSocket::ConnectedState) {
+        statsConnectTimer->stop();
+        return;
+    }
+    if (statsSocket->state() == QLocalSocket::UnconnectedState) {
+        statsSocket->connectToServer(statsPath, QIODevice::ReadOnly);
+    }
 }
 
-void LaunchWindow::onBackendOutput()
+void LaunchWindow::onStatsReadyRead()
 {
-    QString output = QString::fromUtf8(backendProcess->readAllStandardOutput());
-    qDebug() << "Backend output:" << output;
-
-    // Parse backend output to update status
-    if (output.contains("Key exchange successful", Qt::CaseInsensitive)) {
-        updateStatusMessage("Key exchange successful", "success");
-    }
-    else if (output.contains("Authentication successful", Qt::CaseInsensitive)) {
-        updateStatusMessage("Authentication successful", "success");
-    }
-    else if (output.contains("Connected", Qt::CaseInsensitive)) {
-        updateStatusMessage("Connected - Call started!", "success");
-        // Could open a call window here in the future
+    // Several snapshots may have arrived; only the newest is shown
+    QJsonObject latest;
+    while (statsSocket->canReadLine()) {
+        QJsonDocument document = QJsonDocument::fromJson(statsSocket->readLine());
+        if (document.isObject()) {
+            latest = document.object();
+        }
     }
-    else if (output.contains("Waiting", Qt::CaseInsensitive)) {
-        updateStatusMessage("Waiting for peer...", "info");
+    if (!latest.isEmpty()) {
+        showStats(latest);
     }
 }
 
-void LaunchWindow::onBackendError()
+void LaunchWindow::showStats(const QJsonObject &stats)
 {
-    QString error = QString::fromUtf8(backendProcess->readAllStandardError());
-    qDebug() << "Backend error:" << error;
+    QString state = stats.value("state").toString();
+    if (state != callState) {
+        callState = state;
+        if (state == "waiting") {
+            updateStatusMessage("Waiting for peer...", "info");
+        } else if (state == "connecting") {
+            updateStatusMessage("Authenticating...", "info");
+        } else if (state == "connected") {
+            QJsonObject handshake = stats.value("handshake").toObject();
+            qDebug() << "Key exchange took" << handshake.value("exchange_ms").toInt() << "ms";
+            updateStatusMessage("Connected - Call started!", "success");
+            // Could open a call window here in the future
+        } else if (state == "failed") {
+            updateStatusMessage("Key exchange failed", "error");
+        } else if (state == "ended") {
+            updateStatusMessage("Call ended", "info");
+        }
+    }
+    if (state != "connected") {
+        return;
+    }
 
-    // Show errors in status bar
-    if (!error.trimmed().isEmpty()) {
-        updateStatusMessage("Error: " + error.left(50), "error");
+    // The peer's video as we receive it, and the round trip of ours
+    double kbps = 0, loss = 0, fps = 0, rtt = 0;
+    for (const QJsonValue &value : stats.value("received").toArray()) {
+        QJsonObject stream = value.toObject();
+        if (stream.value("kind").toString() == "video") {
+            kbps += stream.value("bitrate_kbps").toDouble();
+            loss = qMax(loss, stream.value("loss_percent").toDouble());
+            fps = qMax(fps, stream.value("fps").toDouble());
+        }
     }
+    for (const QJsonValue &value : stats.value("sent").toArray()) {
+        QJsonObject stream = value.toObject();
+        if (stream.value("kind").toString() == "video") {
+            rtt = qMax(rtt, stream.value("rtt_ms").toDouble());
+        }
+    }
+    statusLabel->setText(QString("● Connected - %1 kbit/s, %2 fps, loss %3%, RTT %4 ms")
+                             .arg(qRound(kbps)).arg(qRound(fps)).arg(loss, 0, 'f', 1).arg(qRound(rtt)));
 }
 
-void LaunchWindow::onBackendFinished(int exitCode, QProcess::ExitStatus exitStatus)
+void LaunchWindow::onCallFinished(int result)
 {
-    qDebug() << "Backend finished. Exit code:" << exitCode << "Status:" << exitStatus;
+    qDebug() << "Call finished with" << result;
+
+    callThread->wait();
+    delete callThread;
+    callThread = nullptr;
+    session.reset();
+
+    statsConnectTimer->stop();
+    onStatsReadyRead();
+    statsSocket->abort();
 
-    // Re-enable connect button
+    showCallView(false);
     connectBtn->setEnabled(true);
     connectBtn->setText("Connect");
 
-    if (exitStatus == QProcess::CrashExit) {
-        updateStatusMessage("Backend crashed", "error");
-        QMessageBox::warning(this, "Backend Crashed",
-                             "The backend process crashed unexpectedly.");
-    }
-    else if (exitCode != 0) {
-        updateStatusMessage("Backend exited with error", "error");
-    }
-    else {
+    if (result != 0) {
+        // A failed key exchange has already been shown from the statistics
+        if (callState != "failed") {
+            updateStatusMessage("Call could not be set up", "error");
+        }
+    } else {
         updateStatusMessage("Call ended", "info");
     }
 }
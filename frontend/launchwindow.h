@@ -1,6 +1,9 @@
 #ifndef LAUNCHWINDOW_H
 #define LAUNCHWINDOW_H
 
+// Backend (GLib) headers before Qt's, whose "signals" macro they would trip on
+#include "call_session.h"
+#include "videowidget.h"
 #include <QMainWindow>
 #include <QLineEdit>
 #include <QComboBox>
@@ -8,7 +11,11 @@
 #include <QPushButton>
 #include <QLabel>
 #include <QGroupBox>
-#include <QProcess>
+#include <QThread>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QJsonObject>
+#include <memory>
 
 class LaunchWindow : public QMainWindow
 {
@@ -24,11 +31,12 @@ private slots:
     void onConnectClicked();
     void updateStatusMessage(const QString &message, const QString &type);
 
-    // Backend slots - ADD THESE
-    void onBackendStarted();
-    void onBackendOutput();
-    void onBackendError();
-    void onBackendFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    // The call's thread is done; result is CallSession::run()'s
+    void onCallFinished(int result);
+
+    // Live call statistics from the backend's stats socket
+    void onStatsConnectTimer();
+    void onStatsReadyRead();
 
 private:
     // UI Elements
@@ -42,14 +50,29 @@ private:
     QLabel *usernameHelp;
     QPushButton *connectBtn;
     QLabel *statusLabel;
+    QGroupBox *modeGroup;
+    QGroupBox *networkGroup;
+    VideoWidget *videoWidget;
+
+    // The backend runs in-process: the call on a thread of its own, its
+    // video painted by videoWidget
+    std::unique_ptr<CallSession> session;
+    QThread *callThread;
 
-    QProcess *backendProcess;
+    // The backend publishes call state and statistics here, one JSON
+    // object per line; connected to once the backend has made it
+    QLocalSocket *statsSocket;
+    QTimer *statsConnectTimer;
+    QString statsPath;
+    QString callState;
 
     // Helper functions
     QStringList getAllLocalIPs();
     void populateIpDropdown();
     bool validateIP(const QString &ip);
     void setupUI();
+    void showCallView(bool inCall);
+    void showStats(const QJsonObject &stats);
 };
 
 #endif // LAUNCHWINDOW_H
@@ -3,6 +3,9 @@
 
 int main(int argc, char *argv[])
 {
+    // Calls run in-process
+    gst_init(&argc, &argv);
+
     QApplication app(argc, argv);
 
     LaunchWindow window;
@@ -0,0 +1,57 @@
+#include "videowidget.h"
+#include <QPainter>
+#include <QImage>
+#include <QMutexLocker>
+
+VideoWidget::VideoWidget(QWidget *parent)
+    : QWidget(parent)
+{
+    setMinimumSize(320, 180);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void VideoWidget::presentFrame(const std::shared_ptr<VideoFrame> &frame)
+{
+    {
+        QMutexLocker locker(&frameMutex);
+        latestFrame = frame;
+    }
+    // Repaints are merged, so frames arriving faster than the screen cost
+    // nothing but the swap above
+    QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+}
+
+void VideoWidget::clear()
+{
+    {
+        QMutexLocker locker(&frameMutex);
+        latestFrame.reset();
+    }
+    update();
+}
+
+void VideoWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+
+    // Held for the paint, so the decoder cannot reuse the buffer meanwhile
+    std::shared_ptr<VideoFrame> frame;
+    {
+        QMutexLocker locker(&frameMutex);
+        frame = latestFrame;
+    }
+    if (!frame) {
+        painter.setPen(Qt::white);
+        painter.drawText(rect(), Qt::AlignCenter, "Waiting for video...");
+        return;
+    }
+
+    // BGRx is Format_RGB32 on little-endian machines; the image only wraps
+    // the mapped buffer
+    QImage image(frame->data(), frame->width(), frame->height(), frame->stride(), QImage::Format_RGB32);
+    QRect target(QPoint(0, 0), image.size().scaled(size(), Qt::KeepAspectRatio));
+    target.moveCenter(rect().center());
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(target, image);
+}
@@ -0,0 +1,32 @@
+#ifndef VIDEOWIDGET_H
+#define VIDEOWIDGET_H
+
+// Backend (GLib) headers before Qt's, whose "signals" macro they would trip on
+#include "media_pipeline.h"
+#include <QWidget>
+#include <QMutex>
+#include <memory>
+
+// The peer's video as the in-process backend decodes it. Frames are painted
+// straight from the decoder's mapped buffer, without a copy; only the newest
+// is kept, so a slow repaint skips frames instead of queueing them.
+class VideoWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    VideoWidget(QWidget *parent = nullptr);
+
+    // From any thread; the backend calls this from its streaming thread
+    void presentFrame(const std::shared_ptr<VideoFrame> &frame);
+    void clear();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    QMutex frameMutex;
+    std::shared_ptr<VideoFrame> latestFrame;
+};
+
+#endif // VIDEOWIDGET_H